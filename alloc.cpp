@@ -0,0 +1,171 @@
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+// Exception specifications went away after C++03
+#if __cplusplus >= 201103L
+#define ALLOC_THROWS
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROWS throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+static PLATFORM_THREAD_LOCAL const char* tGuard;
+static PLATFORM_THREAD_LOCAL uint32_t tCount;
+
+static volatile uint32_t gTrap;
+static volatile uint32_t gGuarded;
+static volatile uint32_t gBlocking;
+
+// Where a guard last caught something.  Written by whichever thread did
+// it; only for the report, so a torn pair costs nothing.
+static const char* volatile gLastGuard;
+static const char* volatile gLastWhat;
+
+static void caught(const char* what, volatile uint32_t* counter)
+{
+    atomicAdd(counter, 1);
+    gLastGuard = tGuard;
+    gLastWhat = what;
+}
+
+// Every new and delete comes through here
+static void heapCall(const char* what)
+{
+    tCount++;
+    if (tGuard == NULL)
+        return;
+
+    caught(what, &gGuarded);
+    if (atomicLoad(&gTrap) != 0)
+    {
+        // Nothing here may allocate, or it would come back in
+        fprintf(stderr, "alloc: %s under guard %s\n", what, tGuard);
+#ifdef _MSC_VER
+        __debugbreak();
+#else
+        abort();
+#endif
+    }
+}
+
+AllocGuard::AllocGuard(const char* name)
+    : m_outer(tGuard)
+{
+    tGuard = name;
+}
+
+AllocGuard::~AllocGuard()
+{
+    tGuard = m_outer;
+}
+
+void allocTrap(bool trap)
+{
+    atomicStore(&gTrap, trap ? 1u : 0u);
+}
+
+void allocBlocking(const char* what)
+{
+    if (tGuard != NULL)
+        caught(what, &gBlocking);
+}
+
+uint32_t allocThreadCount()
+{
+    return tCount;
+}
+
+uint32_t allocGuardedCount()
+{
+    return atomicLoad(&gGuarded);
+}
+
+uint32_t allocBlockingCount()
+{
+    return atomicLoad(&gBlocking);
+}
+
+std::string allocReport()
+{
+    char line[160];
+    const char* guard = gLastGuard;
+    const char* what = gLastWhat;
+    if (guard == NULL)
+        sprintf(line, "alloc: nothing allocated or blocked under a guard\n");
+    else
+        sprintf(line, "alloc: %u heap calls and %u blocking calls under a guard, last %s in %s\n",
+                allocGuardedCount(), allocBlockingCount(), what, guard);
+    return line;
+}
+
+// The replacements ---------------------------------------------------------
+
+void* operator new(size_t size) ALLOC_THROWS
+{
+    heapCall("new");
+    void* p = malloc(size != 0 ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) ALLOC_THROWS
+{
+    heapCall("new[]");
+    void* p = malloc(size != 0 ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) ALLOC_NOTHROW
+{
+    heapCall("new");
+    return malloc(size != 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) ALLOC_NOTHROW
+{
+    heapCall("new[]");
+    return malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void* p) ALLOC_NOTHROW
+{
+    if (p == NULL)
+        return;
+    heapCall("delete");
+    free(p);
+}
+
+void operator delete[](void* p) ALLOC_NOTHROW
+{
+    if (p == NULL)
+        return;
+    heapCall("delete[]");
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) ALLOC_NOTHROW
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) ALLOC_NOTHROW
+{
+    operator delete[](p);
+}
+
+// The sized forms, which C++14 compilers call in place of the ones above
+void operator delete(void* p, size_t) ALLOC_NOTHROW
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) ALLOC_NOTHROW
+{
+    operator delete[](p);
+}
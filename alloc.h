@@ -0,0 +1,54 @@
+// Make sure this header is included only once
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "platform.h"
+#include <string>
+
+// Keeping the heap out of the hot paths.  A servo tick or a simulation
+// step that allocates can wait on a lock some other thread holds inside
+// the allocator, or fault in fresh pages; a debug print or a file write
+// can wait on the disk or the debugger.  Either is a force glitch or a
+// late step, and neither shows up until it happens at the wrong moment.
+//
+// alloc.cpp replaces the global operator new and delete with versions
+// that count what each thread does.  An AllocGuard on the stack marks a
+// stretch of code that must not touch the heap: any new or delete while
+// it is active is counted against it and, with allocTrap(true), stops
+// the program there.  Code that knows it blocks (a file write) says so
+// with allocBlocking(), which is counted the same way but never traps.
+//
+// Only operator new and delete are hooked.  malloc and the C library are
+// not, but nothing in the game calls malloc on a hot path; the containers
+// and strings were the ones that did.
+//
+//     AllocGuard guard("servo.tick");
+
+class AllocGuard
+{
+public:
+    // name must outlive the guard; a string literal does
+    explicit AllocGuard(const char* name);
+    ~AllocGuard();
+
+private:
+    const char* m_outer;    // the guard this one is inside, if any
+};
+
+// Stop in the debugger (or abort, off Windows) at a guarded allocation
+void allocTrap(bool trap);
+
+// The caller is about to block on a call it names
+void allocBlocking(const char* what);
+
+// New and deletes on the calling thread since it started, guarded or not
+uint32_t allocThreadCount();
+
+// Heap calls and blocking calls made under a guard, by every thread
+uint32_t allocGuardedCount();
+uint32_t allocBlockingCount();
+
+// What was counted, and in which guard it last happened
+std::string allocReport();
+
+#endif // ALLOC_H
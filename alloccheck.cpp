@@ -0,0 +1,233 @@
+// alloccheck: plays a long match the way the game does, on the simulated
+// device, and fails if steady-state play touches the heap.  Each step
+// reads the device, steps a local game and a networked pair over
+// loopback with impairment, records the session, publishes the events
+// and a snapshot; a stand-in render thread takes the snapshots and the
+// servo thread ticks throughout, playing the effects off the bus.  The servo tick, the
+// step and the frame run under their AllocGuards, as in the game.
+//
+// After a warm-up, which is allowed to allocate (files opening, first
+// packets), any new or delete on the stepping thread, or under any
+// guard, is a failure: the exit status is 1 and the report says where.
+#include "alloc.h"
+#include "haptics.h"
+#include "game.h"
+#include "params.h"
+#include "netplay.h"
+#include "session.h"
+#include "triplebuffer.h"
+#include "eventbus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keeps the render thread's blending from being optimized away
+static volatile double gSink;
+
+struct CheckSnapshot {
+    uint32_t step;
+    double   puckX, puckY;
+    double   paddleY[PLAYER_COUNT];
+    int      score[PLAYER_COUNT];
+};
+
+struct CheckRender {
+    TripleBuffer<CheckSnapshot> snapshots;
+    volatile uint32_t           stop;
+    uint32_t                    frames;
+    uint32_t                    heapCalls;
+};
+
+// Stands in for drawGraphics(): take the newest snapshot and blend
+static void renderThread(void* arg)
+{
+    CheckRender& render = *(CheckRender*)arg;
+    uint32_t before = allocThreadCount();
+    double lastX = 0, sum = 0;
+    while (atomicLoad(&render.stop) == 0)
+    {
+        {
+            AllocGuard guard("frame.draw");
+            render.snapshots.acquire();
+            const CheckSnapshot& view = render.snapshots.front();
+            sum += lastX + (view.puckX - lastX) * 0.5 + view.paddleY[PLAYER_2];
+            lastX = view.puckX;
+            render.frames++;
+        }
+        platformSleepMs(2);
+    }
+    render.heapCalls = allocThreadCount() - before;
+    gSink = sum;
+}
+
+// Follows the puck with a little wobble, and serves after a pause
+static PlayerInput botInput(const GameState& state, int player, int& holdSteps)
+{
+    double wobble = ((state.step / 41 + player * 7) % 13 - 6) * 0.03;
+    bool button = false;
+    if (state.freeze == (player == PLAYER_1 ? 1 : 2))
+        button = ++holdSteps > 40;
+    else
+        holdSteps = 0;
+    return gameMakeInput(state.puckY + wobble, button);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool alloccheck [options]\n"
+        "  --steps N      steps to play after the warm-up (default 120000, ten minutes)\n"
+        "  --warmup N     steps allowed to allocate first (default 2000)\n"
+        "  --port N       first of two UDP ports for the networked pair (default %d)\n"
+        "  --no-net       leave out the networked pair\n",
+        NET_DEFAULT_PORT + 10);
+}
+
+int alloccheckMain(int argc, char* argv[])
+{
+    int steps = 120000;
+    int warmup = 2000;
+    int port = NET_DEFAULT_PORT + 10;
+    bool net = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--steps") == 0 && hasValue)
+            steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--port") == 0 && hasValue)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-net") == 0)
+            net = false;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    // The device, ticking on its own thread as fast as it can
+    static ParamBlock block;
+    memset(&block, 0, sizeof(block));
+    paramsDefault(block.params);
+    double puckX = 0, puckY = 0;
+    HapticsClass haptics(puckX, puckY);
+    haptics.init(&block);
+    EventBus events;
+    haptics.listen(events, PLAYER_1);
+    hdlSimStartServo(0);
+
+    GameConfig config;
+    gameDefaultConfig(config);
+    config.practice = false;
+    GameState state;
+    gameInit(state, config);
+
+    NetSession stations[PLAYER_COUNT];
+    if (net && (!stations[PLAYER_1].open(port, "127.0.0.1", port + 1, PLAYER_1) ||
+                !stations[PLAYER_2].open(port + 1, "127.0.0.1", port, PLAYER_2)))
+    {
+        fprintf(stderr, "alloccheck: could not open UDP ports %d and %d\n", port, port + 1);
+        net = false;
+    }
+    for (int p = 0; net && p < PLAYER_COUNT; p++)
+    {
+        NetConditions conditions = { 40, 10, 0.02, (uint32_t)p + 1 };
+        stations[p].start(state, config);
+        stations[p].setConditions(conditions);
+    }
+
+#ifdef _WIN32
+    const char* sessionPath = "NUL";
+#else
+    const char* sessionPath = "/dev/null";
+#endif
+    SessionWriter session;
+    if (!session.open(sessionPath, config))
+        fprintf(stderr, "alloccheck: cannot record to %s\n", sessionPath);
+
+    CheckRender render;
+    render.stop = 0;
+    render.frames = 0;
+    render.heapCalls = 0;
+    PlatformThread thread;
+    if (!platformStartThread(thread, renderThread, &render))
+    {
+        fprintf(stderr, "alloccheck: cannot start the render thread\n");
+        return 1;
+    }
+
+    int holds[PLAYER_COUNT] = { 0, 0 };
+    int netHolds[PLAYER_COUNT] = { 0, 0 };
+    uint32_t recorded = 0;
+    uint32_t threadBefore = 0, guardedBefore = 0;
+    uint64_t nowUs = 0, startUs = 0;
+    for (int i = 0; i < warmup + steps; i++)
+    {
+        if (i == warmup)
+        {
+            threadBefore = allocThreadCount();
+            guardedBefore = allocGuardedCount();
+            startUs = platformMicros();
+        }
+        nowUs += GAME_STEP_US;
+        AllocGuard guard("sim.step");
+
+        double cursor[3];
+        haptics.synchFromServo();
+        haptics.getPosition(cursor);
+
+        PlayerInput input[PLAYER_COUNT];
+        input[PLAYER_1] = botInput(state, PLAYER_1, holds[PLAYER_1]);
+        input[PLAYER_2] = botInput(state, PLAYER_2, holds[PLAYER_2]);
+        GameState before = state;
+        unsigned int stepEvents = gameStep(state, config, input);
+        session.record(before, input, stepEvents);
+
+        for (int p = 0; net && p < PLAYER_COUNT; p++)
+        {
+            unsigned int netEvents;
+            stations[p].advance(botInput(stations[p].state(), p, netHolds[p]), nowUs, netEvents);
+            stepEvents |= netEvents;
+        }
+        PlayerInput confirmed[PLAYER_COUNT];
+        unsigned int confirmedEvents;
+        while (net && stations[PLAYER_1].confirmedStep(recorded, confirmed, before, confirmedEvents))
+            recorded++;
+
+        events.publishStep(state, config, stepEvents);
+
+        CheckSnapshot& next = render.snapshots.back();
+        next.step = state.step;
+        next.puckX = puckX = state.puckX;
+        next.puckY = puckY = state.puckY;
+        next.paddleY[PLAYER_1] = state.paddleY[PLAYER_1];
+        next.paddleY[PLAYER_2] = state.paddleY[PLAYER_2];
+        next.score[PLAYER_1] = state.score[PLAYER_1];
+        next.score[PLAYER_2] = state.score[PLAYER_2];
+        render.snapshots.publish();
+    }
+    uint64_t elapsedUs = platformMicros() - startUs;
+    uint32_t threadCalls = allocThreadCount() - threadBefore;
+    uint32_t guardedCalls = allocGuardedCount() - guardedBefore;
+
+    atomicStore(&render.stop, 1);
+    platformJoinThread(thread);
+    hdlSimStopServo();
+    haptics.uninit();
+    session.close();
+
+    printf("alloccheck: %d steps after %d of warm-up, %.0f ms; score %d - %d, %u frames drawn%s\n",
+           steps, warmup, elapsedUs / 1000.0, state.score[PLAYER_2], state.score[PLAYER_1],
+           render.frames, net ? ", networked pair on loopback" : "");
+    printf("stepping thread: %u heap calls\n", threadCalls);
+    printf("render thread:   %u heap calls\n", render.heapCalls);
+    printf("under a guard:   %u heap calls, %u blocking calls\n", guardedCalls, allocBlockingCount());
+    printf("%s", allocReport().c_str());
+
+    bool clean = threadCalls == 0 && render.heapCalls == 0 && guardedCalls == 0;
+    printf("%s\n", clean ? "ok: steady-state play does not allocate" : "FAIL: steady-state play allocates");
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,389 @@
+#include "arena.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Segments per leaf.  A few share the cost of reaching the leaf without
+// testing many the query could have ruled out.
+static const uint32_t ARENA_LEAF_SEGMENTS = 4;
+
+static const uint32_t ARENA_NO_SEGMENT = 0xFFFFFFFF;
+
+Arena::Arena()
+    : m_depth(0)
+{
+}
+
+// Orders segments along one axis by their midpoints, ties by index, so
+// the tree comes out the same from every standard library
+struct SegmentOrder {
+    const std::vector<ArenaSegment>* segments;
+    int axis;
+
+    double centre(uint32_t i) const
+    {
+        const ArenaSegment& s = (*segments)[i];
+        return axis == 0 ? s.ax + s.bx : s.ay + s.by;
+    }
+
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        double ca = centre(a), cb = centre(b);
+        return ca < cb || (ca == cb && a < b);
+    }
+};
+
+void Arena::build(const std::vector<ArenaSegment>& segments)
+{
+    m_segments = segments;
+    m_leaves.clear();
+    m_leafIndex.clear();
+    m_nodes.clear();
+    m_depth = 0;
+    if (segments.empty())
+        return;
+
+    std::vector<uint32_t> order(segments.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = (uint32_t)i;
+
+    m_nodes.reserve(segments.size() * 2);
+    m_nodes.push_back(Node());
+    m_depth = split(order, 0, 0, (uint32_t)order.size(), 1);
+
+    // Leaves point into order; copy the segments there so each leaf
+    // reads one contiguous run
+    m_leaves.resize(order.size());
+    m_leafIndex = order;
+    for (size_t i = 0; i < order.size(); i++)
+        m_leaves[i] = m_segments[order[i]];
+}
+
+int Arena::split(std::vector<uint32_t>& order, size_t node, uint32_t begin, uint32_t end, int level)
+{
+    double box[4] = { 1e300, 1e300, -1e300, -1e300 };
+    double centres[4] = { 1e300, 1e300, -1e300, -1e300 };
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const ArenaSegment& s = m_segments[order[i]];
+        box[0] = std::min(box[0], std::min(s.ax, s.bx));
+        box[1] = std::min(box[1], std::min(s.ay, s.by));
+        box[2] = std::max(box[2], std::max(s.ax, s.bx));
+        box[3] = std::max(box[3], std::max(s.ay, s.by));
+        centres[0] = std::min(centres[0], s.ax + s.bx);
+        centres[1] = std::min(centres[1], s.ay + s.by);
+        centres[2] = std::max(centres[2], s.ax + s.bx);
+        centres[3] = std::max(centres[3], s.ay + s.by);
+    }
+    m_nodes[node].min[0] = box[0];
+    m_nodes[node].min[1] = box[1];
+    m_nodes[node].max[0] = box[2];
+    m_nodes[node].max[1] = box[3];
+
+    if (end - begin <= ARENA_LEAF_SEGMENTS)
+    {
+        m_nodes[node].first = begin;
+        m_nodes[node].count = end - begin;
+        return level;
+    }
+
+    // Halve along the axis the midpoints spread furthest on
+    SegmentOrder less;
+    less.segments = &m_segments;
+    less.axis = (centres[2] - centres[0] >= centres[3] - centres[1]) ? 0 : 1;
+    std::sort(order.begin() + begin, order.begin() + end, less);
+    uint32_t middle = begin + (end - begin) / 2;
+
+    uint32_t child = (uint32_t)m_nodes.size();
+    m_nodes.push_back(Node());
+    m_nodes.push_back(Node());
+    m_nodes[node].first = child;
+    m_nodes[node].count = 0;
+
+    int left = split(order, child, begin, middle, level + 1);
+    int right = split(order, child + 1, middle, end, level + 1);
+    return std::max(left, right);
+}
+
+// Squared distance from a point to the nearest point of a segment, and
+// that point
+static double closestPoint(const ArenaSegment& s, double x, double y, double& cx, double& cy)
+{
+    double ex = s.bx - s.ax;
+    double ey = s.by - s.ay;
+    double length2 = ex * ex + ey * ey;
+    double t = 0;
+    if (length2 > 0)
+    {
+        t = ((x - s.ax) * ex + (y - s.ay) * ey) / length2;
+        if (t < 0) t = 0;
+        if (t > 1) t = 1;
+    }
+    cx = s.ax + t * ex;
+    cy = s.ay + t * ey;
+    double dx = x - cx;
+    double dy = y - cy;
+    return dx * dx + dy * dy;
+}
+
+static double boxDistance2(const double min[2], const double max[2], double x, double y)
+{
+    double dx = x < min[0] ? min[0] - x : (x > max[0] ? x - max[0] : 0);
+    double dy = y < min[1] ? min[1] - y : (y > max[1] ? y - max[1] : 0);
+    return dx * dx + dy * dy;
+}
+
+// Nearest so far, with ties to the lower index
+struct NearestSegment {
+    double   distance2;
+    uint32_t index;
+    double   cx, cy;
+
+    void offer(const ArenaSegment& s, uint32_t i, double x, double y)
+    {
+        double px, py;
+        double d2 = closestPoint(s, x, y, px, py);
+        if (d2 < distance2 || (d2 == distance2 && index != ARENA_NO_SEGMENT && i < index))
+        {
+            distance2 = d2;
+            index = i;
+            cx = px;
+            cy = py;
+        }
+    }
+};
+
+static bool makeContact(const std::vector<ArenaSegment>& segments, const NearestSegment& nearest,
+                        double x, double y, double radius, ArenaContact& contact)
+{
+    if (nearest.index == ARENA_NO_SEGMENT)
+        return false;
+
+    contact.segment = nearest.index;
+    double distance = sqrt(nearest.distance2);
+    contact.depth = radius - distance;
+    if (distance > 0)
+    {
+        contact.nx = (x - nearest.cx) / distance;
+        contact.ny = (y - nearest.cy) / distance;
+        return true;
+    }
+
+    // Centre right on the segment: push out to its left
+    const ArenaSegment& s = segments[nearest.index];
+    double ex = s.bx - s.ax;
+    double ey = s.by - s.ay;
+    double length = sqrt(ex * ex + ey * ey);
+    contact.nx = length > 0 ? -ey / length : 0;
+    contact.ny = length > 0 ? ex / length : 1;
+    return true;
+}
+
+bool Arena::contact(double x, double y, double radius, ArenaContact& contact) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    NearestSegment nearest;
+    nearest.distance2 = radius * radius;
+    nearest.index = ARENA_NO_SEGMENT;
+
+    // Deep enough for any tree that fits in memory
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node& node = m_nodes[stack[--top]];
+        if (boxDistance2(node.min, node.max, x, y) > nearest.distance2)
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                nearest.offer(m_leaves[i], m_leafIndex[i], x, y);
+            continue;
+        }
+
+        // The nearer child goes on top, so it can shrink the radius
+        // before the other is looked at
+        const Node& a = m_nodes[node.first];
+        const Node& b = m_nodes[node.first + 1];
+        bool aNearer = boxDistance2(a.min, a.max, x, y) <= boxDistance2(b.min, b.max, x, y);
+        stack[top++] = aNearer ? node.first + 1 : node.first;
+        stack[top++] = aNearer ? node.first : node.first + 1;
+    }
+    return makeContact(m_segments, nearest, x, y, radius, contact);
+}
+
+bool Arena::contactLinear(double x, double y, double radius, ArenaContact& contact) const
+{
+    NearestSegment nearest;
+    nearest.distance2 = radius * radius;
+    nearest.index = ARENA_NO_SEGMENT;
+    for (size_t i = 0; i < m_segments.size(); i++)
+        nearest.offer(m_segments[i], (uint32_t)i, x, y);
+    return makeContact(m_segments, nearest, x, y, radius, contact);
+}
+
+uint32_t Arena::checksum() const
+{
+    // FNV-1a over the coordinates as stored
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        const unsigned char* bytes = (const unsigned char*)&m_segments[i];
+        for (size_t b = 0; b < sizeof(ArenaSegment); b++)
+        {
+            hash ^= bytes[b];
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+// Numbers up to the end of the line or a comment
+static bool readNumbers(const char*& p, std::vector<double>& numbers)
+{
+    numbers.clear();
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+        if (*p == '\0' || *p == '\n' || *p == '#')
+            return true;
+        char* end;
+        double value = strtod(p, &end);
+        if (end == p)
+            return false;
+        numbers.push_back(value);
+        p = end;
+    }
+}
+
+bool Arena::load(const char* path, std::string& error)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        error = std::string("cannot read ") + path;
+        return false;
+    }
+    std::string text;
+    char chunk[16384];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        text.append(chunk, got);
+    fclose(file);
+
+    std::vector<ArenaSegment> segments;
+    std::vector<double> numbers;
+    int lineNumber = 0;
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        lineNumber++;
+
+        const char* p = line.c_str();
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '\r' || *p == '#')
+            continue;
+
+        char message[128];
+        bool closed;
+        if (strncmp(p, "wall", 4) == 0 && (p[4] == ' ' || p[4] == '\t'))
+        {
+            closed = false;
+            p += 4;
+        }
+        else if (strncmp(p, "bumper", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+        {
+            closed = true;
+            p += 6;
+        }
+        else
+        {
+            sprintf(message, "line %d: expected wall or bumper", lineNumber);
+            error = message;
+            return false;
+        }
+
+        if (!readNumbers(p, numbers))
+        {
+            sprintf(message, "line %d: not a number", lineNumber);
+            error = message;
+            return false;
+        }
+
+        double bounce = 1;
+        size_t first = 0;
+        if (closed)
+        {
+            if (numbers.empty() || numbers[0] <= 0)
+            {
+                sprintf(message, "line %d: a bumper needs a positive bounce", lineNumber);
+                error = message;
+                return false;
+            }
+            bounce = numbers[0];
+            first = 1;
+        }
+
+        size_t points = (numbers.size() - first) / 2;
+        if ((numbers.size() - first) % 2 != 0 || points < (closed ? 3u : 2u))
+        {
+            sprintf(message, "line %d: %s", lineNumber,
+                    closed ? "a bumper needs three or more x y pairs" : "a wall needs two or more x y pairs");
+            error = message;
+            return false;
+        }
+
+        size_t edges = closed ? points : points - 1;
+        for (size_t i = 0; i < edges; i++)
+        {
+            size_t j = (i + 1) % points;
+            ArenaSegment s;
+            s.ax = numbers[first + i * 2];
+            s.ay = numbers[first + i * 2 + 1];
+            s.bx = numbers[first + j * 2];
+            s.by = numbers[first + j * 2 + 1];
+            s.bounce = bounce;
+            segments.push_back(s);
+        }
+    }
+
+    if (segments.empty())
+    {
+        error = std::string(path) + " has no walls";
+        return false;
+    }
+    build(segments);
+    return true;
+}
+
+void arenaPenetration(const double position[3], double force[3], void* context)
+{
+    const ArenaProbe& probe = *(const ArenaProbe*)context;
+    force[0] = 0;
+    force[1] = 0;
+    force[2] = 0;
+
+    // The local paddle is always drawn on the right; seen from the other
+    // side, the arena is flipped
+    double x = probe.mirror ? -probe.x : probe.x;
+    ArenaContact contact;
+    if (!probe.arena->contact(x, position[1], probe.radius, contact))
+        return;
+
+    double nx = probe.mirror ? -contact.nx : contact.nx;
+    force[0] = -nx * contact.depth;
+    force[1] = -contact.ny * contact.depth;
+}
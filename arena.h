@@ -0,0 +1,106 @@
+// Make sure this header is included only once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "platform.h"
+#include <string>
+#include <vector>
+
+// Walls and bumpers inside the playfield, as line segments in game
+// coordinates, loaded from a file and kept in a bounding volume hierarchy.
+// The puck physics asks it what the puck is touching every step; the
+// haptics bakes the paddle's contact with it into the servo's force field.
+// Either way a query visits a handful of boxes down one or two paths of
+// the tree, so it costs the logarithm of the wall count, not the count.
+//
+// An arena is built once and then only read, so any number of threads
+// can query it at the same time.
+//
+// Arena files are text, one shape per line, coordinates in game units
+// (the classic playfield runs from -1.5 to 1.5 across and -1 to 1 up):
+//
+//     # comment
+//     wall x1 y1 x2 y2 [x3 y3 ...]             open polyline
+//     bumper bounce x1 y1 x2 y2 x3 y3 [...]    closed polygon
+//
+// bounce is the share of its speed into the surface the puck leaves
+// with: 1 for a plain wall, more for a bumper that kicks.
+
+struct ArenaSegment {
+    double ax, ay;
+    double bx, by;
+    double bounce;
+};
+
+// What a disc is touching: the segment nearest its centre
+struct ArenaContact {
+    uint32_t segment;   // index into the arena's segments
+    double   depth;     // how far the disc overlaps it
+    double   nx, ny;    // unit normal, from the segment towards the centre
+};
+
+class Arena
+{
+public:
+    Arena();
+
+    // Read an arena file and build its tree.  error receives the reason,
+    // with the line number, if the file cannot be used.
+    bool load(const char* path, std::string& error);
+
+    // Build the tree over a list of segments
+    void build(const std::vector<ArenaSegment>& segments);
+
+    bool empty() const { return m_segments.empty(); }
+    size_t size() const { return m_segments.size(); }
+    const ArenaSegment& segment(size_t index) const { return m_segments[index]; }
+
+    // The segment nearest (x, y) closer than radius, if there is one.
+    // Equally near segments go to the lower index, so the answer never
+    // depends on the shape of the tree.
+    bool contact(double x, double y, double radius, ArenaContact& contact) const;
+
+    // The same query against every segment in turn; what contact() is
+    // checked and measured against
+    bool contactLinear(double x, double y, double radius, ArenaContact& contact) const;
+
+    // Hash of the geometry, for checking two stations agree on it
+    uint32_t checksum() const;
+
+    // Tree nodes, and the longest path from the root to a leaf
+    size_t nodeCount() const { return m_nodes.size(); }
+    int depth() const { return m_depth; }
+
+private:
+    // A leaf holds count segments from first; an inner node has count 0
+    // and its children at first and first + 1
+    struct Node {
+        double   min[2];
+        double   max[2];
+        uint32_t first;
+        uint32_t count;
+    };
+
+    int split(std::vector<uint32_t>& order, size_t node, uint32_t begin, uint32_t end, int level);
+
+    std::vector<ArenaSegment> m_segments;   // in the order they were given
+    std::vector<ArenaSegment> m_leaves;     // the same, in leaf order
+    std::vector<uint32_t>     m_leafIndex;  // index in m_segments of each
+    std::vector<Node>         m_nodes;
+    int                       m_depth;
+};
+
+// The force field's view of an arena: the paddle, a disc of the given
+// radius at column x, pushed into whatever it touches.  The force is the
+// penetration, like arenaWallsPenetration(); mirror flips the arena left
+// to right, for the player who sees it from the other side.
+struct ArenaProbe {
+    const Arena* arena;
+    double       x;
+    double       radius;
+    bool         mirror;
+};
+
+void arenaPenetration(const double position[3], double force[3], void* context);
+
+#endif // ARENA_H
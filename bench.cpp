@@ -0,0 +1,1032 @@
+// bench: microbenchmarks of the servo, physics and frame hot paths, run
+// against the simulated device (hdlsim) and a simulated frame clock, so
+// they need no Falcon, no window and no HDAL.
+//
+// Each benchmark is timed in batches long enough for the clock to resolve
+// (--batch-us), and every batch gives one ns/op sample.  The output is one
+// CSV line per benchmark with the mean and the spread of those samples,
+// so runs from two builds can be diffed or loaded into a spreadsheet.
+//
+// Cache misses per op come from the processor's counters where the kernel
+// allows it (Linux perf events).  Otherwise the force field benchmarks
+// fall back to a model of a 32 KB, 8-way L1 cache fed with the addresses
+// each lookup reads.
+#include "haptics.h"
+#include "game.h"
+#include "params.h"
+#include "forcefield.h"
+#include "arena.h"
+#include "trace.h"
+#include "triplebuffer.h"
+#include "eventbus.h"
+#include "predict.h"
+#include "log.h"
+#include "spectator.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// What drawGraphics() moves the game objects through
+static double gPuckX, gPuckY;
+static HapticsClass gBenchHaptics(gPuckX, gPuckY);
+static ParamBlock* gBenchParams;
+
+// The benchmarks reach into the haptics object through this
+class HapticsProbe
+{
+public:
+    static void effects(HapticsClass& h, int bump, int jitter, int fire)
+    {
+        h.dobump = bump;
+        h.dojitter = jitter;
+        h.doFire = fire;
+    }
+
+    static void cubeContact(HapticsClass& h)
+    {
+        h.cubeContact();
+    }
+
+    static void vecMultMatrix(HapticsClass& h, double src[3], double dst[3])
+    {
+        h.vecMultMatrix(src, h.m_transformMat, dst);
+    }
+};
+
+// Keeps results alive so the compiler cannot drop the work
+static volatile double gSink;
+
+// Set by a setup whose results would be wrong, so the run fails
+static bool gBenchFailed;
+
+// Servo tick in each effect state ---------------------------------------
+
+// Device positions, in meters: in the middle, and pushed into the top wall
+static const double gDeviceCenter[3] = { 0, 0, 0 };
+static const double gDeviceTop[3] = { 0, 0.05, 0 };
+
+static void servoSetup(const double position[3], int bump, int jitter, int fire)
+{
+    hdlSimStopServo();
+    hdlSimSetPosition(position);
+    HapticsProbe::effects(gBenchHaptics, bump, jitter, fire);
+}
+
+// Long enough that no effect runs out during a benchmark
+static const int EFFECT_FOREVER = 1 << 30;
+
+static void setupTrack()  { servoSetup(gDeviceCenter, 0, 0, 0); }
+static void setupWall()   { servoSetup(gDeviceTop, 0, 0, 0); }
+static void setupBump()   { servoSetup(gDeviceCenter, EFFECT_FOREVER, 0, 0); }
+static void setupJitter() { servoSetup(gDeviceCenter, 0, EFFECT_FOREVER, 0); }
+static void setupFire()   { servoSetup(gDeviceCenter, 0, 0, EFFECT_FOREVER); }
+
+// One servo tick: read the device, cubeContact(), send the force
+static void runServoTick(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        hdlSimTick();
+}
+
+// A tick that also finds the parameter block changed
+static void runServoRetune(int iterations)
+{
+    GameParams params;
+    uint32_t version;
+    paramsRead(gBenchParams, params, version);
+    for (int i = 0; i < iterations; i++)
+    {
+        params.stiffness = 200.0 + (i & 1);
+        paramsWrite(gBenchParams, params);
+        HapticsProbe::cubeContact(gBenchHaptics);
+    }
+}
+
+static void runVecMultMatrix(int iterations)
+{
+    double src[3] = { 0.01, 0.02, 0.03 };
+    double dst[3] = { 0, 0, 0 };
+    for (int i = 0; i < iterations; i++)
+    {
+        HapticsProbe::vecMultMatrix(gBenchHaptics, src, dst);
+        src[0] = dst[0] * 1e-3;
+    }
+    gSink = dst[0] + dst[1] + dst[2];
+}
+
+// synchFromServo() round trips -------------------------------------------
+
+// The servo thread free running, and at the Falcon's 1 kHz, where a
+// round trip waits for the next tick
+static void setupSyncInline() { hdlSimStopServo(); }
+static void setupSyncFree()   { hdlSimStopServo(); hdlSimStartServo(0); }
+static void setupSync1kHz()   { hdlSimStopServo(); hdlSimStartServo(1000); }
+
+static void runSync(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        gBenchHaptics.synchFromServo();
+}
+
+// Physics across puck speeds ---------------------------------------------
+
+static GameConfig gPhysicsConfig;
+static GameState gPhysicsState;
+
+// A practice rally that never ends: the paddle is always under the puck,
+// the puck never speeds up, and the button releases any serve
+static void setupPhysics(double speed)
+{
+    hdlSimStopServo();
+    gameDefaultConfig(gPhysicsConfig);
+    gPhysicsConfig.speedUp = 1.0;
+    gPhysicsConfig.rebounds = 0x7fffffff;
+    gameInit(gPhysicsState, gPhysicsConfig);
+    gPhysicsState.velX = speed;
+    gPhysicsState.velY = speed * 0.6;
+}
+
+static void setupPhysicsServe() { setupPhysics(0.7); }
+static void setupPhysics2()     { setupPhysics(2); }
+static void setupPhysics8()     { setupPhysics(8); }
+static void setupPhysics32()    { setupPhysics(32); }
+
+// The same rally among angled walls and two kicking diamonds, so the
+// puck bounces off the tree every few steps
+static Arena gPhysicsArena;
+
+static void addPolyline(std::vector<ArenaSegment>& segments, const double* xy, int points,
+                        bool closed, double bounce)
+{
+    int edges = closed ? points : points - 1;
+    for (int i = 0; i < edges; i++)
+    {
+        int j = (i + 1) % points;
+        ArenaSegment s = { xy[i * 2], xy[i * 2 + 1], xy[j * 2], xy[j * 2 + 1], bounce };
+        segments.push_back(s);
+    }
+}
+
+static void setupPhysicsArena()
+{
+    static const double top[] = { -3, 1, -0.5, 1, 0, 0.9, 0.5, 1, 3, 1 };
+    static const double bottom[] = { -3, -1, -0.5, -1, 0, -0.9, 0.5, -1, 3, -1 };
+    static const double upper[] = { 0, 0.7, 0.15, 0.55, 0, 0.4, -0.15, 0.55 };
+    static const double lower[] = { 0, -0.4, 0.15, -0.55, 0, -0.7, -0.15, -0.55 };
+
+    setupPhysics(8);
+    if (gPhysicsArena.empty())
+    {
+        std::vector<ArenaSegment> segments;
+        addPolyline(segments, top, 5, false, 1);
+        addPolyline(segments, bottom, 5, false, 1);
+        addPolyline(segments, upper, 4, true, 1);
+        addPolyline(segments, lower, 4, true, 1);
+        gPhysicsArena.build(segments);
+    }
+    gPhysicsConfig.arena = &gPhysicsArena;
+}
+
+static void runPhysics(int iterations)
+{
+    unsigned int events = 0;
+    PlayerInput input[PLAYER_COUNT];
+    for (int i = 0; i < iterations; i++)
+    {
+        input[PLAYER_1] = gameMakeInput(gPhysicsState.puckY, true);
+        input[PLAYER_2] = input[PLAYER_1];
+        events |= gameStep(gPhysicsState, gPhysicsConfig, input);
+    }
+    gSink = gPhysicsState.puckX + events;
+}
+
+// The same rally as a match, both paddles under the puck
+static void setupPhysicsMatch()
+{
+    setupPhysics(2);
+    gPhysicsConfig.practice = false;
+}
+
+// Through the step picked once for the mode (gameStepFor), as the game's
+// loops run it, rather than gameStep() picking it every step
+static void runPhysicsPicked(int iterations)
+{
+    GameStepFn step = gameStepFor(gPhysicsConfig);
+    unsigned int events = 0;
+    PlayerInput input[PLAYER_COUNT];
+    for (int i = 0; i < iterations; i++)
+    {
+        input[PLAYER_1] = gameMakeInput(gPhysicsState.puckY, true);
+        input[PLAYER_2] = input[PLAYER_1];
+        events |= step(gPhysicsState, gPhysicsConfig, input);
+    }
+    gSink = gPhysicsState.puckX + events;
+}
+
+// The frame path ---------------------------------------------------------
+
+static GameState gFrameState;
+static EventBus gFrameEvents;
+static uint64_t gFrameAccumulatedUs;
+static uint32_t gFrameParamsVersion;
+
+static void setupFrame()
+{
+    setupPhysics(2);
+    setupSyncInline();
+    hdlSimSetPosition(gDeviceCenter);
+    gFrameState = gPhysicsState;
+    gFrameAccumulatedUs = 0;
+    gFrameParamsVersion = atomicLoad(&gBenchParams->version);
+}
+
+// drawCursor() and drawGraphics() minus the GL calls, then UpdatePos() on
+// a 60 Hz frame clock: about three fixed steps a frame
+static void runFrame(int iterations)
+{
+    const uint64_t frameUs = 1000000 / 60;
+    for (int i = 0; i < iterations; i++)
+    {
+        double cp[3];
+        gBenchHaptics.synchFromServo();
+        gBenchHaptics.getPosition(cp);
+        bool button = gBenchHaptics.isButtonDown();
+        gBenchHaptics.synchFromServo();
+        gBenchHaptics.getPosition(cp);
+
+        if (atomicLoad(&gBenchParams->version) != gFrameParamsVersion)
+            gFrameParamsVersion = atomicLoad(&gBenchParams->version);
+
+        gFrameAccumulatedUs += frameUs;
+        while (gFrameAccumulatedUs >= GAME_STEP_US)
+        {
+            gFrameAccumulatedUs -= GAME_STEP_US;
+            PlayerInput input[PLAYER_COUNT];
+            input[PLAYER_1] = gameMakeInput(gFrameState.puckY, !button);
+            input[PLAYER_2] = gameMakeInput(cp[1], false);
+            gFrameEvents.publishStep(gFrameState, gPhysicsConfig, gameStep(gFrameState, gPhysicsConfig, input));
+        }
+
+        gPuckX = gFrameState.puckX;
+        gPuckY = gFrameState.puckY;
+    }
+}
+
+// Force field lookups ----------------------------------------------------
+
+static const double gFieldBounds[6] = { -2, -2, -2, 2, 2, 3 };
+static ForceField gField;
+static int gFieldResolution;
+
+static void setupField(int resolution)
+{
+    if (gFieldResolution == resolution)
+        return;
+    ArenaWalls walls;
+    walls.north = 1;
+    walls.south = -1;
+    walls.halfEdge = 0.25;
+    gField.build(gFieldBounds, resolution, resolution, resolution, arenaWallsPenetration, &walls);
+    gFieldResolution = resolution;
+
+    // Short of the walls the field must be exactly zero, or the cursor
+    // is pulled at before it touches one
+    int pulls = 0;
+    double worst = 0;
+    for (int i = 0; i <= 200; i++)
+    {
+        double p[3], force[3];
+        p[0] = gFieldBounds[0] + (gFieldBounds[3] - gFieldBounds[0]) * ((i * 37) % 201) / 200.0;
+        p[1] = (walls.south + walls.halfEdge) + (walls.north - walls.south - 2 * walls.halfEdge) * i / 200.0;
+        p[2] = gFieldBounds[2] + (gFieldBounds[5] - gFieldBounds[2]) * ((i * 59) % 201) / 200.0;
+        gField.sample(p, force);
+        for (int j = 0; j < 3; j++)
+        {
+            if (force[j] != 0)
+            {
+                pulls++;
+                if (fabs(force[j]) > worst)
+                    worst = fabs(force[j]);
+            }
+        }
+    }
+    if (pulls != 0)
+    {
+        fprintf(stderr, "bench: field.%d is not zero short of the walls, %d times, up to %g\n", resolution, pulls, worst);
+        gBenchFailed = true;
+    }
+}
+
+static void setupField8()  { setupField(8); }
+static void setupField16() { setupField(16); }
+static void setupField32() { setupField(32); }
+static void setupField64() { setupField(64); }
+
+// Where the lookups go.  A path moves the way a hand does at the servo
+// rate, a few thousandths of a unit a tick, bouncing off the workspace;
+// random lookups jump anywhere in it, which is the worst case for the
+// cache.
+struct FieldWalk {
+    double   p[3];
+    double   v[3];
+    uint32_t seed;
+};
+
+static FieldWalk gWalk;
+
+static void resetWalk()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gWalk.p[i] = 0;
+        gWalk.v[i] = 0.003 + 0.001 * i;
+    }
+    gWalk.seed = 1;
+}
+
+static const double* nextPathPosition()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gWalk.p[i] += gWalk.v[i];
+        if (gWalk.p[i] < gFieldBounds[i] || gWalk.p[i] > gFieldBounds[i + 3])
+            gWalk.v[i] = -gWalk.v[i];
+    }
+    return gWalk.p;
+}
+
+static const double* nextRandomPosition()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gWalk.seed = gWalk.seed * 1664525 + 1013904223;
+        double u = (gWalk.seed >> 8) * (1.0 / 16777216.0);
+        gWalk.p[i] = gFieldBounds[i] + u * (gFieldBounds[i + 3] - gFieldBounds[i]);
+    }
+    return gWalk.p;
+}
+
+static void runFieldPath(int iterations)
+{
+    double force[3], total = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        gField.sample(nextPathPosition(), force);
+        total += force[1];
+    }
+    gSink = total;
+}
+
+static void runFieldRandom(int iterations)
+{
+    double force[3], total = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        gField.sample(nextRandomPosition(), force);
+        total += force[1];
+    }
+    gSink = total;
+}
+
+// A 32 KB, 8-way, least recently used cache of 64-byte lines
+class CacheModel
+{
+public:
+    CacheModel() : m_clock(0), m_misses(0)
+    {
+        memset(m_tags, 0xff, sizeof(m_tags));
+        memset(m_used, 0, sizeof(m_used));
+    }
+
+    // Every line the bytes [p, p + size) touch
+    void read(const void* p, size_t size)
+    {
+        size_t first = (size_t)p >> 6;
+        size_t last = ((size_t)p + size - 1) >> 6;
+        for (size_t line = first; line <= last; line++)
+            touch(line);
+    }
+
+    uint64_t misses() const { return m_misses; }
+
+private:
+    enum { SETS = 64, WAYS = 8 };
+
+    void touch(size_t line)
+    {
+        size_t set = line % SETS;
+        int oldest = 0;
+        m_clock++;
+        for (int w = 0; w < WAYS; w++)
+        {
+            if (m_tags[set][w] == line)
+            {
+                m_used[set][w] = m_clock;
+                return;
+            }
+            if (m_used[set][w] < m_used[set][oldest])
+                oldest = w;
+        }
+        m_misses++;
+        m_tags[set][oldest] = line;
+        m_used[set][oldest] = m_clock;
+    }
+
+    size_t   m_tags[SETS][WAYS];
+    uint64_t m_used[SETS][WAYS];
+    uint64_t m_clock;
+    uint64_t m_misses;
+};
+
+static double modelField(const double* (*next)(), int iterations)
+{
+    CacheModel cache;
+    const ForceFieldNode* nodes[8];
+    resetWalk();
+    for (int i = 0; i < iterations; i++)
+    {
+        gField.corners(next(), nodes);
+        for (int c = 0; c < 8; c++)
+            cache.read(nodes[c], sizeof(ForceFieldNode));
+    }
+    return (double)cache.misses() / iterations;
+}
+
+static double modelFieldPath(int iterations)   { return modelField(nextPathPosition, iterations); }
+static double modelFieldRandom(int iterations) { return modelField(nextRandomPosition, iterations); }
+
+// Hardware cache misses --------------------------------------------------
+
+#ifdef __linux__
+static int gMissCounter = -1;
+
+static bool openMissCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    gMissCounter = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    return gMissCounter >= 0;
+}
+
+static void startMissCounter()
+{
+    ioctl(gMissCounter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(gMissCounter, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static uint64_t stopMissCounter()
+{
+    ioctl(gMissCounter, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count = 0;
+    if (read(gMissCounter, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+#else
+static bool openMissCounter() { return false; }
+static void startMissCounter() {}
+static uint64_t stopMissCounter() { return 0; }
+#endif
+
+// Arena queries -----------------------------------------------------------
+
+// A course of square posts, four segments each, one to a unit cell.  The
+// course grows with the segment count and the puck stays the same size,
+// the way a bigger obstacle course is laid out, so the segments near any
+// one query stay few and the tree's depth is what grows.
+static Arena gCourse;
+static int gCourseSegments;
+static double gCourseSize;
+
+static void setupCourse(int segments)
+{
+    if (gCourseSegments == segments)
+        return;
+
+    int posts = segments / 4;
+    int side = 1;
+    while (side * side < posts)
+        side++;
+
+    std::vector<ArenaSegment> course;
+    uint32_t seed = 1;
+    for (int i = 0; i < posts; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        double angle = (seed >> 8) * (6.283185307179586 / 16777216.0);
+        double cx = i % side + 0.5;
+        double cy = i / side + 0.5;
+        double corners[8];
+        for (int c = 0; c < 4; c++)
+        {
+            double a = angle + c * 1.5707963267948966;
+            corners[c * 2] = cx + 0.2 * cos(a);
+            corners[c * 2 + 1] = cy + 0.2 * sin(a);
+        }
+        addPolyline(course, corners, 4, true, 1);
+    }
+    gCourse.build(course);
+    gCourseSegments = segments;
+    gCourseSize = side;
+}
+
+static void setupCourse64()    { setupCourse(64); }
+static void setupCourse1k()    { setupCourse(1024); }
+static void setupCourse16k()   { setupCourse(16384); }
+static void setupCourse64k()   { setupCourse(65536); }
+
+// A puck gliding across the course, a little further each query than it
+// goes in a game step
+static double gCourseX, gCourseY, gCourseVX = 0.0123, gCourseVY = 0.0071;
+
+static void nextCoursePath(double& x, double& y)
+{
+    gCourseX += gCourseVX;
+    gCourseY += gCourseVY;
+    if (gCourseX < 0 || gCourseX > gCourseSize)
+        gCourseVX = -gCourseVX;
+    if (gCourseY < 0 || gCourseY > gCourseSize)
+        gCourseVY = -gCourseVY;
+    x = gCourseX;
+    y = gCourseY;
+}
+
+static void nextCourseRandom(double& x, double& y)
+{
+    gWalk.seed = gWalk.seed * 1664525 + 1013904223;
+    x = (gWalk.seed >> 8) * (1.0 / 16777216.0) * gCourseSize;
+    gWalk.seed = gWalk.seed * 1664525 + 1013904223;
+    y = (gWalk.seed >> 8) * (1.0 / 16777216.0) * gCourseSize;
+}
+
+static void runCourse(int iterations, void (*next)(double&, double&), bool linear)
+{
+    ArenaContact contact;
+    double total = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        double x, y;
+        next(x, y);
+        bool touching = linear ? gCourse.contactLinear(x, y, 0.25, contact)
+                               : gCourse.contact(x, y, 0.25, contact);
+        if (touching)
+            total += contact.depth;
+    }
+    gSink = total;
+}
+
+static void runCoursePath(int iterations)   { runCourse(iterations, nextCoursePath, false); }
+static void runCourseRandom(int iterations) { runCourse(iterations, nextCourseRandom, false); }
+static void runCourseLinear(int iterations) { runCourse(iterations, nextCourseRandom, true); }
+
+// Simulation to render hand-off -------------------------------------------
+
+// About the size of what the game hands the screen after every step
+struct BenchSnapshot {
+    uint64_t us;
+    double   values[20];
+};
+
+static TripleBuffer<BenchSnapshot> gSnapshots;
+
+static void setupSnapshot() { hdlSimStopServo(); }
+
+// One step's publish and one frame's acquire, on the same thread
+static void runSnapshot(int iterations)
+{
+    double total = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        BenchSnapshot& next = gSnapshots.back();
+        next.us = i;
+        for (int v = 0; v < 20; v++)
+            next.values[v] = i + v;
+        gSnapshots.publish();
+        gSnapshots.acquire();
+        total += gSnapshots.front().values[19];
+    }
+    gSink = total;
+}
+
+// Game events -------------------------------------------------------------
+
+static EventBus gBusEvents;
+static EventReader gBusReaders[4];
+
+static void setupBus()
+{
+    hdlSimStopServo();
+    setupPhysics(2);
+    for (int r = 0; r < 4; r++)
+        gBusReaders[r].attach(gBusEvents);
+}
+
+// One event, nobody reading
+static void runBusPublish(int iterations)
+{
+    BusEvent event;
+    memset(&event, 0, sizeof(event));
+    for (int i = 0; i < iterations; i++)
+    {
+        event.step = i;
+        gBusEvents.publish(event);
+    }
+}
+
+// A step with a hit and a bounce, as the simulation thread publishes it
+static void runBusStep(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        gBusEvents.publishStep(gPhysicsState, gPhysicsConfig, GAME_EV_RIGHT_HIT | GAME_EV_WALL);
+}
+
+// One event published and read by four readers, all on this thread
+static void runBusDeliver4(int iterations)
+{
+    BusEvent event;
+    memset(&event, 0, sizeof(event));
+    uint32_t total = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        event.step = i;
+        gBusEvents.publish(event);
+        for (int r = 0; r < 4; r++)
+        {
+            BusEvent got;
+            while (gBusReaders[r].next(got))
+                total += got.step;
+        }
+    }
+    gSink = total;
+}
+
+// Paddle prediction ---------------------------------------------------------
+
+static MotionRing gMotionRing;
+static MotionPredictor gMotionPredictor;
+static uint32_t gMotionNext;
+
+static void setupPredict()
+{
+    hdlSimStopServo();
+    gMotionPredictor.reset();
+    gMotionNext = gMotionRing.head();
+}
+
+// A hand swinging up and down, read every millisecond
+static double handAt(uint64_t us)
+{
+    return 0.8 * sin(us * 6e-6);
+}
+
+// One servo reading into the filter
+static void runPredictUpdate(int iterations)
+{
+    uint64_t us = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        us += 1000;
+        gMotionPredictor.update(us, handAt(us));
+    }
+    gSink = gMotionPredictor.predict(us + 20000);
+}
+
+// A 60 Hz frame: the servo's 16 readings through the ring into the
+// filter, and the prediction the paddle is drawn at
+static void runPredictFrame(int iterations)
+{
+    uint64_t us = 0;
+    double sum = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int s = 0; s < 16; s++)
+        {
+            us += 1000;
+            gMotionRing.push(us, handAt(us));
+        }
+        MotionSample sample;
+        while (gMotionRing.read(gMotionNext, sample))
+            gMotionPredictor.update(sample.us, sample.y);
+        sum += gMotionPredictor.predict(us + 20000);
+    }
+    gSink = sum;
+}
+
+// Logging ---------------------------------------------------------------
+
+static void setupLog()
+{
+    hdlSimStopServo();
+    logStop();
+    logDiscard();
+}
+
+// A record with two arguments, as the servo makes them, into a ring
+// that is emptied (without formatting) before it fills
+static void runLogRecord(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        LOG2("bench: record %d at %f", i, 0.5);
+        if ((i & (LOG_RING_RECORDS / 2 - 1)) == 0)
+            logDiscard();
+    }
+}
+
+// The same with the ring full: what a record costs once the formatter
+// has fallen behind and records are dropped
+static void setupLogFull()
+{
+    setupLog();
+    for (uint32_t i = 0; i < LOG_RING_RECORDS; i++)
+        LOG0("bench: filling");
+}
+
+static void runLogRecordFull(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        LOG2("bench: record %d at %f", i, 0.5);
+}
+
+// Spectator feed ----------------------------------------------------------
+
+// The rally's steps, published over and over into a private ring.  Going
+// back to the first is a step gap, so one in 1024 is a keyframe.
+const int BENCH_SPECTATE_STATES = 1024;
+
+static SpectatorFeed gBenchFeed;
+static std::vector<GameState> gSpectateStates;
+
+static void setupSpectate()
+{
+    setupPhysics(2);
+    PlayerInput input[PLAYER_COUNT];
+    gSpectateStates.resize(BENCH_SPECTATE_STATES);
+    for (int i = 0; i < BENCH_SPECTATE_STATES; i++)
+    {
+        input[PLAYER_1] = gameMakeInput(gPhysicsState.puckY, true);
+        input[PLAYER_2] = input[PLAYER_1];
+        gameStep(gPhysicsState, gPhysicsConfig, input);
+        gSpectateStates[i] = gPhysicsState;
+    }
+    if (!gBenchFeed.isOpen())
+        gBenchFeed.open(false);
+    gBenchFeed.configure(gPhysicsConfig);
+}
+
+static void runSpectate(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        gBenchFeed.publish(gSpectateStates[i & (BENCH_SPECTATE_STATES - 1)]);
+}
+
+// Tracing itself ----------------------------------------------------------
+
+#ifdef HG_TRACE
+static void setupTrace() { hdlSimStopServo(); }
+
+static void runTraceScope(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        TRACE_SCOPE("bench.scope");
+    }
+}
+
+static void runTraceEvery(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        TRACE_SCOPE_EVERY("bench.every", 64);
+    }
+}
+
+static void runTraceInstant(int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        TRACE_INSTANT("bench.instant");
+}
+#endif
+
+// ------------------------------------------------------------------------
+
+struct Benchmark {
+    const char* name;
+    void (*setup)();
+    void (*run)(int iterations);
+    double (*model)(int iterations);    // modeled cache misses per op, if any
+};
+
+static const Benchmark gBenchmarks[] = {
+    { "servo.track",           setupTrack,         runServoTick,     NULL },
+    { "servo.wall",            setupWall,          runServoTick,     NULL },
+    { "servo.bump",            setupBump,          runServoTick,     NULL },
+    { "servo.jitter",          setupJitter,        runServoTick,     NULL },
+    { "servo.fire",            setupFire,          runServoTick,     NULL },
+    { "servo.retune",          setupTrack,         runServoRetune,   NULL },
+    { "servo.vec_mult_matrix", setupTrack,         runVecMultMatrix, NULL },
+    { "sync.inline",           setupSyncInline,    runSync,          NULL },
+    { "sync.servo_free",       setupSyncFree,      runSync,          NULL },
+    { "sync.servo_1khz",       setupSync1kHz,      runSync,          NULL },
+    { "physics.serve",         setupPhysicsServe,  runPhysics,       NULL },
+    { "physics.speed_2",       setupPhysics2,      runPhysics,       NULL },
+    { "physics.speed_8",       setupPhysics8,      runPhysics,       NULL },
+    { "physics.speed_32",      setupPhysics32,     runPhysics,       NULL },
+    { "physics.arena",         setupPhysicsArena,  runPhysics,       NULL },
+    { "physics.match",         setupPhysicsMatch,  runPhysics,       NULL },
+    { "physics.picked_2",      setupPhysics2,      runPhysicsPicked, NULL },
+    { "physics.picked_match",  setupPhysicsMatch,  runPhysicsPicked, NULL },
+    { "physics.picked_arena",  setupPhysicsArena,  runPhysicsPicked, NULL },
+    { "frame.no_gl",           setupFrame,         runFrame,         NULL },
+    { "field.8.path",          setupField8,        runFieldPath,     modelFieldPath },
+    { "field.8.random",        setupField8,        runFieldRandom,   modelFieldRandom },
+    { "field.16.path",         setupField16,       runFieldPath,     modelFieldPath },
+    { "field.16.random",       setupField16,       runFieldRandom,   modelFieldRandom },
+    { "field.32.path",         setupField32,       runFieldPath,     modelFieldPath },
+    { "field.32.random",       setupField32,       runFieldRandom,   modelFieldRandom },
+    { "field.64.path",         setupField64,       runFieldPath,     modelFieldPath },
+    { "field.64.random",       setupField64,       runFieldRandom,   modelFieldRandom },
+    { "arena.64.path",         setupCourse64,      runCoursePath,    NULL },
+    { "arena.64.random",       setupCourse64,      runCourseRandom,  NULL },
+    { "arena.64.linear",       setupCourse64,      runCourseLinear,  NULL },
+    { "arena.1k.path",         setupCourse1k,      runCoursePath,    NULL },
+    { "arena.1k.random",       setupCourse1k,      runCourseRandom,  NULL },
+    { "arena.1k.linear",       setupCourse1k,      runCourseLinear,  NULL },
+    { "arena.16k.path",        setupCourse16k,     runCoursePath,    NULL },
+    { "arena.16k.random",      setupCourse16k,     runCourseRandom,  NULL },
+    { "arena.16k.linear",      setupCourse16k,     runCourseLinear,  NULL },
+    { "arena.64k.path",        setupCourse64k,     runCoursePath,    NULL },
+    { "arena.64k.random",      setupCourse64k,     runCourseRandom,  NULL },
+    { "arena.64k.linear",      setupCourse64k,     runCourseLinear,  NULL },
+    { "snapshot.handoff",      setupSnapshot,      runSnapshot,      NULL },
+    { "events.publish",        setupBus,           runBusPublish,    NULL },
+    { "events.publish_step",   setupBus,           runBusStep,       NULL },
+    { "events.deliver_4",      setupBus,           runBusDeliver4,   NULL },
+    { "predict.update",        setupPredict,       runPredictUpdate, NULL },
+    { "predict.frame",         setupPredict,       runPredictFrame,  NULL },
+    { "log.record_2",          setupLog,           runLogRecord,     NULL },
+    { "log.record_full",       setupLogFull,       runLogRecordFull, NULL },
+    { "spectate.publish",      setupSpectate,      runSpectate,      NULL },
+#ifdef HG_TRACE
+    { "trace.scope",           setupTrace,         runTraceScope,    NULL },
+    { "trace.scope_every_64",  setupTrace,         runTraceEvery,    NULL },
+    { "trace.instant",         setupTrace,         runTraceInstant,  NULL },
+#endif
+};
+
+static const int gBenchmarkCount = sizeof(gBenchmarks) / sizeof(gBenchmarks[0]);
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool bench [options]\n"
+        "  --filter TEXT    only benchmarks whose name contains TEXT\n"
+        "  --samples N      batches timed per benchmark (default 100)\n"
+        "  --batch-us N     shortest batch, in microseconds (default 2000)\n"
+        "  --list           list the benchmarks\n"
+#ifdef HG_TRACE
+        "  --trace FILE     save a trace of the run as Chrome trace-event JSON\n"
+#endif
+        );
+}
+
+int benchMain(int argc, char* argv[])
+{
+    const char* filter = NULL;
+    int samples = 100;
+    int batchUs = 2000;
+#ifdef HG_TRACE
+    const char* tracePath = NULL;
+#endif
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--filter") == 0 && hasValue)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--samples") == 0 && hasValue)
+            samples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch-us") == 0 && hasValue)
+            batchUs = atoi(argv[++i]);
+#ifdef HG_TRACE
+        else if (strcmp(argv[i], "--trace") == 0 && hasValue)
+            tracePath = argv[++i];
+#endif
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            for (int b = 0; b < gBenchmarkCount; b++)
+                printf("%s\n", gBenchmarks[b].name);
+            return 0;
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (samples < 1)
+        samples = 1;
+
+    // A private block, so a running game is not disturbed
+    static ParamBlock block;
+    memset(&block, 0, sizeof(block));
+    paramsDefault(block.params);
+    gBenchParams = &block;
+    gBenchHaptics.init(gBenchParams);
+    resetWalk();
+    TRACE_THREAD("bench");
+    bool countMisses = openMissCounter();
+
+    printf("benchmark,iterations,samples,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns,misses_per_op,misses_from\n");
+    for (int b = 0; b < gBenchmarkCount; b++)
+    {
+        const Benchmark& bench = gBenchmarks[b];
+        if (filter != NULL && strstr(bench.name, filter) == NULL)
+            continue;
+
+        TRACE_SCOPE(bench.name);
+        bench.setup();
+
+        // Grow the batch until it takes long enough to time; this also
+        // warms the caches and the branch predictors
+        int iterations = 1;
+        for (;;)
+        {
+            uint64_t start = platformMicros();
+            bench.run(iterations);
+            uint64_t elapsed = platformMicros() - start;
+            if ((int)elapsed >= batchUs || iterations >= (1 << 28))
+                break;
+            iterations *= 2;
+        }
+
+        std::vector<double> ns;
+        double total = 0;
+        uint64_t misses = 0;
+        for (int s = 0; s < samples; s++)
+        {
+            if (countMisses)
+                startMissCounter();
+            uint64_t start = platformMicros();
+            bench.run(iterations);
+            double perOp = (platformMicros() - start) * 1000.0 / iterations;
+            if (countMisses)
+                misses += stopMissCounter();
+            ns.push_back(perOp);
+            total += perOp;
+        }
+        std::sort(ns.begin(), ns.end());
+
+        char missText[32] = "";
+        const char* missFrom = "";
+        if (countMisses)
+        {
+            sprintf(missText, "%.4f", (double)misses / ((double)iterations * samples));
+            missFrom = "hw";
+        }
+        else if (bench.model != NULL)
+        {
+            sprintf(missText, "%.4f", bench.model(iterations));
+            missFrom = "model";
+        }
+
+        printf("%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%s,%s\n", bench.name, iterations, samples,
+               total / samples, ns.front(), percentile(ns, 0.5), percentile(ns, 0.9),
+               percentile(ns, 0.99), ns.back(), missText, missFrom);
+        fflush(stdout);
+    }
+
+    hdlSimStopServo();
+    gBenchHaptics.uninit();
+
+#ifdef HG_TRACE
+    if (tracePath != NULL && !traceWrite(tracePath))
+    {
+        fprintf(stderr, "bench: cannot write %s\n", tracePath);
+        return 1;
+    }
+#endif
+    return gBenchFailed ? 1 : 0;
+}
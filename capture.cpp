@@ -0,0 +1,212 @@
+#include "capture.h"
+#include "realtime.h"
+#include "trace.h"
+#include <string.h>
+
+VideoCapture::VideoCapture()
+    : m_file(NULL),
+      m_index(NULL),
+      m_width(0),
+      m_height(0),
+      m_red(0),
+      m_blue(2),
+      m_avoidCpu(-1),
+      m_head(0),
+      m_tail(0),
+      m_dropped(0),
+      m_stop(0),
+      m_thread(0),
+      m_encodeUs(0)
+{
+}
+
+VideoCapture::~VideoCapture()
+{
+    close();
+}
+
+bool VideoCapture::open(const char* path, const char* indexPath, int width, int height, int fps,
+                        CapturePixels pixels, int avoidCpu)
+{
+    close();
+    m_width = width & ~1;
+    m_height = height & ~1;
+    if (m_width <= 0 || m_height <= 0)
+        return false;
+
+    m_file = fopen(path, "wb");
+    if (m_file == NULL)
+        return false;
+    m_path = path;
+    if (indexPath != NULL)
+        m_index = fopen(indexPath, "w");
+
+    // A frame's worth of buffering, so each frame is about one write
+    size_t frameBytes = (size_t)m_width * m_height * 3 / 2;
+    m_buffer.resize(frameBytes + 64);
+    setvbuf(m_file, &m_buffer[0], _IOFBF, m_buffer.size());
+    m_planes.resize(frameBytes);
+    for (int i = 0; i < CAPTURE_SLOTS; i++)
+        m_slots[i].pixels.resize((size_t)m_width * m_height * 4);
+
+    m_red = pixels == CAPTURE_BGRA ? 2 : 0;
+    m_blue = pixels == CAPTURE_BGRA ? 0 : 2;
+    m_avoidCpu = avoidCpu;
+    m_head = 0;
+    m_tail = 0;
+    m_dropped = 0;
+    m_stop = 0;
+    m_encodeUs = 0;
+
+    // Full-range BT.601 with centred chroma.  C420jpeg only says where the
+    // chroma sits; without XCOLORRANGE=FULL readers such as ffmpeg take
+    // the levels as limited range and stretch them.
+    fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", m_width, m_height, fps);
+    if (m_index != NULL)
+        fprintf(m_index, "frame,step,us\n");
+
+    if (!platformStartThread(m_thread, encoderThread, this))
+    {
+        fclose(m_file);
+        m_file = NULL;
+        if (m_index != NULL)
+            fclose(m_index);
+        m_index = NULL;
+        return false;
+    }
+    return true;
+}
+
+unsigned char* VideoCapture::claim()
+{
+    if (m_file == NULL)
+        return NULL;
+    uint32_t head = m_head;
+    if (head - atomicLoad(&m_tail) >= (uint32_t)CAPTURE_SLOTS)
+    {
+        atomicAdd(&m_dropped, 1);
+        return NULL;
+    }
+    return &m_slots[head % CAPTURE_SLOTS].pixels[0];
+}
+
+void VideoCapture::submit(uint32_t step, uint64_t us)
+{
+    uint32_t head = m_head;
+    Slot& slot = m_slots[head % CAPTURE_SLOTS];
+    slot.step = step;
+    slot.us = us;
+    atomicStore(&m_head, head + 1);
+}
+
+void VideoCapture::drop()
+{
+    atomicAdd(&m_dropped, 1);
+}
+
+void VideoCapture::close()
+{
+    if (m_file == NULL)
+        return;
+    atomicStore(&m_stop, 1);
+    platformJoinThread(m_thread);
+    fclose(m_file);
+    m_file = NULL;
+    if (m_index != NULL)
+        fclose(m_index);
+    m_index = NULL;
+}
+
+std::string VideoCapture::report()
+{
+    char line[256];
+    uint32_t written = atomicLoad(&m_tail);
+    sprintf(line, "capture: %u frames written to %s, %u dropped, %.2f ms a frame to encode\n",
+            written, m_path.c_str(), atomicLoad(&m_dropped),
+            written ? m_encodeUs / 1000.0 / written : 0.0);
+    return line;
+}
+
+// Encode slots as they are submitted, until told to stop and the queue
+// is empty
+void VideoCapture::encoderThread(void* arg)
+{
+    VideoCapture& capture = *(VideoCapture*)arg;
+    TRACE_THREAD("capture");
+    rtAvoidCpu(capture.m_avoidCpu);
+    for (;;)
+    {
+        uint32_t tail = capture.m_tail;
+        if (atomicLoad(&capture.m_head) == tail)
+        {
+            if (atomicLoad(&capture.m_stop) != 0)
+                return;
+            platformSleepMs(1);
+            continue;
+        }
+
+        uint64_t start = platformMicros();
+        capture.encode(capture.m_slots[tail % CAPTURE_SLOTS]);
+        capture.m_encodeUs += platformMicros() - start;
+        atomicStore(&capture.m_tail, tail + 1);
+    }
+}
+
+// RGB to full-range YCbCr in 16.16 fixed point
+static inline unsigned char luma(int r, int g, int b)
+{
+    return (unsigned char)((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+}
+
+static inline unsigned char chroma(int a, int b, int c, int d)
+{
+    int value = (a + b + c + d + (128 << 16) * 4 + 131072) >> 18;
+    return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+void VideoCapture::encode(const Slot& slot)
+{
+    TRACE_SCOPE("capture.encode");
+    int width = m_width, height = m_height;
+    unsigned char* y = &m_planes[0];
+    unsigned char* cb = y + width * height;
+    unsigned char* cr = cb + width * height / 4;
+    const unsigned char* pixels = &slot.pixels[0];
+    int red = m_red, blue = m_blue;
+
+    // Two rows at a time, flipped: the read back starts at the bottom
+    for (int row = 0; row < height; row += 2)
+    {
+        const unsigned char* top = pixels + (size_t)(height - 1 - row) * width * 4;
+        const unsigned char* bottom = top - (size_t)width * 4;
+        unsigned char* yTop = y + (size_t)row * width;
+        unsigned char* yBottom = yTop + width;
+        unsigned char* cbRow = cb + (size_t)row / 2 * width / 2;
+        unsigned char* crRow = cr + (size_t)row / 2 * width / 2;
+        for (int col = 0; col < width; col += 2)
+        {
+            const unsigned char* p[4] = { top + col * 4, top + col * 4 + 4,
+                                          bottom + col * 4, bottom + col * 4 + 4 };
+            int cbSum[4], crSum[4];
+            for (int i = 0; i < 4; i++)
+            {
+                int r = p[i][red], g = p[i][1], b = p[i][blue];
+                cbSum[i] = -11059 * r - 21709 * g + 32768 * b;
+                crSum[i] = 32768 * r - 27439 * g - 5329 * b;
+            }
+            yTop[col] = luma(p[0][red], p[0][1], p[0][blue]);
+            yTop[col + 1] = luma(p[1][red], p[1][1], p[1][blue]);
+            yBottom[col] = luma(p[2][red], p[2][1], p[2][blue]);
+            yBottom[col + 1] = luma(p[3][red], p[3][1], p[3][blue]);
+            cbRow[col / 2] = chroma(cbSum[0], cbSum[1], cbSum[2], cbSum[3]);
+            crRow[col / 2] = chroma(crSum[0], crSum[1], crSum[2], crSum[3]);
+        }
+    }
+
+    // Y4M allows parameters after FRAME; X ones are the application's
+    uint32_t frame = m_tail;
+    fprintf(m_file, "FRAME Xstep=%u\n", slot.step);
+    fwrite(&m_planes[0], 1, m_planes.size(), m_file);
+    if (m_index != NULL)
+        fprintf(m_index, "%u,%u,%llu\n", frame, slot.step, (unsigned long long)slot.us);
+}
@@ -0,0 +1,96 @@
+// Make sure this header is included only once
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "platform.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Video of the playfield, recorded by the game itself, since a screen
+// recorder on the experiment machine disturbs the very timing being
+// measured.  The window reads each frame back (through pixel buffer
+// objects where it can, so the read never waits on the GPU) into a slot
+// of a small queue, and an encoder thread of its own turns the slots
+// into a Y4M file.  When the encoder is behind and every slot is full,
+// the frame is dropped and counted; the window never waits.
+//
+// Every frame written is stamped with the simulation step it shows, in
+// the Y4M frame header, and with the time it was drawn too in an index
+// of "frame,step,us" lines, so it lines up with the session and the
+// results.
+
+// Frames waiting for the encoder
+const int CAPTURE_SLOTS = 4;
+
+// Byte order of the pixels handed over, as glReadPixels gives them
+enum CapturePixels {
+    CAPTURE_RGBA,
+    CAPTURE_BGRA
+};
+
+class VideoCapture
+{
+public:
+    VideoCapture();
+    ~VideoCapture();
+
+    // Start a width x height video (rounded down to even) at a nominal
+    // fps, with its index at indexPath if not NULL, and the encoder
+    // thread, kept off avoidCpu.  Everything the capture needs is
+    // allocated here.
+    bool open(const char* path, const char* indexPath, int width, int height, int fps,
+              CapturePixels pixels, int avoidCpu = -1);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    bool isOpen() const { return m_file != NULL; }
+
+    // A slot for the next frame: width x height pixels of 4 bytes, rows
+    // bottom up.  NULL, with the frame counted as dropped, if the
+    // encoder has every slot.
+    unsigned char* claim();
+
+    // Hand the claimed slot to the encoder
+    void submit(uint32_t step, uint64_t us);
+
+    // Count a frame that could not be captured
+    void drop();
+
+    // Write what is queued, stop the encoder and close the files
+    void close();
+
+    uint32_t written() const { return atomicLoad(&m_tail); }
+    uint32_t dropped() const { return atomicLoad(&m_dropped); }
+
+    // Frames written and dropped, and how long encoding took
+    std::string report();
+
+private:
+    struct Slot {
+        std::vector<unsigned char> pixels;
+        uint32_t                   step;
+        uint64_t                   us;
+    };
+
+    static void encoderThread(void* arg);
+    void encode(const Slot& slot);
+
+    FILE*                      m_file;
+    FILE*                      m_index;
+    std::string                m_path;
+    int                        m_width, m_height;
+    int                        m_red, m_blue;       // byte of each in a pixel
+    int                        m_avoidCpu;
+    Slot                       m_slots[CAPTURE_SLOTS];
+    volatile uint32_t          m_head;              // frames submitted
+    volatile uint32_t          m_tail;              // frames written
+    volatile uint32_t          m_dropped;
+    volatile uint32_t          m_stop;
+    PlatformThread             m_thread;
+    std::vector<unsigned char> m_planes;            // Y, then Cb and Cr at half size
+    std::vector<char>          m_buffer;            // for the file
+    uint64_t                   m_encodeUs;
+};
+
+#endif // CAPTURE_H
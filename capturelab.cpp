@@ -0,0 +1,138 @@
+// capturelab: the video capture queue and encoder without a window.  A
+// stand-in window thread "draws" frames at a given rate (or flat out),
+// copies each into a capture slot as the game copies a mapped pixel
+// buffer, and hands it over; the encoder thread writes the Y4M.  For
+// each rate it reports what a hand-over cost the window, and how many
+// frames were written and dropped.  The window's cost must not grow
+// when the encoder falls behind: the frames are dropped instead.
+#include "capture.h"
+#include "realtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+template <class T>
+static T percentile(std::vector<T> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+// Something like the playfield: a dark background with a puck moving
+static void drawFrame(std::vector<unsigned char>& frame, int width, int height, int n)
+{
+    memset(&frame[0], 16, frame.size());
+    int x = (n * 7) % (width - 20), y = (n * 3) % (height - 20);
+    for (int row = y; row < y + 20; row++)
+        memset(&frame[((size_t)row * width + x) * 4], 200, 20 * 4);
+}
+
+static void run(const char* path, const char* indexPath, int width, int height, int fps, int seconds)
+{
+    VideoCapture capture;
+    if (!capture.open(path, indexPath, width, height, fps > 0 ? fps : 60, CAPTURE_BGRA))
+    {
+        fprintf(stderr, "capturelab: cannot write %s\n", path);
+        return;
+    }
+
+    std::vector<unsigned char> frame((size_t)capture.width() * capture.height() * 4);
+    std::vector<double> handoffUs;
+    handoffUs.reserve(fps > 0 ? (size_t)fps * seconds : 100000);
+
+    uint64_t start = platformMicros();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint64_t due = start;
+    int frames = 0;
+    while (platformMicros() < end)
+    {
+        if (fps > 0)
+        {
+            due += 1000000 / fps;
+            rtSleepUntil(due);
+        }
+        drawFrame(frame, capture.width(), capture.height(), frames);
+
+        uint64_t before = platformTicks();
+        unsigned char* slot = capture.claim();
+        if (slot != NULL)
+        {
+            memcpy(slot, &frame[0], frame.size());
+            capture.submit(frames, platformMicros());
+        }
+        handoffUs.push_back((platformTicks() - before) * 1e6 / platformTicksPerSecond());
+        frames++;
+    }
+    capture.close();
+
+    char rate[16];
+    sprintf(rate, fps > 0 ? "%d" : "flat out", fps);
+    printf("%s,%dx%d,%d,%u,%u,%.1f,%.1f,%.1f\n", rate, capture.width(), capture.height(), frames,
+           capture.written(), capture.dropped(), percentile(handoffUs, 0.5),
+           percentile(handoffUs, 0.99), percentile(handoffUs, 1.0));
+    fprintf(stderr, "%s", capture.report().c_str());
+    fflush(stdout);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool capturelab [options]\n"
+        "  --out FILE      where the video goes, with its index in FILE.frames.csv\n"
+        "                  (default the null device, without an index)\n"
+        "  --size WxH      frame size (default 500x500, the game's window)\n"
+        "  --fps LIST      frame rates, comma separated; 0 is flat out (default 60,240,0)\n"
+        "  --seconds N     time for each rate (default 2)\n");
+}
+
+int capturelabMain(int argc, char* argv[])
+{
+#ifdef _WIN32
+    const char* path = "NUL";
+#else
+    const char* path = "/dev/null";
+#endif
+    std::string indexPath;
+    int width = 500, height = 500;
+    const char* rates = "60,240,0";
+    int seconds = 2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--out") == 0 && hasValue)
+        {
+            path = argv[++i];
+            indexPath = std::string(path) + ".frames.csv";
+        }
+        else if (strcmp(argv[i], "--size") == 0 && hasValue && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+            i++;
+        else if (strcmp(argv[i], "--fps") == 0 && hasValue)
+            rates = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (seconds < 1)
+        seconds = 1;
+
+    printf("fps,size,frames,written,dropped,handoff_p50_us,handoff_p99_us,handoff_max_us\n");
+    fflush(stdout);
+    for (const char* p = rates; *p != '\0'; )
+    {
+        if (*p >= '0' && *p <= '9')
+            run(path, indexPath.empty() ? NULL : indexPath.c_str(), width, height, atoi(p), seconds);
+        while (*p != '\0' && *p++ != ',')
+            ;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "eventbus.h"
+#include <string.h>
+
+EventBus::EventBus()
+    : m_head(0)
+{
+    memset(m_events, 0, sizeof(m_events));
+}
+
+void EventBus::publish(const BusEvent& event)
+{
+    uint32_t head = m_head;
+    m_events[head % EVENT_BUS_EVENTS] = event;
+    atomicStore(&m_head, head + 1);
+}
+
+void EventBus::publishStep(const GameState& state, const GameConfig& config, unsigned int events)
+{
+    static const struct { unsigned int bit; uint16_t type; uint16_t player; } kinds[] = {
+        { GAME_EV_RIGHT_HIT,   BUS_HIT,         PLAYER_1 },
+        { GAME_EV_LEFT_HIT,    BUS_HIT,         PLAYER_2 },
+        { GAME_EV_WALL,        BUS_WALL,        PLAYER_1 },
+        { GAME_EV_SCORE_P1,    BUS_SCORE,       PLAYER_1 },
+        { GAME_EV_SCORE_P2,    BUS_SCORE,       PLAYER_2 },
+        { GAME_EV_FIRE,        BUS_SERVE,       PLAYER_1 },
+        { GAME_EV_SERVE_P2,    BUS_SERVE,       PLAYER_2 },
+        { GAME_EV_SESSION_END, BUS_SESSION_END, PLAYER_1 },
+    };
+
+    if (events == GAME_EV_NONE)
+        return;
+
+    BusEvent event;
+    event.us = platformMicros();
+    event.step = state.step;
+    event.x = state.puckX;
+    event.y = state.puckY;
+    event.velX = (float)state.velX;
+    event.velY = (float)state.velY;
+    event.score[PLAYER_1] = state.score[PLAYER_1];
+    event.score[PLAYER_2] = state.score[PLAYER_2];
+    event.hits = state.hits;
+    event.misses = state.misses;
+    event.rebounds = config.rebounds;
+    event.version = 0;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+    {
+        if (events & kinds[i].bit)
+        {
+            event.type = kinds[i].type;
+            event.player = kinds[i].player;
+            publish(event);
+        }
+    }
+}
+
+EventReader::EventReader()
+    : m_bus(NULL),
+      m_next(0),
+      m_dropped(0)
+{
+}
+
+void EventReader::attach(const EventBus& bus)
+{
+    m_next = atomicLoad(&bus.m_head);
+    m_dropped = 0;
+    m_bus = &bus;
+}
+
+bool EventReader::next(BusEvent& event)
+{
+    if (m_bus == NULL)
+        return false;
+
+    for (;;)
+    {
+        uint32_t head = atomicLoad(&m_bus->m_head);
+        if (head == m_next)
+            return false;
+
+        // Too far behind: what is left of the oldest has been overwritten
+        if (head - m_next > EVENT_BUS_EVENTS)
+        {
+            m_dropped += head - m_next - EVENT_BUS_EVENTS;
+            m_next = head - EVENT_BUS_EVENTS;
+        }
+
+        event = m_bus->m_events[m_next % EVENT_BUS_EVENTS];
+
+        // The writer may have come round to this slot while it was copied
+        atomicLoadFence();
+        if (atomicLoad(&m_bus->m_head) - m_next >= EVENT_BUS_EVENTS)
+        {
+            m_dropped++;
+            m_next++;
+            continue;
+        }
+        m_next++;
+        return true;
+    }
+}
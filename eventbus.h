@@ -0,0 +1,93 @@
+// Make sure this header is included only once
+#ifndef EVENTBUS_H
+#define EVENTBUS_H
+
+#include "game.h"
+
+// What happened in the game, fanned out from the simulation thread to
+// whoever cares: the servo thread for the haptic effects, the window for
+// sounds, the score and the practice results.  The step used to call
+// each of them itself, so every one of them, a file write included,
+// held up the next step.  Now the step only publishes, and each consumer
+// reads on its own schedule.
+//
+// One ring, one writer and any number of readers, each with its own
+// position.  Publishing is a copy and a store and never waits; a reader
+// that falls more than EVENT_BUS_EVENTS behind loses the oldest and
+// counts them.  Readers never write to the ring, so one can be added
+// without the writer or the others knowing.
+//
+// gameStep() stays pure: it still returns its GameEvent bits, and the
+// caller publishes them with the state they left.  Over the network,
+// events a rollback turned up for earlier steps carry the present state.
+
+// Events the ring holds; a second of steps each with a hit and a bounce
+const uint32_t EVENT_BUS_EVENTS = 512;
+
+enum BusEventType {
+    BUS_HIT = 1,        // player's paddle (or player 2's back wall) hit the puck
+    BUS_WALL,           // the puck bounced off a wall or bumper
+    BUS_SCORE,          // player scored
+    BUS_SERVE,          // player released the puck
+    BUS_SESSION_END,    // the practice session reached its rebound count
+    BUS_PARAMS          // the tuning parameters changed (params.h)
+};
+
+// One cache line.  Everything a reader needs comes with the event, so
+// that no reader looks at the simulation's own state.
+struct BusEvent {
+    uint64_t us;            // platformMicros() when published
+    uint32_t step;          // the state's step after it happened
+    uint16_t type;
+    uint16_t player;
+    double   x, y;          // the puck
+    float    velX, velY;
+    int32_t  score[PLAYER_COUNT];
+    int32_t  hits, misses;
+    int32_t  rebounds;      // the session's length, as the step had it
+    uint32_t version;       // BUS_PARAMS: the parameter block's version
+};
+
+class EventBus
+{
+    friend class EventReader;
+
+public:
+    EventBus();
+
+    // Writer only
+    void publish(const BusEvent& event);
+
+    // One event for each bit of a step's GameEvent mask, in the order
+    // hits, bounces, scores, serves, session end
+    void publishStep(const GameState& state, const GameConfig& config, unsigned int events);
+
+    // Events ever published
+    uint32_t published() const { return atomicLoad(&m_head); }
+
+private:
+    BusEvent          m_events[EVENT_BUS_EVENTS];
+    volatile uint32_t m_head;       // event i is at i % EVENT_BUS_EVENTS
+};
+
+class EventReader
+{
+public:
+    EventReader();
+
+    // Read from bus, starting with the next event published
+    void attach(const EventBus& bus);
+
+    // The oldest event not yet read, if any
+    bool next(BusEvent& event);
+
+    // Events lost for falling behind
+    uint32_t dropped() const { return m_dropped; }
+
+private:
+    const EventBus* m_bus;
+    uint32_t        m_next;
+    uint32_t        m_dropped;
+};
+
+#endif // EVENTBUS_H
@@ -0,0 +1,185 @@
+// eventlab: the game event bus between threads.  The calling thread
+// publishes events at the rate the simulation does (a hit and a bounce
+// every step by default, far more than a game has), and a number of
+// consumer threads read them on one of the schedules the game's readers
+// keep:
+//
+//   spin   read, yield, read again: the best a reader can do
+//   1khz   read once a millisecond, like the servo tick
+//   60hz   read once a frame, like the window
+//
+// For each number of consumers and each schedule it reports what a
+// publish cost the publisher, and how long events took from publish to
+// being read, over every consumer.
+#include "eventbus.h"
+#include "realtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct Consumer {
+    int                   periodUs;     // 0 to spin
+    volatile uint32_t*    stop;
+    EventReader           reader;
+    std::vector<uint32_t> latencyUs;
+};
+
+static void consumerThread(void* arg)
+{
+    Consumer& c = *(Consumer*)arg;
+    uint64_t next = platformMicros();
+    while (atomicLoad(c.stop) == 0)
+    {
+        BusEvent event;
+        while (c.reader.next(event))
+            c.latencyUs.push_back((uint32_t)(platformMicros() - event.us));
+
+        if (c.periodUs == 0)
+        {
+            platformYield();
+        }
+        else
+        {
+            next += c.periodUs;
+            rtSleepUntil(next);
+        }
+    }
+}
+
+template <class T>
+static T percentile(std::vector<T> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+static void run(int consumers, const char* schedule, int periodUs, int seconds, int perStep)
+{
+    EventBus* bus = new EventBus;
+    volatile uint32_t stop = 0;
+    std::vector<Consumer> readers(consumers);
+    std::vector<PlatformThread> threads(consumers);
+    for (int i = 0; i < consumers; i++)
+    {
+        readers[i].periodUs = periodUs;
+        readers[i].stop = &stop;
+        readers[i].reader.attach(*bus);
+        readers[i].latencyUs.reserve((size_t)seconds * 200 * perStep + 1024);
+    }
+    for (int i = 0; i < consumers; i++)
+        platformStartThread(threads[i], consumerThread, &readers[i]);
+
+    // The simulation's pace: perStep events every step
+    BusEvent event;
+    memset(&event, 0, sizeof(event));
+    std::vector<double> publishNs;
+    publishNs.reserve((size_t)seconds * 200 * perStep);
+    double nsPerTick = 1e9 / (double)platformTicksPerSecond();
+
+    uint64_t start = platformMicros();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    for (uint64_t due = start; due < end; due += GAME_STEP_US)
+    {
+        rtSleepUntil(due);
+        for (int e = 0; e < perStep; e++)
+        {
+            event.type = (uint16_t)(e % 2 == 0 ? BUS_HIT : BUS_WALL);
+            event.step++;
+            event.us = platformMicros();
+            uint64_t before = platformTicks();
+            bus->publish(event);
+            publishNs.push_back((platformTicks() - before) * nsPerTick);
+        }
+    }
+
+    // Let the slowest reader catch up before stopping
+    platformSleepMs(periodUs / 1000 * 2 + 5);
+    atomicStore(&stop, 1);
+    std::vector<uint32_t> latency;
+    uint32_t received = 0, dropped = 0;
+    for (int i = 0; i < consumers; i++)
+    {
+        platformJoinThread(threads[i]);
+        latency.insert(latency.end(), readers[i].latencyUs.begin(), readers[i].latencyUs.end());
+        received += (uint32_t)readers[i].latencyUs.size();
+        dropped += readers[i].reader.dropped();
+    }
+
+    double total = 0;
+    for (size_t i = 0; i < publishNs.size(); i++)
+        total += publishNs[i];
+    printf("%d,%s,%u,%.1f,%.1f,%u,%u,%u,%u,%u\n", consumers, schedule, (unsigned)publishNs.size(),
+           publishNs.empty() ? 0 : total / publishNs.size(), percentile(publishNs, 0.99),
+           percentile(latency, 0.5), percentile(latency, 0.99), percentile(latency, 1.0),
+           received, dropped);
+    fflush(stdout);
+    delete bus;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool eventlab [options]\n"
+        "  --seconds N       time for each run (default 1)\n"
+        "  --per-step N      events published every step (default 2)\n"
+        "  --consumers LIST  numbers of consumers, comma separated (default 1,2,4,8)\n"
+        "  --schedule NAME   spin, 1khz or 60hz (default all three)\n");
+}
+
+int eventlabMain(int argc, char* argv[])
+{
+    static const struct { const char* name; int periodUs; } schedules[] = {
+        { "spin", 0 },
+        { "1khz", 1000 },
+        { "60hz", 16667 },
+    };
+    int seconds = 1;
+    int perStep = 2;
+    const char* counts = "1,2,4,8";
+    const char* only = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--per-step") == 0 && hasValue)
+            perStep = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--consumers") == 0 && hasValue)
+            counts = argv[++i];
+        else if (strcmp(argv[i], "--schedule") == 0 && hasValue)
+            only = argv[++i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (seconds < 1)
+        seconds = 1;
+    if (perStep < 1)
+        perStep = 1;
+
+    printf("# %d events a step, a step every %u us, %d s a run, a ring of %u events\n",
+           perStep, (unsigned)GAME_STEP_US, seconds, EVENT_BUS_EVENTS);
+    printf("consumers,schedule,events,publish_mean_ns,publish_p99_ns,"
+           "latency_p50_us,latency_p99_us,latency_max_us,received,dropped\n");
+    for (int s = 0; s < 3; s++)
+    {
+        if (only != NULL && strcmp(only, schedules[s].name) != 0)
+            continue;
+        for (const char* p = counts; *p != '\0'; )
+        {
+            int consumers = atoi(p);
+            if (consumers > 0)
+                run(consumers, schedules[s].name, schedules[s].periodUs, seconds, perStep);
+            while (*p != '\0' && *p++ != ',')
+                ;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "forcefield.h"
+
+ForceField::ForceField()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        m_count[i] = 0;
+        m_origin[i] = 0;
+        m_spacing[i] = 1;
+        m_inverse[i] = 1;
+    }
+}
+
+bool ForceField::build(const double bounds[6], int nx, int ny, int nz, ForceFunction fn, void* context)
+{
+    // Every axis is checked before anything changes, so a field that
+    // cannot be built is left as it was
+    int count[3] = { nx, ny, nz };
+    for (int i = 0; i < 3; i++)
+    {
+        if (count[i] < 2 || !(bounds[i + 3] > bounds[i]) || fn == NULL)
+            return false;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        m_count[i] = count[i];
+        m_origin[i] = bounds[i];
+        m_spacing[i] = (bounds[i + 3] - bounds[i]) / (count[i] - 1);
+        m_inverse[i] = 1.0 / m_spacing[i];
+    }
+
+    m_nodes.resize((size_t)nx * ny * nz);
+
+    // A small step, so the gradient is the slope at the node rather than
+    // across a cell
+    double step[3];
+    for (int i = 0; i < 3; i++)
+        step[i] = m_spacing[i] * 1e-3;
+
+    size_t index = 0;
+    for (int z = 0; z < nz; z++)
+    {
+        for (int y = 0; y < ny; y++)
+        {
+            for (int x = 0; x < nx; x++, index++)
+            {
+                double p[3] = { m_origin[0] + x * m_spacing[0],
+                                m_origin[1] + y * m_spacing[1],
+                                m_origin[2] + z * m_spacing[2] };
+                ForceFieldNode& node = m_nodes[index];
+
+                double force[3];
+                fn(p, force, context);
+                for (int i = 0; i < 3; i++)
+                    node.force[i] = (float)force[i];
+
+                for (int j = 0; j < 3; j++)
+                {
+                    double ahead[3] = { p[0], p[1], p[2] };
+                    double behind[3] = { p[0], p[1], p[2] };
+                    ahead[j] += step[j];
+                    behind[j] -= step[j];
+
+                    double fa[3], fb[3];
+                    fn(ahead, fa, context);
+                    fn(behind, fb, context);
+                    for (int i = 0; i < 3; i++)
+                        node.gradient[i * 3 + j] = (float)((fa[i] - fb[i]) / (2 * step[j]));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void ForceField::locate(const double position[3], int cell[3], double offset[3]) const
+{
+    for (int i = 0; i < 3; i++)
+    {
+        double u = (position[i] - m_origin[i]) * m_inverse[i];
+        int c = (int)u;
+        if (u < 0)
+            c = 0;
+        if (c > m_count[i] - 2)
+            c = m_count[i] - 2;
+        cell[i] = c;
+        offset[i] = u - c;
+    }
+}
+
+// A node's extrapolated force, kept on its own side of zero.  A force
+// like a wall's is zero up to a hinge and linear past it; carried back
+// across the hinge it would change sign and pull on the cursor before
+// contact.  A node with no force has nothing to extrapolate.
+static inline float sameSide(float term, float force)
+{
+    if (force > 0)
+        return term > 0 ? term : 0;
+    if (force < 0)
+        return term < 0 ? term : 0;
+    return 0;
+}
+
+void ForceField::sample(const double position[3], double force[3]) const
+{
+    force[0] = force[1] = force[2] = 0;
+    if (m_nodes.empty())
+        return;
+
+    int cell[3];
+    double offset[3];
+    locate(position, cell, offset);
+
+    // Blend weights stay within the cell; the offsets from each node do
+    // not, which is what extrapolates past the grid.  The arithmetic is in
+    // float, like the nodes, so nothing needs converting.
+    float w1[3], w0[3], d0[3], d1[3];
+    for (int i = 0; i < 3; i++)
+    {
+        double w = offset[i] < 0 ? 0 : (offset[i] > 1 ? 1 : offset[i]);
+        w1[i] = (float)w;
+        w0[i] = (float)(1 - w);
+        d0[i] = (float)(offset[i] * m_spacing[i]);
+        d1[i] = (float)((offset[i] - 1) * m_spacing[i]);
+    }
+
+    size_t row = m_count[0];
+    size_t plane = row * m_count[1];
+    const ForceFieldNode* base = &m_nodes[cell[0] + cell[1] * row + cell[2] * plane];
+
+    float f[3] = { 0, 0, 0 };
+    for (int c = 0; c < 8; c++)
+    {
+        int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+        const ForceFieldNode& node = base[cx + cy * row + cz * plane];
+        float w = (cx ? w1[0] : w0[0]) * (cy ? w1[1] : w0[1]) * (cz ? w1[2] : w0[2]);
+        float dx = cx ? d1[0] : d0[0];
+        float dy = cy ? d1[1] : d0[1];
+        float dz = cz ? d1[2] : d0[2];
+        const float* g = node.gradient;
+        f[0] += w * sameSide(node.force[0] + g[0] * dx + g[1] * dy + g[2] * dz, node.force[0]);
+        f[1] += w * sameSide(node.force[1] + g[3] * dx + g[4] * dy + g[5] * dz, node.force[1]);
+        f[2] += w * sameSide(node.force[2] + g[6] * dx + g[7] * dy + g[8] * dz, node.force[2]);
+    }
+    force[0] = f[0];
+    force[1] = f[1];
+    force[2] = f[2];
+}
+
+void ForceField::corners(const double position[3], const ForceFieldNode* nodes[8]) const
+{
+    int cell[3];
+    double offset[3];
+    locate(position, cell, offset);
+
+    size_t rowStride = m_count[0];
+    size_t planeStride = rowStride * m_count[1];
+    const ForceFieldNode* base = &m_nodes[cell[0] + cell[1] * rowStride + cell[2] * planeStride];
+    for (int corner = 0; corner < 8; corner++)
+        nodes[corner] = &base[(corner & 1) + ((corner >> 1) & 1) * rowStride + (corner >> 2) * planeStride];
+}
+
+void arenaWallsPenetration(const double position[3], double force[3], void* context)
+{
+    const ArenaWalls& walls = *(const ArenaWalls*)context;
+    double top = position[1] + walls.halfEdge;
+    double bottom = position[1] - walls.halfEdge;
+
+    force[0] = 0;
+    force[1] = 0;
+    force[2] = 0;
+    if (top > walls.north)
+        force[1] = top - walls.north;
+    if (bottom < walls.south)
+        force[1] = bottom - walls.south;
+}
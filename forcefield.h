@@ -0,0 +1,75 @@
+// Make sure this header is included only once
+#ifndef FORCEFIELD_H
+#define FORCEFIELD_H
+
+#include <stddef.h>
+#include <vector>
+
+// Arena boundary forces, baked into a regular 3D grid so the servo loop
+// pays the same few dozen multiplies for any arena, however many walls
+// it has.  Each node stores the force at that point and its gradient.  A
+// lookup blends the eight nodes around the position, each extrapolated
+// to the position along its gradient, so a field that is linear within
+// a cell (a flat wall, away from its edge) comes back exactly; only the
+// cells a boundary passes through are approximated.  No node's share
+// crosses zero, so where the force is zero it samples as exactly zero.
+//
+// Nodes are stored x fastest, 48 bytes each, so the eight corners of a
+// cell are four pairs of neighbours: four or five cache lines a lookup.
+
+struct ForceFieldNode {
+    float force[3];
+    float gradient[9];      // d force[i] / d position[j], at [i * 3 + j]
+};
+
+// The force at a point, for building a field
+typedef void (*ForceFunction)(const double position[3], double force[3], void* context);
+
+class ForceField
+{
+public:
+    ForceField();
+
+    // Evaluate fn on an nx by ny by nz lattice of nodes spanning bounds
+    // (min x, y, z, max x, y, z).  Gradients are taken by central
+    // differences.  False, with the field as it was, if an axis has
+    // fewer than two nodes or no length.
+    bool build(const double bounds[6], int nx, int ny, int nz, ForceFunction fn, void* context);
+
+    // Force at a position.  Outside the grid the nearest face is
+    // extrapolated along its gradients, so walls keep pushing back.
+    void sample(const double position[3], double force[3]) const;
+
+    bool empty() const { return m_nodes.empty(); }
+    size_t bytes() const { return m_nodes.size() * sizeof(ForceFieldNode); }
+
+    // The nodes a sample() at position reads
+    void corners(const double position[3], const ForceFieldNode* nodes[8]) const;
+
+private:
+    // Cell holding a position, and where in it the position is
+    void locate(const double position[3], int cell[3], double offset[3]) const;
+
+    std::vector<ForceFieldNode> m_nodes;
+    int    m_count[3];      // nodes along each axis
+    double m_origin[3];     // position of node 0
+    double m_spacing[3];    // distance between nodes
+    double m_inverse[3];    // 1 / m_spacing
+};
+
+// The arena the game has always had: a wall along the top and one along
+// the bottom, felt by a paddle of the given height.  The force is the
+// paddle's penetration into the walls; the servo scales it by the wall
+// gain, so retuning the gain needs no rebuild.
+struct ArenaWalls {
+    double north;
+    double south;
+    double halfEdge;
+};
+
+void arenaWallsPenetration(const double position[3], double force[3], void* context);
+
+// Nodes along each axis of the servo's arena field
+const int FORCEFIELD_RESOLUTION = 32;
+
+#endif // FORCEFIELD_H
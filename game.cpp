@@ -0,0 +1,328 @@
+#include "game.h"
+#include "arena.h"
+#include <math.h>
+#include <string.h>
+
+// Most hops an arena step is split into; past this speed the puck can
+// tunnel again
+static const int ARENA_MAX_HOPS = 64;
+
+void gameDefaultConfig(GameConfig& config)
+{
+    config.north = 1.0;
+    config.south = -1.0;
+    config.east = 1.5;
+    config.west = -1.5;
+    config.edgeLength = 0.5;
+    config.serveSpeed = 0.7;
+    config.speedUp = 1.1;
+    config.rebounds = 100;
+    config.practice = true;
+    config.arena = NULL;
+}
+
+void gameInit(GameState& state, const GameConfig& config)
+{
+    // Clear padding as well, so states can be compared byte for byte
+    memset(&state, 0, sizeof(state));
+    state.velX = config.serveSpeed;
+    state.velY = config.serveSpeed;
+    state.spin = 1;
+}
+
+// Reset the puck after a goal.  The player who was scored on serves.
+static void score(GameState& state, const GameConfig& config, int player)
+{
+    state.velX = (player == 1 ? config.serveSpeed : -config.serveSpeed);
+    state.velY = (state.velY > 0 ? config.serveSpeed : -config.serveSpeed);
+
+    if( player == 1 ){
+        state.freeze = 2;
+        state.puckX = config.west + config.edgeLength;
+    }else{
+        state.freeze = 1;
+        state.puckX = config.east - config.edgeLength;
+    }
+}
+
+// Send the puck back the way it came off a paddle, a little faster
+static void paddleBounce(GameState& state, const GameConfig& config, double dt)
+{
+    state.puckX -= state.velX * 2 * dt;
+    state.velX = -state.velX;
+    state.velX *= config.speedUp;
+    state.velY *= config.speedUp;
+}
+
+// The plain playfield: a wall along the top and one along the bottom
+static unsigned int wallBounce(GameState& state, const GameConfig& config, double halfEdge, double dt)
+{
+    unsigned int events = GAME_EV_NONE;
+    double top = state.puckY + halfEdge;
+    double bottom = state.puckY - halfEdge;
+
+    if( top > config.north ){
+        state.puckY -= state.velY * 2 * dt;
+        if( state.puckY + halfEdge > config.north ){
+            state.puckY = config.north - halfEdge;
+        }
+        state.velY = -state.velY;
+        events |= GAME_EV_WALL;
+    }
+    if( bottom < config.south ){
+        state.puckY -= state.velY * 2 * dt;
+        if( state.puckY - halfEdge < config.south ){
+            state.puckY = config.south + halfEdge;
+        }
+        state.velY = -state.velY;
+        events |= GAME_EV_WALL;
+    }
+    return events;
+}
+
+// Bounce off whatever the puck touches, the way wallBounce() does off a
+// flat wall: step back out along the normal, reflect the speed into the
+// surface, and if it still overlaps, move it out to touching
+static unsigned int arenaBounce(GameState& state, const Arena& arena, double halfEdge, double dt)
+{
+    ArenaContact contact;
+    if( !arena.contact(state.puckX, state.puckY, halfEdge, contact) ){
+        return GAME_EV_NONE;
+    }
+
+    unsigned int events = GAME_EV_NONE;
+    double into = state.velX * contact.nx + state.velY * contact.ny;
+    if( into < 0 ){
+        double bounce = arena.segment(contact.segment).bounce;
+        state.puckX -= contact.nx * into * 2 * dt;
+        state.puckY -= contact.ny * into * 2 * dt;
+        state.velX -= (1 + bounce) * into * contact.nx;
+        state.velY -= (1 + bounce) * into * contact.ny;
+        events |= GAME_EV_WALL;
+    }
+
+    if( arena.contact(state.puckX, state.puckY, halfEdge, contact) ){
+        state.puckX += contact.nx * contact.depth;
+        state.puckY += contact.ny * contact.depth;
+    }
+    return events;
+}
+
+// Arena walls are thin, so a fast puck moves in short hops, checking for
+// contact after each, rather than jumping over one in a single step
+static unsigned int arenaMove(GameState& state, const Arena& arena, double halfEdge, double dt)
+{
+    double travel = fabs(state.velX * dt) + fabs(state.velY * dt);
+    int hops = 1 + (int)(travel / (halfEdge / 2));
+    if( hops > ARENA_MAX_HOPS ){
+        hops = ARENA_MAX_HOPS;
+    }
+
+    unsigned int events = GAME_EV_NONE;
+    double hop = dt / hops;
+    for( int i = 0; i < hops; i++ ){
+        state.puckX += state.velX * hop;
+        state.puckY += state.velY * hop;
+        events |= arenaBounce(state, arena, halfEdge, hop);
+    }
+    return events;
+}
+
+// The step's mode, as policies: the scoring rules, and the playfield.
+// Each combination is compiled as a step of its own, so a loop that
+// knows its mode at startup tests none of it per step.
+
+// Practice: the left paddle is a back wall shadowing the puck, and the
+// session ends after config.rebounds returns or misses
+struct PracticeRules {
+    static void readPaddles(GameState& state, const PlayerInput input[PLAYER_COUNT])
+    {
+        state.paddleY[PLAYER_1] = gameInputY(input[PLAYER_1]);
+    }
+    static bool leftReturns(double, double, double, double) { return true; }
+    static bool sessionEnds(const GameState& state, const GameConfig& config)
+    {
+        return state.hits + state.misses >= config.rebounds;
+    }
+    static void afterStep(GameState& state) { state.paddleY[PLAYER_2] = state.puckY; }
+};
+
+// A match: both paddles are played, and play goes on
+struct MatchRules {
+    static void readPaddles(GameState& state, const PlayerInput input[PLAYER_COUNT])
+    {
+        state.paddleY[PLAYER_1] = gameInputY(input[PLAYER_1]);
+        state.paddleY[PLAYER_2] = gameInputY(input[PLAYER_2]);
+    }
+    static bool leftReturns(double top, double bottom, double paddle, double halfEdge)
+    {
+        return top > paddle - halfEdge && bottom < paddle + halfEdge;
+    }
+    static bool sessionEnds(const GameState&, const GameConfig&) { return false; }
+    static void afterStep(GameState&) {}
+};
+
+// The plain playfield: the puck moves in one go between flat walls
+struct PlainField {
+    static unsigned int move(GameState& state, const GameConfig&, double dt)
+    {
+        state.puckX += state.velX * dt;
+        state.puckY += state.velY * dt;
+        return GAME_EV_NONE;
+    }
+    static unsigned int walls(GameState& state, const GameConfig& config, double halfEdge, double dt)
+    {
+        return wallBounce(state, config, halfEdge, dt);
+    }
+};
+
+// An arena: the puck hops between its walls, which it has bounced off
+// by the time the bounds are checked
+struct ArenaField {
+    static unsigned int move(GameState& state, const GameConfig& config, double dt)
+    {
+        return arenaMove(state, *config.arena, config.edgeLength / 2.0, dt);
+    }
+    static unsigned int walls(GameState&, const GameConfig&, double, double) { return GAME_EV_NONE; }
+};
+
+template <class Rules, class Field>
+static unsigned int boundCheck(GameState& state, const GameConfig& config, double dt)
+{
+    unsigned int events = GAME_EV_NONE;
+    double halfEdge = config.edgeLength / 2.0;
+
+    double top = state.puckY + halfEdge;
+    double bottom = state.puckY - halfEdge;
+    double left = state.puckX - halfEdge;
+    double right = state.puckX + halfEdge;
+
+    events |= Field::walls(state, config, halfEdge, dt);
+
+    if( right >= config.east ){
+        double paddle = state.paddleY[PLAYER_1];
+        state.spin = -state.spin;
+        if( top > paddle - halfEdge && bottom < paddle + halfEdge ){
+            paddleBounce(state, config, dt);
+            events |= GAME_EV_RIGHT_HIT;
+            state.hits++;
+        }else{
+            state.score[PLAYER_2]++;
+            score(state, config, 2);
+            events |= GAME_EV_SCORE_P2;
+            state.misses++;
+        }
+
+        if( Rules::sessionEnds(state, config) ){
+            events |= GAME_EV_SESSION_END;
+        }
+    }
+
+    if( left <= config.west ){
+        double paddle = state.paddleY[PLAYER_2];
+        state.spin = -state.spin;
+        if( Rules::leftReturns(top, bottom, paddle, halfEdge) ){
+            paddleBounce(state, config, dt);
+            events |= GAME_EV_LEFT_HIT;
+        }else{
+            state.score[PLAYER_1]++;
+            score(state, config, 1);
+            events |= GAME_EV_SCORE_P1;
+        }
+    }
+
+    return events;
+}
+
+template <class Rules, class Field>
+static unsigned int step(GameState& state, const GameConfig& config,
+                         const PlayerInput input[PLAYER_COUNT])
+{
+    unsigned int events = GAME_EV_NONE;
+    const double dt = GAME_STEP_MS / 1000.0;
+
+    Rules::readPaddles(state, input);
+
+    if( state.freeze == 1 ){
+        if( input[PLAYER_1].button ){
+            state.freeze = 0;
+            events |= GAME_EV_FIRE;
+        }else{
+            state.puckY = state.paddleY[PLAYER_1];
+        }
+    }else if( state.freeze == 2 ){
+        if( input[PLAYER_2].button ){
+            state.freeze = 0;
+            events |= GAME_EV_SERVE_P2;
+        }else{
+            state.puckY = state.paddleY[PLAYER_2];
+        }
+    }else{
+        events |= Field::move(state, config, dt);
+        events |= boundCheck<Rules, Field>(state, config, dt);
+    }
+
+    Rules::afterStep(state);
+
+    state.step++;
+    return events;
+}
+
+GameStepFn gameStepFor(const GameConfig& config)
+{
+    if( config.practice ){
+        return config.arena != NULL ? &step<PracticeRules, ArenaField> : &step<PracticeRules, PlainField>;
+    }
+    return config.arena != NULL ? &step<MatchRules, ArenaField> : &step<MatchRules, PlainField>;
+}
+
+unsigned int gameStep(GameState& state, const GameConfig& config,
+                      const PlayerInput input[PLAYER_COUNT])
+{
+    return gameStepFor(config)(state, config, input);
+}
+
+// FNV-1a, one field at a time so padding never takes part
+static void hashBytes(uint32_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+}
+
+uint32_t gameChecksum(const GameState& state)
+{
+    uint32_t hash = 2166136261u;
+    hashBytes(hash, &state.step, sizeof(state.step));
+    hashBytes(hash, &state.puckX, sizeof(state.puckX));
+    hashBytes(hash, &state.puckY, sizeof(state.puckY));
+    hashBytes(hash, &state.velX, sizeof(state.velX));
+    hashBytes(hash, &state.velY, sizeof(state.velY));
+    hashBytes(hash, state.paddleY, sizeof(state.paddleY));
+    hashBytes(hash, state.score, sizeof(state.score));
+    hashBytes(hash, &state.hits, sizeof(state.hits));
+    hashBytes(hash, &state.misses, sizeof(state.misses));
+    hashBytes(hash, &state.freeze, sizeof(state.freeze));
+    hashBytes(hash, &state.spin, sizeof(state.spin));
+    return hash;
+}
+
+PlayerInput gameMakeInput(double paddleY, bool button)
+{
+    double scaled = paddleY * GAME_INPUT_SCALE;
+    if (scaled > 32767) scaled = 32767;
+    if (scaled < -32768) scaled = -32768;
+
+    PlayerInput input;
+    input.paddleY = (int16_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    input.button = button ? 1 : 0;
+    return input;
+}
+
+double gameInputY(const PlayerInput& input)
+{
+    return input.paddleY / GAME_INPUT_SCALE;
+}
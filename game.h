@@ -0,0 +1,97 @@
+// Make sure this header is included only once
+#ifndef GAME_H
+#define GAME_H
+
+#include "platform.h"
+
+class Arena;
+
+// The game simulation: puck, paddles and scoring, advanced in fixed steps.
+// Given the same configuration, starting state and inputs, gameStep()
+// produces bit-identical results on every machine.  That is what lets two
+// stations roll back and resimulate each other's inputs, and what lets a
+// recorded session be replayed.  Keep it that way: no clocks, no random
+// numbers and no transcendental functions in here.
+
+// Length of one simulation step
+const int GAME_STEP_MS = 5;
+const uint64_t GAME_STEP_US = GAME_STEP_MS * 1000;
+
+// Paddle positions travel as fixed point so both ends see the same value
+const double GAME_INPUT_SCALE = 8192.0;
+
+// Players.  Player 1 is the right paddle, normally the haptic device.
+enum GamePlayer {
+    PLAYER_1 = 0,
+    PLAYER_2 = 1,
+    PLAYER_COUNT
+    };
+
+// Things that happened during a step, returned as a bit mask
+enum GameEvent {
+    GAME_EV_NONE        = 0,
+    GAME_EV_RIGHT_HIT   = 1 << 0,   // puck came off player 1's paddle
+    GAME_EV_LEFT_HIT    = 1 << 1,   // puck came off player 2's paddle (or the back wall)
+    GAME_EV_WALL        = 1 << 2,   // puck bounced off a wall or bumper
+    GAME_EV_SCORE_P1    = 1 << 3,   // player 1 scored
+    GAME_EV_SCORE_P2    = 1 << 4,   // player 2 scored
+    GAME_EV_FIRE        = 1 << 5,   // player 1 released the puck
+    GAME_EV_SERVE_P2    = 1 << 6,   // player 2 released the puck
+    GAME_EV_SESSION_END = 1 << 7    // the practice session reached its rebound count
+    };
+
+// Input from one player for one step
+struct PlayerInput {
+    int16_t paddleY;    // paddle centre, in 1/GAME_INPUT_SCALE units
+    uint8_t button;     // nonzero while the button is held
+};
+
+// Rules and playfield.  Both ends of a networked game must agree on these.
+struct GameConfig {
+    double north, south, east, west;    // playfield edges
+    double edgeLength;                  // paddle height and puck diameter
+    double serveSpeed;                  // puck speed along each axis after a score
+    double speedUp;                     // speed multiplier on every paddle hit
+    int    rebounds;                    // practice session length
+    bool   practice;                    // player 2 is a back wall; count hits/misses
+    const Arena* arena;                 // walls and bumpers; NULL for plain north and south walls
+};
+
+// Everything that changes during play
+struct GameState {
+    uint32_t step;
+    double puckX, puckY;
+    double velX, velY;
+    double paddleY[PLAYER_COUNT];
+    int    score[PLAYER_COUNT];
+    int    hits, misses;
+    int    freeze;      // 0 = in play, 1 = held by player 1, 2 = held by player 2
+    int    spin;
+};
+
+// Fill in the standard rules
+void gameDefaultConfig(GameConfig& config);
+
+// Start a new game
+void gameInit(GameState& state, const GameConfig& config);
+
+// Advance the game one step.  Returns a mask of GameEvent bits.
+unsigned int gameStep(GameState& state, const GameConfig& config,
+                      const PlayerInput input[PLAYER_COUNT]);
+
+// gameStep() compiled for one mode: config's rules (practice or match)
+// and playfield (plain or arena).  A loop whose mode is fixed picks its
+// step once, and the step tests neither.  Pick it again when
+// config.practice or config.arena change; the rest may change freely.
+typedef unsigned int (*GameStepFn)(GameState& state, const GameConfig& config,
+                                   const PlayerInput input[PLAYER_COUNT]);
+GameStepFn gameStepFor(const GameConfig& config);
+
+// Hash of the state, for checking that two simulations agree
+uint32_t gameChecksum(const GameState& state);
+
+// Convert a paddle position to and from its input representation
+PlayerInput gameMakeInput(double paddleY, bool button);
+double gameInputY(const PlayerInput& input);
+
+#endif // GAME_H
@@ -1,6 +1,14 @@
 #include "haptics.h"
+#include "trace.h"
+#include "alloc.h"
+#include "log.h"
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sstream>
 
 // Continuous servo callback function
@@ -8,6 +16,20 @@ HDLServoOpExitCode ContactCB(void* pUserData)
 {
     // Get pointer to haptics object
     HapticsClass* haptics = static_cast< HapticsClass* >( pUserData );
+    TRACE_THREAD("servo");
+    LOG_THREAD("servo");
+    TRACE_SCOPE_EVERY("servo.tick", 64);
+
+    // A new scheduling policy is applied from the thread itself
+    if (atomicLoad(&haptics->m_servoPolicyPending) != 0)
+    {
+        haptics->m_servoPolicyReport = rtApplyThread(haptics->m_servoPolicy);
+        atomicStore(&haptics->m_servoPolicyPending, 0);
+        atomicStore(&haptics->m_servoPolicyDone, 1);
+    }
+
+    // From here on the tick must not touch the heap
+    AllocGuard guard("servo.tick");
 
     // Get current state of haptic device
     hdlToolPosition(haptics->m_positionServo);
@@ -41,14 +63,34 @@ HDLServoOpExitCode GetStateCB(void* pUserData)
 
 // Constructor--just make sure needed variables are initialized.
 HapticsClass::HapticsClass( double& xposb, double& yposb)
-    : m_lastFace(FACE_NONE),
+    : m_inited(false),
+      m_initThreadRunning(false),
+      m_status(HAPTICS_OFF),
+      m_lastFace(FACE_NONE),
       m_deviceHandle(HDL_INVALID_HANDLE),
       m_servoOp(HDL_INVALID_HANDLE),
       m_cubeEdgeLength(1),
       m_cubeStiffness(1),
-      m_inited(false),
+      m_paramBlock(NULL),
+      m_paramSequence(1),
+      m_arenaIndex(0),
+      m_arenaInUse(0),
+      m_arenaEdgeLength(0),
+      m_arenaGeometry(NULL),
+      m_arenaEast(0),
+      m_arenaMirror(false),
+      m_bakeRunning(false),
+      m_bakeDone(0),
+      m_bakeBuilt(false),
+      m_bakeInto(0),
+      m_bakeEdgeLength(0),
+      m_bakeAvoidCpu(-1),
+      m_servoPolicyPending(0),
+      m_servoPolicyDone(0),
 	  m_xpos(xposb),
 	  m_ypos(yposb),
+	  m_localPlayer(PLAYER_1),
+	  m_listening(0),
 	  dobump(0),
 	  dojitter(0),
 	  doPullDown(0),
@@ -56,7 +98,13 @@ HapticsClass::HapticsClass( double& xposb, double& yposb)
 	  doFire(0)
 {
     for (int i = 0; i < 3; i++)
+    {
         m_positionServo[i] = 0;
+        m_positionApp[i] = 0;
+    }
+    m_buttonServo = false;
+    m_buttonApp = false;
+    paramsDefault(m_params);
 }
 
 // Destructor--make sure devices are uninited.
@@ -67,47 +115,121 @@ HapticsClass::~HapticsClass()
 
 
 
-void HapticsClass::init(double a_cubeSize, double a_stiffness, double paddleWidth )
+void HapticsClass::init(const ParamBlock* params)
+{
+    m_paramBlock = params;
+    atomicStore(&m_status, HAPTICS_STARTING);
+    bool ready = bringUp();
+    atomicStore(&m_status, ready ? HAPTICS_READY : HAPTICS_FAILED);
+    if (!ready)
+    {
+        MessageBox(NULL, m_initReport.c_str(), "Device Failure", MB_OK);
+        exit(0);
+    }
+}
+
+void HapticsClass::startInit(const ParamBlock* params)
+{
+    m_paramBlock = params;
+    atomicStore(&m_status, HAPTICS_STARTING);
+    m_initThreadRunning = platformStartThread(m_initThread, initThread, this);
+    if (!m_initThreadRunning)
+    {
+        m_initReport = "device: cannot start the bring-up thread\n";
+        atomicStore(&m_status, HAPTICS_FAILED);
+    }
+}
+
+void HapticsClass::initThread(void* arg)
+{
+    HapticsClass* haptics = static_cast< HapticsClass* >( arg );
+    TRACE_THREAD("device init");
+    bool ready = haptics->bringUp();
+    atomicStore(&haptics->m_status, ready ? HAPTICS_READY : HAPTICS_FAILED);
+}
+
+bool HapticsClass::waitReady(int timeoutMs)
+{
+    uint64_t deadline = platformMicros() + (uint64_t)timeoutMs * 1000;
+    while (status() == HAPTICS_STARTING && platformMicros() < deadline)
+        platformSleepMs(1);
+    return status() == HAPTICS_READY;
+}
+
+std::string HapticsClass::initReport()
 {
-	m_paddleWidth = paddleWidth;
-    m_cubeEdgeLength = a_cubeSize;
-    m_cubeStiffness = a_stiffness;
+    if (status() == HAPTICS_STARTING)
+        return "";
+    return m_initReport;
+}
+
+void HapticsClass::initPhase(const char* name, uint64_t& markUs)
+{
+    uint64_t now = platformMicros();
+    char line[96];
+    sprintf(line, "device: %-10s %7.1f ms\n", name, (now - markUs) / 1000.0);
+    m_initReport += line;
+    markUs = now;
+}
+
+bool HapticsClass::bringUp()
+{
+    TRACE_SCOPE("device.bringUp");
+    uint64_t mark = platformMicros();
+    m_initReport.clear();
+
+    // The defaults if a writer holds the block; the servo picks up the
+    // rest when it lets go
+    uint32_t version;
+    paramsRead(m_paramBlock, m_params, version);
+	m_paddleWidth = m_params.cubeEdgeLength / 2;
+    m_cubeEdgeLength = m_params.cubeEdgeLength;
+    m_cubeStiffness = m_params.stiffness;
 	//m_xpos = xposb;
 	//m_ypos = yposb;
 
 
-    HDLError err = HDL_NO_ERROR;
+    if (!buildArena(m_params.cubeEdgeLength, m_params.workspace))
+        m_initReport += "device: the workspace has no room for the arena walls\n";
+    initPhase("field", mark);
 
     // Passing "DEFAULT" or 0 initializes the default device based on the
     // [DEFAULT] section of HDAL.INI.   The names of other sections of HDAL.INI
     // could be passed instead, allowing run-time control of different devices
     // or the same device with different parameters.  See HDAL.INI for details.
     m_deviceHandle = hdlInitNamedDevice("DEFAULT");
-    testHDLError("hdlInitDevice");
+    if (!testHDLError("hdlInitDevice"))
+        return false;
 
     if (m_deviceHandle == HDL_INVALID_HANDLE)
     {
-        MessageBox(NULL, "Could not open device", "Device Failure", MB_OK);
-        exit(0);
+        m_initReport += "device: could not open device\n";
+        return false;
     }
+    initPhase("open", mark);
 
     // Now that the device is fully initialized, start the servo thread.
     // Failing to do this will result in a non-funtional haptics application.
     hdlStart();
-    testHDLError("hdlStart");
+    if (!testHDLError("hdlStart"))
+        return false;
 
     // Set up callback function
     m_servoOp = hdlCreateServoOp(ContactCB, this, bNonBlocking);
     if (m_servoOp == HDL_INVALID_HANDLE)
     {
-        MessageBox(NULL, "Invalid servo op handle", "Device Failure", MB_OK);
+        m_initReport += "device: invalid servo op handle\n";
+        return false;
     }
-    testHDLError("hdlCreateServoOp");
+    if (!testHDLError("hdlCreateServoOp"))
+        return false;
+    initPhase("start", mark);
 
     // Make the device current.  All subsequent calls will
     // be directed towards the current device.
     hdlMakeCurrent(m_deviceHandle);
-    testHDLError("hdlMakeCurrent");
+    if (!testHDLError("hdlMakeCurrent"))
+        return false;
 
     // Get the extents of the device workspace.
     // Used to create the mapping between device and application coordinates.
@@ -119,7 +241,8 @@ void HapticsClass::init(double a_cubeSize, double a_stiffness, double paddleWidt
     //   near-far is the z-axis, near is greater than far
     // workspace center is (0,0,0)
     hdlDeviceWorkspace(m_workspaceDims);
-    testHDLError("hdlDeviceWorkspace");
+    if (!testHDLError("hdlDeviceWorkspace"))
+        return false;
 
 
     // Establish the transformation from device space to app space
@@ -129,16 +252,33 @@ void HapticsClass::init(double a_cubeSize, double a_stiffness, double paddleWidt
     // origin.  Note the Z axis values; this has the effect of
     // moving the origin of world coordinates toward the base of the
     // unit.
-    double gameWorkspace[] = {-2,-2,-2,2,2,3};
     bool useUniformScale = true;
     hdluGenerateHapticToAppWorkspaceTransform(m_workspaceDims,
-                                              gameWorkspace,
+                                              m_params.workspace,
                                               useUniformScale,
                                               m_transformMat);
-    testHDLError("hdluGenerateHapticToAppWorkspaceTransform");
-
+    if (!testHDLError("hdluGenerateHapticToAppWorkspaceTransform"))
+        return false;
+    initPhase("workspace", mark);
+
+    // The device needs a moment to initialize and stabilize.  Rather than
+    // sleep for a fixed time, watch its state until it says it is running.
+    uint64_t deadline = platformMicros() + HAPTICS_SETTLE_MS * 1000;
+    unsigned int state;
+    while (((state = hdlGetState()) & (HDAL_UNINITIALIZED | HDAL_SERVO_NOT_STARTED)) != 0
+           && platformMicros() < deadline)
+        platformSleepMs(1);
+    if ((state & (HDAL_UNINITIALIZED | HDAL_SERVO_NOT_STARTED)) != 0)
+    {
+        char line[96];
+        sprintf(line, "device: still in state 0x%x after %d ms\n", state, HAPTICS_SETTLE_MS);
+        m_initReport += line;
+    }
+    initPhase("settle", mark);
 
+    atomicFence();
     m_inited = true;
+    return true;
 }
 
 // uninit() undoes the setup in reverse order.  Note the setting of
@@ -146,6 +286,17 @@ void HapticsClass::init(double a_cubeSize, double a_stiffness, double paddleWidt
 // more than once.
 void HapticsClass::uninit()
 {
+    // The bring-up gives up by itself, so this does not wait long
+    if (m_initThreadRunning)
+    {
+        platformJoinThread(m_initThread);
+        m_initThreadRunning = false;
+    }
+    if (m_bakeRunning)
+    {
+        platformJoinThread(m_bakeThread);
+        m_bakeRunning = false;
+    }
     if (m_servoOp != HDL_INVALID_HANDLE)
     {
         hdlDestroyServoOp(m_servoOp);
@@ -158,18 +309,23 @@ void HapticsClass::uninit()
         m_deviceHandle = HDL_INVALID_HANDLE;
     }
     m_inited = false;
+    atomicStore(&m_status, HAPTICS_OFF);
 }
 
-// This is a simple function for testing error returns.  A production
-// application would need to be more sophisticated than this.
-void HapticsClass::testHDLError(const char* str)
+// This is a simple function for testing error returns.  The bring-up
+// may be on its own thread, so errors go into its report for the game
+// to show rather than into a message box.
+bool HapticsClass::testHDLError(const char* str)
 {
     HDLError err = hdlGetError();
     if (err != HDL_NO_ERROR)
     {
-        MessageBox(NULL, str, "HDAL ERROR", MB_OK);
-        abort();
+        char line[128];
+        sprintf(line, "device: HDAL error 0x%x in %s\n", (unsigned)err, str);
+        m_initReport += line;
+        return false;
     }
+    return true;
 }
 
 // This is the entry point used by the application to synchronize
@@ -177,8 +333,9 @@ void HapticsClass::testHDLError(const char* str)
 // need for the application to worry about threads.
 void HapticsClass::synchFromServo()
 {
-	if ( !m_inited )
+	if ( status() != HAPTICS_READY )
 		return;
+	TRACE_SCOPE("synchFromServo");
     hdlCreateServoOp(GetStateCB, this, bBlocking);
 }
 
@@ -210,6 +367,128 @@ void HapticsClass::vecMultMatrix(double srcVec[3], double mat[16], double dstVec
         + mat[14];
 }
 
+// Called from the servo thread when the parameter block has changed.
+// The workspace transform is recomputed here too; it is plain arithmetic.
+void HapticsClass::applyParams()
+{
+	m_paddleWidth = m_params.cubeEdgeLength / 2;
+    m_cubeEdgeLength = m_params.cubeEdgeLength;
+    m_cubeStiffness = m_params.stiffness;
+
+    bool useUniformScale = true;
+    hdluGenerateHapticToAppWorkspaceTransform(m_workspaceDims,
+                                              m_params.workspace,
+                                              useUniformScale,
+                                              m_transformMat);
+}
+
+bool HapticsClass::bakeArena(double edgeLength, const double workspace[6], uint32_t into)
+{
+    // The field covers the game workspace; past it the walls are
+    // extrapolated
+    ArenaWalls walls;
+    walls.north = 1;
+    walls.south = -1;
+    walls.halfEdge = edgeLength / 2;
+
+    // A loaded arena is queried through its tree, once for each node and
+    // gradient sample
+    ArenaProbe probe;
+    probe.arena = m_arenaGeometry;
+    probe.x = m_arenaEast + edgeLength / 4;
+    probe.radius = edgeLength / 2;
+    probe.mirror = m_arenaMirror;
+
+    ForceFunction fn = arenaWallsPenetration;
+    void* context = &walls;
+    if (m_arenaGeometry != NULL)
+    {
+        fn = arenaPenetration;
+        context = &probe;
+    }
+
+    return m_arena[into].build(workspace, FORCEFIELD_RESOLUTION, FORCEFIELD_RESOLUTION,
+                               FORCEFIELD_RESOLUTION, fn, context);
+}
+
+void HapticsClass::bakeThread(void* arg)
+{
+    HapticsClass* haptics = static_cast< HapticsClass* >( arg );
+    rtAvoidCpu(haptics->m_bakeAvoidCpu);
+    haptics->m_bakeBuilt = haptics->bakeArena(haptics->m_bakeEdgeLength, haptics->m_bakeWorkspace,
+                                              haptics->m_bakeInto);
+    atomicStore(&haptics->m_bakeDone, 1);
+}
+
+bool HapticsClass::buildArena(double edgeLength, const double workspace[6])
+{
+    // Tried once for each edge length, so a bad one is not retried every
+    // step
+    m_arenaEdgeLength = edgeLength;
+    uint32_t next = 1 - atomicLoad(&m_arenaIndex);
+    if (!bakeArena(edgeLength, workspace, next))
+    {
+        LOG4("haptics: no arena field for workspace x %f to %f, y %f to %f; the walls stay as they were",
+             workspace[0], workspace[3], workspace[1], workspace[4]);
+        return false;
+    }
+    atomicStore(&m_arenaIndex, next);
+    return true;
+}
+
+void HapticsClass::setArena(const Arena* arena, double east, bool mirror)
+{
+    m_arenaGeometry = arena != NULL && !arena->empty() ? arena : NULL;
+    m_arenaEast = east;
+    m_arenaMirror = mirror;
+}
+
+void HapticsClass::updateArena(int avoidCpu)
+{
+    // A bake that has finished is handed to the servo; one still going
+    // is left to it
+    if (m_bakeRunning)
+    {
+        if (atomicLoad(&m_bakeDone) == 0)
+            return;
+        platformJoinThread(m_bakeThread);
+        m_bakeRunning = false;
+        if (m_bakeBuilt)
+            atomicStore(&m_arenaIndex, m_bakeInto);
+        else
+            LOG4("haptics: no arena field for workspace x %f to %f, y %f to %f; the walls stay as they were",
+                 m_bakeWorkspace[0], m_bakeWorkspace[3], m_bakeWorkspace[1], m_bakeWorkspace[4]);
+    }
+
+    GameParams params;
+    uint32_t version;
+    if (!paramsRead(m_paramBlock, params, version) || params.cubeEdgeLength == m_arenaEdgeLength)
+        return;
+
+    // The bring-up builds the first field itself
+    if (status() == HAPTICS_STARTING)
+        return;
+
+    // The servo must have moved on to the current field before the
+    // other one can be rebuilt
+    if (m_inited && atomicLoad(&m_arenaInUse) != atomicLoad(&m_arenaIndex))
+        return;
+
+    // Tried once for each edge length, as in buildArena
+    m_arenaEdgeLength = params.cubeEdgeLength;
+    m_bakeEdgeLength = params.cubeEdgeLength;
+    memcpy(m_bakeWorkspace, params.workspace, sizeof(m_bakeWorkspace));
+    m_bakeInto = 1 - atomicLoad(&m_arenaIndex);
+    m_bakeAvoidCpu = avoidCpu;
+    m_bakeDone = 0;
+    m_bakeRunning = platformStartThread(m_bakeThread, bakeThread, this);
+    if (!m_bakeRunning)
+    {
+        LOG0("haptics: cannot start the arena bake thread; baking on this one");
+        buildArena(params.cubeEdgeLength, params.workspace);
+    }
+}
+
 void HapticsClass::bump(){
 	dobump += 20;
 }
@@ -221,6 +500,24 @@ void HapticsClass::fire(){
 	doFire = 100;
 }
 
+void HapticsClass::listen(const EventBus& bus, int localPlayer){
+	atomicStore(&m_listening, 0);
+	m_localPlayer = localPlayer;
+	m_events.attach(bus);
+	atomicStore(&m_listening, 1);
+}
+
+void HapticsClass::effect(const BusEvent& event){
+	LOG2( "servo: effect for event %u of player %d", (unsigned int)event.type, (int)event.player );
+	if( event.type == BUS_HIT && event.player == m_localPlayer ){
+		bump();
+	}else if( event.type == BUS_SCORE && event.player != m_localPlayer ){
+		jitter();
+	}else if( event.type == BUS_SERVE && event.player == m_localPlayer ){
+		fire();
+	}
+}
+
 // Here is where the heavy calculations are done.  This function is
 // called from ContactCB to calculate the forces based on current
 // cursor position and cube dimensions.  A simple spring model is
@@ -230,27 +527,34 @@ void HapticsClass::cubeContact()
 	// Skip the whole thing if not initialized
     if (!m_inited) return;
 
+    // Pick up tuning changes.  Unless something changed this is
+    // a single load of the block's sequence number.
+    if (paramsRefresh(m_paramBlock, m_params, m_paramSequence))
+        applyParams();
+
+    // Effects for what happened in the game since the last tick
+    if (atomicLoad(&m_listening) != 0)
+    {
+        BusEvent event;
+        while (m_events.next(event))
+            effect(event);
+    }
 
     // Convert from device coordinates to application coordinates.
     vecMultMatrix(m_positionServo, m_transformMat, m_positionApp);
+    m_motion.push(platformMicros(), m_positionApp[Y]);
     m_forceServo[X] = 0; 
     m_forceServo[Y] = 0; 
     m_forceServo[Z] = 0;
 
-	// Haptics for top and bottom of playable area
-	double paddle_top = m_positionApp[Y] + m_cubeEdgeLength / 2;
-	double paddle_bottom = m_positionApp[Y] - m_cubeEdgeLength / 2;
-
-	if( paddle_top > 1 ){
-		m_forceServo[Y] = (paddle_top - 1) * -100;
-	}
-	if( paddle_bottom < -1 ){
-		m_forceServo[Y] = ( paddle_bottom + 1) * -100;
-	}
-
-	/*char letters[100];
-	sprintf( letters, "Force: %f      Y-Pos: %f\n", m_forceServo[Y], m_positionApp[Y]  );
-	OutputDebugString( letters );*/
+	// Haptics for the edges of the playable area, from the baked field
+	uint32_t arena = atomicLoad(&m_arenaIndex);
+	atomicStore(&m_arenaInUse, arena);
+	double penetration[3];
+	m_arena[arena].sample(m_positionApp, penetration);
+	m_forceServo[X] = penetration[X] * m_params.wallGain;
+	m_forceServo[Y] = penetration[Y] * m_params.wallGain;
+	m_forceServo[Z] = penetration[Z] * m_params.wallGain;
 
 	// Haptics for ball hitting paddle
 	if( dobump > 0 ){
@@ -283,8 +587,8 @@ void HapticsClass::cubeContact()
 
 	// 2.5 for Y and 1.5 for X is actually decent
 	
-	m_forceServo[Y] += (m_positionApp[Y] - m_ypos) * -2.5;
-	m_forceServo[X] += (m_positionApp[X] - m_xpos - m_paddleWidth * 1.5) * -1.5;
+	m_forceServo[Y] += (m_positionApp[Y] - m_ypos) * m_params.paddleGainY;
+	m_forceServo[X] += (m_positionApp[X] - m_xpos - m_paddleWidth * 1.5) * m_params.paddleGainX;
 	return;
 
 	if ( doPullDown > doPullUp ) {
@@ -305,17 +609,13 @@ void HapticsClass::cubeContact()
 		doPullUp--;
 	}
 
-	double d = m_xpos * m_xpos + m_ypos * m_ypos;
-
 	if ( m_ypos > m_positionApp[Y] && m_positionApp[Y] > prevY + 0.002 ) {
-		char letters[100];
-		sprintf( letters, "Stopping Pull Up %f\n", m_positionApp[Y]-prevY);
-		OutputDebugString( letters );
+		TRACE_INSTANT( "servo.stop_pull_up" );
+		LOG2( "Stopping Pull Up: paddle %.4f, hand %.4f", m_ypos, m_positionApp[Y] );
 		doPullUp = -10;
 	} else if ( m_ypos < m_positionApp[Y] && m_positionApp[Y] < prevY - 0.002 ) {
-		char letters[100];
-		sprintf( letters, "Stopping Pull Down %f\n", prevY-m_positionApp[Y]);
-		OutputDebugString( letters );
+		TRACE_INSTANT( "servo.stop_pull_down" );
+		LOG2( "Stopping Pull Down: paddle %.4f, hand %.4f", m_ypos, m_positionApp[Y] );
 		doPullDown = -10;
 	} else {		
 		if ( m_ypos > m_positionApp[Y] && doPullUp < 5 ) {
@@ -330,6 +630,22 @@ void HapticsClass::cubeContact()
 	prevY = m_positionApp[Y];
 }
 
+void HapticsClass::setServoPolicy(const RtPolicy& policy)
+{
+    if (atomicLoad(&m_servoPolicyPending) != 0)
+        return;
+    atomicStore(&m_servoPolicyDone, 0);
+    m_servoPolicy = policy;
+    atomicStore(&m_servoPolicyPending, 1);
+}
+
+std::string HapticsClass::servoPolicyReport()
+{
+    if (atomicLoad(&m_servoPolicyDone) == 0)
+        return "";
+    return m_servoPolicyReport;
+}
+
 // Interface function to get current position
 void HapticsClass::getPosition(double pos[3])
 {
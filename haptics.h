@@ -5,8 +5,19 @@
 #ifndef HAPTICS_H
 #define HAPTICS_H
 
+#ifdef HDL_SIMULATED
+#include "hdlsim.h"
+#else
 #include <hdl/hdl.h>
 #include <hdlu/hdlu.h>
+#endif
+#include "params.h"
+#include "realtime.h"
+#include "forcefield.h"
+#include "arena.h"
+#include "eventbus.h"
+#include "predict.h"
+#include <string>
 
 // Know which face is in contact
 enum RS_Face {
@@ -29,6 +40,17 @@ enum HapCoord {
 const bool bNonBlocking = false;
 const bool bBlocking = true;
 
+// How far the device bring-up has got
+enum HapticsStatus {
+    HAPTICS_OFF,
+    HAPTICS_STARTING,
+    HAPTICS_READY,
+    HAPTICS_FAILED
+};
+
+// Longest the bring-up waits for the device to report itself running
+const int HAPTICS_SETTLE_MS = 1000;
+
 class HapticsClass 
 {
 
@@ -36,6 +58,9 @@ class HapticsClass
 friend HDLServoOpExitCode ContactCB(void *data);
 friend HDLServoOpExitCode GetStateCB(void *data);
 
+// The benchmarks drive the servo side directly
+friend class HapticsProbe;
+
 public:
     // Constructor
     HapticsClass( double& xposb, double& yposb );
@@ -43,8 +68,27 @@ public:
     // Destructor
     ~HapticsClass();
 
-    // Initialize
-    void init(double a_cubeSize, double a_stiffness, double edgeLength );
+    // Initialize.  Tuning parameters are read from the block on every
+    // servo tick, so changes to it take effect immediately.  A device
+    // that cannot be brought up is reported in a message box, and the
+    // program exits.
+    void init(const ParamBlock* params);
+
+    // The same on a thread of its own, returning at once so the window,
+    // sounds and files can be set up meanwhile.  Until status() says
+    // HAPTICS_READY there is no device: the position stays at the origin
+    // and no forces are sent.
+    void startInit(const ParamBlock* params);
+
+    HapticsStatus status() const { return (HapticsStatus)atomicLoad(&m_status); }
+
+    // Wait up to timeoutMs for the bring-up to finish; true if the
+    // device is ready
+    bool waitReady(int timeoutMs);
+
+    // How long each step of the bring-up took, and why it failed if it
+    // did; complete once status() is no longer HAPTICS_STARTING
+    std::string initReport();
 
     // Clean up
     void uninit();
@@ -63,10 +107,38 @@ public:
     // Get ready state of device.
     bool isDeviceCalibrated();
 
+    // Have the servo thread take on a scheduling policy on its next tick.
+    // HDAL owns the thread, so this is the only way onto it.
+    void setServoPolicy(const RtPolicy& policy);
+
+    // What the servo thread achieved, once it has applied the policy;
+    // empty until then
+    std::string servoPolicyReport();
+
+    // Feel the walls of arena rather than the plain top and bottom ones.
+    // The paddle runs up and down a quarter edge outside the east goal
+    // line; mirror when the local player is player 2.  Call before init().
+    void setArena(const Arena* arena, double east, bool mirror);
+
+    // Rebuild the arena field if the paddle size has changed since it was
+    // built.  Called from the application thread every step: the field is
+    // baked on a helper thread kept off avoidCpu, and a later call hands
+    // it to the servo, which keeps the old field until then.
+    void updateArena(int avoidCpu = -1);
+
 	void bump();
 	void jitter();
 	void fire();
 
+    // Play the effects for what the game publishes on bus: a bump when
+    // localPlayer hits, a shake when scored on, a kick on serving.  The
+    // servo thread reads the bus at the start of every tick.
+    void listen(const EventBus& bus, int localPlayer);
+
+    // Every reading of the hand's height, stamped by the servo thread,
+    // for drawing the paddle where the hand is going
+    const MotionRing& motion() const { return m_motion; }
+
 private:
     // Move data between servo and app variables
     void synch();
@@ -74,15 +146,44 @@ private:
     // Calculate contact force with cube
     void cubeContact();
 
+    // Start the effect for a game event (servo thread)
+    void effect(const BusEvent& event);
+
+    // Take on a new set of tuning parameters (servo thread)
+    void applyParams();
+
+    // Bake the arena boundaries into field into, which the servo is not
+    // using.  False if the workspace has no room for one.
+    bool bakeArena(double edgeLength, const double workspace[6], uint32_t into);
+    static void bakeThread(void* arg);
+
+    // Bake into the field the servo is not using, and hand it to the
+    // servo.  False, with the servo's field left as it was, on failure.
+    bool buildArena(double edgeLength, const double workspace[6]);
+
     // Matrix multiply
     void vecMultMatrix(double srcVec[3], double mat[16], double dstVec[3]);
 
-    // Check error result; display message and abort, if any
-    void testHDLError(const char* str);
+    // Open the device and start the servo, timing each step into
+    // m_initReport.  False, with the reason there, if it cannot.
+    bool bringUp();
+    static void initThread(void* arg);
+
+    // Check error result; note it in the report, if any
+    bool testHDLError(const char* str);
+
+    // Mark the end of a bring-up step
+    void initPhase(const char* name, uint64_t& markUs);
 
     // Nothing happens until initialization is done
     bool m_inited;
 
+    // The bring-up: its thread, how far it has got, and its log
+    PlatformThread m_initThread;
+    bool m_initThreadRunning;
+    volatile uint32_t m_status;
+    std::string m_initReport;
+
     // Transformation from Device coordinates to Application coordinates
     double m_transformMat[16];
     
@@ -113,10 +214,50 @@ private:
     // Stiffness of cube
     double m_cubeStiffness;
 
+    // Tuning parameters, and the block they are refreshed from
+    const ParamBlock* m_paramBlock;
+    GameParams m_params;
+    uint32_t m_paramSequence;
+
+    // Arena boundary forces.  The application thread builds into the
+    // field the servo thread is not using, then switches it over.
+    ForceField m_arena[2];
+    volatile uint32_t m_arenaIndex;     // field to use, set by the app
+    volatile uint32_t m_arenaInUse;     // field in use, set by the servo
+    double m_arenaEdgeLength;
+    const Arena* m_arenaGeometry;       // NULL for the plain walls
+    double m_arenaEast;
+    bool m_arenaMirror;
+
+    // A field being baked on a helper thread, so that the step that
+    // notices a retune is not held up by it
+    PlatformThread m_bakeThread;
+    bool m_bakeRunning;
+    volatile uint32_t m_bakeDone;
+    bool m_bakeBuilt;
+    uint32_t m_bakeInto;
+    double m_bakeEdgeLength;
+    double m_bakeWorkspace[6];
+    int m_bakeAvoidCpu;
+
+    // Scheduling policy waiting for the servo thread, and its outcome
+    RtPolicy m_servoPolicy;
+    volatile uint32_t m_servoPolicyPending;
+    volatile uint32_t m_servoPolicyDone;
+    std::string m_servoPolicyReport;
+
 	double& m_xpos;
 	double& m_ypos;
 	double m_paddleWidth;
 
+	// Game events, once listen() has been called
+	EventReader m_events;
+	int m_localPlayer;
+	volatile uint32_t m_listening;
+
+	// The hand's height at every tick
+	MotionRing m_motion;
+
 	int dobump;
 	double prevY;
 	int dojitter;
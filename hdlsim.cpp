@@ -0,0 +1,277 @@
+#include "hdlsim.h"
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+
+// Room for the continuous ops of a few haptics objects
+static const int SIM_MAX_OPS = 8;
+
+struct SimServoOp {
+    HDLServoOp        fn;
+    void*             param;
+    volatile uint32_t active;
+};
+
+struct SimDevice {
+    double            position[3];
+    bool              button;
+    double            force[3];
+    bool              started;
+    SimServoOp        ops[SIM_MAX_OPS];
+
+    // A blocking op handed to the servo thread
+    HDLServoOp        blockingFn;
+    void*             blockingParam;
+    volatile uint32_t blockingPending;
+
+    // Servo thread
+    PlatformThread    thread;
+    volatile uint32_t threadRunning;
+    int               rateHz;
+    bool              hasPolicy;
+    RtPolicy          policy;
+};
+
+static SimDevice gSim;
+
+// Falcon workspace, in meters
+static const double gSimWorkspace[6] = { -0.06, -0.06, -0.06, 0.06, 0.06, 0.06 };
+
+HDLDeviceHandle hdlInitNamedDevice(const char*)
+{
+    return 0;
+}
+
+void hdlUninitDevice(HDLDeviceHandle)
+{
+}
+
+void hdlMakeCurrent(HDLDeviceHandle)
+{
+}
+
+void hdlStart()
+{
+    gSim.started = true;
+}
+
+void hdlStop()
+{
+    hdlSimStopServo();
+    gSim.started = false;
+}
+
+HDLOpHandle hdlCreateServoOp(HDLServoOp pServoOp, void* pParam, bool bBlocking)
+{
+    if (bBlocking)
+    {
+        if (atomicLoad(&gSim.threadRunning) == 0)
+        {
+            pServoOp(pParam);
+            return HDL_INVALID_HANDLE;
+        }
+
+        // Wait for the servo thread to run it on its next tick
+        gSim.blockingFn = pServoOp;
+        gSim.blockingParam = pParam;
+        atomicStore(&gSim.blockingPending, 1);
+        while (atomicLoad(&gSim.blockingPending) != 0)
+            platformYield();
+        return HDL_INVALID_HANDLE;
+    }
+
+    for (int i = 0; i < SIM_MAX_OPS; i++)
+    {
+        if (atomicLoad(&gSim.ops[i].active) == 0)
+        {
+            gSim.ops[i].fn = pServoOp;
+            gSim.ops[i].param = pParam;
+            atomicStore(&gSim.ops[i].active, 1);
+            return i;
+        }
+    }
+    return HDL_INVALID_HANDLE;
+}
+
+void hdlDestroyServoOp(HDLOpHandle hServoOp)
+{
+    if (hServoOp >= 0 && hServoOp < SIM_MAX_OPS)
+        atomicStore(&gSim.ops[hServoOp].active, 0);
+}
+
+HDLError hdlGetError()
+{
+    return HDL_NO_ERROR;
+}
+
+unsigned int hdlGetState()
+{
+    return gSim.started ? 0 : HDAL_SERVO_NOT_STARTED;
+}
+
+void hdlDeviceWorkspace(double workspaceDimensions[6])
+{
+    memcpy(workspaceDimensions, gSimWorkspace, sizeof(gSimWorkspace));
+}
+
+void hdlToolPosition(double position[3])
+{
+    position[0] = gSim.position[0];
+    position[1] = gSim.position[1];
+    position[2] = gSim.position[2];
+}
+
+void hdlToolButton(bool* pButton)
+{
+    *pButton = gSim.button;
+}
+
+void hdlSetToolForce(double force[3])
+{
+    gSim.force[0] = force[0];
+    gSim.force[1] = force[1];
+    gSim.force[2] = force[2];
+}
+
+// Scale the device box into the game box about their centers, with the
+// same scale on every axis if asked.  Column-major, like OpenGL.
+void hdluGenerateHapticToAppWorkspaceTransform(double hapticWorkspace[6],
+                                               double gameWorkspace[6],
+                                               bool useUniformScale,
+                                               double transformMat[16])
+{
+    double scale[3];
+    for (int i = 0; i < 3; i++)
+        scale[i] = (gameWorkspace[i + 3] - gameWorkspace[i]) / (hapticWorkspace[i + 3] - hapticWorkspace[i]);
+
+    if (useUniformScale)
+    {
+        double smallest = scale[0];
+        for (int i = 1; i < 3; i++)
+        {
+            if (scale[i] < smallest)
+                smallest = scale[i];
+        }
+        scale[0] = scale[1] = scale[2] = smallest;
+    }
+
+    memset(transformMat, 0, 16 * sizeof(double));
+    for (int i = 0; i < 3; i++)
+    {
+        double hapticCenter = (hapticWorkspace[i] + hapticWorkspace[i + 3]) / 2;
+        double gameCenter = (gameWorkspace[i] + gameWorkspace[i + 3]) / 2;
+        transformMat[i * 5] = scale[i];
+        transformMat[12 + i] = gameCenter - hapticCenter * scale[i];
+    }
+    transformMat[15] = 1;
+}
+
+void hdlSimSetPosition(const double position[3])
+{
+    gSim.position[0] = position[0];
+    gSim.position[1] = position[1];
+    gSim.position[2] = position[2];
+}
+
+void hdlSimSetButton(bool down)
+{
+    gSim.button = down;
+}
+
+void hdlSimGetForce(double force[3])
+{
+    force[0] = gSim.force[0];
+    force[1] = gSim.force[1];
+    force[2] = gSim.force[2];
+}
+
+void hdlSimTick()
+{
+    for (int i = 0; i < SIM_MAX_OPS; i++)
+    {
+        SimServoOp& op = gSim.ops[i];
+        if (atomicLoad(&op.active) != 0 && op.fn(op.param) == HDL_SERVOOP_EXIT)
+            atomicStore(&op.active, 0);
+    }
+
+    if (atomicLoad(&gSim.blockingPending) != 0)
+    {
+        gSim.blockingFn(gSim.blockingParam);
+        atomicStore(&gSim.blockingPending, 0);
+    }
+}
+
+static void servoThread(void*)
+{
+    if (gSim.hasPolicy)
+        rtApplyThread(gSim.policy);
+
+    uint64_t periodUs = gSim.rateHz > 0 ? 1000000 / gSim.rateHz : 0;
+    uint64_t next = platformMicros();
+    while (atomicLoad(&gSim.threadRunning) != 0)
+    {
+        hdlSimTick();
+
+        // Free running still yields once a tick, or a single processor
+        // would never get to the application
+        if (periodUs == 0)
+        {
+            platformYield();
+            continue;
+        }
+
+        // A tick that missed whole periods starts a new schedule
+        next += periodUs;
+        uint64_t now = platformMicros();
+        if (now > next)
+            next = now;
+        rtSleepUntil(next);
+    }
+}
+
+bool hdlSimStartServo(int rateHz, const RtPolicy* policy)
+{
+    if (atomicLoad(&gSim.threadRunning) != 0)
+        return true;
+
+    gSim.rateHz = rateHz;
+    gSim.hasPolicy = policy != NULL;
+    if (policy != NULL)
+        gSim.policy = *policy;
+    atomicStore(&gSim.threadRunning, 1);
+    if (!platformStartThread(gSim.thread, servoThread, NULL))
+    {
+        atomicStore(&gSim.threadRunning, 0);
+        return false;
+    }
+    return true;
+}
+
+void hdlSimStopServo()
+{
+    if (atomicLoad(&gSim.threadRunning) == 0)
+        return;
+
+    atomicStore(&gSim.threadRunning, 0);
+    platformJoinThread(gSim.thread);
+
+    // Nobody is left to run a blocking op that raced the shutdown
+    if (atomicLoad(&gSim.blockingPending) != 0)
+    {
+        gSim.blockingFn(gSim.blockingParam);
+        atomicStore(&gSim.blockingPending, 0);
+    }
+}
+
+#ifndef _WIN32
+int MessageBox(void*, const char* text, const char* caption, unsigned int)
+{
+    fprintf(stderr, "%s: %s\n", caption, text);
+    return 0;
+}
+
+void OutputDebugString(const char* text)
+{
+    fputs(text, stderr);
+}
+#endif
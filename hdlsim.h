@@ -0,0 +1,73 @@
+// Make sure this header is included only once
+#ifndef HDLSIM_H
+#define HDLSIM_H
+
+// A stand-in for the parts of HDAL the game uses, so the haptics code can
+// run without a Falcon: on a build machine, under a benchmark, on Linux.
+// Build with HDL_SIMULATED defined and haptics.h picks this up instead of
+// the real headers.
+//
+// The simulated device sits wherever hdlSimSetPosition() last put it and
+// remembers the last force it was given.  Servo ops run when the servo
+// is ticked, either by hand with hdlSimTick() or by a servo thread
+// started with hdlSimStartServo().  Without a servo thread, a blocking
+// servo op runs at once on the caller's thread.
+
+#include "realtime.h"
+
+typedef int HDLDeviceHandle;
+typedef int HDLOpHandle;
+typedef int HDLError;
+typedef int HDLServoOpExitCode;
+typedef HDLServoOpExitCode (*HDLServoOp)(void* pParam);
+
+#define HDL_INVALID_HANDLE      -1
+#define HDL_NO_ERROR            0
+#define HDL_SERVOOP_EXIT        0
+#define HDL_SERVOOP_CONTINUE    1
+
+#define HDAL_NOT_CALIBRATED     0x04
+#define HDAL_UNINITIALIZED      0x08
+#define HDAL_SERVO_NOT_STARTED  0x10
+
+HDLDeviceHandle hdlInitNamedDevice(const char* deviceName);
+void hdlUninitDevice(HDLDeviceHandle hHandle);
+void hdlMakeCurrent(HDLDeviceHandle hHandle);
+void hdlStart();
+void hdlStop();
+HDLOpHandle hdlCreateServoOp(HDLServoOp pServoOp, void* pParam, bool bBlocking);
+void hdlDestroyServoOp(HDLOpHandle hServoOp);
+HDLError hdlGetError();
+unsigned int hdlGetState();
+void hdlDeviceWorkspace(double workspaceDimensions[6]);
+void hdlToolPosition(double position[3]);
+void hdlToolButton(bool* pButton);
+void hdlSetToolForce(double force[3]);
+
+void hdluGenerateHapticToAppWorkspaceTransform(double hapticWorkspace[6],
+                                               double gameWorkspace[6],
+                                               bool useUniformScale,
+                                               double transformMat[16]);
+
+// Simulation controls
+void hdlSimSetPosition(const double position[3]);
+void hdlSimSetButton(bool down);
+void hdlSimGetForce(double force[3]);
+
+// Run every continuous servo op, and any blocking op waiting, once
+void hdlSimTick();
+
+// Tick from a thread of our own, rateHz times a second, or as fast as
+// possible if rateHz is 0.  Blocking servo ops then wait for the next tick
+// like they do on the device.  The thread takes on policy, if given.
+bool hdlSimStartServo(int rateHz, const RtPolicy* policy = NULL);
+void hdlSimStopServo();
+
+// Off Windows, the two user interface calls the haptics code makes
+#ifndef _WIN32
+#define MB_OK 0
+int MessageBox(void* window, const char* text, const char* caption, unsigned int type);
+void OutputDebugString(const char* text);
+#endif
+
+#endif // HDLSIM_H
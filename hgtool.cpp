@@ -0,0 +1,70 @@
+// Command line companion to the game: test harnesses and offline tools
+// that need neither the haptic device nor a window.
+#include <stdio.h>
+#include <string.h>
+
+int alloccheckMain(int argc, char* argv[]);
+int benchMain(int argc, char* argv[]);
+int capturelabMain(int argc, char* argv[]);
+int eventlabMain(int argc, char* argv[]);
+int inputlabMain(int argc, char* argv[]);
+int loglabMain(int argc, char* argv[]);
+int looplabMain(int argc, char* argv[]);
+int netlabMain(int argc, char* argv[]);
+int predictlabMain(int argc, char* argv[]);
+int replayMain(int argc, char* argv[]);
+int rtcheckMain(int argc, char* argv[]);
+int spectateMain(int argc, char* argv[]);
+int spectatelabMain(int argc, char* argv[]);
+int tuneMain(int argc, char* argv[]);
+
+struct Command {
+    const char* name;
+    int (*main)(int argc, char* argv[]);
+    const char* help;
+};
+
+static const Command gCommands[] = {
+    { "alloccheck", alloccheckMain, "a long match on the simulated device; fails if steady-state play allocates" },
+    { "bench",   benchMain,   "microbenchmarks of the servo, physics and frame paths on a simulated device" },
+    { "capturelab", capturelabMain, "the video capture queue and encoder, fed frames at a given rate" },
+    { "eventlab", eventlabMain, "game events through the bus to consumer threads on the game's schedules" },
+    { "inputlab", inputlabMain, "input events through the queue, picked up at fixed steps as the game does" },
+    { "loglab",   loglabMain,   "producer threads logging at the servo's rate and flat out, against the formatter" },
+    { "looplab",  looplabMain,  "the game loop single-threaded and with a simulation thread, under slow frames" },
+    { "netlab",  netlabMain,  "two stations over loopback with injected latency, jitter and loss" },
+    { "predictlab", predictlabMain, "the paddle predictor against a recorded hand, at several display latencies" },
+    { "replay",  replayMain,  "re-simulate a recorded session and regenerate its statistics" },
+    { "rtcheck", rtcheckMain, "servo wakeup jitter under load, with the real-time policy off and on" },
+    { "spectate", spectateMain, "follow the running game through its spectator feed, as CSV" },
+    { "spectatelab", spectatelabMain, "the spectator feed published to 1, 16 and 128 observers" },
+    { "tune",    tuneMain,    "read or change the running game's parameters" },
+};
+
+static const int gCommandCount = sizeof(gCommands) / sizeof(gCommands[0]);
+
+static void usage()
+{
+    fprintf(stderr, "usage: hgtool <command> [options]\n\n");
+    for (int i = 0; i < gCommandCount; i++)
+        fprintf(stderr, "  %-10s %s\n", gCommands[i].name, gCommands[i].help);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+        return 2;
+    }
+
+    for (int i = 0; i < gCommandCount; i++)
+    {
+        // Each command sees its own name as argv[0]
+        if (strcmp(argv[1], gCommands[i].name) == 0)
+            return gCommands[i].main(argc - 1, argv + 1);
+    }
+
+    usage();
+    return 2;
+}
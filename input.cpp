@@ -0,0 +1,459 @@
+#include "input.h"
+#include "realtime.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#endif
+
+void inputSyntheticDefaults(InputSynthetic& synthetic)
+{
+    synthetic.rateHz = 1000;
+    synthetic.centreY = 250;
+    synthetic.amplitude = 200;
+    synthetic.periodMs = 700;
+    synthetic.clickMs = 2000;
+    synthetic.startUs = 0;
+}
+
+double inputSyntheticY(const InputSynthetic& synthetic, uint64_t us)
+{
+    double t = (double)(int64_t)(us - synthetic.startUs) / 1000.0;
+    return synthetic.centreY + synthetic.amplitude * sin(2 * 3.14159265358979 * t / synthetic.periodMs);
+}
+
+InputCapture::InputCapture()
+    : m_head(0), m_tail(0), m_dropped(0), m_stop(0), m_thread(0), m_running(false),
+      m_window(NULL), m_sink(NULL), m_ready(0), m_deviceClock(false)
+{
+    memset(m_events, 0, sizeof(m_events));
+    inputSyntheticDefaults(m_synthetic);
+    m_devices[0] = -1;
+    m_devices[1] = -1;
+}
+
+InputCapture::~InputCapture()
+{
+    stop();
+}
+
+bool InputCapture::push(const InputEvent& event)
+{
+    uint32_t head = m_head;
+    if (head - atomicLoad(&m_tail) >= INPUT_QUEUE_EVENTS)
+    {
+        atomicAdd(&m_dropped, 1);
+        return false;
+    }
+    m_events[head % INPUT_QUEUE_EVENTS] = event;
+    atomicStore(&m_head, head + 1);
+    return true;
+}
+
+bool InputCapture::popUntil(uint64_t us, InputEvent& event)
+{
+    uint32_t tail = m_tail;
+    if (tail == atomicLoad(&m_head))
+        return false;
+
+    const InputEvent& next = m_events[tail % INPUT_QUEUE_EVENTS];
+    if (next.us > us)
+        return false;
+    event = next;
+    atomicStore(&m_tail, tail + 1);
+    return true;
+}
+
+bool InputCapture::startSynthetic(InputSynthetic& synthetic)
+{
+    stop();
+    if (synthetic.rateHz < 1)
+        synthetic.rateHz = 1;
+    synthetic.startUs = platformMicros();
+    m_synthetic = synthetic;
+    m_stop = 0;
+    if (!platformStartThread(m_thread, syntheticThread, this))
+    {
+        m_report = "input: cannot start the synthetic source\n";
+        return false;
+    }
+    char line[128];
+    sprintf(line, "input: synthetic, %d Hz\n", synthetic.rateHz);
+    m_report = line;
+    m_running = true;
+    return true;
+}
+
+void InputCapture::syntheticThread(void* arg)
+{
+    InputCapture& capture = *(InputCapture*)arg;
+    const InputSynthetic& synthetic = capture.m_synthetic;
+    uint64_t periodUs = 1000000 / synthetic.rateHz;
+    uint64_t nextClickUs = synthetic.startUs + (uint64_t)synthetic.clickMs * 1000;
+
+    // Stamped with when each sample was due, so inputSyntheticY() says
+    // exactly where the cursor was
+    for (uint64_t next = synthetic.startUs; atomicLoad(&capture.m_stop) == 0; next += periodUs)
+    {
+        rtSleepUntil(next);
+
+        InputEvent event;
+        memset(&event, 0, sizeof(event));
+        event.us = next;
+        event.type = INPUT_POINTER;
+        event.y = (int32_t)floor(inputSyntheticY(synthetic, next) + 0.5);
+        capture.push(event);
+
+        if (synthetic.clickMs > 0 && next >= nextClickUs)
+        {
+            event.type = INPUT_BUTTON;
+            event.code = 0;
+            event.down = 1;
+            capture.push(event);
+            event.down = 0;
+            capture.push(event);
+            nextClickUs += (uint64_t)synthetic.clickMs * 1000;
+        }
+    }
+}
+
+#ifdef _WIN32
+
+bool InputCapture::startSystem(void* window, const char* device)
+{
+    (void)device;
+    stop();
+    m_window = window;
+    m_stop = 0;
+    m_ready = 0;
+    if (!platformStartThread(m_thread, systemThread, this))
+    {
+        m_report = "input: cannot start the capture thread\n";
+        return false;
+    }
+
+    // The thread makes its window and registers for raw input itself,
+    // since the messages go to the thread that owns the window
+    while (atomicLoad(&m_ready) == 0)
+        platformSleepMs(1);
+    if (m_ready != 1)
+    {
+        platformJoinThread(m_thread);
+        m_report = "input: raw input unavailable, using GLUT\n";
+        return false;
+    }
+    m_report = "input: raw input\n";
+    m_running = true;
+    return true;
+}
+
+// Mouse button transitions in a raw input report, as (down, up) flag pairs
+static const USHORT gButtonFlags[3][2] = {
+    { RI_MOUSE_LEFT_BUTTON_DOWN, RI_MOUSE_LEFT_BUTTON_UP },
+    { RI_MOUSE_RIGHT_BUTTON_DOWN, RI_MOUSE_RIGHT_BUTTON_UP },
+    { RI_MOUSE_MIDDLE_BUTTON_DOWN, RI_MOUSE_MIDDLE_BUTTON_UP },
+};
+
+void InputCapture::systemThread(void* arg)
+{
+    InputCapture& capture = *(InputCapture*)arg;
+    HWND sink = CreateWindowExA(0, "STATIC", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
+
+    // Mouse and keyboard, delivered here even while the game window has
+    // the focus
+    RAWINPUTDEVICE devices[2];
+    devices[0].usUsagePage = 0x01;
+    devices[0].usUsage = 0x02;
+    devices[0].dwFlags = RIDEV_INPUTSINK;
+    devices[0].hwndTarget = sink;
+    devices[1] = devices[0];
+    devices[1].usUsage = 0x06;
+    if (sink == NULL || !RegisterRawInputDevices(devices, 2, sizeof(RAWINPUTDEVICE)))
+    {
+        if (sink != NULL)
+            DestroyWindow(sink);
+        atomicStore(&capture.m_ready, 2);
+        return;
+    }
+    capture.m_sink = sink;
+    atomicStore(&capture.m_ready, 1);
+
+    HWND window = (HWND)capture.m_window;
+    MSG msg;
+    while (atomicLoad(&capture.m_stop) == 0 && GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        if (msg.message == WM_INPUT)
+        {
+            uint64_t now = platformMicros();
+            RAWINPUT raw;
+            UINT size = sizeof(raw);
+            if (GetRawInputData((HRAWINPUT)msg.lParam, RID_INPUT, &raw, &size, sizeof(RAWINPUTHEADER)) != (UINT)-1
+                && GetForegroundWindow() == window)
+            {
+                InputEvent event;
+                memset(&event, 0, sizeof(event));
+                event.us = now;
+                if (raw.header.dwType == RIM_TYPEMOUSE)
+                {
+                    // Where the cursor ended up, the way GLUT would report it
+                    POINT cursor;
+                    GetCursorPos(&cursor);
+                    ScreenToClient(window, &cursor);
+                    event.type = INPUT_POINTER;
+                    event.x = cursor.x;
+                    event.y = cursor.y;
+                    if (raw.data.mouse.lLastX != 0 || raw.data.mouse.lLastY != 0
+                        || (raw.data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE))
+                        capture.push(event);
+
+                    for (uint16_t b = 0; b < 3; b++)
+                    {
+                        USHORT flags = raw.data.mouse.usButtonFlags;
+                        if ((flags & (gButtonFlags[b][0] | gButtonFlags[b][1])) == 0)
+                            continue;
+                        event.type = INPUT_BUTTON;
+                        event.code = b;
+                        event.down = (flags & gButtonFlags[b][0]) ? 1 : 0;
+                        capture.push(event);
+                    }
+                }
+                else if (raw.header.dwType == RIM_TYPEKEYBOARD)
+                {
+                    event.type = INPUT_KEY;
+                    event.code = raw.data.keyboard.VKey;
+                    event.down = (raw.data.keyboard.Flags & RI_KEY_BREAK) ? 0 : 1;
+                    capture.push(event);
+                }
+            }
+        }
+        DispatchMessage(&msg);
+    }
+
+    devices[0].dwFlags = RIDEV_REMOVE;
+    devices[0].hwndTarget = NULL;
+    devices[1].dwFlags = RIDEV_REMOVE;
+    devices[1].hwndTarget = NULL;
+    RegisterRawInputDevices(devices, 2, sizeof(RAWINPUTDEVICE));
+    DestroyWindow(sink);
+}
+
+void InputCapture::stop()
+{
+    if (!m_running)
+        return;
+    atomicStore(&m_stop, 1);
+    if (m_sink != NULL)
+        PostMessage((HWND)m_sink, WM_NULL, 0, 0);
+    platformJoinThread(m_thread);
+    m_sink = NULL;
+    m_running = false;
+}
+
+#elif defined(__linux__)
+
+// Whether an evdev device reports a code of a given event type
+static bool hasCode(int fd, int type, int code)
+{
+    unsigned char bits[KEY_MAX / 8 + 1];
+    memset(bits, 0, sizeof(bits));
+    if (ioctl(fd, EVIOCGBIT(type, sizeof(bits)), bits) < 0)
+        return false;
+    return (bits[code / 8] >> (code % 8)) & 1;
+}
+
+bool InputCapture::startSystem(void* window, const char* device)
+{
+    (void)window;
+    stop();
+    m_report.clear();
+
+    // A named device, or the first mouse and the first keyboard
+    if (device != NULL)
+    {
+        m_devices[0] = open(device, O_RDONLY | O_NONBLOCK);
+        if (m_devices[0] < 0)
+            m_report = std::string("input: cannot open ") + device + ": " + strerror(errno) + "\n";
+        else
+            m_report = std::string("input: ") + device + "\n";
+    }
+    else
+    {
+        DIR* dir = opendir("/dev/input");
+        struct dirent* entry;
+        while (dir != NULL && (entry = readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, "event", 5) != 0)
+                continue;
+            std::string path = std::string("/dev/input/") + entry->d_name;
+            int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+            if (fd < 0)
+                continue;
+            int slot = -1;
+            if (m_devices[0] < 0 && hasCode(fd, EV_REL, REL_Y) && hasCode(fd, EV_KEY, BTN_LEFT))
+                slot = 0;
+            else if (m_devices[1] < 0 && hasCode(fd, EV_KEY, KEY_A))
+                slot = 1;
+            if (slot < 0)
+            {
+                close(fd);
+                continue;
+            }
+            m_devices[slot] = fd;
+            m_report += "input: " + path + (slot == 0 ? " (mouse)\n" : " (keyboard)\n");
+        }
+        if (dir != NULL)
+            closedir(dir);
+        if (m_devices[0] < 0 && m_devices[1] < 0)
+            m_report = "input: no readable mouse or keyboard in /dev/input\n";
+    }
+    if (m_devices[0] < 0 && m_devices[1] < 0)
+        return false;
+
+    // Have the kernel stamp events on the clock platformMicros() reads
+    m_deviceClock = true;
+    for (int i = 0; i < 2; i++)
+    {
+#ifdef EVIOCSCLOCKID
+        int clock = CLOCK_MONOTONIC;
+        if (m_devices[i] >= 0 && ioctl(m_devices[i], EVIOCSCLOCKID, &clock) < 0)
+            m_deviceClock = false;
+#else
+        m_deviceClock = false;
+#endif
+    }
+
+    m_stop = 0;
+    if (!platformStartThread(m_thread, systemThread, this))
+    {
+        m_report += "input: cannot start the capture thread\n";
+        for (int i = 0; i < 2; i++)
+        {
+            if (m_devices[i] >= 0)
+                close(m_devices[i]);
+            m_devices[i] = -1;
+        }
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void InputCapture::systemThread(void* arg)
+{
+    InputCapture& capture = *(InputCapture*)arg;
+    struct pollfd fds[2];
+    int count = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        if (capture.m_devices[i] >= 0)
+        {
+            fds[count].fd = capture.m_devices[i];
+            fds[count].events = POLLIN;
+            count++;
+        }
+    }
+
+    // Relative motion is gathered up to each SYN_REPORT, which ends one
+    // sample from the device
+    int32_t dx = 0, dy = 0;
+    while (atomicLoad(&capture.m_stop) == 0)
+    {
+        // Wake now and then to see whether to stop
+        if (poll(fds, count, 50) <= 0)
+            continue;
+
+        for (int f = 0; f < count; f++)
+        {
+            struct input_event raw[64];
+            ssize_t got;
+            while ((got = read(fds[f].fd, raw, sizeof(raw))) > 0)
+            {
+                for (size_t i = 0; i < (size_t)got / sizeof(raw[0]); i++)
+                {
+                    const struct input_event& e = raw[i];
+                    InputEvent event;
+                    memset(&event, 0, sizeof(event));
+                    event.us = capture.m_deviceClock
+                        ? (uint64_t)e.time.tv_sec * 1000000 + e.time.tv_usec
+                        : platformMicros();
+
+                    if (e.type == EV_REL && e.code == REL_X)
+                        dx += e.value;
+                    else if (e.type == EV_REL && e.code == REL_Y)
+                        dy += e.value;
+                    else if (e.type == EV_SYN && e.code == SYN_REPORT && (dx != 0 || dy != 0))
+                    {
+                        event.type = INPUT_POINTER_MOVE;
+                        event.x = dx;
+                        event.y = dy;
+                        capture.push(event);
+                        dx = 0;
+                        dy = 0;
+                    }
+                    else if (e.type == EV_KEY && e.value != 2)
+                    {
+                        // Autorepeat (value 2) is not a new press
+                        bool button = e.code >= BTN_LEFT && e.code <= BTN_MIDDLE;
+                        event.type = button ? INPUT_BUTTON : INPUT_KEY;
+                        event.code = (uint16_t)(button ? e.code - BTN_LEFT : e.code);
+                        event.down = e.value != 0;
+                        capture.push(event);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void InputCapture::stop()
+{
+    if (m_running)
+    {
+        atomicStore(&m_stop, 1);
+        platformJoinThread(m_thread);
+        m_running = false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (m_devices[i] >= 0)
+            close(m_devices[i]);
+        m_devices[i] = -1;
+    }
+}
+
+#else
+
+bool InputCapture::startSystem(void* window, const char* device)
+{
+    (void)window;
+    (void)device;
+    m_report = "input: no system capture on this platform\n";
+    return false;
+}
+
+void InputCapture::systemThread(void* arg)
+{
+    (void)arg;
+}
+
+void InputCapture::stop()
+{
+    if (!m_running)
+        return;
+    atomicStore(&m_stop, 1);
+    platformJoinThread(m_thread);
+    m_running = false;
+}
+
+#endif
@@ -0,0 +1,115 @@
+// Make sure this header is included only once
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "platform.h"
+#include <string>
+
+// Pointer and keyboard events, captured on a thread of their own and
+// stamped with platformMicros() when they happened.  GLUT only calls its
+// mouse callbacks when the render loop gets round to dispatching them, so
+// all the game used to see was the last position of each frame; with the
+// stamps, each fixed step applies the events that fall before its own
+// time, and motion between frames reaches the steps it belongs to.
+//
+// Sources:
+//   system     raw input on Windows (WM_INPUT to a hidden window), evdev
+//              on Linux (/dev/input/event*, needs read access)
+//   synthetic  a pointer sweeping up and down at a fixed rate, with a
+//              click now and then, for hgtool input
+//
+// The capture thread is the only producer and the simulation thread's
+// applyInput() the only consumer, so the queue between them needs no
+// lock.  When nothing is capturing, the GLUT callbacks (glutMouseMove,
+// glutMouse) push into it instead, from the window thread; still one
+// producer, one consumer.
+
+enum InputEventType {
+    INPUT_POINTER = 1,      // x, y: cursor position in window pixels
+    INPUT_POINTER_MOVE,     // x, y: counts moved, where only that is known
+    INPUT_BUTTON,           // code: 0 left, 1 right, 2 middle
+    INPUT_KEY               // code: virtual key (Windows) or evdev key code
+};
+
+struct InputEvent {
+    uint64_t us;            // platformMicros() when it happened
+    uint16_t type;
+    uint16_t code;
+    uint32_t down;          // buttons and keys: 1 pressed, 0 released
+    int32_t  x, y;
+};
+
+// Events the queue holds; more than a second of 1 kHz mouse
+const uint32_t INPUT_QUEUE_EVENTS = 2048;
+
+// The synthetic source: the cursor's y sweeps a sine wave around centreY
+// and clicks every clickMs (0 never)
+struct InputSynthetic {
+    int    rateHz;
+    double centreY;
+    double amplitude;
+    double periodMs;
+    int    clickMs;
+    uint64_t startUs;       // set when the source starts
+};
+
+void inputSyntheticDefaults(InputSynthetic& synthetic);
+
+// Where the synthetic cursor is at a given time
+double inputSyntheticY(const InputSynthetic& synthetic, uint64_t us);
+
+class InputCapture
+{
+public:
+    InputCapture();
+    ~InputCapture();
+
+    // Capture from the operating system.  On Windows window is the game's
+    // HWND, which pointer positions are made relative to, and device is
+    // unused; on Linux device is an evdev path, or NULL for the first
+    // mouse and keyboard found.  Returns false, with the reason in
+    // report(), if nothing could be opened.
+    bool startSystem(void* window, const char* device);
+
+    // Generate events instead
+    bool startSynthetic(InputSynthetic& synthetic);
+
+    // Stop capturing.  Events already queued can still be popped.
+    void stop();
+
+    bool running() const { return m_running; }
+
+    // Producer side: queue an event, or count it dropped if the queue is full
+    bool push(const InputEvent& event);
+
+    // Consumer side: the oldest event, if it happened at or before us
+    bool popUntil(uint64_t us, InputEvent& event);
+
+    uint32_t dropped() const { return atomicLoad(&m_dropped); }
+
+    // What was opened, or why nothing was
+    const std::string& report() const { return m_report; }
+
+private:
+    static void systemThread(void* arg);
+    static void syntheticThread(void* arg);
+
+    InputEvent        m_events[INPUT_QUEUE_EVENTS];
+    volatile uint32_t m_head;       // next to write; producer only
+    volatile uint32_t m_tail;       // next to read; consumer only
+    volatile uint32_t m_dropped;
+    volatile uint32_t m_stop;
+
+    PlatformThread    m_thread;
+    bool              m_running;
+    std::string       m_report;
+
+    InputSynthetic    m_synthetic;
+    void*             m_window;         // the game's window (Windows)
+    void*             m_sink;           // the hidden window raw input goes to
+    volatile uint32_t m_ready;          // 1 once capturing, 2 if that failed
+    int               m_devices[2];     // evdev descriptors, -1 if unused
+    bool              m_deviceClock;    // evdev stamps events on our clock
+};
+
+#endif // INPUT_H
@@ -0,0 +1,169 @@
+// inputlab: runs an input source into the queue and consumes it the way
+// the game loop does, one render frame at a time with fixed steps inside,
+// and reports how late events were picked up and how far the paddle was
+// from the cursor at each step.  The paddle error is given two ways: with
+// each step applying the events stamped before it ("stamped"), and with
+// every step of a frame taking the last position seen that frame, which
+// is all the GLUT callbacks offered ("latest").
+//
+// The synthetic source's cursor position is known at every instant, so
+// only it gets the paddle error; a system source reports the rest.
+#include "input.h"
+#include "game.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+template <class T>
+static T percentile(std::vector<T> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+static double mean(const std::vector<double>& values)
+{
+    double total = 0;
+    for (size_t i = 0; i < values.size(); i++)
+        total += values[i];
+    return values.empty() ? 0 : total / values.size();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool inputlab [options]\n"
+        "  --source synthetic|system  where events come from (default synthetic)\n"
+        "  --device PATH              evdev device for the system source (Linux)\n"
+        "  --rate HZ                  synthetic samples per second (default 1000)\n"
+        "  --seconds N                how long to run (default 5)\n"
+        "  --frame-ms N               render frame time to consume at (default 16)\n");
+}
+
+int inputlabMain(int argc, char* argv[])
+{
+    bool synthetic = true;
+    const char* device = NULL;
+    int seconds = 5;
+    int frameMs = 16;
+    InputSynthetic pattern;
+    inputSyntheticDefaults(pattern);
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--source") == 0 && hasValue)
+            synthetic = strcmp(argv[++i], "system") != 0;
+        else if (strcmp(argv[i], "--device") == 0 && hasValue)
+            device = argv[++i];
+        else if (strcmp(argv[i], "--rate") == 0 && hasValue)
+            pattern.rateHz = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frame-ms") == 0 && hasValue)
+            frameMs = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (frameMs < 1)
+        frameMs = 1;
+
+    InputCapture capture;
+    bool started = synthetic ? capture.startSynthetic(pattern) : capture.startSystem(NULL, device);
+    printf("# %s", capture.report().c_str());
+    if (!started)
+        return 1;
+
+    std::vector<uint32_t> lateUs;
+    std::vector<double> stampedError, latestError;
+    std::vector<InputEvent> frame;
+    uint32_t events = 0, clicks = 0, keys = 0;
+    double stampedY = pattern.centreY, latestY = pattern.centreY;
+
+    uint64_t lastUs = platformMicros();
+    uint64_t endUs = lastUs + (uint64_t)seconds * 1000000;
+    uint64_t accumulatedUs = 0;
+    while (platformMicros() < endUs)
+    {
+        platformSleepMs(frameMs);
+        uint64_t now = platformMicros();
+        accumulatedUs += now - lastUs;
+        lastUs = now;
+
+        // What the frame has to go on: everything stamped up to now
+        frame.clear();
+        InputEvent event;
+        while (capture.popUntil(now, event))
+        {
+            frame.push_back(event);
+            lateUs.push_back((uint32_t)(now - event.us));
+            events++;
+            if (event.type == INPUT_POINTER)
+                latestY = event.y;
+            else if (event.type == INPUT_POINTER_MOVE)
+                latestY += event.y;
+            else if (event.type == INPUT_BUTTON && event.down)
+                clicks++;
+            else if (event.type == INPUT_KEY && event.down)
+                keys++;
+        }
+
+        // Each step takes the events stamped before its own time
+        size_t next = 0;
+        while (accumulatedUs >= GAME_STEP_US)
+        {
+            accumulatedUs -= GAME_STEP_US;
+            uint64_t stepUs = now - accumulatedUs;
+            for (; next < frame.size() && frame[next].us <= stepUs; next++)
+            {
+                if (frame[next].type == INPUT_POINTER)
+                    stampedY = frame[next].y;
+                else if (frame[next].type == INPUT_POINTER_MOVE)
+                    stampedY += frame[next].y;
+            }
+
+            if (synthetic)
+            {
+                double cursor = inputSyntheticY(pattern, stepUs);
+                stampedError.push_back(fabs(stampedY - cursor));
+                latestError.push_back(fabs(latestY - cursor));
+            }
+        }
+
+        // Events after the last step belong to the next frame's steps
+        for (; next < frame.size(); next++)
+        {
+            if (frame[next].type == INPUT_POINTER)
+                stampedY = frame[next].y;
+            else if (frame[next].type == INPUT_POINTER_MOVE)
+                stampedY += frame[next].y;
+        }
+    }
+    capture.stop();
+
+    printf("# %u events in %d s (%.0f/s), %u clicks, %u key presses, %u dropped\n",
+           events, seconds, events / (double)seconds, clicks, keys, capture.dropped());
+    printf("# frame %d ms, step %u us; pickup is from an event's stamp to the frame that took it\n",
+           frameMs, (unsigned)GAME_STEP_US);
+    printf("pickup,p50_us,p99_us,max_us\n");
+    printf("queue,%u,%u,%u\n", percentile(lateUs, 0.5), percentile(lateUs, 0.99), percentile(lateUs, 1.0));
+
+    if (synthetic)
+    {
+        printf("paddle,steps,mean_px,p50_px,p99_px,max_px\n");
+        printf("stamped,%u,%.2f,%.2f,%.2f,%.2f\n", (unsigned)stampedError.size(), mean(stampedError),
+               percentile(stampedError, 0.5), percentile(stampedError, 0.99), percentile(stampedError, 1.0));
+        printf("latest,%u,%.2f,%.2f,%.2f,%.2f\n", (unsigned)latestError.size(), mean(latestError),
+               percentile(latestError, 0.5), percentile(latestError, 0.99), percentile(latestError, 1.0));
+    }
+    return 0;
+}
@@ -0,0 +1,376 @@
+#include "log.h"
+#include "realtime.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#define snprintf _snprintf
+#endif
+
+struct LogEntry {
+    uint64_t ticks;
+    uint16_t site;
+    uint8_t  count;
+    uint8_t  types[4];
+    uint64_t args[4];
+};
+
+// One thread's records.  Only that thread writes head and dropped; only
+// the formatter writes tail.
+struct LogRing {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;
+    char              name[32];
+    LogEntry          entries[LOG_RING_RECORDS];
+};
+
+// Fixed, so a thread's first record never touches the heap
+static LogRing gRings[LOG_MAX_THREADS];
+static volatile uint32_t gRingCount;
+static volatile uint32_t gNoRingDropped;
+
+static LogSite* volatile gSites[LOG_MAX_SITES + 1];
+static volatile uint32_t gSiteCount;
+
+static PLATFORM_THREAD_LOCAL LogRing* tRing;
+static PLATFORM_THREAD_LOCAL uint32_t tNoRing;
+
+// The formatter
+static FILE* gFile;
+static PlatformThread gThread;
+static volatile uint32_t gRunning;
+static volatile uint32_t gStop;
+static int gAvoidCpu = -1;
+static uint64_t gStartTicks;
+static volatile uint32_t gWritten;
+static uint64_t gFormatTicks;
+
+static LogRing* threadRing()
+{
+    LogRing* ring = tRing;
+    if (ring != NULL || tNoRing)
+        return ring;
+
+    uint32_t slot = atomicAdd(&gRingCount, 1) - 1;
+    if (slot >= LOG_MAX_THREADS)
+    {
+        tNoRing = 1;
+        return NULL;
+    }
+    ring = &gRings[slot];
+    sprintf(ring->name, "thread %u", slot + 1);
+    tRing = ring;
+    return ring;
+}
+
+// Ids start at 1; 0 is not yet given
+static uint32_t siteId(LogSite& site)
+{
+    uint32_t id = atomicLoad(&site.id);
+    if (id != 0)
+        return id;
+
+    id = atomicAdd(&gSiteCount, 1);
+    if (id > LOG_MAX_SITES)
+        return 0;
+    gSites[id] = &site;
+    atomicFence();
+
+    // Two threads may get here at once; the first one's id stands
+    uint32_t before = atomicCompareExchange(&site.id, id, 0);
+    return before != 0 ? before : id;
+}
+
+void logRecord(LogSite& site, uint32_t count, const LogArg* args)
+{
+    LogRing* ring = threadRing();
+    if (ring == NULL)
+    {
+        atomicAdd(&gNoRingDropped, 1);
+        return;
+    }
+    uint32_t id = siteId(site);
+    uint32_t head = ring->head;
+    if (id == 0 || head - atomicLoad(&ring->tail) >= LOG_RING_RECORDS)
+    {
+        atomicStore(&ring->dropped, ring->dropped + 1);
+        return;
+    }
+
+    LogEntry& entry = ring->entries[head % LOG_RING_RECORDS];
+    entry.ticks = platformTicks();
+    entry.site = (uint16_t)id;
+    entry.count = (uint8_t)count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        entry.types[i] = (uint8_t)args[i].type;
+        entry.args[i] = args[i].bits;
+    }
+    atomicStore(&ring->head, head + 1);
+}
+
+void logThreadName(const char* name)
+{
+    LogRing* ring = threadRing();
+    if (ring == NULL || strncmp(ring->name, name, sizeof(ring->name) - 1) == 0)
+        return;
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    ring->name[sizeof(ring->name) - 1] = '\0';
+}
+
+// One conversion of the format, given the argument recorded for it
+static int formatArg(char* out, size_t size, const char* spec, size_t specLength,
+                     char conversion, uint32_t type, uint64_t bits)
+{
+    // The spec with its length modifiers replaced by our own
+    char format[32];
+    size_t length = 0;
+    for (size_t i = 0; i < specLength && length < sizeof(format) - 4; i++)
+    {
+        char c = spec[i];
+        if (c != 'h' && c != 'l' && c != 'L' && c != 'j' && c != 'z' && c != 't' && c != 'q')
+            format[length++] = c;
+    }
+
+    double real;
+    memcpy(&real, &bits, sizeof(real));
+    long long signedValue = type == LOG_DOUBLE ? (long long)real : (long long)(int64_t)bits;
+    unsigned long long unsignedValue = type == LOG_DOUBLE ? (unsigned long long)real : (unsigned long long)bits;
+    double realValue = type == LOG_DOUBLE ? real : type == LOG_INT ? (double)(int64_t)bits : (double)bits;
+    switch (conversion)
+    {
+    case 'd': case 'i':
+        strcpy(format + length, "lld");
+        return snprintf(out, size, format, signedValue);
+    case 'u': case 'x': case 'X': case 'o':
+        sprintf(format + length, "ll%c", conversion);
+        return snprintf(out, size, format, unsignedValue);
+    case 'c':
+        strcpy(format + length, "c");
+        return snprintf(out, size, format, (int)signedValue);
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        sprintf(format + length, "%c", conversion);
+        return snprintf(out, size, format, realValue);
+    case 's':
+        strcpy(format + length, "s");
+        return snprintf(out, size, format, type == LOG_STRING && bits != 0 ? (const char*)(size_t)bits : "?");
+    case 'p':
+        return snprintf(out, size, "%p", (void*)(size_t)bits);
+    }
+    return snprintf(out, size, "?");
+}
+
+// The record as its site's format says, into line
+static void formatRecord(const LogEntry& entry, const LogSite& site, char* line, size_t size)
+{
+    size_t length = 0;
+    uint32_t arg = 0;
+    for (const char* p = site.format; *p != '\0' && length + 1 < size; )
+    {
+        if (*p != '%')
+        {
+            line[length++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            line[length++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Flags, width, precision and length, up to the conversion
+        const char* spec = p++;
+        while (*p != '\0' && strchr("-+ #0123456789.hlLjztq", *p) != NULL)
+            p++;
+        if (*p == '\0')
+            break;
+        char conversion = *p++;
+
+        int written;
+        if (arg < entry.count)
+        {
+            written = formatArg(line + length, size - length, spec, p - 1 - spec, conversion,
+                                entry.types[arg], entry.args[arg]);
+            arg++;
+        }
+        else
+        {
+            written = snprintf(line + length, size - length, "<missing>");
+        }
+        if (written < 0 || (size_t)written >= size - length)
+        {
+            length = size - 1;
+            break;
+        }
+        length += written;
+    }
+    line[length] = '\0';
+}
+
+static void writeLine(const char* text)
+{
+    if (gFile != NULL)
+    {
+        fputs(text, gFile);
+        return;
+    }
+#ifdef _WIN32
+    OutputDebugString(text);
+#else
+    fputs(text, stderr);
+#endif
+}
+
+// Write the oldest record of all the rings; false if there are none
+static bool writeOldest()
+{
+    uint32_t count = atomicLoad(&gRingCount);
+    if (count > LOG_MAX_THREADS)
+        count = LOG_MAX_THREADS;
+
+    LogRing* oldest = NULL;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        LogRing& ring = gRings[i];
+        if (atomicLoad(&ring.head) == ring.tail)
+            continue;
+        const LogEntry& entry = ring.entries[ring.tail % LOG_RING_RECORDS];
+        if (oldest == NULL || (int64_t)(entry.ticks - oldest->entries[oldest->tail % LOG_RING_RECORDS].ticks) < 0)
+            oldest = &ring;
+    }
+    if (oldest == NULL)
+        return false;
+
+    uint64_t start = platformTicks();
+    const LogEntry& entry = oldest->entries[oldest->tail % LOG_RING_RECORDS];
+    const LogSite* site = gSites[entry.site];
+    char message[512];
+    char line[600];
+    if (site != NULL)
+        formatRecord(entry, *site, message, sizeof(message));
+    else
+        strcpy(message, "?");
+    double ms = (double)(int64_t)(entry.ticks - gStartTicks) * 1000.0 / platformTicksPerSecond();
+    size_t length = strlen(message);
+    bool newline = length > 0 && message[length - 1] == '\n';
+    snprintf(line, sizeof(line), "%10.3f %-8s %s%s", ms, oldest->name, message, newline ? "" : "\n");
+    line[sizeof(line) - 1] = '\0';
+    writeLine(line);
+
+    atomicStore(&oldest->tail, oldest->tail + 1);
+    gFormatTicks += platformTicks() - start;
+    atomicStore(&gWritten, gWritten + 1);
+    return true;
+}
+
+static void formatterThread(void*)
+{
+    rtAvoidCpu(gAvoidCpu);
+    for (;;)
+    {
+        bool any = false;
+        while (writeOldest())
+            any = true;
+        if (any && gFile != NULL)
+            fflush(gFile);
+        if (atomicLoad(&gStop) != 0)
+            return;
+        platformSleepMs(1);
+    }
+}
+
+bool logStart(const char* path, int avoidCpu)
+{
+    if (atomicLoad(&gRunning) != 0)
+        return false;
+    gFile = NULL;
+    if (path != NULL)
+    {
+        gFile = fopen(path, "a");
+        if (gFile == NULL)
+            return false;
+    }
+    gAvoidCpu = avoidCpu;
+    gStartTicks = platformTicks();
+    gStop = 0;
+    if (!platformStartThread(gThread, formatterThread, NULL))
+    {
+        if (gFile != NULL)
+            fclose(gFile);
+        gFile = NULL;
+        return false;
+    }
+    atomicStore(&gRunning, 1);
+    return true;
+}
+
+void logStop()
+{
+    if (atomicLoad(&gRunning) == 0)
+        return;
+    atomicStore(&gStop, 1);
+    platformJoinThread(gThread);
+    if (gFile != NULL)
+        fclose(gFile);
+    gFile = NULL;
+    atomicStore(&gRunning, 0);
+}
+
+void logDiscard()
+{
+    if (atomicLoad(&gRunning) != 0)
+        return;
+    uint32_t count = atomicLoad(&gRingCount);
+    if (count > LOG_MAX_THREADS)
+        count = LOG_MAX_THREADS;
+    for (uint32_t i = 0; i < count; i++)
+        atomicStore(&gRings[i].tail, atomicLoad(&gRings[i].head));
+}
+
+LogStats logStats()
+{
+    LogStats stats;
+    uint32_t count = atomicLoad(&gRingCount);
+    stats.threads = count;
+    stats.written = atomicLoad(&gWritten);
+    stats.dropped = atomicLoad(&gNoRingDropped);
+    if (count > LOG_MAX_THREADS)
+        count = LOG_MAX_THREADS;
+    for (uint32_t i = 0; i < count; i++)
+        stats.dropped += atomicLoad(&gRings[i].dropped);
+    stats.formatNs = stats.written != 0
+        ? gFormatTicks * 1e9 / platformTicksPerSecond() / stats.written : 0;
+    return stats;
+}
+
+std::string logReport()
+{
+    LogStats stats = logStats();
+    char line[256];
+    sprintf(line, "log: %u records from %u threads, %u dropped, %.0f ns a record to format and write\n",
+            stats.written, stats.threads, stats.dropped, stats.formatNs);
+    std::string report = line;
+
+    uint32_t count = stats.threads < LOG_MAX_THREADS ? stats.threads : LOG_MAX_THREADS;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t dropped = atomicLoad(&gRings[i].dropped);
+        if (dropped != 0)
+        {
+            sprintf(line, "log: %u dropped from %s\n", dropped, gRings[i].name);
+            report += line;
+        }
+    }
+    uint32_t noRing = atomicLoad(&gNoRingDropped);
+    if (noRing != 0)
+    {
+        sprintf(line, "log: %u dropped from threads past the first %u\n", noRing, LOG_MAX_THREADS);
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,122 @@
+// Make sure this header is included only once
+#ifndef LOG_H
+#define LOG_H
+
+#include "platform.h"
+#include <string.h>
+#include <string>
+
+// Diagnostics that any thread can write, the servo callback included.
+// sprintf and OutputDebugString take microseconds and may lock, which a
+// 1 kHz callback cannot afford.  Here a call site records only the
+// address of its format, fixed when the code was built, and its
+// arguments as they are, into a ring of the calling thread's own.  A
+// background thread formats the records and writes them out.
+//
+//     LOG2("servo: effect %d for player %d", type, player);
+//     LOG_THREAD("servo");           name the calling thread's lines
+//
+// Recording takes no lock and never waits: a clock read and a few
+// stores.  When a thread's ring is full the record is dropped and
+// counted.  Records made before logStart() wait in the rings.
+//
+// Formats are printf's, with up to four arguments: integers, doubles
+// and strings.  Strings are kept as pointers, so they must be literals,
+// or anything else that outlives the log.
+
+// Records each thread's ring holds
+const uint32_t LOG_RING_RECORDS = 1024;
+
+// Threads that can log; later ones are counted as dropped
+const uint32_t LOG_MAX_THREADS = 16;
+
+// Call sites that can log
+const uint32_t LOG_MAX_SITES = 1024;
+
+// A call site: its format, and where it is.  id is given on first use.
+struct LogSite {
+    const char*       format;
+    const char*       file;
+    int               line;
+    volatile uint32_t id;
+};
+
+enum LogType {
+    LOG_INT,
+    LOG_UINT,
+    LOG_DOUBLE,
+    LOG_STRING
+};
+
+struct LogArg {
+    uint64_t bits;
+    uint32_t type;
+};
+
+inline LogArg logArg(int v)            { LogArg a = { (uint64_t)(int64_t)v, LOG_INT }; return a; }
+inline LogArg logArg(long v)           { LogArg a = { (uint64_t)(int64_t)v, LOG_INT }; return a; }
+inline LogArg logArg(unsigned int v)   { LogArg a = { (uint64_t)v, LOG_UINT }; return a; }
+inline LogArg logArg(unsigned long v)  { LogArg a = { (uint64_t)v, LOG_UINT }; return a; }
+inline LogArg logArg(bool v)           { LogArg a = { v ? 1u : 0u, LOG_INT }; return a; }
+inline LogArg logArg(const char* v)    { LogArg a = { (uint64_t)(size_t)v, LOG_STRING }; return a; }
+
+// Where long is 32 bits the 64-bit integers are types of their own
+#if !defined(__LP64__)
+inline LogArg logArg(int64_t v)        { LogArg a = { (uint64_t)v, LOG_INT }; return a; }
+inline LogArg logArg(uint64_t v)       { LogArg a = { v, LOG_UINT }; return a; }
+#endif
+
+inline LogArg logArg(double v)
+{
+    LogArg a;
+    memcpy(&a.bits, &v, sizeof(v));
+    a.type = LOG_DOUBLE;
+    return a;
+}
+
+void logRecord(LogSite& site, uint32_t count, const LogArg* args);
+void logThreadName(const char* name);
+
+// Start formatting records to path, or to the debug output if path is
+// NULL, on a thread kept off avoidCpu
+bool logStart(const char* path, int avoidCpu = -1);
+
+// Write what is left in the rings and stop
+void logStop();
+
+// Throw away what the rings hold, unwritten, while the log is stopped;
+// for benchmarks of recording alone
+void logDiscard();
+
+struct LogStats {
+    uint32_t threads;       // that have logged
+    uint32_t written;       // records formatted and written
+    uint32_t dropped;       // records lost to full rings, or to no ring
+    double   formatNs;      // formatting and writing, per record
+};
+
+LogStats logStats();
+
+// The stats, and the drops of each thread that had any
+std::string logReport();
+
+#define LOG_SITE(format) static LogSite logSite = { format, __FILE__, __LINE__, 0 }
+
+#define LOG0(format) \
+    do { LOG_SITE(format); logRecord(logSite, 0, NULL); } while (0)
+#define LOG1(format, a) \
+    do { LOG_SITE(format); LogArg logArgs[1] = { logArg(a) }; \
+         logRecord(logSite, 1, logArgs); } while (0)
+#define LOG2(format, a, b) \
+    do { LOG_SITE(format); LogArg logArgs[2] = { logArg(a), logArg(b) }; \
+         logRecord(logSite, 2, logArgs); } while (0)
+#define LOG3(format, a, b, c) \
+    do { LOG_SITE(format); LogArg logArgs[3] = { logArg(a), logArg(b), logArg(c) }; \
+         logRecord(logSite, 3, logArgs); } while (0)
+#define LOG4(format, a, b, c, d) \
+    do { LOG_SITE(format); LogArg logArgs[4] = { logArg(a), logArg(b), logArg(c), logArg(d) }; \
+         logRecord(logSite, 4, logArgs); } while (0)
+
+#define LOG_THREAD(name) logThreadName(name)
+
+#endif // LOG_H
@@ -0,0 +1,229 @@
+// loglab: the logger under load.  Producer threads record at the servo's
+// 1 kHz, or flat out, while the formatter writes to a file (the null
+// device by default).  For each number of producers and each rate it
+// reports what a record cost its caller, how many were written and
+// dropped, and how many records a second the formatter got through.
+// The cost to the caller must not grow when the formatter falls behind:
+// the records are dropped instead.
+//
+// The producers are started once and kept, since the log has a ring for
+// each thread that ever logged and never gives one back.
+#include "log.h"
+#include "realtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Record costs, in 1 ns buckets; the last is everything longer
+const int LOGLAB_BUCKETS = 10001;
+
+struct Producer {
+    int                   index;
+    std::vector<uint32_t> ns;
+    uint32_t              records;
+    double                maxNs;
+};
+
+static volatile uint32_t gGeneration;
+static volatile uint32_t gDone;
+static volatile uint32_t gQuit;
+static volatile uint32_t gActive;
+static int gRate;
+static uint64_t gEndUs;
+
+static void produce(Producer& p)
+{
+    std::fill(p.ns.begin(), p.ns.end(), 0);
+    p.records = 0;
+    p.maxNs = 0;
+    double nsPerTick = 1e9 / platformTicksPerSecond();
+    uint64_t due = platformMicros();
+    while (platformMicros() < gEndUs)
+    {
+        if (gRate > 0)
+        {
+            due += 1000000 / gRate;
+            rtSleepUntil(due);
+        }
+        uint64_t before = platformTicks();
+        LOG3("loglab: producer %d record %u at %f", p.index, p.records, 0.25);
+        double ns = (platformTicks() - before) * nsPerTick;
+        p.ns[ns < LOGLAB_BUCKETS - 1 ? (int)ns : LOGLAB_BUCKETS - 1]++;
+        if (ns > p.maxNs)
+            p.maxNs = ns;
+        p.records++;
+    }
+}
+
+static void producerThread(void* arg)
+{
+    Producer& p = *(Producer*)arg;
+    char name[32];
+    sprintf(name, "loglab %d", p.index);
+    LOG_THREAD(name);
+
+    uint32_t generation = 0;
+    for (;;)
+    {
+        while (atomicLoad(&gGeneration) == generation && atomicLoad(&gQuit) == 0)
+            platformSleepMs(1);
+        if (atomicLoad(&gQuit) != 0)
+            return;
+        generation = atomicLoad(&gGeneration);
+        if ((uint32_t)p.index < atomicLoad(&gActive))
+            produce(p);
+        atomicAdd(&gDone, 1);
+    }
+}
+
+static double percentile(const std::vector<uint32_t>& buckets, uint64_t total, double p)
+{
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (total - 1) + 0.5), seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if (seen > rank)
+            return (double)i;
+    }
+    return (double)buckets.size();
+}
+
+static void run(std::vector<Producer>& producers, int active, int rate, int seconds)
+{
+    LogStats before = logStats();
+    uint64_t start = platformMicros();
+    gRate = rate;
+    gEndUs = start + (uint64_t)seconds * 1000000;
+    atomicStore(&gActive, (uint32_t)active);
+    atomicStore(&gDone, 0);
+    atomicAdd(&gGeneration, 1);
+    while (atomicLoad(&gDone) < producers.size())
+        platformSleepMs(1);
+
+    // Let the formatter catch up, for its rate over the whole run
+    std::vector<uint32_t> ns(LOGLAB_BUCKETS, 0);
+    uint64_t records = 0;
+    double maxNs = 0;
+    for (int i = 0; i < active; i++)
+    {
+        for (int b = 0; b < LOGLAB_BUCKETS; b++)
+            ns[b] += producers[i].ns[b];
+        records += producers[i].records;
+        if (producers[i].maxNs > maxNs)
+            maxNs = producers[i].maxNs;
+    }
+    LogStats after = logStats();
+    while (after.written - before.written + after.dropped - before.dropped < records)
+    {
+        platformSleepMs(1);
+        after = logStats();
+    }
+    double elapsed = (platformMicros() - start) / 1e6;
+
+    char label[16];
+    sprintf(label, rate > 0 ? "%d" : "flat out", rate);
+    printf("%d,%s,%llu,%u,%u,%.0f,%.0f,%.0f,%.0f\n", active, label, (unsigned long long)records,
+           after.written - before.written, after.dropped - before.dropped,
+           percentile(ns, records, 0.5), percentile(ns, records, 0.99), maxNs,
+           (after.written - before.written) / elapsed);
+    fflush(stdout);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool loglab [options]\n"
+        "  --out FILE       where the log goes (default the null device)\n"
+        "  --threads LIST   numbers of producers, comma separated (default 1,2,4,8)\n"
+        "  --rates LIST     records a second from each; 0 is flat out (default 1000,0)\n"
+        "  --seconds N      time for each (default 2)\n");
+}
+
+// The numbers in a comma separated list
+static std::vector<int> numbers(const char* list)
+{
+    std::vector<int> values;
+    for (const char* p = list; *p != '\0'; )
+    {
+        if (*p >= '0' && *p <= '9')
+            values.push_back(atoi(p));
+        while (*p != '\0' && *p++ != ',')
+            ;
+    }
+    return values;
+}
+
+int loglabMain(int argc, char* argv[])
+{
+#ifdef _WIN32
+    const char* path = "NUL";
+#else
+    const char* path = "/dev/null";
+#endif
+    const char* threads = "1,2,4,8";
+    const char* rates = "1000,0";
+    int seconds = 2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--out") == 0 && hasValue)
+            path = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+            threads = argv[++i];
+        else if (strcmp(argv[i], "--rates") == 0 && hasValue)
+            rates = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (seconds < 1)
+        seconds = 1;
+
+    std::vector<int> counts = numbers(threads);
+    std::vector<int> rateList = numbers(rates);
+    int most = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        if (counts[i] > (int)LOG_MAX_THREADS)
+            counts[i] = LOG_MAX_THREADS;
+        if (counts[i] > most)
+            most = counts[i];
+    }
+
+    if (!logStart(path))
+    {
+        fprintf(stderr, "loglab: cannot write %s\n", path);
+        return 1;
+    }
+    std::vector<Producer> producers(most);
+    std::vector<PlatformThread> handles(most);
+    for (int i = 0; i < most; i++)
+    {
+        producers[i].index = i;
+        producers[i].ns.resize(LOGLAB_BUCKETS);
+        platformStartThread(handles[i], producerThread, &producers[i]);
+    }
+
+    printf("threads,rate,records,written,dropped,record_p50_ns,record_p99_ns,record_max_ns,formatted_per_s\n");
+    fflush(stdout);
+    for (size_t c = 0; c < counts.size(); c++)
+        for (size_t r = 0; r < rateList.size(); r++)
+            if (counts[c] > 0)
+                run(producers, counts[c], rateList[r], seconds);
+
+    atomicStore(&gQuit, 1);
+    for (int i = 0; i < most; i++)
+        platformJoinThread(handles[i]);
+    logStop();
+    fprintf(stderr, "%s", logReport().c_str());
+    return 0;
+}
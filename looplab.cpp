@@ -0,0 +1,280 @@
+// looplab: the game loop two ways against a stand-in renderer, to compare
+// how a slow frame and a slow step affect each other.
+//
+//   single    one thread draws a frame, then runs the steps the time
+//             since the last frame calls for, as the game used to
+//   threaded  a simulation thread steps on the clock and publishes a
+//             snapshot through a triple buffer after each step; the
+//             render thread draws the newest, a step behind
+//
+// Drawing is stood in for by spinning for --frame-ms, with a --spike-ms
+// frame every --spike-every frames; a step can be made slow the same way
+// (a results write, a session flush).  For each loop it reports the
+// frames and steps per second, how late steps ran against the time they
+// stand for, and how old the simulated moment on screen was when each
+// frame finished.
+#include "game.h"
+#include "realtime.h"
+#include "triplebuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct LoopOptions {
+    int seconds;
+    int frameUs;
+    int spikeUs;
+    int spikeEvery;
+    int stepSpikeUs;
+    int stepSpikeEvery;
+};
+
+struct LoopLog {
+    uint32_t              frames;
+    uint32_t              steps;
+    std::vector<uint32_t> stepLateUs;   // ran this long after it was due
+    std::vector<uint32_t> ageUs;        // frame done this long after the moment it shows
+    std::vector<uint32_t> frameUs;      // time between frames
+};
+
+// The simulation as the game runs it, with a paddle chasing the puck
+struct LoopSim {
+    GameConfig config;
+    GameState  state;
+    uint32_t   count;
+
+    void init()
+    {
+        gameDefaultConfig(config);
+        config.practice = true;
+        gameInit(state, config);
+        count = 0;
+    }
+
+    void step(const LoopOptions& options)
+    {
+        PlayerInput input[PLAYER_COUNT];
+        input[PLAYER_1] = gameMakeInput(state.puckY, state.freeze != 0);
+        input[PLAYER_2] = gameMakeInput(0, false);
+        gameStep(state, config, input);
+        count++;
+        if (options.stepSpikeEvery > 0 && count % (uint32_t)options.stepSpikeEvery == 0)
+            spin(options.stepSpikeUs);
+    }
+
+    static void spin(int us)
+    {
+        uint64_t end = platformMicros() + us;
+        while (platformMicros() < end)
+            ;
+    }
+};
+
+static void drawFrame(const LoopOptions& options, uint32_t frame)
+{
+    bool spike = options.spikeEvery > 0 && frame % (uint32_t)options.spikeEvery == (uint32_t)options.spikeEvery - 1;
+    LoopSim::spin(spike ? options.spikeUs : options.frameUs);
+}
+
+static void runSingle(const LoopOptions& options, LoopLog& log)
+{
+    LoopSim sim;
+    sim.init();
+    uint64_t start = platformMicros();
+    uint64_t end = start + (uint64_t)options.seconds * 1000000;
+    uint64_t last = start, accumulated = 0, shown = start, previousFrame = start;
+
+    for (log.frames = 0; platformMicros() < end; log.frames++)
+    {
+        // Draw what the last frame's steps left, then step
+        drawFrame(options, log.frames);
+        uint64_t done = platformMicros();
+        log.ageUs.push_back((uint32_t)(done - shown));
+        log.frameUs.push_back((uint32_t)(done - previousFrame));
+        previousFrame = done;
+
+        uint64_t now = platformMicros();
+        accumulated += now - last;
+        last = now;
+        if (accumulated > 100 * GAME_STEP_US)
+            accumulated = GAME_STEP_US;
+        while (accumulated >= GAME_STEP_US)
+        {
+            accumulated -= GAME_STEP_US;
+            uint64_t due = now - accumulated;
+            sim.step(options);
+            log.stepLateUs.push_back((uint32_t)(platformMicros() - due));
+            shown = due;
+        }
+    }
+    log.steps = sim.count;
+}
+
+struct Snapshot {
+    uint64_t due;
+    double   puckX, puckY;
+};
+
+struct Threaded {
+    const LoopOptions*     options;
+    LoopLog*               log;
+    TripleBuffer<Snapshot> snapshots;
+    volatile uint32_t      stop;
+};
+
+static void simThread(void* arg)
+{
+    Threaded& t = *(Threaded*)arg;
+    LoopSim sim;
+    sim.init();
+    uint64_t last = platformMicros(), accumulated = 0;
+    while (atomicLoad(&t.stop) == 0)
+    {
+        uint64_t now = platformMicros();
+        accumulated += now - last;
+        last = now;
+        if (accumulated > 100 * GAME_STEP_US)
+            accumulated = GAME_STEP_US;
+        while (accumulated >= GAME_STEP_US)
+        {
+            accumulated -= GAME_STEP_US;
+            uint64_t due = now - accumulated;
+            sim.step(*t.options);
+            t.log->stepLateUs.push_back((uint32_t)(platformMicros() - due));
+
+            Snapshot& next = t.snapshots.back();
+            next.due = due;
+            next.puckX = sim.state.puckX;
+            next.puckY = sim.state.puckY;
+            t.snapshots.publish();
+        }
+        rtSleepUntil(last + GAME_STEP_US - accumulated);
+    }
+    t.log->steps = sim.count;
+}
+
+static void runThreaded(const LoopOptions& options, LoopLog& log)
+{
+    Threaded t;
+    t.options = &options;
+    t.log = &log;
+    t.stop = 0;
+    Snapshot& first = t.snapshots.back();
+    first.due = platformMicros();
+    first.puckX = first.puckY = 0;
+    t.snapshots.publish();
+
+    PlatformThread thread;
+    if (!platformStartThread(thread, simThread, &t))
+        return;
+
+    uint64_t start = platformMicros();
+    uint64_t end = start + (uint64_t)options.seconds * 1000000;
+    uint64_t previousFrame = start;
+    for (log.frames = 0; platformMicros() < end; log.frames++)
+    {
+        // The game draws a step behind the newest snapshot
+        t.snapshots.acquire();
+        uint64_t shown = t.snapshots.front().due - GAME_STEP_US;
+        drawFrame(options, log.frames);
+        uint64_t done = platformMicros();
+        log.ageUs.push_back((uint32_t)(done - shown));
+        log.frameUs.push_back((uint32_t)(done - previousFrame));
+        previousFrame = done;
+    }
+
+    atomicStore(&t.stop, 1);
+    platformJoinThread(thread);
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+static void report(const char* name, const LoopOptions& options, const LoopLog& log)
+{
+    printf("%s,%.1f,%.1f,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", name,
+           log.frames / (double)options.seconds, log.steps / (double)options.seconds,
+           percentile(log.frameUs, 0.5), percentile(log.frameUs, 0.99), percentile(log.frameUs, 1.0),
+           percentile(log.stepLateUs, 0.5), percentile(log.stepLateUs, 0.99), percentile(log.stepLateUs, 1.0),
+           percentile(log.ageUs, 0.5), percentile(log.ageUs, 0.99), percentile(log.ageUs, 1.0));
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool looplab [options]\n"
+        "  --seconds N          time for each loop (default 3)\n"
+        "  --frame-ms N         drawing time of a frame (default 6)\n"
+        "  --spike-ms N         drawing time of a slow frame (default 40)\n"
+        "  --spike-every N      frames between slow frames (default 30, 0 none)\n"
+        "  --step-spike-ms N    time of a slow step (default 20)\n"
+        "  --step-spike-every N steps between slow steps (default 200, 0 none)\n"
+        "  --only single|threaded\n");
+}
+
+int looplabMain(int argc, char* argv[])
+{
+    LoopOptions options;
+    options.seconds = 3;
+    options.frameUs = 6000;
+    options.spikeUs = 40000;
+    options.spikeEvery = 30;
+    options.stepSpikeUs = 20000;
+    options.stepSpikeEvery = 200;
+    bool single = true, threaded = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            options.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frame-ms") == 0 && hasValue)
+            options.frameUs = atoi(argv[++i]) * 1000;
+        else if (strcmp(argv[i], "--spike-ms") == 0 && hasValue)
+            options.spikeUs = atoi(argv[++i]) * 1000;
+        else if (strcmp(argv[i], "--spike-every") == 0 && hasValue)
+            options.spikeEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--step-spike-ms") == 0 && hasValue)
+            options.stepSpikeUs = atoi(argv[++i]) * 1000;
+        else if (strcmp(argv[i], "--step-spike-every") == 0 && hasValue)
+            options.stepSpikeEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--only") == 0 && hasValue)
+        {
+            threaded = strcmp(argv[++i], "threaded") == 0;
+            single = !threaded;
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (options.seconds < 1)
+        options.seconds = 1;
+
+    printf("# frame %d us, slow frame %d us every %d, slow step %d us every %d, step %u us\n",
+           options.frameUs, options.spikeUs, options.spikeEvery,
+           options.stepSpikeUs, options.stepSpikeEvery, (unsigned)GAME_STEP_US);
+    printf("loop,frames_per_s,steps_per_s,frame_p50_us,frame_p99_us,frame_max_us,"
+           "step_late_p50_us,step_late_p99_us,step_late_max_us,age_p50_us,age_p99_us,age_max_us\n");
+    if (single)
+    {
+        LoopLog log;
+        runSingle(options, log);
+        report("single", options, log);
+    }
+    if (threaded)
+    {
+        LoopLog log;
+        runThreaded(options, log);
+        report("threaded", options, log);
+    }
+    return 0;
+}
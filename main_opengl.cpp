@@ -15,47 +15,223 @@
 #include "glut.h"
 #include <math.h>
 #include "haptics.h"
+#include "game.h"
+#include "arena.h"
+#include "netplay.h"
+#include "session.h"
+#include "params.h"
+#include "realtime.h"
+#include "trace.h"
+#include "input.h"
+#include "triplebuffer.h"
+#include "alloc.h"
+#include "eventbus.h"
+#include "predict.h"
+#include "capture.h"
+#include "log.h"
+#include "spectator.h"
 #include <sstream>
+#include <vector>
 #include <shlobj.h>
 #include <iostream>
 #include <fstream>
 
-#define HAPTIC	1
-#define PCPLAYER 1
-#define REBOUNDS 100
-
-double NORTH = 1.0;
-double SOUTH = -1.0;
-double EAST = 1.5;
-double WEST = -1.5;
-
-int SCORE_P1 = 0;
-int SCORE_P2 = 0;
-
-int hits = 0;
-int misses = 0;
-
 enum Sound { LEFT_HIT, RIGHT_HIT, SCORE };
 
+// The mode, chosen at startup rather than built in: the rules (--mode
+// practice or match) and where each paddle comes from (--p1 device or
+// mouse, --p2 mouse or ai).  Over the network player 2 is the peer, and
+// a replay plays both.
+enum PlayerSource { SOURCE_DEVICE, SOURCE_MOUSE, SOURCE_AI };
+bool gPractice = true;
+PlayerSource gPlayer1 = SOURCE_DEVICE;
+PlayerSource gPlayer2 = SOURCE_MOUSE;
+bool gUseDevice;
+
+// Whether the device is playing player 1 (simulation thread).  Until it
+// is ready, or if it fails, the mouse plays player 1 instead and the AI
+// player 2, since one mouse can't play both sides.
+bool gDeviceReady;
+
+// The steps for that mode, picked once the rules are known: the game's
+// (game.h), and around it the one that gathers the paddles, picked again
+// when the device comes or goes
+typedef unsigned int ( *PlayStepFn )( uint64_t now, bool click );
+GameStepFn gStep;
+PlayStepFn gPlayStep;
+
+// The simulation, and the copy of it the screen and haptics look at.
+// When playing as player 2 over the network the view is mirrored, so
+// the local player is always on the right.
+GameConfig gConfig;
+GameState gState;
 double xposb, yposb;
 double yposp1, xposp1;
 double yposp2, xposp2;
-double xmov, ymov;
-int freeze;
 int mRot;
 int spin;
-SYSTEMTIME lasttime;
 
+// Simulation time not yet stepped
+uint64_t gLastUs;
+uint64_t gAccumulatedUs;
+
+// The simulation runs on a thread of its own and hands the screen a
+// snapshot after every step, through a triple buffer so that neither
+// ever waits for the other.  The screen draws a step behind, blending
+// the last two steps.  Everything above belongs to the simulation thread
+// once it is running.
+struct ViewState {
+	double puckX, puckY;
+	double leftY;
+};
+
+struct Snapshot {
+	uint64_t  us;               // when the newest step was due
+	uint32_t  step;             // the newest step
+	ViewState before, after;    // the step before it, and the newest
+	bool      cut;              // the puck jumped (serve, score); don't blend
+	int       spin;
+	double    rightY;           // the local paddle and the device cursor,
+	double    cursor[3];        // newest, since they follow the hand
+	uint32_t  leadUs;           // how far ahead to draw the hand; 0 not to
+	bool      button;
+	double    rightX, leftX;
+	double    edgeLength, north, south, east, west;
+	const Arena* arena;
+};
+
+TripleBuffer<Snapshot> gSnapshots;
+ViewState gLastView;
+double gCursor[3];
+bool gButton;
+PlatformThread gSimThread;
+bool gSimRunning;
+volatile uint32_t gSimStop;
+
+// The local paddle and the cursor are drawn where the hand will be when
+// the frame is seen, predicted from the servo's readings (predict.h).
+// The game still plays the hand where it was read.
+MotionPredictor gHandPredictor;
+uint32_t gHandNext;
+
+// What happens in the game goes out on the event bus.  The servo thread
+// plays the haptic effects; the window plays the sounds, prints the
+// score and keeps the practice results, each with a reader of its own.
+EventBus gEvents;
+EventReader gSoundEvents;
+EventReader gResultsEvents;
+int gLocalPlayer = PLAYER_1;
+bool gKeepResults;
+
+// The practice session is over and the simulation has stopped; and a
+// request from the window to move to the next (1) or previous (2) rally
+volatile uint32_t gQuit;
+volatile uint32_t gSeekRequest;
+int gAvoidCpu = -1;
+
+// Walls and bumpers from --arena; the plain playfield without it
+Arena gArena;
+const char* gArenaPath = NULL;
+
+// The mouse.  Events come stamped from the capture thread, or from the
+// GLUT callbacks if raw input is unavailable, and each step applies the
+// ones that happened before it.  Until the device is ready the mouse
+// stands in for it.
+InputCapture gInput;
+double gPointerY;
+bool gMouseClick;
+
+// The device bring-up, as last shown in the title bar.  --device-wait is
+// how long startup waits for it before play begins without it.
+int gDeviceWaitMs = 2000;
+HapticsStatus gDeviceStatus = HAPTICS_OFF;
+bool gDeviceHomed;
+
+// How long each part of startup took
+uint64_t gStartupStartUs;
+uint64_t gStartupMarkUs;
+std::string gStartupReport;
+
+// --log: where the log goes (log.h); the debug output if not given
+const char* gLogPath = NULL;
+
+// --capture: video of the playfield (capture.h).  Each frame is read
+// back into one of two pixel buffer objects in turn and collected the
+// frame after, once the copy is done; without them, with glReadPixels.
+const char* gCapturePath = NULL;
+VideoCapture gCapture;
+GLuint gCaptureBuffers[2];
+bool gCapturePending[2];
+uint32_t gCaptureStep[2];
+uint64_t gCaptureUs[2];
+uint32_t gCaptureFrames;
+
+// --spectate: every step goes out on the spectator feed (spectator.h),
+// for other processes on this machine to watch.  Only one game at a time
+// can publish, so it is off unless asked for.
+bool gSpectate;
+SpectatorFeed gSpectators;
+
+// Pixel buffer objects are OpenGL 2.1, or ARB_pixel_buffer_object
+// before it; the gl.h that comes with Windows is 1.1
+#define CAPTURE_PIXEL_PACK_BUFFER	0x88EB
+#define CAPTURE_STREAM_READ			0x88E1
+#define CAPTURE_READ_ONLY			0x88B8
+typedef void ( APIENTRY *GenBuffersProc )( GLsizei n, GLuint* buffers );
+typedef void ( APIENTRY *BindBufferProc )( GLenum target, GLuint buffer );
+typedef void ( APIENTRY *BufferDataProc )( GLenum target, ptrdiff_t size, const void* data, GLenum usage );
+typedef void* ( APIENTRY *MapBufferProc )( GLenum target, GLenum access );
+typedef GLboolean ( APIENTRY *UnmapBufferProc )( GLenum target );
+GenBuffersProc gGenBuffers;
+BindBufferProc gBindBuffer;
+BufferDataProc gBufferData;
+MapBufferProc gMapBuffer;
+UnmapBufferProc gUnmapBuffer;
+
+// Sounds, loaded at startup
+std::vector<char> gSounds[3];
+
+// Networked play, when --net is given
+NetSession gNet;
+const char* gNetHost = NULL;
+int gNetPort = NET_DEFAULT_PORT;
+int gNetRemotePort = NET_DEFAULT_PORT;
+int gNetPlayer = PLAYER_1;
+
+// Every match is recorded; --replay plays one back instead
+SessionWriter gSession;
+uint32_t gRecorded;
+SessionReader gReplay;
+const char* gReplayPath = NULL;
+int gReplayRally = 0;
+
+// Results.txt, and the parameters as last written to it (window thread)
 std::ofstream myfile;
-
-
-
-// Cube parameters
-const double gStiffness = 200.0;
-const double gCubeEdgeLength = 0.5;
+GameParams gResultsParams;
+
+// Tuning parameters, shared with the servo thread and hgtool tune.
+// Documents/HapticsGame/Params.ini is reloaded whenever it changes, by
+// the window thread, which owns the path, stamp and check time.
+ParamBlock* gParamBlock;
+GameParams gParams;
+uint32_t gParamsVersion;
+char gParamsPath[MAX_PATH];
+uint64_t gParamsStamp;
+uint64_t gParamsCheckUs;
+
+// A writer seen holding the block, and since when (params.h)
+uint32_t gParamsStuck;
+uint64_t gParamsStuckUs;
+
+// --rt: real-time priority and locked memory for the servo thread, pinned
+// to --servo-cpu or a quiet core, with the render loop kept off that core
+bool gRealtime = false;
+int gServoCpu = -1;
+bool gServoPolicyLogged;
 
 // Some OpenGL values
 static GLuint gCursorDisplayList = 0;
+static GLuint gArenaDisplayList = 0;
 static double gCursorRadius = 0.05;
 static GLfloat colorRed[]  = {1.0, 0.0, 0.0};
 static GLfloat colorTeal[] = {0.0, 0.5, 0.5};
@@ -73,20 +249,97 @@ void exitHandler(void);
 void initGL();
 void initScene();
 void drawGraphics();
-void drawCursor();
+struct Snapshot;
+void updateSounds();
+void updateResults();
+void writeParamChanges();
+void reloadParams();
+bool predictHand( uint32_t leadUs, double& y );
+void drawCursor( const Snapshot& view, double cursorY );
+void drawArena( const Arena* arena );
+void updateView();
+void updateParams();
+void updateDeviceStatus();
 
 void glutMouseMove(int x, int y);
 void glutMouse( int button, int state, int x, int y );
+void applyInput( uint64_t stepUs );
+void publishView( uint64_t us, bool cut );
+void UpdatePos();
+PlayStepFn playStepFor();
+bool deviceReady();
+void simThread( void* arg );
+void stopSim();
 
 void playSound( Sound sound );
+void writeTrace();
+void startCapture();
+void captureFrame();
 
 
 
 int main(int argc, char *argv[])
 {
 	AllocConsole();
+	TRACE_THREAD( "main" );
     // Normal OpenGL Setup
     glutInit(&argc, argv);
+
+	// Networked play: --net host [--port n] [--remote-port n] [--player 1|2]
+	// Playback: --replay session.hgs [--rally n]
+	// Servo scheduling: --rt [--servo-cpu n]
+	// Obstacle course: --arena file
+	// Startup: --device-wait ms
+	// Video of the playfield: --capture file.y4m
+	// Log to a file rather than the debug output: --log file
+	// Publish every step for spectators on this machine: --spectate
+	// Rules and players: --mode practice|match --p1 device|mouse --p2 mouse|ai
+	// Stop at any allocation in the servo tick, a step or a frame: --alloc-trap
+	for( int i = 1; i < argc; i++ ){
+		bool hasValue = i + 1 < argc;
+		if( strcmp( argv[i], "--net" ) == 0 && hasValue ){
+			gNetHost = argv[++i];
+		}else if( strcmp( argv[i], "--port" ) == 0 && hasValue ){
+			gNetPort = atoi( argv[++i] );
+		}else if( strcmp( argv[i], "--remote-port" ) == 0 && hasValue ){
+			gNetRemotePort = atoi( argv[++i] );
+		}else if( strcmp( argv[i], "--player" ) == 0 && hasValue ){
+			gNetPlayer = ( atoi( argv[++i] ) == 2 ? PLAYER_2 : PLAYER_1 );
+		}else if( strcmp( argv[i], "--replay" ) == 0 && hasValue ){
+			gReplayPath = argv[++i];
+		}else if( strcmp( argv[i], "--rally" ) == 0 && hasValue ){
+			gReplayRally = atoi( argv[++i] );
+		}else if( strcmp( argv[i], "--rt" ) == 0 ){
+			gRealtime = true;
+		}else if( strcmp( argv[i], "--servo-cpu" ) == 0 && hasValue ){
+			gServoCpu = atoi( argv[++i] );
+		}else if( strcmp( argv[i], "--arena" ) == 0 && hasValue ){
+			gArenaPath = argv[++i];
+		}else if( strcmp( argv[i], "--device-wait" ) == 0 && hasValue ){
+			gDeviceWaitMs = atoi( argv[++i] );
+		}else if( strcmp( argv[i], "--capture" ) == 0 && hasValue ){
+			gCapturePath = argv[++i];
+		}else if( strcmp( argv[i], "--log" ) == 0 && hasValue ){
+			gLogPath = argv[++i];
+		}else if( strcmp( argv[i], "--spectate" ) == 0 ){
+			gSpectate = true;
+		}else if( strcmp( argv[i], "--mode" ) == 0 && hasValue ){
+			gPractice = strcmp( argv[++i], "match" ) != 0;
+		}else if( strcmp( argv[i], "--p1" ) == 0 && hasValue ){
+			gPlayer1 = strcmp( argv[++i], "mouse" ) == 0 ? SOURCE_MOUSE : SOURCE_DEVICE;
+		}else if( strcmp( argv[i], "--p2" ) == 0 && hasValue ){
+			gPlayer2 = strcmp( argv[++i], "ai" ) == 0 ? SOURCE_AI : SOURCE_MOUSE;
+		}else if( strcmp( argv[i], "--alloc-trap" ) == 0 ){
+			allocTrap( true );
+		}
+	}
+
+	// One mouse can't play both sides
+	if( gPlayer1 == SOURCE_MOUSE && gPlayer2 == SOURCE_MOUSE ){
+		gPlayer2 = SOURCE_AI;
+	}
+	gUseDevice = gPlayer1 == SOURCE_DEVICE;
+
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(500, 500);
     glutCreateWindow("Basic--OpenGL");
@@ -113,8 +366,23 @@ int main(int argc, char *argv[])
 // drawing callback function
 void glutDisplay()
 {   
-    drawGraphics();
-    glutSwapBuffers();
+    TRACE_SCOPE( "frame" );
+	updateDeviceStatus();
+    {
+        TRACE_SCOPE( "draw" );
+        drawGraphics();
+    }
+	updateSounds();
+	updateResults();
+	reloadParams();
+	if( gCapture.isOpen() ){
+		TRACE_SCOPE( "capture" );
+		captureFrame();
+	}
+    {
+        TRACE_SCOPE( "swapBuffers" );
+        glutSwapBuffers();
+    }
 }
 
 // reshape function (handle window resize)
@@ -150,91 +418,293 @@ void glutIdle()
 }
 
 
-// Handle keyboard.  In this case, just the Escape key
+// Handle keyboard.  Escape quits; during a replay n and p move
+// to the next and previous rally.
 void glutKeyboard(unsigned char key, int x, int y)
 {
     static bool inited = true;
 
     if (key == 27) // esc key
     {
-		#if PCPLAYER
-			myfile << std::endl;
-			myfile.close();
-		#endif
         exit(0);
     }
+
+	if( key == 't' ){
+		writeTrace();
+	}
+
+	if( gReplayPath != NULL && ( key == 'n' || key == 'p' ) ){
+		atomicStore( &gSeekRequest, key == 'n' ? 1 : 2 );
+	}
 }
 
-// Handle mouse movement
+// Handle mouse movement, when the capture thread is not
 void glutMouseMove( int x, int y){
-#if !PCPLAYER
-	yposp2 = (y - 250) / -(500 / 3.0);
-	if( yposp2 + gCubeEdgeLength / 2 > NORTH ){
-		yposp2 = NORTH - gCubeEdgeLength / 2;
+	if( gInput.running() ){
+		return;
 	}
+	InputEvent event;
+	memset( &event, 0, sizeof( event ) );
+	event.us = platformMicros();
+	event.type = INPUT_POINTER;
+	event.x = x;
+	event.y = y;
+	gInput.push( event );
+}
 
-	if( yposp2 - gCubeEdgeLength / 2 < SOUTH ){
-		yposp2 = SOUTH + gCubeEdgeLength / 2;
+void glutMouse( int button, int state, int x, int y ){
+	if( gInput.running() ){
+		return;
 	}
-#endif
+	InputEvent event;
+	memset( &event, 0, sizeof( event ) );
+	event.us = platformMicros();
+	event.type = INPUT_BUTTON;
+	event.code = (uint16_t)button;
+	event.down = ( state == GLUT_DOWN );
+	gInput.push( event );
 }
 
-void glutMouse( int button, int state, int x, int y ){
-	if( button == 0 && freeze == 2 ){
-		freeze = 0;
+// Apply the mouse events that happened up to a step's time.  A click
+// serves for the mouse's player; it is held until a step sees it.
+void applyInput( uint64_t stepUs ){
+	InputEvent event;
+	while( gInput.popUntil( stepUs, event ) ){
+		if( event.type == INPUT_POINTER ){
+			gPointerY = (event.y - 250) / -(500 / 3.0);
+			if( gPointerY + gConfig.edgeLength / 2 > gConfig.north ){
+				gPointerY = gConfig.north - gConfig.edgeLength / 2;
+			}
+
+			if( gPointerY - gConfig.edgeLength / 2 < gConfig.south ){
+				gPointerY = gConfig.south + gConfig.edgeLength / 2;
+			}
+		}else if( event.type == INPUT_BUTTON && event.code == 0 && event.down ){
+			gMouseClick = true;
+		}
+	}
+}
+
+// Mark the end of a startup phase: log how long it took since the last
+void startupPhase( const char* name ){
+	uint64_t now = platformMicros();
+	char line[96];
+	sprintf( line, "startup: %-10s %7.1f ms\n", name, ( now - gStartupMarkUs ) / 1000.0 );
+	gStartupReport += line;
+	gStartupMarkUs = now;
+}
+
+// Load a sound into memory, so playing it does not wait on the disk
+void loadSound( Sound sound, const char* name ){
+	char path[MAX_PATH];
+	SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, path );
+	strcat( path, "\\Documents\\HapticsGame\\" );
+	strcat( path, name );
+
+	gSounds[sound].clear();
+	FILE* file = fopen( path, "rb" );
+	if( file == NULL ){
+		return;
+	}
+	char chunk[16384];
+	size_t got;
+	while( ( got = fread( chunk, 1, sizeof( chunk ), file ) ) > 0 ){
+		gSounds[sound].insert( gSounds[sound].end(), chunk, chunk + got );
 	}
+	fclose( file );
 }
 
-// Scene setup
+// Scene setup.  The device comes up on a thread of its own while the
+// window, files and sounds are set up here; if it is not ready by the
+// end, play starts without it and picks it up when it is.
 void initScene()
 {
+	gStartupStartUs = platformMicros();
+	gStartupMarkUs = gStartupStartUs;
+	gStartupReport.clear();
+
+	// Start from the defaults with Params.ini on top
+	gParamBlock = paramsShared( true );
+	SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, gParamsPath );
+	strcat( gParamsPath, "/Documents/HapticsGame/Params.ini" );
+	gParamsStamp = paramsFileStamp( gParamsPath );
+	if( !paramsRead( gParamBlock, gParams, gParamsVersion ) ){
+		paramsDefault( gParams );
+	}
+	std::string rejected;
+	if( paramsLoadFile( gParamsPath, gParams, rejected ) && paramsWrite( gParamBlock, gParams ) ){
+		paramsRead( gParamBlock, gParams, gParamsVersion );
+	}
+	if( !rejected.empty() ){
+		OutputDebugString( ( "Params.ini: skipped\n" + rejected ).c_str() );
+	}
+	gResultsParams = gParams;
+
+	gameDefaultConfig( gConfig );
+	gConfig.edgeLength = gParams.cubeEdgeLength;
+	gConfig.rebounds = gParams.rebounds;
+	gConfig.speedUp = gParams.speedUp;
+	gConfig.practice = gPractice && gNetHost == NULL;
+	if( gArenaPath != NULL ){
+		std::string error;
+		if( !gArena.load( gArenaPath, error ) ){
+			MessageBox(NULL, error.c_str(), "Not an arena file", MB_OK);
+			exit(0);
+		}
+		gConfig.arena = &gArena;
+	}
+	gameInit( gState, gConfig );
+	startupPhase( "params" );
+
+    // Start bringing the device up; the arena it bakes is known by now
+	if( gUseDevice ){
+		gHaptics.setArena( gConfig.arena, gConfig.east, gNetHost != NULL && gNetPlayer == PLAYER_2 );
+		gHaptics.startInit(gParamBlock);
+	}
+
+	if( gReplayPath != NULL ){
+		if( !gReplay.open( gReplayPath ) ){
+			MessageBox(NULL, gReplayPath, "Not a session file", MB_OK);
+			exit(0);
+		}
+		gConfig = gReplay.config();
+		if( !gReplay.seekRally( gReplayRally, gState ) ){
+			gReplayRally = 0;
+			gReplay.seekRally( 0, gState );
+		}
+		startupPhase( "replay" );
+	}
+
+	if( gNetHost != NULL ){
+		if( !gNet.open( gNetPort, gNetHost, gNetRemotePort, gNetPlayer ) ){
+			MessageBox(NULL, "Could not open network connection", "Network Failure", MB_OK);
+			exit(0);
+		}
+		gNet.start( gState, gConfig );
+		startupPhase( "network" );
+	}
 
-	xposp1 = EAST + gCubeEdgeLength / 4.0;
+	xposp1 = gConfig.east + gConfig.edgeLength / 4.0;
 	yposp1 = 0;
-	xposp2 = WEST - gCubeEdgeLength / 4.0;
-	yposp2 = 0;
-	xposb = 0;
-	yposb = 0;
-	xmov = 0.7;
-	ymov = 0.7;
-	freeze = 0;
+	xposp2 = gConfig.west - gConfig.edgeLength / 4.0;
+	gPointerY = 0;
+	gMouseClick = false;
 	mRot = 0;
-	spin = 1;
+	updateView();
+	gInput.startSystem( WindowFromDC( wglGetCurrentDC() ), NULL );
+	OutputDebugString( gInput.report().c_str() );
+	startupPhase( "input" );
 
-	#if PCPLAYER
+	if( gConfig.practice ){
 		char path[MAX_PATH];
 		SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, path );
 		strcat( path, "/Documents/HapticsGame/Results.txt");
 		myfile.open( path, std::ios.app );
-	#endif
+	}
 
-    // Call the haptics initialization function
-#if HAPTIC
-	gHaptics.init(gCubeEdgeLength, gStiffness, gCubeEdgeLength / 2);
-#endif
+	// Record the match next to the results, named for when it started
+	if( gReplayPath == NULL ){
+		char sessionPath[MAX_PATH];
+		char name[64];
+		SYSTEMTIME now;
+		GetLocalTime( &now );
+		sprintf( name, "/Documents/HapticsGame/Session-%04d%02d%02d-%02d%02d%02d.hgs",
+				 now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond );
+		SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, sessionPath );
+		strcat( sessionPath, name );
+		gSession.open( sessionPath, gConfig );
+		gRecorded = 0;
+	}
+	startupPhase( "files" );
+
+	// Check what the policy achieves before the servo thread takes it on
+	if( gRealtime ){
+		RtPolicy policy;
+		rtServoPolicy( policy, gServoCpu );
+		std::string report = rtLockMemory( policy );
+		std::vector<uint32_t> lateUs;
+		std::string threadReport;
+		if( rtSelfCheck( policy, 1000, 250, lateUs, threadReport ) ){
+			report += threadReport + "servo jitter: " + rtJitterSummary( lateUs ) + "\n";
+		}
+		report += rtAvoidCpu( policy.cpu );
+		gAvoidCpu = policy.cpu;
+		OutputDebugString( report.c_str() );
+		if( gUseDevice ){
+			gHaptics.setServoPolicy( policy );
+		}
+		startupPhase( "realtime" );
+	}
+
+	// The formatter stays off the servo's core like every other helper
+	if( !logStart( gLogPath, gAvoidCpu ) ){
+		OutputDebugString( "log: cannot start, records wait in the rings\n" );
+	}
 
     // Set up the OpenGL graphics
     initGL();
+	startupPhase( "graphics" );
 
-    // Some time is required between init() and checking status,
-    // for the device to initialize and stabilize.  In a complex
-    // application, this time can be consumed in the initGL()
-    // function.  Here, it is simulated with Sleep().
-    Sleep(100);
-
-    // Tell the user what to do if the device is not calibrated
-#if HAPTIC
-	if (!gHaptics.isDeviceCalibrated())
-        MessageBox(NULL, 
-                   // The next two lines are one long string
-                   "Please home the device by extending\n"
-                   "then pushing the arms all the way in.",
-                   "Not Homed",
-                   MB_OK);
-#endif
+	if( gCapturePath != NULL ){
+		startCapture();
+		startupPhase( "capture" );
+	}
 
+	loadSound( LEFT_HIT, "leftPaddleHit.wav" );
+	loadSound( RIGHT_HIT, "rightPaddleHit.wav" );
+	if( !gConfig.practice ){
+		loadSound( SCORE, "gruntScore.wav" );
+	}
+	startupPhase( "sounds" );
+
+	// Whatever the device still needs is waited for here, up to
+	// --device-wait; after that play starts without it
+	if( gUseDevice ){
+		gHaptics.waitReady( gDeviceWaitMs );
+		startupPhase( "device" );
+	}
 
-	GetSystemTime(&lasttime);
+	char total[96];
+	sprintf( total, "startup: total      %7.1f ms\n", ( platformMicros() - gStartupStartUs ) / 1000.0 );
+	gStartupReport += total;
+	OutputDebugString( gStartupReport.c_str() );
+	updateDeviceStatus();
+
+	// The mode is settled by now; its steps are picked here
+	gStep = gameStepFor( gConfig );
+	gDeviceReady = deviceReady();
+	gPlayStep = playStepFor();
+
+	if( gSpectate ){
+		if( !gSpectators.open() || !gSpectators.isShared() ){
+			OutputDebugString( "spectate: no shared memory, nobody can watch\n" );
+		}
+		gSpectators.configure( gConfig );
+	}
+
+	gLastUs = platformMicros();
+	gAccumulatedUs = 0;
+
+	// The screen has something to draw from the start
+	updateView();
+	gLastView.puckX = xposb;
+	gLastView.puckY = yposb;
+	gLastView.leftY = yposp2;
+	publishView( gLastUs, true );
+
+	// Everyone who reads the event bus starts reading before the first step
+	gLocalPlayer = gNetHost != NULL ? gNet.localPlayer() : PLAYER_1;
+	gKeepResults = gConfig.practice && gReplayPath == NULL;
+	gSoundEvents.attach( gEvents );
+	gResultsEvents.attach( gEvents );
+	gHaptics.listen( gEvents, gLocalPlayer );
+
+	gSimStop = 0;
+	gSimRunning = platformStartThread( gSimThread, simThread, NULL );
+	if( !gSimRunning ){
+		MessageBox(NULL, "Could not start the simulation thread", "Startup Failure", MB_OK);
+		exit(0);
+	}
 }
 
 // Set up OpenGL.  Details are left to the reader
@@ -268,7 +738,23 @@ void initGL()
 // Make sure we exit cleanly
 void exitHandler()
 {
+    stopSim();
+    gInput.stop();
+	if( gCapture.isOpen() ){
+		gCapture.close();
+		OutputDebugString( gCapture.report().c_str() );
+	}
     gHaptics.uninit();
+    gSession.close();
+	if( myfile.is_open() ){
+		myfile << std::endl;
+		myfile.close();
+	}
+	OutputDebugString( allocReport().c_str() );
+    writeTrace();
+	gSpectators.close();
+	logStop();
+	OutputDebugString( logReport().c_str() );
 }
 
 float CalculateTimeLeft(SYSTEMTIME timeTo, SYSTEMTIME timeFrom )
@@ -294,291 +780,554 @@ float CalculateTimeLeft(SYSTEMTIME timeTo, SYSTEMTIME timeFrom )
     return fReturn;
 }
 
-long double Delta(const SYSTEMTIME st1, const SYSTEMTIME st2)
-{
-    union timeunion {
-        FILETIME fileTime;
-        ULARGE_INTEGER ul;
-    } ;
-    
-    timeunion ft1;
-    timeunion ft2;
+// The simulation as it currently stands, networked or not
+const GameState& currentState(){
+	return gNetHost != NULL ? gNet.state() : gState;
+}
 
-    SystemTimeToFileTime(&st1, &ft1.fileTime);
-    SystemTimeToFileTime(&st2, &ft2.fileTime);
+// Copy the simulation into the globals the screen and haptics use
+void updateView(){
+	const GameState& state = currentState();
+	bool mirror = gNetHost != NULL && gNet.localPlayer() == PLAYER_2;
 
-    return (long double)( ft2.ul.QuadPart - ft1.ul.QuadPart ) / 10000.0; // milliseconds
+	xposb = mirror ? -state.puckX : state.puckX;
+	yposb = state.puckY;
+	yposp2 = state.paddleY[ mirror ? PLAYER_1 : PLAYER_2 ];
+	if( !gDeviceReady ){
+		yposp1 = state.paddleY[ mirror ? PLAYER_2 : PLAYER_1 ];
+	}
+	spin = mirror ? -state.spin : state.spin;
 }
 
-void Score( int player ){
-	char letters[100];
-	sprintf( letters, "%i - %i", SCORE_P2, SCORE_P1  );
-	OutputDebugString( letters );
-	OutputDebugString("\n" );
-	playSound( SCORE );
+// Hand the screen what the last step left in the globals.  us is when
+// the step was due; cut says not to blend it with the step before.
+void publishView( uint64_t us, bool cut ){
+	Snapshot& next = gSnapshots.back();
+	next.us = us;
+	next.step = currentState().step;
+	next.before = gLastView;
+	next.after.puckX = xposb;
+	next.after.puckY = yposb;
+	next.after.leftY = yposp2;
+	next.cut = cut;
+	next.spin = spin;
+	next.rightY = yposp1;
+	for( int i = 0; i < 3; i++ ){
+		next.cursor[i] = gCursor[i];
+	}
+	next.leadUs = gReplayPath == NULL && gHaptics.status() == HAPTICS_READY && gParams.predictMs > 0
+		? (uint32_t)( gParams.predictMs * 1000 ) : 0;
+	next.button = gButton;
+	next.rightX = xposp1;
+	next.leftX = xposp2;
+	next.edgeLength = gConfig.edgeLength;
+	next.north = gConfig.north;
+	next.south = gConfig.south;
+	next.east = gConfig.east;
+	next.west = gConfig.west;
+	next.arena = gConfig.arena;
+	gLastView = next.after;
+	gSnapshots.publish();
+}
 
-	// Reset ball movement
-	xmov = (player == 1 ? 0.7 : -0.7);
-	ymov = (ymov > 0 ? 0.7 : -0.7);
+// The simulation thread: step as the clock calls for, then sleep until
+// the next step is due.  Kept off the servo's processor, like the window.
+void simThread( void* arg ){
+	TRACE_THREAD( "sim" );
+	rtAvoidCpu( gAvoidCpu );
+	while( atomicLoad( &gSimStop ) == 0 ){
+		if( atomicLoad( &gQuit ) == 0 ){
+			UpdatePos();
+		}
+		rtSleepUntil( gLastUs + GAME_STEP_US - gAccumulatedUs );
+	}
+}
 
-	if( player == 1 ){
-		freeze = 2;
-		xposb = WEST + gCubeEdgeLength;
-	}else if( player == 2 ){
-		freeze = 1;
-		xposb = EAST - gCubeEdgeLength;
+void stopSim(){
+	if( !gSimRunning ){
+		return;
 	}
+	atomicStore( &gSimStop, 1 );
+	platformJoinThread( gSimThread );
+	gSimRunning = false;
 }
 
-void BoundCheck( long double i ){
+// Put what happened in a step on the event bus; sound, force and
+// results all come from there
+void GameEvents( unsigned int events ){
+	gEvents.publishStep( currentState(), gConfig, events );
+
+	// The window thread writes the last results and does the exiting,
+	// once it reads the end of the session
+	if( gConfig.practice && gReplayPath == NULL && ( events & GAME_EV_SESSION_END ) ){
+		atomicStore( &gQuit, 1 );
+	}
+}
 
-	double halfEdge = gCubeEdgeLength / 2.0;
+// Sounds for the events since the last frame.  The local player's paddle
+// is the one drawn on the right.
+void updateSounds(){
+	BusEvent event;
+	while( gSoundEvents.next( event ) ){
+		if( event.type == BUS_HIT ){
+			playSound( event.player == gLocalPlayer ? RIGHT_HIT : LEFT_HIT );
+		}else if( event.type == BUS_SCORE ){
+			playSound( SCORE );
+		}
+	}
+}
 
-	double top = yposb + halfEdge ;
-	double bottom = yposb - halfEdge;
-	double left = xposb - halfEdge;
-	double right = xposb + halfEdge;
+// Write the parameters that changed since the last time to the results,
+// each with the time (window thread)
+void writeParamChanges(){
+	GameParams params;
+	uint32_t version;
+	if( !myfile.is_open() || !paramsRead( gParamBlock, params, version ) ){
+		return;
+	}
+	std::string changes = paramsDiff( gResultsParams, params );
+	gResultsParams = params;
+
+	SYSTEMTIME time;
+	GetLocalTime( &time );
+	char stamp[64];
+	sprintf( stamp, "# %04d-%02d-%02d %02d:%02d:%02d.%03d param ",
+			 time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds );
+	std::istringstream lines( changes );
+	std::string line;
+	while( std::getline( lines, line ) ){
+		myfile << stamp << line << "\n";
+	}
+}
 
-//	if( right > EAST ){
-//		xposb -= xmov * 2 * i / 1000.0;
-//		xmov = -xmov;
-//	}
-	if( top > NORTH ){
-		yposb -= ymov * 2 * i / 1000.0;
-		if( yposb + halfEdge > NORTH ){
-			yposb = NORTH - halfEdge;
+// Print the score, and write the practice results and parameter changes,
+// from the events since the last frame.  Results.txt belongs to the
+// window thread; everything it needs comes with the events.
+void updateResults(){
+	BusEvent event;
+	while( gResultsEvents.next( event ) ){
+		if( event.type == BUS_SCORE ){
+			LOG2( "%i - %i", event.score[PLAYER_2], event.score[PLAYER_1] );
 		}
-		ymov = -ymov;
-	}
-//	if( left < WEST ){
-//		xposb -= xmov * 2 * i / 1000.0;
-//		xmov = -xmov;
-//	}
-	if( bottom < SOUTH ){
-		yposb -= ymov * 2 * i / 1000.0;
-		if( yposb - halfEdge < SOUTH ){
-			yposb = SOUTH + halfEdge;
+		if( event.type == BUS_PARAMS ){
+			writeParamChanges();
 		}
-		ymov = -ymov;
-
-	}
-
-	if( right >= EAST ){
-		spin = -spin;
-		if( top > yposp1 - halfEdge && bottom < yposp1 + halfEdge ){
-			xposb -= xmov * 2 * i / 1000.0;
-			xmov = -xmov;
-			xmov *= 1.1;
-			ymov *= 1.1;
-			gHaptics.bump();
-			playSound( RIGHT_HIT );
-			hits++;
-		}else{
-			SCORE_P2++;
-			Score(2);
-			gHaptics.jitter();
-			misses++;
+
+		if( !gKeepResults ){
+			continue;
 		}
-		
-		#if PCPLAYER
-			char letters[100];
-			sprintf( letters, "Hits: %i    Misses: %i\n", hits, misses  );
-			myfile << hits << ", " << misses << std::endl;
-
-			OutputDebugString( letters );
-			if( hits + misses >= REBOUNDS ){
-				sprintf( letters, "Hits: %f%%    Misses: %f%%\n", hits * 100.0 / REBOUNDS, misses * 100.0 / REBOUNDS );
-				OutputDebugString( letters );
-				myfile << std::endl;
-				myfile.close();
-				exit(0);
-			}
-		#endif
-	}
-
-#if PCPLAYER
-	if( left <= WEST ){
-		spin = -spin;
-		xposb -= xmov * 2 * i / 1000.0;
-		xmov = -xmov;
-		xmov *= 1.1;
-		ymov *= 1.1;
-		playSound( LEFT_HIT );
-	}
-#else
-	if( left <= WEST ){
-		spin = -spin;
-		if( top > yposp2 - halfEdge && bottom < yposp2 + halfEdge ){
-			xposb -= xmov * 2 * i / 1000.0;
-			xmov = -xmov;
-			xmov *= 1.1;
-			ymov *= 1.1;
-			playSound( LEFT_HIT );
-		}else{
-			SCORE_P1++;
-			Score(1);
+		bool counted = ( event.type == BUS_HIT && event.player == PLAYER_1 ) ||
+					   ( event.type == BUS_SCORE && event.player == PLAYER_2 );
+		if( counted ){
+			TRACE_SCOPE( "results.write" );
+			myfile << event.hits << ", " << event.misses << std::endl;
+			LOG2( "Hits: %i    Misses: %i", event.hits, event.misses );
+		}
+		if( event.type == BUS_SESSION_END ){
+			LOG2( "Hits: %f%%    Misses: %f%%", event.hits * 100.0 / event.rebounds, event.misses * 100.0 / event.rebounds );
+			myfile << std::endl;
+			myfile.close();
+			exit(0);
 		}
 	}
-#endif
 }
 
+// Reload Params.ini when it changes, into the parameter block.  Values
+// out of range are skipped and reported.  Only what the file changes is
+// written, so a change from hgtool tune stays until the file says
+// otherwise.  This is file reading, so it runs on the window thread, and
+// the simulation picks the change up from the block.
+void reloadParams(){
+	uint64_t now = platformMicros();
+	if( now - gParamsCheckUs < 500000 ){
+		return;
+	}
+	gParamsCheckUs = now;
+	uint64_t stamp = paramsFileStamp( gParamsPath );
+	if( stamp == gParamsStamp ){
+		return;
+	}
+
+	TRACE_SCOPE( "params.reload" );
+	GameParams before, after;
+	uint32_t version;
+	if( !paramsRead( gParamBlock, before, version ) ){
+		return;
+	}
+	after = before;
+	std::string rejected;
+	bool loaded = paramsLoadFile( gParamsPath, after, rejected );
+	if( !rejected.empty() ){
+		OutputDebugString( ( "Params.ini: skipped\n" + rejected ).c_str() );
+	}
+
+	// Read again next time if another writer held the block
+	if( !loaded || paramsWriteChanges( gParamBlock, before, after ) ){
+		gParamsStamp = stamp;
+	}
+}
+
+// Pick up parameter changes, from Params.ini or from hgtool tune.  Each
+// change is logged with the time it took effect.  Rules that change the
+// simulation are left alone over the network, where both stations must
+// agree on them, and during a replay, which has the recorded ones.
+void updateParams(){
+	// A tool that died while writing the block would hold it for good
+	if( paramsRecover( gParamBlock, gParams, gParamsStuck, gParamsStuckUs ) ){
+		LOG0( "params: a writer died in the block; the last good values are back" );
+	}
+
+	// A new paddle size needs a new arena field, baked on a helper thread
+	// once the servo lets go of the old one and swapped in here when done
+	if( gUseDevice ){
+		gHaptics.updateArena( gAvoidCpu );
+	}
+
+	if( atomicLoad( &gParamBlock->version ) == gParamsVersion ){
+		return;
+	}
+
+	// Kept as they were if a writer is in the block; tried again next time
+	GameParams before = gParams;
+	if( !paramsRead( gParamBlock, gParams, gParamsVersion ) ){
+		return;
+	}
+	if( !paramsLog( before, gParams ) ){
+		return;
+	}
+
+	// The window writes the change to the results
+	BusEvent event;
+	memset( &event, 0, sizeof( event ) );
+	event.us = platformMicros();
+	event.step = currentState().step;
+	event.type = BUS_PARAMS;
+	event.rebounds = gConfig.rebounds;
+	event.version = gParamsVersion;
+	gEvents.publish( event );
+
+	if( gNetHost == NULL && gReplayPath == NULL ){
+		gConfig.edgeLength = gParams.cubeEdgeLength;
+		gConfig.rebounds = gParams.rebounds;
+		gConfig.speedUp = gParams.speedUp;
+		gSession.configure( gConfig );
+		gSpectators.configure( gConfig );
+		xposp1 = gConfig.east + gConfig.edgeLength / 4.0;
+		xposp2 = gConfig.west - gConfig.edgeLength / 4.0;
+	}
+}
+
+// Follow the device bring-up after startup: log how it went, and say
+// in the title bar what the player needs to do
+void updateDeviceStatus(){
+	if( !gUseDevice ){
+		return;
+	}
+	HapticsStatus status = gHaptics.status();
+	bool homed = status == HAPTICS_READY && gHaptics.isDeviceCalibrated();
+	if( status == gDeviceStatus && homed == gDeviceHomed ){
+		return;
+	}
+	if( status != gDeviceStatus && status != HAPTICS_STARTING ){
+		OutputDebugString( gHaptics.initReport().c_str() );
+	}
+	gDeviceStatus = status;
+	gDeviceHomed = homed;
+
+	if( status == HAPTICS_STARTING ){
+		glutSetWindowTitle( "Basic--OpenGL - waiting for the device" );
+	}else if( status != HAPTICS_READY ){
+		// In a local match the AI has taken player 2 from the mouse
+		glutSetWindowTitle( gPractice || gNetHost != NULL
+			? "Basic--OpenGL - no device, the mouse plays"
+			: "Basic--OpenGL - no device, the mouse plays the AI" );
+	}else if( !homed ){
+		// Tell the user what to do if the device is not calibrated
+		glutSetWindowTitle( "Basic--OpenGL - home the device: extend the arms, then push them all the way in" );
+	}else{
+		glutSetWindowTitle( "Basic--OpenGL" );
+	}
+}
+
+// Where a paddle comes from, as policies of the step.  Each pairing of
+// sources is compiled as a step of its own (stepLocal), which asks none
+// of these questions per step.
+
+// The device.  Steps with it are only picked while it is ready (see
+// playStepFor), so it has no stand-in of its own.
+struct DeviceSource {
+	static PlayerInput input( int, bool ){
+		return gameMakeInput( yposp1, gButton );
+	}
+};
+
+struct MouseSource {
+	static PlayerInput input( int, bool click ){
+		return gameMakeInput( gPointerY, click );
+	}
+};
+
+// Follows the puck no faster than a hand would, and serves after a
+// moment's hold
+const double AI_SPEED = 1.5;
+const int AI_SERVE_STEPS = 200;
+double gAiY[PLAYER_COUNT];
+int gAiHeld[PLAYER_COUNT];
+
+struct AiSource {
+	static PlayerInput input( int player, bool ){
+		double most = AI_SPEED * GAME_STEP_MS / 1000.0;
+		double move = gState.puckY - gAiY[player];
+		gAiY[player] += move > most ? most : move < -most ? -most : move;
+		bool held = gState.freeze == player + 1;
+		gAiHeld[player] = held ? gAiHeld[player] + 1 : 0;
+		return gameMakeInput( gAiY[player], held && gAiHeld[player] > AI_SERVE_STEPS );
+	}
+};
+
+// One step of play on this machine: each paddle from its source, and
+// the step for the mode's rules and playfield
+template < class Player1, class Player2 >
+unsigned int stepLocal( uint64_t, bool click ){
+	PlayerInput input[PLAYER_COUNT];
+	input[PLAYER_1] = Player1::input( PLAYER_1, click );
+	input[PLAYER_2] = Player2::input( PLAYER_2, click );
+
+	GameState before = gState;
+	unsigned int events = gStep( gState, gConfig, input );
+	gSession.record( before, input, events );
+	GameEvents( events );
+	return events;
+}
+
+// One step over the network, with the local paddle from its source.  A
+// stalled step is dropped, which slows us to the peer's pace.
+template < class Player1 >
+unsigned int stepNet( uint64_t now, bool click ){
+	unsigned int events = 0;
+	gNet.advance( Player1::input( PLAYER_1, click ), now, events );
+	GameEvents( events );
+
+	// Only steps both stations agree on are recorded
+	PlayerInput input[PLAYER_COUNT];
+	GameState before;
+	unsigned int confirmedEvents;
+	while( gNet.confirmedStep( gRecorded, input, before, confirmedEvents ) ){
+		gSession.record( before, input, confirmedEvents );
+		gRecorded++;
+	}
+	return events;
+}
+
+// One step of a recording, whose rules may change from rally to rally;
+// after the end the last position is held
+unsigned int stepReplay( uint64_t, bool ){
+	unsigned int events = 0;
+	PlayerInput input[PLAYER_COUNT];
+	if( gReplay.next( input, gState ) ){
+		// The rules may have changed with the rally
+		gConfig = gReplay.config();
+		gSpectators.configure( gConfig );
+		events = gameStep( gState, gConfig, input );
+		GameEvents( events );
+	}
+	return events;
+}
+
+// Whether player 1 is the device and it is ready to play
+bool deviceReady(){
+	return gUseDevice && gReplayPath == NULL && gHaptics.status() == HAPTICS_READY;
+}
+
+// The step for the mode chosen at startup, and whether the device is
+// ready to play it
+PlayStepFn playStepFor(){
+	if( gReplayPath != NULL ){
+		return stepReplay;
+	}
+	if( gNetHost != NULL ){
+		return gDeviceReady ? &stepNet< DeviceSource > : &stepNet< MouseSource >;
+	}
+	if( gDeviceReady ){
+		return gPlayer2 == SOURCE_AI ? &stepLocal< DeviceSource, AiSource > : &stepLocal< DeviceSource, MouseSource >;
+	}
+	// The mouse has player 1, so it can't have player 2 as well
+	return &stepLocal< MouseSource, AiSource >;
+}
+
+// Run as many fixed steps as the time since the last call calls for,
+// publishing a snapshot after each (simulation thread)
 void UpdatePos(){
-	SYSTEMTIME str_t;
-	GetSystemTime(&str_t);
-	
-	long double i = Delta( lasttime, str_t );
-
-//	char letters[100];
-//	sprintf( letters, "%f", i  );
-//	OutputDebugString( letters );
-//	OutputDebugString("\n" );
-
-	if( freeze == 1 ){
-		if( gHaptics.isButtonDown() ){
-			freeze = 0;
-			gHaptics.fire();
-		}else{
-			yposb = yposp1;
+	updateParams();
+
+	// Rally changes asked for from the keyboard during a replay
+	uint32_t seek = atomicExchange( &gSeekRequest, 0 );
+	if( seek != 0 ){
+		int rally = gReplayRally + ( seek == 1 ? 1 : -1 );
+		if( rally >= 0 && gReplay.seekRally( rally, gState ) ){
+			gReplayRally = rally;
+			gConfig = gReplay.config();
+			gSpectators.configure( gConfig );
+			updateView();
+			publishView( platformMicros(), true );
 		}
-	}else if( freeze == 2 ){
-		yposb = yposp2;
-	}else{
-		xposb += xmov * i / 1000.0;
-		yposb += ymov * i / 1000.0;
+	}
 
-		BoundCheck( i );
+	// Where the hand is.  Must synch before data is valid.
+	gHaptics.synchFromServo();
+	gHaptics.getPosition( gCursor );
+	gButton = gHaptics.isButtonDown();
+	bool ready = deviceReady();
+	if( ready != gDeviceReady ){
+		gDeviceReady = ready;
+		gPlayStep = playStepFor();
+	}
+	if( gDeviceReady ){
+		yposp1 = gCursor[1];
 	}
 
-	#if PCPLAYER
-		yposp2 = yposb;
-	#endif
+	if( gRealtime && !gServoPolicyLogged ){
+		std::string report = gHaptics.servoPolicyReport();
+		if( !report.empty() ){
+			OutputDebugString( ( "servo thread " + report ).c_str() );
+			gServoPolicyLogged = true;
+		}
+	}
+
+	uint64_t now = platformMicros();
+	gAccumulatedUs += now - gLastUs;
+	gLastUs = now;
 
+	// Don't race to catch up after a long pause (window drag, breakpoint)
+	if( gAccumulatedUs > 100 * GAME_STEP_US ){
+		gAccumulatedUs = GAME_STEP_US;
+	}
 
-//	sprintf( letters, "%f", xmov * i / 1000 );
-//	OutputDebugString( letters );
-//	OutputDebugString("\n" );
+	while( gAccumulatedUs >= GAME_STEP_US ){
+		TRACE_SCOPE( "physics.step" );
+		AllocGuard guard( "sim.step" );
+		gAccumulatedUs -= GAME_STEP_US;
 
+		// This step stands for the time now less what is still to step
+		applyInput( now - gAccumulatedUs );
 
+		bool click = gMouseClick;
+		gMouseClick = false;
+		unsigned int events = gPlayStep( now, click );
+		gSpectators.publish( currentState() );
 
-	lasttime = str_t;
+		updateView();
+		publishView( now - gAccumulatedUs,
+					 ( events & ( GAME_EV_SCORE_P1 | GAME_EV_SCORE_P2 | GAME_EV_FIRE | GAME_EV_SERVE_P2 ) ) != 0 );
+	}
 }
 
 // Draw the cursor and the cube.  In a real application,
 // this function would be much more complex.
 void drawGraphics()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);           
-
-    drawCursor();
+	AllocGuard guard( "frame.draw" );
+
+	// The newest snapshot, drawn a step behind the simulation so that
+	// there are always two steps to blend
+	gSnapshots.acquire();
+	const Snapshot& view = gSnapshots.front();
+	double blend = ( (double)(int64_t)( platformMicros() - view.us ) ) / GAME_STEP_US;
+	if( view.cut || blend > 1 ){
+		blend = 1;
+	}
+	if( blend < 0 ){
+		blend = 0;
+	}
+	double puckX = view.before.puckX + ( view.after.puckX - view.before.puckX ) * blend;
+	double puckY = view.before.puckY + ( view.after.puckY - view.before.puckY ) * blend;
+	double leftY = view.before.leftY + ( view.after.leftY - view.before.leftY ) * blend;
+
+	// The hand, carried forward to when this frame will be seen
+	double cursorY = view.cursor[1];
+	double rightY = view.rightY;
+	if( predictHand( view.leadUs, cursorY ) ){
+		rightY = cursorY;
+	}
 
-	
-	double cp[3];
-	gHaptics.synchFromServo();
-	gHaptics.getPosition( cp );
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);           
 
-	yposp1 = cp[1];
-	/*if( yposp1 + gCubeEdgeLength / 2 > NORTH ){
-		yposp1 = NORTH - gCubeEdgeLength / 2;
-	}
-	if( yposp1 -gCubeEdgeLength / 2 < SOUTH ){
-		yposp1 = SOUTH + gCubeEdgeLength / 2;
-	}*/
+    drawCursor( view, cursorY );
 
 	// Draw right paddle (p1)
 	glPushMatrix();
-	glTranslatef( xposp1, yposp1, 0 );
+	glTranslatef( view.rightX, rightY, 0 );
 	glScalef( 0.5, 1, 1 );
-	glutSolidCube(gCubeEdgeLength);
+	glutSolidCube(view.edgeLength);
 	glPopMatrix();
 
 	// Draw left paddle (p2)
 	glPushMatrix();
-	glTranslatef( xposp2, yposp2, 0 );
+	glTranslatef( view.leftX, leftY, 0 );
 	glScalef( 0.5, 1, 1 );
-	glutSolidCube(gCubeEdgeLength);
+	glutSolidCube(view.edgeLength);
 	glPopMatrix();
 
 	// Draw puck
 	glPushMatrix();
-    glTranslatef( xposb, yposb, 0);
+    glTranslatef( puckX, puckY, 0);
 	glRotated( mRot, 0, 0, 1 );
-	mRot = (mRot + spin) % 360;
-	glutSolidSphere( gCubeEdgeLength / 2, 10, 10 );
-    //glutSolidCube(gCubeEdgeLength);
-	glPopMatrix();
-
-	// Draw top
-	//glDisable(GL_DEPTH_TEST);
-	////glDepthMask(GL_FALSE);
-
-	////Define the color (blue)
-	//glColor3ub(255, 0, 0);
-	//glBegin(GL_QUADS);
-
-	//  //Draw our four points, clockwise.
-	//  glVertex2d(0, 0);
-	//  glVertex2d(10, 0);
-	//  glVertex2d(10, 10);
-	//  glVertex2d(0, 10);
-	//glEnd();
-
-	//glEnable(GL_DEPTH_TEST);
-	////glDepthMask(!GL_FALSE);
-	double width = ( EAST - WEST ) * 2;
-	glPushMatrix();
-	glTranslatef( 0, NORTH + width / 2, 0 );
-	glScalef( 1, 1, 1 / width / 2 );
-	glutSolidCube(width);
+	mRot = (mRot + view.spin) % 360;
+	glutSolidSphere( view.edgeLength / 2, 10, 10 );
+    //glutSolidCube(gConfig.edgeLength);
 	glPopMatrix();
 
-	glPushMatrix();
-	glTranslatef( 0, (SOUTH - width / 2), 0 );
-	glScalef( 1, 1, 1 / width / 2 );
-	glutSolidCube( width );
-	glPopMatrix();
-
-	// Update puck position
-	UpdatePos();
+	if( view.arena != NULL ){
+		drawArena( view.arena );
+	}else{
+		double width = ( view.east - view.west ) * 2;
+		glPushMatrix();
+		glTranslatef( 0, view.north + width / 2, 0 );
+		glScalef( 1, 1, 1 / width / 2 );
+		glutSolidCube(width);
+		glPopMatrix();
+
+		glPushMatrix();
+		glTranslatef( 0, (view.south - width / 2), 0 );
+		glScalef( 1, 1, 1 / width / 2 );
+		glutSolidCube( width );
+		glPopMatrix();
+	}
 }
 
+// Catch up on the servo's readings of the hand, and say where it will be
+// leadUs from now; false, leaving y alone, when not predicting
+bool predictHand( uint32_t leadUs, double& y ){
+	MotionSample sample;
+	while( gHaptics.motion().read( gHandNext, sample ) ){
+		gHandPredictor.update( sample.us, sample.y );
+	}
+	if( leadUs == 0 || !gHandPredictor.ready() ){
+		return false;
+	}
+	y = gHandPredictor.predict( platformMicros() + leadUs );
+	return true;
+}
 
 void playSound( Sound sound ){
-	char path[MAX_PATH];
-	SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, path );
-	strcat( path, "\\Documents\\HapticsGame\\");
-
-	switch( sound ){
-		case LEFT_HIT:
-			strcat( path, "leftPaddleHit.wav");
-			break;
-		case RIGHT_HIT:
-			strcat( path, "rightPaddleHit.wav");
-			break;
-		case SCORE:
-			#if !PCPLAYER
-				strcat( path, "gruntScore.wav");
-			#endif
-			break;
+	TRACE_SCOPE( "playSound" );
+	if( !gSounds[sound].empty() ){
+		PlaySound( &gSounds[sound][0], NULL, SND_MEMORY | SND_ASYNC );
 	}
-
-	PlaySound(path, NULL, SND_ASYNC);
 }
 
 
 // Draw the cursor
-void drawCursor()
+void drawCursor( const Snapshot& view, double cursorY )
 {
     static const int kCursorTess = 15;
 
-    // Haptic cursor position in "world coordinates"
-    double cursorPosWC[3];
-
-    // Must synch before data is valid
-    gHaptics.synchFromServo();
-    gHaptics.getPosition(cursorPosWC);
+    // Haptic cursor position in "world coordinates", as the simulation
+    // thread last read it, at the height the hand is predicted at
+    const double* cursorPosWC = view.cursor;
 
     // The color will depend on the button state.
-    gCurrentColor = gHaptics.isButtonDown() ? colorRed : colorTeal;
+    gCurrentColor = view.button ? colorRed : colorTeal;
 
     GLUquadricObj *qobj = 0;
 
@@ -599,7 +1348,7 @@ void drawCursor()
         glEndList();
     }
 
-    glTranslatef(cursorPosWC[0], cursorPosWC[1], cursorPosWC[2]);
+    glTranslatef(cursorPosWC[0], cursorY, cursorPosWC[2]);
 
     glEnable(GL_COLOR_MATERIAL);
     glColor3fv(gCurrentColor);
@@ -609,3 +1358,150 @@ void drawCursor()
     glPopMatrix(); 
     glPopAttrib();
 }
+
+// The arena's segments as thin bars, compiled into a display list once;
+// the arena never changes during a game
+void drawArena( const Arena* arena )
+{
+	static const double kThickness = 0.04;
+
+	if( !gArenaDisplayList ){
+		bool mirror = gNetHost != NULL && gNetPlayer == PLAYER_2;
+		gArenaDisplayList = glGenLists(1);
+		glNewList(gArenaDisplayList, GL_COMPILE);
+		for( size_t i = 0; i < arena->size(); i++ ){
+			const ArenaSegment& s = arena->segment( i );
+			double ax = mirror ? -s.ax : s.ax;
+			double bx = mirror ? -s.bx : s.bx;
+			double dx = bx - ax;
+			double dy = s.by - s.ay;
+			glPushMatrix();
+			glTranslated( ( ax + bx ) / 2, ( s.ay + s.by ) / 2, 0 );
+			glRotated( atan2( dy, dx ) * 180 / 3.14159265358979, 0, 0, 1 );
+			glScaled( sqrt( dx * dx + dy * dy ) + kThickness, kThickness, kThickness );
+			glutSolidCube( 1 );
+			glPopMatrix();
+		}
+		glEndList();
+	}
+	glCallList(gArenaDisplayList);
+}
+
+// A GL entry point, by its OpenGL 2.1 name or with the ARB suffix
+PROC captureProc( const char* name, bool arb ){
+	char full[64];
+	sprintf( full, "%s%s", name, arb ? "ARB" : "" );
+	return wglGetProcAddress( full );
+}
+
+// Open the video, the size the window is now, and the pixel buffers to
+// read it back through if the driver has them
+void startCapture(){
+	int width = glutGet( GLUT_WINDOW_WIDTH );
+	int height = glutGet( GLUT_WINDOW_HEIGHT );
+	std::string index = std::string( gCapturePath ) + ".frames.csv";
+	if( !gCapture.open( gCapturePath, index.c_str(), width, height, 60, CAPTURE_BGRA, gAvoidCpu ) ){
+		OutputDebugString( ( std::string( "capture: cannot write " ) + gCapturePath + "\n" ).c_str() );
+		return;
+	}
+
+	const char* version = (const char*)glGetString( GL_VERSION );
+	const char* extensions = (const char*)glGetString( GL_EXTENSIONS );
+	bool core = version != NULL && ( version[0] > '2' || ( version[0] == '2' && version[2] >= '1' ) );
+	bool arb = !core && extensions != NULL && strstr( extensions, "GL_ARB_pixel_buffer_object" ) != NULL;
+	if( core || arb ){
+		GenBuffersProc genBuffers = (GenBuffersProc)captureProc( "glGenBuffers", arb );
+		gBindBuffer = (BindBufferProc)captureProc( "glBindBuffer", arb );
+		gBufferData = (BufferDataProc)captureProc( "glBufferData", arb );
+		gMapBuffer = (MapBufferProc)captureProc( "glMapBuffer", arb );
+		gUnmapBuffer = (UnmapBufferProc)captureProc( "glUnmapBuffer", arb );
+		if( genBuffers != NULL && gBindBuffer != NULL && gBufferData != NULL &&
+			gMapBuffer != NULL && gUnmapBuffer != NULL ){
+			genBuffers( 2, gCaptureBuffers );
+			for( int i = 0; i < 2; i++ ){
+				gBindBuffer( CAPTURE_PIXEL_PACK_BUFFER, gCaptureBuffers[i] );
+				gBufferData( CAPTURE_PIXEL_PACK_BUFFER, (ptrdiff_t)gCapture.width() * gCapture.height() * 4,
+							 NULL, CAPTURE_STREAM_READ );
+			}
+			gBindBuffer( CAPTURE_PIXEL_PACK_BUFFER, 0 );
+		}
+	}
+
+	char line[MAX_PATH + 128];
+	sprintf( line, "capture: %dx%d to %s, read back %s\n", gCapture.width(), gCapture.height(), gCapturePath,
+			 gCaptureBuffers[0] != 0 ? "through pixel buffer objects" : "with glReadPixels" );
+	OutputDebugString( line );
+}
+
+// Read back the frame just drawn, before the swap.  A frame is only
+// captured while the window is at least the video's size; the video
+// shows its bottom left corner.
+void captureFrame(){
+	AllocGuard guard( "frame.capture" );
+	const Snapshot& view = gSnapshots.front();
+	int width = gCapture.width();
+	int height = gCapture.height();
+	bool fits = glutGet( GLUT_WINDOW_WIDTH ) >= width && glutGet( GLUT_WINDOW_HEIGHT ) >= height;
+
+	if( gCaptureBuffers[0] == 0 ){
+		unsigned char* pixels = fits ? gCapture.claim() : NULL;
+		if( !fits ){
+			gCapture.drop();
+		}else if( pixels != NULL ){
+			glReadPixels( 0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, pixels );
+			gCapture.submit( view.step, platformMicros() );
+		}
+		return;
+	}
+
+	// Start this frame's copy into one buffer; the GPU does it while the
+	// frame carries on
+	int index = gCaptureFrames % 2;
+	gCaptureFrames++;
+	if( fits ){
+		gBindBuffer( CAPTURE_PIXEL_PACK_BUFFER, gCaptureBuffers[index] );
+		glReadPixels( 0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, 0 );
+		gCapturePending[index] = true;
+		gCaptureStep[index] = view.step;
+		gCaptureUs[index] = platformMicros();
+	}else{
+		gCapture.drop();
+	}
+
+	// and hand over the one started a frame ago, which is done by now
+	int other = 1 - index;
+	if( gCapturePending[other] ){
+		gCapturePending[other] = false;
+		unsigned char* pixels = gCapture.claim();
+		if( pixels != NULL ){
+			gBindBuffer( CAPTURE_PIXEL_PACK_BUFFER, gCaptureBuffers[other] );
+			const void* mapped = gMapBuffer( CAPTURE_PIXEL_PACK_BUFFER, CAPTURE_READ_ONLY );
+			if( mapped != NULL ){
+				memcpy( pixels, mapped, (size_t)width * height * 4 );
+				gCapture.submit( gCaptureStep[other], gCaptureUs[other] );
+			}else{
+				gCapture.drop();
+			}
+			gUnmapBuffer( CAPTURE_PIXEL_PACK_BUFFER );
+		}
+	}
+	gBindBuffer( CAPTURE_PIXEL_PACK_BUFFER, 0 );
+}
+
+// With tracing built in (HG_TRACE), save the timeline so far next to the
+// results; t does it on demand, and it is done again on exit
+void writeTrace(){
+#ifdef HG_TRACE
+	char path[MAX_PATH];
+	char name[64];
+	SYSTEMTIME now;
+	GetLocalTime( &now );
+	sprintf( name, "/Documents/HapticsGame/Trace-%04d%02d%02d-%02d%02d%02d.json",
+			 now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond );
+	SHGetFolderPathA( NULL, CSIDL_PROFILE, NULL, 0, path );
+	strcat( path, name );
+	if( traceWrite( path ) ){
+		OutputDebugString( ( std::string( "trace written to " ) + path + "\n" ).c_str() );
+	}
+#endif
+}
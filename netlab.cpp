@@ -0,0 +1,251 @@
+// netlab: runs two networked stations in one process over 127.0.0.1,
+// with latency, jitter and loss injected on both directions, and reports
+// how often and how deeply each station had to roll back.
+//
+// By default the stations run on a virtual clock, so a long match takes
+// a fraction of a second and any run can be reproduced from its seed.
+// --realtime paces the steps against the wall clock instead.
+#include "netplay.h"
+#include "session.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+struct StationLog {
+    std::vector<uint32_t> depth;    // steps resimulated, per advance()
+    std::vector<uint64_t> resimUs;  // time spent resimulating, per advance()
+};
+
+// A stand-in player: chases the puck on its own screen with a limited hand
+// speed and some wobble, and serves after a short pause
+static PlayerInput botInput(const GameState& state, int player, double& paddle, int& holdSteps)
+{
+    const double maxMove = 3.0 * GAME_STEP_MS / 1000.0;
+    double wobble = ((state.step / 37 + player * 5) % 11 - 5) * 0.02;
+    double target = state.puckY + wobble;
+
+    double move = target - paddle;
+    if (move > maxMove) move = maxMove;
+    if (move < -maxMove) move = -maxMove;
+    paddle += move;
+
+    bool button = false;
+    int held = (player == PLAYER_1 ? 1 : 2);
+    if (state.freeze == held)
+    {
+        holdSteps++;
+        button = holdSteps > 60;
+    }
+    else
+    {
+        holdSteps = 0;
+    }
+    return gameMakeInput(paddle, button);
+}
+
+template <class T>
+static T percentile(std::vector<T> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+static void report(const char* name, const NetSession& session, const StationLog& log)
+{
+    const NetStats& s = session.stats();
+    double meanDepth = log.depth.empty() ? 0 : (double)s.totalDepth / log.depth.size();
+    double meanResim = log.resimUs.empty() ? 0 : (double)s.totalResimUs / log.resimUs.size();
+
+    printf("%s: %u steps, %u stalls, %u rollbacks\n", name, s.frames, s.stalls, s.rollbacks);
+    printf("  rollback depth per frame: mean %.2f  p50 %u  p99 %u  max %u steps\n",
+           meanDepth, percentile(log.depth, 0.5), percentile(log.depth, 0.99), s.maxDepth);
+    printf("  resimulation per frame:   mean %.2f  p50 %u  p99 %u  max %u us\n",
+           meanResim, (unsigned)percentile(log.resimUs, 0.5),
+           (unsigned)percentile(log.resimUs, 0.99), (unsigned)s.maxResimUs);
+    printf("  packets: %u sent, %u received, %u dropped; rtt %u us; %u desyncs reported\n",
+           s.packetsSent, s.packetsReceived, s.packetsDropped, s.rttUs, s.desyncs);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool netlab [options]\n"
+        "  --latency MS   one-way latency (default 40)\n"
+        "  --jitter MS    latency varies by up to this much (default 10)\n"
+        "  --loss PCT     percentage of packets dropped (default 2)\n"
+        "  --steps N      steps to play (default 12000, one minute)\n"
+        "  --seed N       impairment seed (default 1)\n"
+        "  --port N       first of two UDP ports (default %d)\n"
+        "  --realtime     pace steps by the wall clock\n"
+        "  --frames       print depth and resimulation time for every frame\n"
+        "  --record FILE  record station 1's confirmed steps as a session\n"
+        "  --arena FILE   play among the walls and bumpers of an arena file\n",
+        NET_DEFAULT_PORT);
+}
+
+int netlabMain(int argc, char* argv[])
+{
+    NetConditions conditions;
+    conditions.latencyMs = 40;
+    conditions.jitterMs = 10;
+    conditions.loss = 0.02;
+    conditions.seed = 1;
+    int steps = 12000;
+    int port = NET_DEFAULT_PORT;
+    bool realtime = false;
+    bool frames = false;
+    const char* recordPath = NULL;
+    const char* arenaPath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--latency") == 0 && hasValue)
+            conditions.latencyMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jitter") == 0 && hasValue)
+            conditions.jitterMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--loss") == 0 && hasValue)
+            conditions.loss = atof(argv[++i]) / 100.0;
+        else if (strcmp(argv[i], "--steps") == 0 && hasValue)
+            steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            conditions.seed = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--port") == 0 && hasValue)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--realtime") == 0)
+            realtime = true;
+        else if (strcmp(argv[i], "--frames") == 0)
+            frames = true;
+        else if (strcmp(argv[i], "--record") == 0 && hasValue)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--arena") == 0 && hasValue)
+            arenaPath = argv[++i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    NetSession stations[PLAYER_COUNT];
+    if (!stations[PLAYER_1].open(port, "127.0.0.1", port + 1, PLAYER_1) ||
+        !stations[PLAYER_2].open(port + 1, "127.0.0.1", port, PLAYER_2))
+    {
+        fprintf(stderr, "netlab: could not open UDP ports %d and %d\n", port, port + 1);
+        return 1;
+    }
+
+    GameConfig config;
+    gameDefaultConfig(config);
+    config.practice = false;
+
+    Arena arena;
+    if (arenaPath != NULL)
+    {
+        std::string error;
+        if (!arena.load(arenaPath, error))
+        {
+            fprintf(stderr, "netlab: %s\n", error.c_str());
+            return 1;
+        }
+        config.arena = &arena;
+    }
+    GameState initial;
+    gameInit(initial, config);
+
+    for (int p = 0; p < PLAYER_COUNT; p++)
+    {
+        NetConditions c = conditions;
+        c.seed = conditions.seed * 2 + p;
+        stations[p].start(initial, config);
+        stations[p].setConditions(c);
+    }
+
+    SessionWriter session;
+    uint32_t recorded = 0;
+    if (recordPath != NULL && !session.open(recordPath, config))
+    {
+        fprintf(stderr, "netlab: cannot write %s\n", recordPath);
+        return 1;
+    }
+
+    StationLog logs[PLAYER_COUNT];
+    double paddles[PLAYER_COUNT] = { 0, 0 };
+    int holds[PLAYER_COUNT] = { 0, 0 };
+    uint32_t compared = 0, mismatches = 0, lastCompared = 0;
+
+    if (frames)
+        printf("station,frame,depth,resim_us\n");
+
+    uint64_t startUs = platformMicros();
+    uint64_t nowUs = 0;
+    for (int i = 0; i < steps; i++)
+    {
+        nowUs += GAME_STEP_US;
+        if (realtime)
+        {
+            while (platformMicros() - startUs < nowUs)
+                platformSleepMs(1);
+        }
+
+        for (int p = 0; p < PLAYER_COUNT; p++)
+        {
+            NetSession& station = stations[p];
+            PlayerInput input = botInput(station.state(), p, paddles[p], holds[p]);
+            unsigned int events;
+            station.advance(input, nowUs, events);
+
+            logs[p].depth.push_back(station.stats().lastDepth);
+            logs[p].resimUs.push_back(station.stats().lastResimUs);
+            if (frames)
+                printf("%d,%d,%u,%u\n", p + 1, i, station.stats().lastDepth,
+                       (unsigned)station.stats().lastResimUs);
+        }
+
+        // Confirmed states must agree exactly
+        uint32_t a = stations[PLAYER_1].confirmedFrames();
+        uint32_t b = stations[PLAYER_2].confirmedFrames();
+        uint32_t both = a < b ? a : b;
+        for (uint32_t f = lastCompared; f < both; f++)
+        {
+            uint32_t ca, cb;
+            if (stations[PLAYER_1].confirmedChecksum(f, ca) && stations[PLAYER_2].confirmedChecksum(f, cb))
+            {
+                compared++;
+                if (ca != cb)
+                    mismatches++;
+            }
+        }
+        if (both > lastCompared)
+            lastCompared = both;
+
+        PlayerInput input[PLAYER_COUNT];
+        GameState before;
+        unsigned int events;
+        while (session.isOpen() && stations[PLAYER_1].confirmedStep(recorded, input, before, events))
+        {
+            session.record(before, input, events);
+            recorded++;
+        }
+    }
+    uint64_t elapsedUs = platformMicros() - startUs;
+    session.close();
+
+    printf("netlab: %d steps, latency %d ms, jitter %d ms, loss %.1f%%, seed %u, %.0f ms wall time\n",
+           steps, conditions.latencyMs, conditions.jitterMs, conditions.loss * 100,
+           conditions.seed, elapsedUs / 1000.0);
+    report("station 1", stations[PLAYER_1], logs[PLAYER_1]);
+    report("station 2", stations[PLAYER_2], logs[PLAYER_2]);
+
+    const GameState& end = stations[PLAYER_1].state();
+    printf("score %d - %d; %u confirmed states compared, %u mismatched\n",
+           end.score[PLAYER_2], end.score[PLAYER_1], compared, mismatches);
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,503 @@
+#include "netplay.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef int socklen_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const NetSocket NET_INVALID_SOCKET = (NetSocket)-1;
+
+// "HGNP" on the wire
+static const uint32_t NET_MAGIC = 0x504E4748;
+
+// Little-endian packing, independent of the host
+static unsigned char* put8(unsigned char* p, uint8_t v)
+{
+    p[0] = v;
+    return p + 1;
+}
+
+static unsigned char* put16(unsigned char* p, uint16_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    return p + 2;
+}
+
+static unsigned char* put32(unsigned char* p, uint32_t v)
+{
+    p = put16(p, (uint16_t)v);
+    return put16(p, (uint16_t)(v >> 16));
+}
+
+static const unsigned char* get8(const unsigned char* p, uint8_t& v)
+{
+    v = p[0];
+    return p + 1;
+}
+
+static const unsigned char* get16(const unsigned char* p, uint16_t& v)
+{
+    v = (uint16_t)(p[0] | (p[1] << 8));
+    return p + 2;
+}
+
+static const unsigned char* get32(const unsigned char* p, uint32_t& v)
+{
+    uint16_t lo, hi;
+    p = get16(p, lo);
+    p = get16(p, hi);
+    v = lo | ((uint32_t)hi << 16);
+    return p;
+}
+
+static bool sameInput(const PlayerInput& a, const PlayerInput& b)
+{
+    return a.paddleY == b.paddleY && a.button == b.button;
+}
+
+static void closeSocket(NetSocket s)
+{
+#ifdef _WIN32
+    closesocket((SOCKET)s);
+#else
+    ::close((int)s);
+#endif
+}
+
+NetSession::NetSession()
+    : m_socket(NET_INVALID_SOCKET),
+      m_local(PLAYER_1),
+      m_remote(PLAYER_2),
+      m_random(1),
+      m_delayedCount(0)
+{
+    memset(m_remoteAddr, 0, sizeof(m_remoteAddr));
+    memset(&m_conditions, 0, sizeof(m_conditions));
+    GameConfig config;
+    gameDefaultConfig(config);
+    GameState initial;
+    gameInit(initial, config);
+    start(initial, config);
+}
+
+NetSession::~NetSession()
+{
+    close();
+}
+
+bool NetSession::open(int localPort, const char* remoteHost, int remotePort, int localPlayer)
+{
+    close();
+
+#ifdef _WIN32
+    static bool winsockStarted = false;
+    if (!winsockStarted)
+    {
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+            return false;
+        winsockStarted = true;
+    }
+#endif
+
+    m_local = localPlayer;
+    m_remote = (localPlayer == PLAYER_1 ? PLAYER_2 : PLAYER_1);
+
+    // Resolve the peer; numeric addresses first, then names
+    sockaddr_in remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons((unsigned short)remotePort);
+    remote.sin_addr.s_addr = inet_addr(remoteHost);
+    if (remote.sin_addr.s_addr == INADDR_NONE)
+    {
+        hostent* host = gethostbyname(remoteHost);
+        if (host == NULL || host->h_addrtype != AF_INET)
+            return false;
+        memcpy(&remote.sin_addr, host->h_addr_list[0], sizeof(remote.sin_addr));
+    }
+    memcpy(m_remoteAddr, &remote, sizeof(remote));
+
+    m_socket = (NetSocket)socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket == NET_INVALID_SOCKET)
+        return false;
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons((unsigned short)localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(m_socket, (sockaddr*)&local, sizeof(local)) != 0)
+    {
+        close();
+        return false;
+    }
+
+    // Never block the game waiting for a packet
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket((SOCKET)m_socket, FIONBIO, &nonBlocking);
+#else
+    fcntl((int)m_socket, F_SETFL, fcntl((int)m_socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    return true;
+}
+
+void NetSession::close()
+{
+    if (m_socket != NET_INVALID_SOCKET)
+    {
+        closeSocket(m_socket);
+        m_socket = NET_INVALID_SOCKET;
+    }
+    m_delayedCount = 0;
+}
+
+void NetSession::start(const GameState& initial, const GameConfig& config)
+{
+    m_config = config;
+    m_step = gameStepFor(config);
+    m_state = initial;
+    memset(m_inputs, 0, sizeof(m_inputs));
+    memset(m_events, 0, sizeof(m_events));
+    memset(m_checksums, 0, sizeof(m_checksums));
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_remoteCount = initial.step;
+    m_remoteFrame = initial.step;
+    m_remoteAck = initial.step;
+    m_rollbackFrame = initial.step;
+    m_confirmed = initial.step;
+    m_checkedFrame = 0;
+    m_peerTime = 0;
+}
+
+void NetSession::setConditions(const NetConditions& conditions)
+{
+    m_conditions = conditions;
+    m_random = conditions.seed ? conditions.seed : 1;
+}
+
+bool NetSession::advance(const PlayerInput& local, uint64_t nowUs, unsigned int& events)
+{
+    events = GAME_EV_NONE;
+    m_stats.lastDepth = 0;
+    m_stats.lastResimUs = 0;
+
+    poll(nowUs);
+
+    // Correct any mispredictions before going further
+    if (m_rollbackFrame < m_state.step)
+        events |= rollback();
+    m_rollbackFrame = m_state.step;
+    confirm();
+
+    // Wait if we are too far ahead of what we know, or of where the
+    // peer probably is by now
+    uint32_t step = m_state.step;
+    uint32_t peerEstimate = m_remoteFrame + (m_stats.rttUs / 2) / (uint32_t)GAME_STEP_US;
+    if (step - m_remoteCount >= (uint32_t)NET_MAX_PREDICTION ||
+        (m_stats.packetsReceived > 0 && step > peerEstimate + NET_MAX_ADVANTAGE))
+    {
+        m_stats.stalls++;
+        sendInputs(nowUs);
+        return false;
+    }
+
+    int slot = step % NET_HISTORY;
+    m_inputs[slot][m_local] = local;
+    if (step >= m_remoteCount)
+        m_inputs[slot][m_remote] = predictRemote();
+
+    m_saved[slot] = m_state;
+    m_events[slot] = m_step(m_state, m_config, m_inputs[slot]);
+    events |= m_events[slot];
+    m_rollbackFrame = m_state.step;
+    m_stats.frames++;
+
+    confirm();
+    sendInputs(nowUs);
+    return true;
+}
+
+uint32_t NetSession::confirmedFrames() const
+{
+    return m_confirmed;
+}
+
+bool NetSession::confirmedChecksum(uint32_t frame, uint32_t& checksum) const
+{
+    if (frame >= m_confirmed || m_confirmed - frame > (uint32_t)NET_HISTORY)
+        return false;
+    checksum = m_checksums[frame % NET_HISTORY];
+    return true;
+}
+
+bool NetSession::confirmedStep(uint32_t frame, PlayerInput input[PLAYER_COUNT],
+                               GameState& before, unsigned int& events) const
+{
+    if (frame >= m_confirmed || m_state.step - frame > (uint32_t)NET_HISTORY)
+        return false;
+    int slot = frame % NET_HISTORY;
+    input[PLAYER_1] = m_inputs[slot][PLAYER_1];
+    input[PLAYER_2] = m_inputs[slot][PLAYER_2];
+    before = m_saved[slot];
+    events = m_events[slot];
+    return true;
+}
+
+void NetSession::poll(uint64_t nowUs)
+{
+    if (m_socket == NET_INVALID_SOCKET)
+        return;
+
+    // Release impaired packets whose time has come; the rest close up
+    // behind, still in the order they were sent
+    int kept = 0;
+    for (int i = 0; i < m_delayedCount; i++)
+    {
+        if (m_delayed[i].deliverUs <= nowUs)
+            sendto(m_socket, (const char*)m_delayed[i].data, m_delayed[i].size, 0,
+                   (const sockaddr*)m_remoteAddr, sizeof(sockaddr_in));
+        else if (kept++ != i)
+            m_delayed[kept - 1] = m_delayed[i];
+    }
+    m_delayedCount = kept;
+
+    const sockaddr_in* expected = (const sockaddr_in*)m_remoteAddr;
+    for (;;)
+    {
+        unsigned char buffer[NET_PACKET_SIZE];
+        sockaddr_in from;
+        socklen_t fromSize = sizeof(from);
+        int size = recvfrom(m_socket, (char*)buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromSize);
+        if (size <= 0)
+            break;
+
+        // Ignore anyone but the peer
+        if (from.sin_port != expected->sin_port)
+            continue;
+        if (expected->sin_addr.s_addr != htonl(INADDR_LOOPBACK) &&
+            from.sin_addr.s_addr != expected->sin_addr.s_addr)
+            continue;
+
+        receive(buffer, size, nowUs);
+    }
+}
+
+void NetSession::receive(const unsigned char* data, int size, uint64_t nowUs)
+{
+    if (size < NET_HEADER_SIZE)
+        return;
+
+    uint32_t magic, frame, ack, sendTime, echoTime, checkFrame, checksum, first;
+    uint8_t player, count;
+    const unsigned char* p = data;
+    p = get32(p, magic);
+    p = get8(p, player);
+    p = get32(p, frame);
+    p = get32(p, ack);
+    p = get32(p, sendTime);
+    p = get32(p, echoTime);
+    p = get32(p, checkFrame);
+    p = get32(p, checksum);
+    p = get32(p, first);
+    p = get8(p, count);
+
+    if (magic != NET_MAGIC || player != m_remote || size < NET_HEADER_SIZE + count * 3)
+        return;
+
+    m_stats.packetsReceived++;
+    if (frame > m_remoteFrame)
+        m_remoteFrame = frame;
+    if (ack > m_remoteAck)
+        m_remoteAck = ack;
+    m_peerTime = sendTime;
+    if (echoTime != 0)
+        m_stats.rttUs = (uint32_t)nowUs - echoTime;
+
+    // Accept inputs that extend the run we already have; anything after a
+    // gap will be sent again, since the peer resends from our ack
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint16_t y;
+        uint8_t button;
+        p = get16(p, y);
+        p = get8(p, button);
+
+        uint32_t step = first + i;
+        if (step != m_remoteCount)
+            continue;
+
+        PlayerInput input;
+        input.paddleY = (int16_t)y;
+        input.button = button;
+
+        int slot = step % NET_HISTORY;
+        if (step < m_state.step && !sameInput(input, m_inputs[slot][m_remote]))
+        {
+            if (step < m_rollbackFrame)
+                m_rollbackFrame = step;
+        }
+        m_inputs[slot][m_remote] = input;
+        m_remoteCount++;
+    }
+
+    // Compare the peer's confirmed state with ours
+    if (checkFrame > m_checkedFrame)
+    {
+        uint32_t ours;
+        if (confirmedChecksum(checkFrame - 1, ours))
+        {
+            if (ours != checksum)
+                m_stats.desyncs++;
+            m_checkedFrame = checkFrame;
+        }
+    }
+}
+
+void NetSession::sendInputs(uint64_t nowUs)
+{
+    if (m_socket == NET_INVALID_SOCKET)
+        return;
+
+    // Everything the peer has not acknowledged, oldest first
+    uint32_t first = m_remoteAck;
+    uint32_t count = m_state.step - first;
+    if (count > (uint32_t)NET_MAX_PACKET_INPUTS)
+        count = NET_MAX_PACKET_INPUTS;
+
+    uint32_t checkFrame = 0, checksum = 0;
+    if (m_confirmed > 0 && confirmedChecksum(m_confirmed - 1, checksum))
+        checkFrame = m_confirmed;
+
+    unsigned char buffer[NET_PACKET_SIZE];
+    unsigned char* p = buffer;
+    p = put32(p, NET_MAGIC);
+    p = put8(p, (uint8_t)m_local);
+    p = put32(p, m_state.step);
+    p = put32(p, m_remoteCount);
+    p = put32(p, (uint32_t)nowUs | 1);
+    p = put32(p, m_peerTime);
+    p = put32(p, checkFrame);
+    p = put32(p, checksum);
+    p = put32(p, first);
+    p = put8(p, (uint8_t)count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const PlayerInput& input = m_inputs[(first + i) % NET_HISTORY][m_local];
+        p = put16(p, (uint16_t)input.paddleY);
+        p = put8(p, input.button);
+    }
+
+    transmit(buffer, (int)(p - buffer), nowUs);
+}
+
+void NetSession::transmit(const unsigned char* data, int size, uint64_t nowUs)
+{
+    m_stats.packetsSent++;
+
+    bool impaired = m_conditions.latencyMs > 0 || m_conditions.jitterMs > 0 || m_conditions.loss > 0;
+    if (!impaired)
+    {
+        sendto(m_socket, (const char*)data, size, 0, (const sockaddr*)m_remoteAddr, sizeof(sockaddr_in));
+        return;
+    }
+
+    if ((nextRandom() >> 8) / 16777216.0 < m_conditions.loss)
+    {
+        m_stats.packetsDropped++;
+        return;
+    }
+
+    int64_t delayUs = (int64_t)m_conditions.latencyMs * 1000;
+    if (m_conditions.jitterMs > 0)
+    {
+        int64_t span = (int64_t)m_conditions.jitterMs * 2000;
+        delayUs += (int64_t)(nextRandom() % (uint32_t)(span + 1)) - span / 2;
+    }
+    if (delayUs < 0)
+        delayUs = 0;
+
+    if (m_delayedCount == NET_MAX_DELAYED || size > NET_PACKET_SIZE)
+    {
+        m_stats.packetsDropped++;
+        return;
+    }
+    DelayedPacket& packet = m_delayed[m_delayedCount++];
+    packet.deliverUs = nowUs + delayUs;
+    packet.size = size;
+    memcpy(packet.data, data, size);
+}
+
+unsigned int NetSession::rollback()
+{
+    uint64_t startUs = platformMicros();
+    uint32_t from = m_rollbackFrame;
+    uint32_t to = m_state.step;
+    unsigned int corrections = GAME_EV_NONE;
+
+    m_state = m_saved[from % NET_HISTORY];
+    for (uint32_t step = from; step < to; step++)
+    {
+        int slot = step % NET_HISTORY;
+        if (step >= m_remoteCount)
+            m_inputs[slot][m_remote] = predictRemote();
+
+        m_saved[slot] = m_state;
+        unsigned int events = m_step(m_state, m_config, m_inputs[slot]);
+
+        // Report only what the prediction missed; the rest already happened
+        corrections |= events & ~m_events[slot];
+        m_events[slot] = events;
+    }
+
+    uint64_t elapsed = platformMicros() - startUs;
+    uint32_t depth = to - from;
+    m_stats.rollbacks++;
+    m_stats.lastDepth = depth;
+    m_stats.totalDepth += depth;
+    if (depth > m_stats.maxDepth)
+        m_stats.maxDepth = depth;
+    m_stats.lastResimUs = elapsed;
+    m_stats.totalResimUs += elapsed;
+    if (elapsed > m_stats.maxResimUs)
+        m_stats.maxResimUs = elapsed;
+
+    return corrections;
+}
+
+PlayerInput NetSession::predictRemote() const
+{
+    if (m_remoteCount == 0)
+        return gameMakeInput(0, false);
+    return m_inputs[(m_remoteCount - 1) % NET_HISTORY][m_remote];
+}
+
+void NetSession::confirm()
+{
+    uint32_t limit = m_remoteCount < m_state.step ? m_remoteCount : m_state.step;
+    while (m_confirmed < limit)
+    {
+        uint32_t step = m_confirmed;
+        const GameState& after = (step + 1 == m_state.step) ? m_state : m_saved[(step + 1) % NET_HISTORY];
+        m_checksums[step % NET_HISTORY] = gameChecksum(after);
+        m_confirmed++;
+    }
+}
+
+uint32_t NetSession::nextRandom()
+{
+    m_random = m_random * 1664525u + 1013904223u;
+    return m_random;
+}
@@ -0,0 +1,171 @@
+// Make sure this header is included only once
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include "game.h"
+
+// Two-station play over UDP.  Each station runs the whole simulation
+// locally and only input frames cross the network.  Until the remote
+// input for a step arrives the session predicts it (the remote paddle
+// stays where it was last seen); when the real input turns out to be
+// different, the session rolls back to the saved state before that step
+// and resimulates up to the present within the same call.  The local
+// paddle, and everything the local player feels, never waits on the
+// network.
+
+// Steps of state kept for rollback
+const int NET_HISTORY = 128;
+
+// Stop and wait rather than predict further ahead than this (200 ms)
+const int NET_MAX_PREDICTION = 40;
+
+// Let the local station run at most this many steps ahead of its peer
+const int NET_MAX_ADVANTAGE = 2;
+
+// Most inputs carried by one packet
+const int NET_MAX_PACKET_INPUTS = 64;
+
+// magic, player, frame, ack, send time, echo time, check frame, checksum,
+// first input, input count, then three bytes per input
+const int NET_HEADER_SIZE = 4 + 1 + 4 * 7 + 1;
+const int NET_PACKET_SIZE = NET_HEADER_SIZE + NET_MAX_PACKET_INPUTS * 3;
+
+// Packets the impairment can hold back at once (over a second of them);
+// more are counted as dropped
+const int NET_MAX_DELAYED = 512;
+
+// Standard port for the game
+const int NET_DEFAULT_PORT = 7460;
+
+// Network impairment applied to outgoing packets, for testing on loopback
+struct NetConditions {
+    int      latencyMs;     // one-way delay
+    int      jitterMs;      // delay varies by up to this much either way
+    double   loss;          // probability that a packet is dropped
+    uint32_t seed;          // the impairment is repeatable for a given seed
+};
+
+struct NetStats {
+    uint32_t frames;            // steps advanced
+    uint32_t stalls;            // advance() calls that waited on the peer
+    uint32_t rollbacks;         // mispredictions corrected
+    uint32_t lastDepth;         // steps resimulated by the last advance()
+    uint32_t maxDepth;
+    uint64_t totalDepth;
+    uint64_t lastResimUs;       // time spent resimulating in the last advance()
+    uint64_t maxResimUs;
+    uint64_t totalResimUs;
+    uint32_t packetsSent;
+    uint32_t packetsReceived;
+    uint32_t packetsDropped;    // dropped by the impairment, not the network
+    uint32_t desyncs;           // confirmed states that disagreed with the peer
+    uint32_t rttUs;
+};
+
+// The socket type differs between Winsock and BSD sockets
+typedef size_t NetSocket;
+
+class NetSession
+{
+public:
+    NetSession();
+    ~NetSession();
+
+    // Open a UDP socket on localPort and aim it at the peer.
+    // localPlayer is PLAYER_1 or PLAYER_2; the two stations must differ.
+    bool open(int localPort, const char* remoteHost, int remotePort, int localPlayer);
+
+    // Close the socket
+    void close();
+
+    // Begin a game from a known state.  Both stations must start
+    // from the same state and configuration.
+    void start(const GameState& initial, const GameConfig& config);
+
+    // Impair outgoing packets
+    void setConditions(const NetConditions& conditions);
+
+    // Advance one step with the local player's input.  events receives the
+    // events of the new step plus any that a rollback newly produced for
+    // earlier steps.  Returns false if the step had to wait on the peer.
+    bool advance(const PlayerInput& local, uint64_t nowUs, unsigned int& events);
+
+    // Current (possibly predicted) state
+    const GameState& state() const { return m_state; }
+
+    // Steps whose inputs are known from both stations
+    uint32_t confirmedFrames() const;
+
+    // Checksum of the state after a confirmed step, if still kept
+    bool confirmedChecksum(uint32_t frame, uint32_t& checksum) const;
+
+    // Inputs, starting state and events of a confirmed step, if still kept
+    bool confirmedStep(uint32_t frame, PlayerInput input[PLAYER_COUNT],
+                       GameState& before, unsigned int& events) const;
+
+    const NetStats& stats() const { return m_stats; }
+
+    int localPlayer() const { return m_local; }
+
+private:
+    struct DelayedPacket {
+        uint64_t      deliverUs;
+        int           size;
+        unsigned char data[NET_PACKET_SIZE];
+    };
+
+    // Read everything waiting on the socket and flush delayed packets
+    void poll(uint64_t nowUs);
+
+    // Handle one packet from the peer
+    void receive(const unsigned char* data, int size, uint64_t nowUs);
+
+    // Tell the peer about our latest inputs
+    void sendInputs(uint64_t nowUs);
+
+    // Put a packet on the wire, subject to the impairment
+    void transmit(const unsigned char* data, int size, uint64_t nowUs);
+
+    // Resimulate from m_rollbackFrame up to the present
+    unsigned int rollback();
+
+    // Input the remote player is assumed to have given for an unconfirmed step
+    PlayerInput predictRemote() const;
+
+    // Record checksums for newly confirmed steps
+    void confirm();
+
+    uint32_t nextRandom();
+
+    NetSocket     m_socket;
+    unsigned char m_remoteAddr[16];
+    int           m_local;
+    int           m_remote;
+
+    GameConfig    m_config;
+    GameStepFn    m_step;                       // gameStep() for m_config's mode
+    GameState     m_state;
+
+    // Per step, indexed by step % NET_HISTORY
+    GameState     m_saved[NET_HISTORY];        // state before the step
+    PlayerInput   m_inputs[NET_HISTORY][PLAYER_COUNT];
+    unsigned int  m_events[NET_HISTORY];
+    uint32_t      m_checksums[NET_HISTORY];    // state after the step, once confirmed
+
+    uint32_t      m_remoteCount;    // remote inputs known, all contiguous from step 0
+    uint32_t      m_remoteFrame;    // step the peer last reported
+    uint32_t      m_remoteAck;      // local inputs the peer has
+    uint32_t      m_rollbackFrame;  // earliest step to resimulate
+    uint32_t      m_confirmed;      // steps with a recorded checksum
+    uint32_t      m_checkedFrame;   // last step compared against the peer
+    uint32_t      m_peerTime;       // peer's last send time, echoed back
+
+    NetConditions m_conditions;
+    uint32_t      m_random;
+    DelayedPacket m_delayed[NET_MAX_DELAYED];  // in the order sent
+    int           m_delayedCount;
+
+    NetStats      m_stats;
+};
+
+#endif // NETPLAY_H
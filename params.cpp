@@ -0,0 +1,496 @@
+#include "params.h"
+#include "log.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// "HGPB"
+static const uint32_t PARAMS_MAGIC = 0x42504748;
+
+#ifdef _WIN32
+static const char* PARAMS_SHARED_NAME = "Local\\HapticsGameParams";
+#else
+static const char* PARAMS_SHARED_NAME = "/hapticsgame-params";
+#endif
+
+// Names used in Params.ini, hgtool tune and the results log, and the
+// values each may take
+struct ParamField {
+    const char* name;
+    size_t      offset;
+    int         count;
+    bool        isInt;
+    double      min, max;
+};
+
+static const ParamField gFields[] = {
+    { "stiffness",     offsetof(GameParams, stiffness),      1, false,    0, 1000   },
+    { "edge_length",   offsetof(GameParams, cubeEdgeLength), 1, false, 0.05, 1      },
+    { "rebounds",      offsetof(GameParams, rebounds),       1, true,     1, 100000 },
+    { "wall_gain",     offsetof(GameParams, wallGain),       1, false, -500, 0      },
+    { "paddle_gain_y", offsetof(GameParams, paddleGainY),    1, false,  -20, 0      },
+    { "paddle_gain_x", offsetof(GameParams, paddleGainX),    1, false,  -20, 0      },
+    { "workspace",     offsetof(GameParams, workspace),      6, false,  -10, 10     },
+    { "speed_up",      offsetof(GameParams, speedUp),        1, false,    1, 2      },
+    { "predict_ms",    offsetof(GameParams, predictMs),      1, false,    0, 100    },
+};
+
+// The workspace's high end must be this far above its low end on each
+// axis; the device is mapped into it, and the arena field is built on it
+static const double PARAMS_WORKSPACE_SPAN = 0.5;
+
+static const int gFieldCount = sizeof(gFields) / sizeof(gFields[0]);
+
+void paramsDefault(GameParams& params)
+{
+    static const double gameWorkspace[] = {-2,-2,-2,2,2,3};
+
+    memset(&params, 0, sizeof(params));
+    params.stiffness = 200.0;
+    params.cubeEdgeLength = 0.5;
+    params.rebounds = 100;
+    params.wallGain = -100;
+    params.paddleGainY = -2.5;
+    params.paddleGainX = -1.5;
+    memcpy(params.workspace, gameWorkspace, sizeof(params.workspace));
+    params.speedUp = 1.1;
+    params.predictMs = 20;
+}
+
+static void initBlock(ParamBlock* block)
+{
+    memset(block, 0, sizeof(*block));
+    paramsDefault(block->params);
+    block->version = 1;
+    block->magic = PARAMS_MAGIC;
+}
+
+ParamBlock* paramsShared(bool create)
+{
+    static ParamBlock privateBlock;
+    ParamBlock* block = NULL;
+
+#ifdef _WIN32
+    HANDLE mapping = create
+        ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(ParamBlock), PARAMS_SHARED_NAME)
+        : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, PARAMS_SHARED_NAME);
+    if (mapping != NULL)
+        block = (ParamBlock*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ParamBlock));
+#else
+    int fd = shm_open(PARAMS_SHARED_NAME, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+    if (fd >= 0)
+    {
+        if (!create || ftruncate(fd, sizeof(ParamBlock)) == 0)
+        {
+            void* p = mmap(NULL, sizeof(ParamBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED)
+                block = (ParamBlock*)p;
+        }
+        close(fd);
+    }
+#endif
+
+    if (!create)
+        return (block != NULL && block->magic == PARAMS_MAGIC) ? block : NULL;
+
+    // A new game always starts from the defaults
+    if (block == NULL)
+        block = &privateBlock;
+    initBlock(block);
+    return block;
+}
+
+// Tries before a reader or writer starts to yield and watch the clock
+static const int PARAMS_SPINS = 64;
+
+// Spin a little, then yield until the deadline; false once it has passed
+static bool keepWaiting(int tries, uint64_t& deadline)
+{
+    if (tries < PARAMS_SPINS)
+        return true;
+    uint64_t now = platformMicros();
+    if (deadline == 0)
+        deadline = now + PARAMS_WAIT_US;
+    else if (now >= deadline)
+        return false;
+    platformYield();
+    return true;
+}
+
+bool paramsRead(const ParamBlock* block, GameParams& params, uint32_t& version)
+{
+    uint64_t deadline = 0;
+    for (int tries = 0; keepWaiting(tries, deadline); tries++)
+    {
+        uint32_t before = atomicLoad(&block->sequence);
+        if ((before & 1) == 0)
+        {
+            GameParams copy;
+            memcpy(&copy, (const void*)&block->params, sizeof(copy));
+            uint32_t copyVersion = block->version;
+            atomicLoadFence();
+            if (atomicLoad(&block->sequence) == before)
+            {
+                params = copy;
+                version = copyVersion;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool paramsRefresh(const ParamBlock* block, GameParams& params, uint32_t& sequence)
+{
+    uint32_t current = atomicLoad(&block->sequence);
+    if (current == sequence || (current & 1) != 0)
+        return false;
+
+    GameParams copy;
+    memcpy(&copy, (const void*)&block->params, sizeof(copy));
+    atomicLoadFence();
+    if (atomicLoad(&block->sequence) != current)
+        return false;
+
+    // A torn copy is thrown away and tried again on the next call.  One
+    // out of range, which no writer here lets in, is thrown away for good.
+    sequence = current;
+    if (!paramsValid(copy))
+        return false;
+    params = copy;
+    return true;
+}
+
+// The fields of params that differ from before, or all of them
+static bool write(ParamBlock* block, const GameParams& params, const GameParams* before)
+{
+    if (!paramsValid(params))
+        return false;
+
+    // Writers take turns by making the sequence odd
+    uint64_t deadline = 0;
+    for (int tries = 0; keepWaiting(tries, deadline); tries++)
+    {
+        uint32_t sequence = atomicLoad(&block->sequence);
+        if ((sequence & 1) != 0 || atomicCompareExchange(&block->sequence, sequence + 1, sequence) != sequence)
+            continue;
+
+        if (before == NULL)
+        {
+            memcpy((void*)&block->params, &params, sizeof(params));
+        }
+        else
+        {
+            for (int i = 0; i < gFieldCount; i++)
+            {
+                const ParamField& field = gFields[i];
+                size_t size = field.isInt ? sizeof(int) : field.count * sizeof(double);
+                const char* from = (const char*)&params + field.offset;
+                if (memcmp((const char*)before + field.offset, from, size) != 0)
+                    memcpy((char*)&block->params + field.offset, from, size);
+            }
+        }
+        block->version++;
+
+        // The owner may have taken the block back, thinking this writer
+        // dead; then it writes again
+        if (atomicCompareExchange(&block->sequence, sequence + 2, sequence + 1) == sequence + 1)
+            return true;
+    }
+    return false;
+}
+
+bool paramsWrite(ParamBlock* block, const GameParams& params)
+{
+    return write(block, params, NULL);
+}
+
+bool paramsWriteChanges(ParamBlock* block, const GameParams& before, const GameParams& after)
+{
+    return write(block, after, &before);
+}
+
+bool paramsRecover(ParamBlock* block, const GameParams& good, uint32_t& stuck, uint64_t& sinceUs)
+{
+    uint32_t sequence = atomicLoad(&block->sequence);
+    if ((sequence & 1) == 0)
+        return false;
+
+    // The same writer must hold it the whole time
+    uint64_t now = platformMicros();
+    if (sequence != stuck)
+    {
+        stuck = sequence;
+        sinceUs = now;
+        return false;
+    }
+    if (now - sinceUs < PARAMS_STUCK_US)
+        return false;
+
+    // Take the block over as a writer would, with a sequence the dead
+    // writer does not expect if it wakes after all
+    if (atomicCompareExchange(&block->sequence, sequence + 2, sequence) != sequence)
+        return false;
+    memcpy((void*)&block->params, &good, sizeof(good));
+    block->version++;
+    atomicStore(&block->sequence, sequence + 3);
+    stuck = 0;
+    return true;
+}
+
+static const ParamField* findField(const char* name)
+{
+    for (int i = 0; i < gFieldCount; i++)
+    {
+        if (strcmp(gFields[i].name, name) == 0)
+            return &gFields[i];
+    }
+    return NULL;
+}
+
+// Whether values, which parse, can be field's.  Written so that NaN
+// fails; allocates nothing, for the servo thread.
+static bool fieldInRange(const ParamField& field, const double* values)
+{
+    for (int i = 0; i < field.count; i++)
+    {
+        if (!(values[i] >= field.min && values[i] <= field.max))
+            return false;
+    }
+    if (field.offset == offsetof(GameParams, workspace))
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (!(values[axis + 3] - values[axis] >= PARAMS_WORKSPACE_SPAN))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Why values are out of range
+static std::string rangeError(const ParamField& field, const double* values)
+{
+    char text[160];
+    sprintf(text, "%s takes %g to %g", field.name, field.min, field.max);
+    for (int i = 0; i < field.count; i++)
+    {
+        if (!(values[i] >= field.min && values[i] <= field.max))
+        {
+            sprintf(text, "%s %g is outside %g to %g", field.name, values[i], field.min, field.max);
+            return text;
+        }
+    }
+    if (field.count == 6)
+        sprintf(text, "workspace needs each high end %g above its low end", PARAMS_WORKSPACE_SPAN);
+    return text;
+}
+
+// A field's values as doubles, integers included
+static void fieldValues(const ParamField& field, const GameParams& params, double* values)
+{
+    const char* base = (const char*)&params + field.offset;
+    if (field.isInt)
+        values[0] = *(const int*)base;
+    else
+        memcpy(values, base, field.count * sizeof(double));
+}
+
+bool paramsValid(const GameParams& params)
+{
+    for (int i = 0; i < gFieldCount; i++)
+    {
+        double values[6];
+        fieldValues(gFields[i], params, values);
+        if (!fieldInRange(gFields[i], values))
+            return false;
+    }
+    return true;
+}
+
+// Past spaces and commas, and the end of a line from a file
+static const char* skipSeparators(const char* p)
+{
+    while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+    return p;
+}
+
+bool paramsSet(GameParams& params, const char* name, const char* value, std::string& error)
+{
+    const ParamField* field = findField(name);
+    if (field == NULL)
+    {
+        error = std::string("no parameter called ") + name;
+        return false;
+    }
+
+    // Numbers separated by spaces or commas, and nothing else
+    double values[6];
+    const char* p = value;
+    for (int i = 0; i < field->count; i++)
+    {
+        p = skipSeparators(p);
+        char* end;
+        values[i] = field->isInt ? (double)strtol(p, &end, 10) : strtod(p, &end);
+        if (end == p)
+        {
+            error = std::string(field->name) + " needs " + (field->count > 1 ? "six numbers" : "a number");
+            return false;
+        }
+        if (field->isInt && (*end == '.' || *end == 'e' || *end == 'E'))
+        {
+            error = std::string(field->name) + " needs a whole number";
+            return false;
+        }
+        p = end;
+    }
+    p = skipSeparators(p);
+    if (*p != '\0')
+    {
+        error = std::string(field->name) + " has more after its value: " + std::string(p, strcspn(p, "\r\n"));
+        return false;
+    }
+
+    if (!fieldInRange(*field, values))
+    {
+        error = rangeError(*field, values);
+        return false;
+    }
+
+    char* base = (char*)&params + field->offset;
+    if (field->isInt)
+        *(int*)base = (int)values[0];
+    else
+        memcpy(base, values, field->count * sizeof(double));
+    return true;
+}
+
+bool paramsLoadFile(const char* path, GameParams& params, std::string& rejected)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        number++;
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+            continue;
+
+        char* equals = strchr(p, '=');
+        if (equals == NULL)
+            continue;
+        *equals = 0;
+
+        // Trim the name
+        char* end = equals;
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+            *--end = 0;
+
+        std::string error;
+        if (!paramsSet(params, p, equals + 1, error))
+        {
+            char where[32];
+            sprintf(where, "line %d: ", number);
+            rejected += where + error + "\n";
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static std::string formatField(const ParamField& field, const GameParams& params)
+{
+    const char* base = (const char*)&params + field.offset;
+    char text[160];
+    if (field.isInt)
+    {
+        sprintf(text, "%d", *(const int*)base);
+        return text;
+    }
+
+    std::string out;
+    const double* values = (const double*)base;
+    for (int i = 0; i < field.count; i++)
+    {
+        sprintf(text, i ? " %g" : "%g", values[i]);
+        out += text;
+    }
+    return out;
+}
+
+void paramsPrint(FILE* out, const GameParams& params)
+{
+    for (int i = 0; i < gFieldCount; i++)
+        fprintf(out, "%s = %s\n", gFields[i].name, formatField(gFields[i], params).c_str());
+}
+
+std::string paramsDiff(const GameParams& before, const GameParams& after)
+{
+    std::string out;
+    for (int i = 0; i < gFieldCount; i++)
+    {
+        const ParamField& field = gFields[i];
+        size_t size = field.isInt ? sizeof(int) : field.count * sizeof(double);
+        if (memcmp((const char*)&before + field.offset, (const char*)&after + field.offset, size) == 0)
+            continue;
+        out += field.name;
+        out += " ";
+        out += formatField(field, before);
+        out += " -> ";
+        out += formatField(field, after);
+        out += "\n";
+    }
+    return out;
+}
+
+bool paramsLog(const GameParams& before, const GameParams& after)
+{
+    bool changed = false;
+    for (int i = 0; i < gFieldCount; i++)
+    {
+        const ParamField& field = gFields[i];
+        double from[6], to[6];
+        fieldValues(field, before, from);
+        fieldValues(field, after, to);
+        for (int j = 0; j < field.count; j++)
+        {
+            if (from[j] == to[j])
+                continue;
+            if (field.count > 1)
+                LOG4("param %s[%d] %g -> %g", field.name, j, from[j], to[j]);
+            else
+                LOG3("param %s %g -> %g", field.name, from[j], to[j]);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+uint64_t paramsFileStamp(const char* path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return 0;
+
+    // Modification times only have whole seconds; the size catches
+    // most second edits within the same second
+    return ((uint64_t)info.st_mtime << 24) ^ (uint64_t)info.st_size ^ 1;
+}
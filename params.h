@@ -0,0 +1,112 @@
+// Make sure this header is included only once
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include "platform.h"
+#include <stdio.h>
+#include <string>
+
+// Tuning knobs that used to be compile-time constants.  They live in one
+// block of shared memory guarded by a sequence lock: a writer makes the
+// sequence odd, changes the block and makes it even again, and a reader
+// that saw the same even sequence before and after its copy has a
+// consistent copy.  The servo thread only copies when the sequence has
+// moved, so an unchanged block costs it one load per tick.
+//
+// The game writes the block when Params.ini changes; hgtool tune writes
+// it from outside the process.  Every value has a range, checked before
+// it goes in: these drive the forces on the player's hand, and a typo
+// must not become a wall of 10^6 N/m.
+//
+// Nobody waits on the block for long.  Readers and writers give up after
+// PARAMS_WAIT_US and keep what they had.  A writer that dies in the block
+// leaves the sequence odd for good, so the game, which owns the block,
+// takes it back after PARAMS_STUCK_US (paramsRecover).
+
+// How long a reader or writer waits for another writer to leave
+const uint64_t PARAMS_WAIT_US = 1000;
+
+// How long a writer can be in the block before it is taken for dead
+const uint64_t PARAMS_STUCK_US = 500000;
+
+struct GameParams {
+    double stiffness;       // cube stiffness handed to the haptics object
+    double cubeEdgeLength;  // paddle height and puck diameter
+    int    rebounds;        // practice session length
+    double wallGain;        // spring at the top and bottom of the play area
+    double paddleGainY;     // spring pulling the hand toward the puck, vertically
+    double paddleGainX;     // and horizontally
+    double workspace[6];    // game workspace the device is mapped into
+    double speedUp;         // puck speed multiplier on every paddle hit
+    double predictMs;       // how far ahead the local paddle is drawn; 0 to draw it as read
+};
+
+struct ParamBlock {
+    uint32_t          magic;
+    volatile uint32_t sequence;     // odd while a writer is in the block
+    uint32_t          version;      // counts changes
+    GameParams        params;
+};
+
+// The values the game always had
+void paramsDefault(GameParams& params);
+
+// Map the shared block.  The game creates it, filled with defaults;
+// tools attach to the game's block and fail if the game is not running.
+// If shared memory is unavailable the game gets a private block.
+ParamBlock* paramsShared(bool create);
+
+// Consistent copy of the block.  False, with params and version left as
+// they were, if a writer stayed in the block for PARAMS_WAIT_US.
+bool paramsRead(const ParamBlock* block, GameParams& params, uint32_t& version);
+
+// Copy the block only if it changed since sequence was last seen.
+// Returns true, and updates sequence, if params was refreshed.
+bool paramsRefresh(const ParamBlock* block, GameParams& params, uint32_t& sequence);
+
+// Replace the block's contents and bump its version.  False if a value
+// is out of range, or if another writer stayed in the block for
+// PARAMS_WAIT_US.
+bool paramsWrite(ParamBlock* block, const GameParams& params);
+
+// The same for only the parameters that differ between before and
+// after, so that a writer working from an older copy leaves everything
+// else in the block as it is
+bool paramsWriteChanges(ParamBlock* block, const GameParams& before, const GameParams& after);
+
+// For the block's owner, every so often: if one writer has held the block
+// for PARAMS_STUCK_US, it died there.  Its half-written values are
+// replaced with good ones and the block is let go.  stuck and sinceUs are
+// the caller's to keep, zero to start.  True if the block was taken back.
+bool paramsRecover(ParamBlock* block, const GameParams& good, uint32_t& stuck, uint64_t& sinceUs);
+
+// Set one parameter by name from text.  workspace takes six numbers,
+// each axis's low end before its high end.  False, with the reason in
+// error and params unchanged, for an unknown name, a bad number or one
+// out of range.
+bool paramsSet(GameParams& params, const char* name, const char* value, std::string& error);
+
+// Every value in range
+bool paramsValid(const GameParams& params);
+
+// Apply "name = value" lines from a file on top of params.  Lines starting
+// with # are comments.  Lines that paramsSet rejects are skipped, with a
+// line each in rejected.  Returns false if the file cannot be read.
+bool paramsLoadFile(const char* path, GameParams& params, std::string& rejected);
+
+// Write every parameter as "name = value" lines
+void paramsPrint(FILE* out, const GameParams& params);
+
+// One "name old -> new" line for each parameter that differs
+std::string paramsDiff(const GameParams& before, const GameParams& after);
+
+// The same as log records (log.h), one for each parameter or workspace
+// value that differs; formats nothing and never waits, for the
+// simulation thread.  True if anything differs.
+bool paramsLog(const GameParams& before, const GameParams& after);
+
+// A value that changes whenever a file's modification time or size does;
+// 0 if the file does not exist
+uint64_t paramsFileStamp(const char* path);
+
+#endif // PARAMS_H
@@ -0,0 +1,148 @@
+#include "platform.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// What a new thread is to run; freed by the thread
+struct ThreadStart {
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+#ifdef _WIN32
+
+uint64_t platformMicros()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    // Split the division so the multiply cannot overflow
+    uint64_t seconds = now.QuadPart / frequency.QuadPart;
+    uint64_t remainder = now.QuadPart % frequency.QuadPart;
+    return seconds * 1000000 + remainder * 1000000 / frequency.QuadPart;
+}
+
+uint64_t platformTicks()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+uint64_t platformTicksPerSecond()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+}
+
+void platformSleepMs(int ms)
+{
+    Sleep(ms);
+}
+
+void platformYield()
+{
+    SwitchToThread();
+}
+
+static DWORD WINAPI threadEntry(LPVOID param)
+{
+    ThreadStart start = *(ThreadStart*)param;
+    delete (ThreadStart*)param;
+    start.fn(start.arg);
+    return 0;
+}
+
+bool platformStartThread(PlatformThread& thread, void (*fn)(void* arg), void* arg)
+{
+    ThreadStart* start = new ThreadStart;
+    start->fn = fn;
+    start->arg = arg;
+    thread = CreateThread(NULL, 0, threadEntry, start, 0, NULL);
+    if (thread == NULL)
+    {
+        delete start;
+        return false;
+    }
+    return true;
+}
+
+void platformJoinThread(PlatformThread& thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    thread = NULL;
+}
+
+#else
+
+uint64_t platformMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t platformTicks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t platformTicksPerSecond()
+{
+    return 1000000000;
+}
+
+void platformSleepMs(int ms)
+{
+    usleep(ms * 1000);
+}
+
+void platformYield()
+{
+    sched_yield();
+}
+
+static void* threadEntry(void* param)
+{
+    ThreadStart start = *(ThreadStart*)param;
+    delete (ThreadStart*)param;
+    start.fn(start.arg);
+    return NULL;
+}
+
+bool platformStartThread(PlatformThread& thread, void (*fn)(void* arg), void* arg)
+{
+    ThreadStart* start = new ThreadStart;
+    start->fn = fn;
+    start->arg = arg;
+    pthread_t id;
+    if (pthread_create(&id, NULL, threadEntry, start) != 0)
+    {
+        delete start;
+        return false;
+    }
+    thread = (PlatformThread)id;
+    return true;
+}
+
+void platformJoinThread(PlatformThread& thread)
+{
+    pthread_join((pthread_t)thread, NULL);
+    thread = 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+// Make sure this header is included only once
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// A thin layer over the few operating system services the game needs
+// outside of HDAL and GLUT.  The game itself runs on Windows; the command
+// line tools also build on Linux.
+
+// Visual Studio 2008 has no <stdint.h>
+#if defined(_MSC_VER) && _MSC_VER < 1600
+typedef signed __int8      int8_t;
+typedef signed __int16     int16_t;
+typedef signed __int32     int32_t;
+typedef signed __int64     int64_t;
+typedef unsigned __int8    uint8_t;
+typedef unsigned __int16   uint16_t;
+typedef unsigned __int32   uint32_t;
+typedef unsigned __int64   uint64_t;
+#else
+#include <stdint.h>
+#endif
+#include <stddef.h>
+
+// Atomic operations on 32-bit words shared between threads or processes.
+// Loads acquire, stores release, and the read-modify-write operations
+// are full barriers.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(_InterlockedCompareExchange, _InterlockedExchange, _InterlockedExchangeAdd, _InterlockedOr, _ReadWriteBarrier)
+
+// x86 does not reorder loads with loads or stores with stores; only the
+// compiler has to be held back
+inline uint32_t atomicLoad(const volatile uint32_t* p)
+{
+    uint32_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+inline void atomicStore(volatile uint32_t* p, uint32_t v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+inline uint32_t atomicCompareExchange(volatile uint32_t* p, uint32_t exchange, uint32_t comparand)
+{
+    return (uint32_t)_InterlockedCompareExchange((volatile long*)p, (long)exchange, (long)comparand);
+}
+
+inline uint32_t atomicExchange(volatile uint32_t* p, uint32_t v)
+{
+    return (uint32_t)_InterlockedExchange((volatile long*)p, (long)v);
+}
+
+inline uint32_t atomicAdd(volatile uint32_t* p, uint32_t v)
+{
+    return (uint32_t)_InterlockedExchangeAdd((volatile long*)p, (long)v) + v;
+}
+
+inline void atomicFence()
+{
+    long dummy = 0;
+    _InterlockedOr(&dummy, 0);
+}
+
+// Order the loads before it against the loads after it
+inline void atomicLoadFence()
+{
+    _ReadWriteBarrier();
+}
+#else
+inline uint32_t atomicLoad(const volatile uint32_t* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void atomicStore(volatile uint32_t* p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+inline uint32_t atomicCompareExchange(volatile uint32_t* p, uint32_t exchange, uint32_t comparand)
+{
+    return __sync_val_compare_and_swap(p, comparand, exchange);
+}
+
+inline uint32_t atomicExchange(volatile uint32_t* p, uint32_t v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+inline uint32_t atomicAdd(volatile uint32_t* p, uint32_t v)
+{
+    return __sync_add_and_fetch(p, v);
+}
+
+inline void atomicFence()
+{
+    __sync_synchronize();
+}
+
+inline void atomicLoadFence()
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+#endif
+
+// Monotonic time in microseconds since an arbitrary origin
+uint64_t platformMicros();
+
+// The raw monotonic counter platformMicros() is read from, for timing
+// very short things cheaply; convert with platformTicksPerSecond()
+uint64_t platformTicks();
+uint64_t platformTicksPerSecond();
+
+// Give up the processor for at least the given number of milliseconds
+void platformSleepMs(int ms);
+
+// Let another ready thread run, if there is one
+void platformYield();
+
+// Storage class of a variable each thread has its own copy of.  Only for
+// plain data without constructors.
+#if defined(_MSC_VER)
+#define PLATFORM_THREAD_LOCAL __declspec(thread)
+#else
+#define PLATFORM_THREAD_LOCAL __thread
+#endif
+
+// A thread running fn(arg) until it returns
+#ifdef _WIN32
+typedef void* PlatformThread;
+#else
+typedef unsigned long PlatformThread;
+#endif
+bool platformStartThread(PlatformThread& thread, void (*fn)(void* arg), void* arg);
+void platformJoinThread(PlatformThread& thread);
+
+#endif // PLATFORM_H
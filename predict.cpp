@@ -0,0 +1,161 @@
+#include "predict.h"
+#include <string.h>
+
+MotionRing::MotionRing()
+    : m_head(0)
+{
+    memset(m_samples, 0, sizeof(m_samples));
+}
+
+void MotionRing::push(uint64_t us, double y)
+{
+    uint32_t head = m_head;
+    MotionSample& sample = m_samples[head % MOTION_RING_SAMPLES];
+    sample.us = us;
+    sample.y = y;
+    atomicStore(&m_head, head + 1);
+}
+
+bool MotionRing::read(uint32_t& next, MotionSample& sample) const
+{
+    for (;;)
+    {
+        uint32_t head = atomicLoad(&m_head);
+        if (head == next)
+            return false;
+
+        // Too far behind: skip to the oldest reading still there
+        if (head - next > MOTION_RING_SAMPLES)
+            next = head - MOTION_RING_SAMPLES;
+
+        sample = m_samples[next % MOTION_RING_SAMPLES];
+
+        // The servo may have come round to this slot while it was copied
+        atomicLoadFence();
+        if (atomicLoad(&m_head) - next >= MOTION_RING_SAMPLES)
+        {
+            next++;
+            continue;
+        }
+        next++;
+        return true;
+    }
+}
+
+// dt^n / n!
+static double term(double dt, int n)
+{
+    double value = 1;
+    for (int i = 1; i <= n; i++)
+        value *= dt / i;
+    return value;
+}
+
+MotionPredictor::MotionPredictor(MotionModel model)
+    : m_model(model),
+      m_states(model == MOTION_HOLD ? 1 : model == MOTION_VELOCITY ? 2 : 3),
+      m_q(model == MOTION_VELOCITY ? MOTION_DEFAULT_ACCELERATION : MOTION_DEFAULT_JERK),
+      m_r(MOTION_DEFAULT_NOISE)
+{
+    reset();
+}
+
+void MotionPredictor::tune(double q, double r)
+{
+    m_q = q;
+    m_r = r;
+}
+
+void MotionPredictor::reset()
+{
+    memset(m_x, 0, sizeof(m_x));
+    memset(m_p, 0, sizeof(m_p));
+    m_us = 0;
+    m_started = false;
+}
+
+void MotionPredictor::update(uint64_t us, double y)
+{
+    int n = m_states;
+    if (!m_started || us - m_us > MOTION_GAP_US || n == 1)
+    {
+        // Start from the reading, at rest but not sure of it
+        reset();
+        m_x[0] = y;
+        m_p[0][0] = m_r * m_r;
+        m_p[1][1] = 100.0;
+        m_p[2][2] = 1e5;
+        m_us = us;
+        m_started = true;
+        return;
+    }
+
+    // Carry the state and its covariance forward to the reading:
+    // x = F x, P = F P F' + Q.  F is the Taylor series in dt, and Q is
+    // white noise in the first derivative the model leaves out.
+    double dt = (us - m_us) * 1e-6;
+    m_us = us;
+    if (dt > 0)
+    {
+        double f[3][3];
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+                f[i][j] = j >= i ? term(dt, j - i) : 0;
+
+        double x[3] = { 0, 0, 0 };
+        for (int i = 0; i < n; i++)
+            for (int j = i; j < n; j++)
+                x[i] += f[i][j] * m_x[j];
+        memcpy(m_x, x, sizeof(m_x));
+
+        double fp[3][3];
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                fp[i][j] = 0;
+                for (int k = i; k < n; k++)
+                    fp[i][j] += f[i][k] * m_p[k][j];
+            }
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                // q dt^(2n-1-i-j) / ((n-1-i)! (n-1-j)! (2n-1-i-j))
+                int a = n - 1 - i, b = n - 1 - j;
+                double q = m_q * term(dt, a) * term(dt, b) * dt / (a + b + 1);
+                double p = 0;
+                for (int k = j; k < n; k++)
+                    p += fp[i][k] * f[j][k];
+                m_p[i][j] = p + q;
+            }
+    }
+
+    // Fold in the reading, which sees the position alone
+    double s = m_p[0][0] + m_r * m_r;
+    double k[3];
+    for (int i = 0; i < n; i++)
+        k[i] = m_p[i][0] / s;
+    double innovation = y - m_x[0];
+    for (int i = 0; i < n; i++)
+        m_x[i] += k[i] * innovation;
+    double row[3];
+    for (int j = 0; j < n; j++)
+        row[j] = m_p[0][j];
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            m_p[i][j] -= k[i] * row[j];
+}
+
+double MotionPredictor::predict(uint64_t us) const
+{
+    if (!m_started || us <= m_us)
+        return m_x[0];
+    uint64_t lead = us - m_us;
+    if (lead > MOTION_MAX_LEAD_US)
+        lead = MOTION_MAX_LEAD_US;
+    double dt = lead * 1e-6;
+
+    double y = 0;
+    for (int i = 0; i < m_states; i++)
+        y += m_x[i] * term(dt, i);
+    return y;
+}
@@ -0,0 +1,107 @@
+// Make sure this header is included only once
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include "platform.h"
+
+// The screen shows the hand where it was a frame or more ago: the frame
+// is drawn from the last device reading, then waits for the swap and
+// the display.  At speed the paddle trails the hand by a good part of
+// its own height.  Drawing it where the hand will be by the time the
+// frame is seen takes that lag out.
+//
+// The servo thread stamps every device reading into a MotionRing.  The
+// window drains the ring each frame into a MotionPredictor, a Kalman
+// filter over position, velocity and (by default) acceleration, and
+// draws the local paddle at its prediction for the time the frame will
+// be on the screen.  The game itself keeps playing the measured
+// position: prediction only moves what is drawn.
+
+// Readings the ring holds; a quarter of a second at the servo's rate
+const uint32_t MOTION_RING_SAMPLES = 256;
+
+// A gap longer than this between readings starts the filter over
+const uint64_t MOTION_GAP_US = 100000;
+
+// Furthest ahead a prediction will reach
+const uint64_t MOTION_MAX_LEAD_US = 100000;
+
+struct MotionSample {
+    uint64_t us;        // platformMicros() when the device was read
+    double   y;         // in game coordinates
+};
+
+// Device readings from the servo thread, for whoever wants them.  One
+// writer; each reader keeps its own position and misses what it falls
+// more than MOTION_RING_SAMPLES behind on.
+class MotionRing
+{
+public:
+    MotionRing();
+
+    // Servo thread only
+    void push(uint64_t us, double y);
+
+    // Where a new reader starts: the next reading pushed
+    uint32_t head() const { return atomicLoad(&m_head); }
+
+    // The oldest reading at or after next that is still in the ring, if
+    // any; next moves past it
+    bool read(uint32_t& next, MotionSample& sample) const;
+
+private:
+    MotionSample      m_samples[MOTION_RING_SAMPLES];
+    volatile uint32_t m_head;       // reading i is at i % MOTION_RING_SAMPLES
+};
+
+enum MotionModel {
+    MOTION_HOLD,            // the last reading: what the game always drew
+    MOTION_VELOCITY,        // constant velocity between readings
+    MOTION_ACCELERATION     // constant acceleration between readings
+};
+
+// Spectral density of what the model leaves out (jerk for constant
+// acceleration, acceleration for constant velocity), in game units and
+// seconds, and the readings' noise as a standard deviation.  Tuned with
+// hgtool predictlab.
+const double MOTION_DEFAULT_JERK = 2e5;
+const double MOTION_DEFAULT_ACCELERATION = 2e3;
+const double MOTION_DEFAULT_NOISE = 0.002;
+
+class MotionPredictor
+{
+public:
+    MotionPredictor(MotionModel model = MOTION_ACCELERATION);
+
+    // Process noise q and reading noise (standard deviation) r
+    void tune(double q, double r);
+
+    // Forget everything; the next reading starts the filter over
+    void reset();
+
+    // A reading of the position at us.  Readings must come in order.
+    void update(uint64_t us, double y);
+
+    // Where the position will be at us, from the readings so far; at
+    // most MOTION_MAX_LEAD_US past the last of them
+    double predict(uint64_t us) const;
+
+    // The filtered position, velocity and acceleration at the last reading
+    double position() const { return m_x[0]; }
+    double velocity() const { return m_x[1]; }
+    double acceleration() const { return m_x[2]; }
+
+    bool ready() const { return m_started; }
+    MotionModel model() const { return m_model; }
+
+private:
+    MotionModel m_model;
+    int         m_states;       // 1, 2 or 3: position, velocity, acceleration
+    double      m_q, m_r;
+    double      m_x[3];
+    double      m_p[3][3];
+    uint64_t    m_us;           // of the last reading
+    bool        m_started;
+};
+
+#endif // PREDICT_H
@@ -0,0 +1,327 @@
+// predictlab: how well the paddle predictor would have drawn a recorded
+// hand.  For each display latency it feeds the trace to each model, one
+// reading at a time as the window would get them, predicts where the
+// hand will be that far ahead, and compares with where the trace says it
+// was.  It reports the error, and the latency the drawn paddle appears
+// to have: the delay that best lines the drawn positions up with the
+// hand's.  Drawing the last reading, as the game used to, appears as
+// late as the display; a perfect predictor would appear on time.
+//
+// The trace is a session file (the local player's inputs, a reading per
+// step), a text file of "us y" lines at any rate, or without either a
+// made-up hand: quick reaches between random targets with pauses,
+// tremor and sensor noise, read at the servo's 1 kHz.
+#include "predict.h"
+#include "session.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Where the trace was at us, between readings
+class Truth
+{
+public:
+    Truth(const std::vector<MotionSample>& samples) : m_samples(samples), m_index(0) {}
+
+    // Times must not go backwards between rewind() calls
+    void rewind() { m_index = 0; }
+    bool at(uint64_t us, double& y)
+    {
+        if (us < m_samples.front().us || us > m_samples.back().us)
+            return false;
+        while (m_samples[m_index + 1].us < us)
+            m_index++;
+        const MotionSample& a = m_samples[m_index];
+        const MotionSample& b = m_samples[m_index + 1];
+        double t = b.us > a.us ? (double)(us - a.us) / (b.us - a.us) : 0;
+        y = a.y + (b.y - a.y) * t;
+        return true;
+    }
+
+private:
+    const std::vector<MotionSample>& m_samples;
+    size_t                           m_index;
+};
+
+// Uniform in [0, 1), repeatable
+static double random01(uint32_t& seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0;
+}
+
+static double gaussian(uint32_t& seed)
+{
+    double u = random01(seed) + 1e-12;
+    double v = random01(seed);
+    return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * v);
+}
+
+static void madeUpHand(std::vector<MotionSample>& samples, int seconds)
+{
+    uint32_t seed = 12345;
+    double from = 0, to = 0;
+    uint64_t start = 0, length = 1;
+    for (uint64_t us = 0; us < (uint64_t)seconds * 1000000; us += 1000)
+    {
+        if (us >= start + length)
+        {
+            // A reach of 150 to 600 ms, or a pause of up to 300 ms
+            from = to;
+            start = us;
+            if (random01(seed) < 0.3)
+            {
+                length = 50000 + (uint64_t)(random01(seed) * 250000);
+            }
+            else
+            {
+                to = random01(seed) * 1.8 - 0.9;
+                length = 150000 + (uint64_t)(random01(seed) * 450000);
+            }
+        }
+
+        // Minimum jerk from one target to the next
+        double s = (double)(us - start) / length;
+        double shape = s * s * s * (10 - 15 * s + 6 * s * s);
+        double y = from + (to - from) * shape;
+        y += 0.004 * sin(2 * 3.14159265358979 * 9 * us * 1e-6);
+        y += 0.0005 * gaussian(seed);
+
+        MotionSample sample = { us, y };
+        samples.push_back(sample);
+    }
+}
+
+static bool loadSession(const char* path, int player, std::vector<MotionSample>& samples)
+{
+    SessionReader reader;
+    GameState state;
+    if (!reader.open(path) || !reader.seekKeyframe(0, state))
+        return false;
+
+    PlayerInput input[PLAYER_COUNT];
+    while (reader.next(input, state))
+    {
+        MotionSample sample = { (uint64_t)state.step * GAME_STEP_US, gameInputY(input[player]) };
+        samples.push_back(sample);
+        gameStep(state, reader.config(), input);
+    }
+    return true;
+}
+
+static bool loadText(const char* path, std::vector<MotionSample>& samples)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        double us, y;
+        if (line[0] != '#' && sscanf(line, "%lf%*[ ,\t]%lf", &us, &y) == 2)
+        {
+            MotionSample sample = { (uint64_t)us, y };
+            if (samples.empty() || sample.us > samples.back().us)
+                samples.push_back(sample);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+struct Result {
+    double rms, p99, max;
+    double apparentMs;
+    bool   apparent;        // false if the hand never moved
+};
+
+static Result evaluate(const std::vector<MotionSample>& samples, MotionModel model,
+                       double q, double r, uint64_t latencyUs)
+{
+    MotionPredictor predictor(model);
+    if (q > 0)
+        predictor.tune(q, r);
+
+    // What would have been drawn, and when it would have been seen.  The
+    // first half second lets the filter settle.
+    std::vector<MotionSample> shown;
+    shown.reserve(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        predictor.update(samples[i].us, samples[i].y);
+        uint64_t seen = samples[i].us + latencyUs;
+        if (samples[i].us - samples[0].us >= 500000)
+        {
+            MotionSample drawn = { seen, predictor.predict(seen) };
+            shown.push_back(drawn);
+        }
+    }
+
+    Result result = { 0, 0, 0, 0, false };
+    Truth truth(samples);
+    std::vector<double> errors;
+    errors.reserve(shown.size());
+    double sum = 0;
+    for (size_t i = 0; i < shown.size(); i++)
+    {
+        double y;
+        if (!truth.at(shown[i].us, y))
+            break;
+        double error = fabs(shown[i].y - y);
+        errors.push_back(error);
+        sum += error * error;
+    }
+    if (errors.empty())
+        return result;
+    result.rms = sqrt(sum / errors.size());
+    std::sort(errors.begin(), errors.end());
+    result.p99 = errors[(size_t)(0.99 * (errors.size() - 1))];
+    result.max = errors.back();
+
+    // The delay, to a tenth of a millisecond, at which the hand best
+    // matches what was drawn
+    double best = -1, worst = 0;
+    for (int64_t delay = -20000; delay <= (int64_t)latencyUs + 20000; delay += 100)
+    {
+        truth.rewind();
+        double square = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < shown.size(); i++)
+        {
+            double y;
+            if ((int64_t)shown[i].us - delay < 0)
+                continue;
+            if (!truth.at(shown[i].us - delay, y))
+                break;
+            square += (shown[i].y - y) * (shown[i].y - y);
+            count++;
+        }
+        if (count == 0)
+            continue;
+        if (best < 0 || square / count < best)
+        {
+            best = square / count;
+            result.apparentMs = delay / 1000.0;
+        }
+        if (square / count > worst)
+            worst = square / count;
+    }
+    result.apparent = worst - best > 1e-12;
+    return result;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool predictlab [options]\n"
+        "  --session FILE    the hand from a recorded session\n"
+        "  --player N        whose hand in the session, 1 or 2 (default 1, the device)\n"
+        "  --trace FILE      the hand from \"us y\" lines\n"
+        "  --seconds N       length of the made-up hand without either (default 60)\n"
+        "  --latency LIST    display latencies in ms, comma separated (default 8,16,25,33,50)\n"
+        "  --q Q --r R       the filters' process and reading noise (default tuned)\n");
+}
+
+int predictlabMain(int argc, char* argv[])
+{
+    static const struct { const char* name; MotionModel model; } models[] = {
+        { "hold",         MOTION_HOLD },
+        { "velocity",     MOTION_VELOCITY },
+        { "acceleration", MOTION_ACCELERATION },
+    };
+    const char* sessionPath = NULL;
+    const char* tracePath = NULL;
+    int player = 1;
+    int seconds = 60;
+    const char* latencies = "8,16,25,33,50";
+    double q = 0, r = MOTION_DEFAULT_NOISE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--session") == 0 && hasValue)
+            sessionPath = argv[++i];
+        else if (strcmp(argv[i], "--player") == 0 && hasValue)
+            player = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0 && hasValue)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--latency") == 0 && hasValue)
+            latencies = argv[++i];
+        else if (strcmp(argv[i], "--q") == 0 && hasValue)
+            q = atof(argv[++i]);
+        else if (strcmp(argv[i], "--r") == 0 && hasValue)
+            r = atof(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (player != 1 && player != 2)
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<MotionSample> samples;
+    const char* source;
+    if (sessionPath != NULL)
+    {
+        source = sessionPath;
+        if (!loadSession(sessionPath, player == 1 ? PLAYER_1 : PLAYER_2, samples))
+        {
+            fprintf(stderr, "predictlab: %s is not a readable session\n", sessionPath);
+            return 1;
+        }
+    }
+    else if (tracePath != NULL)
+    {
+        source = tracePath;
+        if (!loadText(tracePath, samples))
+        {
+            fprintf(stderr, "predictlab: cannot read %s\n", tracePath);
+            return 1;
+        }
+    }
+    else
+    {
+        source = "made-up hand";
+        madeUpHand(samples, seconds < 1 ? 1 : seconds);
+    }
+    if (samples.size() < 2 || samples.back().us - samples.front().us < 1000000)
+    {
+        fprintf(stderr, "predictlab: %s has less than a second of readings\n", source);
+        return 1;
+    }
+
+    double span = (samples.back().us - samples.front().us) / 1e6;
+    printf("# %s: %u readings over %.1f s, every %.1f ms\n", source, (unsigned)samples.size(),
+           span, span * 1000 / (samples.size() - 1));
+    printf("latency_ms,model,error_rms,error_p99,error_max,apparent_latency_ms\n");
+    for (const char* p = latencies; *p != '\0'; )
+    {
+        double latencyMs = atof(p);
+        if (latencyMs > 0)
+        {
+            for (int m = 0; m < 3; m++)
+            {
+                Result result = evaluate(samples, models[m].model, models[m].model == MOTION_HOLD ? 0 : q, r,
+                                         (uint64_t)(latencyMs * 1000));
+                char apparent[32] = "-";
+                if (result.apparent)
+                    sprintf(apparent, "%.1f", result.apparentMs);
+                printf("%g,%s,%.4f,%.4f,%.4f,%s\n", latencyMs, models[m].name,
+                       result.rms, result.p99, result.max, apparent);
+                fflush(stdout);
+            }
+        }
+        while (*p != '\0' && *p++ != ',')
+            ;
+    }
+    return 0;
+}
@@ -0,0 +1,345 @@
+#include "realtime.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "winmm.lib")
+#endif
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+void rtDefaultPolicy(RtPolicy& policy)
+{
+    policy.realtime = false;
+    policy.priority = 0;
+    policy.cpu = -1;
+    policy.lockMemory = false;
+    policy.stackBytes = 0;
+    policy.heapBytes = 0;
+}
+
+void rtServoPolicy(RtPolicy& policy, int cpu)
+{
+    policy.realtime = true;
+    policy.priority = 80;
+    policy.cpu = cpu >= 0 ? cpu : rtServoCpu();
+    policy.lockMemory = true;
+    policy.stackBytes = 256 * 1024;
+    policy.heapBytes = 16 * 1024 * 1024;
+}
+
+// One "name: result" line of a report
+static std::string line(const char* name, const char* format, ...)
+{
+    char text[160];
+    va_list args;
+    va_start(args, format);
+    vsprintf(text, format, args);
+    va_end(args);
+    return std::string(name) + ": " + text + "\n";
+}
+
+// Touch a page at a time so the whole stack is mapped before it is needed.
+// The write after the call keeps the compiler from turning the recursion
+// into a loop that reuses one frame.
+static void prefaultStack(size_t bytes)
+{
+    volatile char page[4096];
+    page[0] = 0;
+    if (bytes > sizeof(page))
+        prefaultStack(bytes - sizeof(page));
+    page[sizeof(page) - 1] = page[0];
+}
+
+static void prefaultHeap(size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    char* block = (char*)malloc(bytes);
+    if (block == NULL)
+        return;
+    for (size_t i = 0; i < bytes; i += 4096)
+        block[i] = 0;
+    free(block);
+}
+
+#ifdef _WIN32
+
+int rtCpuCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+int rtServoCpu()
+{
+    return rtCpuCount() - 1;
+}
+
+std::string rtLockMemory(const RtPolicy& policy)
+{
+    if (!policy.lockMemory)
+        return "memory: not locked\n";
+
+    // Windows has no mlockall; a working set large enough that the game
+    // is never trimmed comes closest
+    SIZE_T minimum = policy.heapBytes + 64 * 1024 * 1024;
+    std::string report;
+    if (SetProcessWorkingSetSize(GetCurrentProcess(), minimum, minimum * 2))
+        report = "memory: working set raised\n";
+    else
+        report = "memory: working set not raised\n";
+
+    prefaultHeap(policy.heapBytes);
+    return report;
+}
+
+std::string rtApplyThread(const RtPolicy& policy)
+{
+    std::string report;
+    char text[128];
+
+    if (policy.realtime)
+    {
+        // Sleep(1) and the multimedia timers wake every millisecond
+        // instead of every 15
+        timeBeginPeriod(1);
+        bool ok = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+        report += ok ? "realtime: time-critical priority\n" : "realtime: priority not raised\n";
+    }
+
+    if (policy.cpu >= 0)
+    {
+        bool ok = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << policy.cpu) != 0;
+        sprintf(text, ok ? "cpu: pinned to %d\n" : "cpu: could not pin to %d\n", policy.cpu);
+        report += text;
+    }
+
+    if (policy.stackBytes > 0)
+        prefaultStack(policy.stackBytes);
+    return report;
+}
+
+std::string rtAvoidCpu(int cpu)
+{
+    int count = rtCpuCount();
+    if (cpu < 0 || count < 2)
+        return "";
+
+    DWORD_PTR mask = 0;
+    for (int i = 0; i < count && i < (int)sizeof(DWORD_PTR) * 8; i++)
+    {
+        if (i != cpu)
+            mask |= (DWORD_PTR)1 << i;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0 ? "render: off the servo cpu\n" : "";
+}
+
+void rtSleepUntil(uint64_t deadlineUs)
+{
+    // Sleep while there is a whole timer tick to spare, then yield
+    for (;;)
+    {
+        uint64_t now = platformMicros();
+        if (now >= deadlineUs)
+            return;
+        if (deadlineUs - now > 2000)
+            Sleep(1);
+        else
+            SwitchToThread();
+    }
+}
+
+#else
+
+int rtCpuCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+int rtServoCpu()
+{
+    // "2-3,6" style list; the first number is enough
+    FILE* file = fopen("/sys/devices/system/cpu/isolated", "r");
+    if (file != NULL)
+    {
+        int cpu;
+        bool found = fscanf(file, "%d", &cpu) == 1;
+        fclose(file);
+        if (found)
+            return cpu;
+    }
+    return rtCpuCount() - 1;
+}
+
+std::string rtLockMemory(const RtPolicy& policy)
+{
+    if (!policy.lockMemory)
+        return "memory: not locked\n";
+
+    std::string report;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        report = "memory: locked\n";
+    else
+        report = line("memory", "not locked (%s)", strerror(errno));
+
+#ifdef __GLIBC__
+    // Keep freed memory in the process instead of handing it back, so the
+    // prefaulted heap stays mapped; and no mmap for large blocks, which
+    // would fault on first touch
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+    prefaultHeap(policy.heapBytes);
+    return report;
+}
+
+std::string rtApplyThread(const RtPolicy& policy)
+{
+    std::string report;
+
+    if (policy.realtime)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = policy.priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error == 0)
+            report += line("realtime", "SCHED_FIFO priority %d", policy.priority);
+        else
+            report += line("realtime", "not granted (%s)", strerror(error));
+    }
+
+#ifdef __linux__
+    if (policy.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(policy.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0)
+            report += line("cpu", "pinned to %d", policy.cpu);
+        else
+            report += line("cpu", "could not pin to %d (%s)", policy.cpu, strerror(errno));
+    }
+#endif
+
+    if (policy.stackBytes > 0)
+        prefaultStack(policy.stackBytes);
+    return report;
+}
+
+std::string rtAvoidCpu(int cpu)
+{
+#ifdef __linux__
+    int count = rtCpuCount();
+    if (cpu < 0 || count < 2)
+        return "";
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < count; i++)
+    {
+        if (i != cpu)
+            CPU_SET(i, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == 0)
+        return "render: off the servo cpu\n";
+#endif
+    return "";
+}
+
+void rtSleepUntil(uint64_t deadlineUs)
+{
+    // platformMicros() is CLOCK_MONOTONIC, so the deadline can be handed
+    // straight to the kernel
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadlineUs / 1000000);
+    ts.tv_nsec = (long)(deadlineUs % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+#endif
+
+void rtMeasureJitter(int periodUs, int count, std::vector<uint32_t>& lateUs)
+{
+    lateUs.clear();
+    lateUs.reserve(count);
+
+    uint64_t deadline = platformMicros() + periodUs;
+    for (int i = 0; i < count; i++)
+    {
+        rtSleepUntil(deadline);
+        uint64_t now = platformMicros();
+        lateUs.push_back(now > deadline ? (uint32_t)(now - deadline) : 0);
+
+        // A wakeup that missed whole periods starts a new schedule rather
+        // than charging every later one for it
+        deadline += periodUs;
+        if (now > deadline)
+            deadline = now + periodUs;
+    }
+}
+
+struct SelfCheck {
+    RtPolicy               policy;
+    int                    periodUs;
+    int                    count;
+    std::vector<uint32_t>* lateUs;
+    std::string            report;
+};
+
+static void selfCheckThread(void* arg)
+{
+    SelfCheck* check = (SelfCheck*)arg;
+    check->report = rtApplyThread(check->policy);
+    rtMeasureJitter(check->periodUs, check->count, *check->lateUs);
+}
+
+bool rtSelfCheck(const RtPolicy& policy, int periodUs, int count,
+                 std::vector<uint32_t>& lateUs, std::string& report)
+{
+    SelfCheck check;
+    check.policy = policy;
+    check.periodUs = periodUs;
+    check.count = count;
+    check.lateUs = &lateUs;
+
+    PlatformThread thread;
+    if (!platformStartThread(thread, selfCheckThread, &check))
+        return false;
+    platformJoinThread(thread);
+    report = check.report;
+    return true;
+}
+
+std::string rtJitterSummary(std::vector<uint32_t> lateUs)
+{
+    if (lateUs.empty())
+        return "no samples";
+
+    std::sort(lateUs.begin(), lateUs.end());
+    size_t n = lateUs.size() - 1;
+    char text[128];
+    sprintf(text, "p50 %u p99 %u p99.9 %u max %u us",
+            lateUs[n / 2], lateUs[(size_t)(n * 0.99 + 0.5)],
+            lateUs[(size_t)(n * 0.999 + 0.5)], lateUs[n]);
+    return text;
+}
@@ -0,0 +1,68 @@
+// Make sure this header is included only once
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "platform.h"
+#include <string>
+#include <vector>
+
+// How the servo thread asks the operating system for a steady 1 kHz.
+// A servo tick that starts late, because the thread was preempted or
+// took a page fault, is a force glitch the player can feel.
+//
+// Each part is optional and each can fail without the others failing:
+// real-time priority usually needs privileges (root, or an rtprio limit
+// in /etc/security/limits.conf), so the functions below report what they
+// actually achieved as "name: result" lines rather than giving up.
+
+struct RtPolicy {
+    bool   realtime;        // SCHED_FIFO on Linux, time-critical priority on Windows
+    int    priority;        // SCHED_FIFO priority, 1 to 99
+    int    cpu;             // processor to pin the servo thread to, or -1
+    bool   lockMemory;      // lock the process in memory and prefault it
+    size_t stackBytes;      // servo thread stack to prefault
+    size_t heapBytes;       // heap to prefault and keep
+};
+
+// Everything off: the operating system's defaults
+void rtDefaultPolicy(RtPolicy& policy);
+
+// Everything on, pinned to the given processor (-1 picks one with
+// rtServoCpu())
+void rtServoPolicy(RtPolicy& policy, int cpu);
+
+// The first processor isolated from the scheduler (isolcpus=), or else the
+// last one; the servo thread has the best chance of a quiet core there
+int rtServoCpu();
+
+// Number of processors online
+int rtCpuCount();
+
+// Process-wide part of the policy: lock memory and prefault the heap.
+// Call once, early, from any thread.
+std::string rtLockMemory(const RtPolicy& policy);
+
+// Per-thread part: priority, pinning and stack prefault, applied to the
+// calling thread
+std::string rtApplyThread(const RtPolicy& policy);
+
+// Keep the calling thread off a processor, so the render loop leaves the
+// servo's core alone
+std::string rtAvoidCpu(int cpu);
+
+// Sleep until platformMicros() reaches deadline
+void rtSleepUntil(uint64_t deadlineUs);
+
+// Run a periodic loop on the calling thread for count periods and record
+// how late each wakeup was, in microseconds
+void rtMeasureJitter(int periodUs, int count, std::vector<uint32_t>& lateUs);
+
+// Start a thread with the policy applied, measure its jitter and stop it.
+// report receives the thread part of the policy's report.
+bool rtSelfCheck(const RtPolicy& policy, int periodUs, int count,
+                 std::vector<uint32_t>& lateUs, std::string& report);
+
+// "p50 3 p99 12 max 40 us" for a jitter measurement
+std::string rtJitterSummary(std::vector<uint32_t> lateUs);
+
+#endif // REALTIME_H
@@ -0,0 +1,157 @@
+// replay: re-simulates a recorded session without a window, as fast as
+// the machine allows, and regenerates its statistics.  Because only the
+// inputs are recorded, a replay always reflects the current scoring code;
+// keyframes that no longer match are counted so a change is noticed.
+#include "session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct RallyStats {
+    uint32_t step;      // first step
+    uint32_t steps;
+    int      hits;      // paddle hits, either side
+};
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool replay <session.hgs> [options]\n"
+        "  --rally N        replay only rally N (from 0)\n"
+        "  --rallies        list every rally\n"
+        "  --results FILE   rewrite the Results.txt lines for the session\n"
+        "  --seek           time a seek to every rally\n");
+}
+
+int replayMain(int argc, char* argv[])
+{
+    const char* path = NULL;
+    const char* resultsPath = NULL;
+    int onlyRally = -1;
+    bool listRallies = false;
+    bool timeSeeks = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--rally") == 0 && hasValue)
+            onlyRally = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--results") == 0 && hasValue)
+            resultsPath = argv[++i];
+        else if (strcmp(argv[i], "--rallies") == 0)
+            listRallies = true;
+        else if (strcmp(argv[i], "--seek") == 0)
+            timeSeeks = true;
+        else if (argv[i][0] != '-' && path == NULL)
+            path = argv[i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (path == NULL)
+    {
+        usage();
+        return 2;
+    }
+
+    SessionReader reader;
+    if (!reader.open(path))
+    {
+        fprintf(stderr, "replay: %s is not a readable session\n", path);
+        return 1;
+    }
+    const GameConfig& config = reader.config();
+
+    if (timeSeeks)
+    {
+        GameState state;
+        uint64_t start = platformMicros();
+        for (size_t r = 0; r < reader.rallyCount(); r++)
+            reader.seekRally(r, state);
+        uint64_t elapsed = platformMicros() - start;
+        printf("seek: %u rallies, %.3f us per seek\n", (unsigned)reader.rallyCount(),
+               reader.rallyCount() ? (double)elapsed / reader.rallyCount() : 0.0);
+    }
+
+    GameState state;
+    bool ok = onlyRally >= 0 ? reader.seekRally(onlyRally, state) : reader.seekKeyframe(0, state);
+    if (!ok)
+    {
+        fprintf(stderr, "replay: no such rally\n");
+        return 1;
+    }
+
+    FILE* results = NULL;
+    if (resultsPath != NULL)
+    {
+        results = fopen(resultsPath, "w");
+        if (results == NULL)
+        {
+            fprintf(stderr, "replay: cannot write %s\n", resultsPath);
+            return 1;
+        }
+    }
+
+    std::vector<RallyStats> rallies;
+    RallyStats current;
+    current.step = state.step;
+    current.steps = 0;
+    current.hits = 0;
+
+    uint64_t start = platformMicros();
+    uint32_t firstStep = state.step;
+    PlayerInput input[PLAYER_COUNT];
+    while (reader.next(input, state))
+    {
+        unsigned int events = gameStep(state, config, input);
+        current.steps++;
+        if (events & (GAME_EV_RIGHT_HIT | GAME_EV_LEFT_HIT))
+            current.hits++;
+
+        if (results != NULL && config.practice && (events & (GAME_EV_RIGHT_HIT | GAME_EV_SCORE_P2)))
+            fprintf(results, "%d, %d\n", state.hits, state.misses);
+
+        // A serve ends one rally and starts the next
+        if (events & (GAME_EV_FIRE | GAME_EV_SERVE_P2))
+        {
+            rallies.push_back(current);
+            if (onlyRally >= 0)
+                break;
+            current.step = state.step;
+            current.steps = 0;
+            current.hits = 0;
+        }
+    }
+    if (current.steps > 0 && (onlyRally < 0 || rallies.empty()))
+        rallies.push_back(current);
+    uint64_t elapsed = platformMicros() - start;
+
+    if (results != NULL)
+    {
+        fprintf(results, "\n");
+        fclose(results);
+    }
+
+    uint32_t steps = state.step - firstStep;
+    int longest = 0;
+    for (size_t r = 0; r < rallies.size(); r++)
+    {
+        if (rallies[r].hits > longest)
+            longest = rallies[r].hits;
+        if (listRallies)
+            printf("rally %u: step %u, %.2f s, %d hits\n", (unsigned)(onlyRally >= 0 ? onlyRally : r),
+                   rallies[r].step, rallies[r].steps * GAME_STEP_MS / 1000.0, rallies[r].hits);
+    }
+
+    double seconds = steps * GAME_STEP_MS / 1000.0;
+    printf("%s: %u steps (%.1f s of play), %u rallies, longest %d hits\n",
+           path, steps, seconds, (unsigned)rallies.size(), longest);
+    printf("score %d - %d; hits %d, misses %d\n",
+           state.score[PLAYER_2], state.score[PLAYER_1], state.hits, state.misses);
+    printf("simulated in %.2f ms, %.0fx real time; %u of %u keyframes differ from this build\n",
+           elapsed / 1000.0, elapsed ? seconds * 1e6 / elapsed : 0.0,
+           reader.mismatches(), (unsigned)reader.keyframeCount());
+    return 0;
+}
@@ -0,0 +1,188 @@
+// rtcheck: how steadily a servo-like thread wakes up every period, with
+// the real-time policy off and then on, while other threads load the
+// machine.  The load threads sweep a large buffer and keep allocating, so
+// they compete for the processor, the caches and the page tables the way
+// the render loop and the rest of the desktop do.
+#include "realtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+static const size_t LOAD_BUFFER_BYTES = 32 * 1024 * 1024;
+
+struct Load {
+    volatile uint32_t* stop;
+    uint32_t           seed;
+};
+
+static void loadThread(void* arg)
+{
+    Load* load = (Load*)arg;
+    char* buffer = (char*)malloc(LOAD_BUFFER_BYTES);
+    if (buffer == NULL)
+        return;
+
+    uint32_t x = load->seed;
+    while (atomicLoad(load->stop) == 0)
+    {
+        for (size_t i = 0; i < LOAD_BUFFER_BYTES; i += 64)
+            buffer[i] += (char)x;
+
+        // Fresh pages to fault in, every sweep
+        x = x * 1664525 + 1013904223;
+        size_t bytes = 1024 * 1024 + (x >> 12);
+        char* block = (char*)malloc(bytes);
+        if (block != NULL)
+        {
+            memset(block, (int)x, bytes);
+            free(block);
+        }
+    }
+    free(buffer);
+}
+
+// Late wakeups are counted into buckets bounded by these, in microseconds
+static const uint32_t gBuckets[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+static const int gBucketCount = sizeof(gBuckets) / sizeof(gBuckets[0]);
+
+static void report(const char* name, int loads, std::vector<uint32_t> lateUs, bool histogram)
+{
+    std::sort(lateUs.begin(), lateUs.end());
+    size_t n = lateUs.size() - 1;
+    double total = 0;
+    for (size_t i = 0; i < lateUs.size(); i++)
+        total += lateUs[i];
+
+    printf("%s,%d,%u,%.2f,%u,%u,%u,%u,%u\n", name, loads, (unsigned)lateUs.size(),
+           total / lateUs.size(), lateUs[n / 2], lateUs[(size_t)(n * 0.9 + 0.5)],
+           lateUs[(size_t)(n * 0.99 + 0.5)], lateUs[(size_t)(n * 0.999 + 0.5)], lateUs[n]);
+
+    if (!histogram)
+        return;
+
+    size_t i = 0;
+    for (int b = 0; b <= gBucketCount; b++)
+    {
+        size_t count = 0;
+        while (i < lateUs.size() && (b == gBucketCount || lateUs[i] < gBuckets[b]))
+        {
+            count++;
+            i++;
+        }
+        if (b < gBucketCount)
+            printf("# %s late < %u us: %u\n", name, gBuckets[b], (unsigned)count);
+        else
+            printf("# %s late >= %u us: %u\n", name, gBuckets[gBucketCount - 1], (unsigned)count);
+    }
+}
+
+// Print a policy report as comments
+static void comment(const char* name, const std::string& text)
+{
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        printf("# %s %s\n", name, text.substr(start, end - start).c_str());
+        start = end + 1;
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool rtcheck [options]\n"
+        "  --period-us N  servo period (default 1000, the Falcon's 1 kHz)\n"
+        "  --seconds N    measuring time for each run (default 5)\n"
+        "  --load N       load threads (default one per processor)\n"
+        "  --cpu N        processor for the servo thread (default: isolated or last)\n"
+        "  --only on|off  run with the policy on or off only\n"
+        "  --histogram    also print how many wakeups fell in each lateness range\n");
+}
+
+int rtcheckMain(int argc, char* argv[])
+{
+    int periodUs = 1000;
+    int seconds = 5;
+    int loads = rtCpuCount();
+    int cpu = -1;
+    bool runOff = true, runOn = true;
+    bool histogram = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--period-us") == 0 && hasValue)
+            periodUs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--load") == 0 && hasValue)
+            loads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cpu") == 0 && hasValue)
+            cpu = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--only") == 0 && hasValue)
+        {
+            runOn = strcmp(argv[++i], "on") == 0;
+            runOff = !runOn;
+        }
+        else if (strcmp(argv[i], "--histogram") == 0)
+            histogram = true;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (periodUs < 50)
+        periodUs = 50;
+    int count = (int)((uint64_t)seconds * 1000000 / periodUs);
+    if (count < 1)
+        count = 1;
+
+    volatile uint32_t stop = 0;
+    std::vector<Load> load(loads);
+    std::vector<PlatformThread> threads(loads);
+    int started = 0;
+    for (int i = 0; i < loads; i++)
+    {
+        load[i].stop = &stop;
+        load[i].seed = i + 1;
+        if (platformStartThread(threads[started], loadThread, &load[i]))
+            started++;
+    }
+
+    printf("# %d processors, %d load threads, period %d us\n", rtCpuCount(), started, periodUs);
+
+    // Off first: locked memory cannot be taken back
+    std::vector<uint32_t> off, on;
+    std::string offReport, onReport, memory;
+    if (runOff)
+    {
+        RtPolicy policy;
+        rtDefaultPolicy(policy);
+        rtSelfCheck(policy, periodUs, count, off, offReport);
+    }
+    if (runOn)
+    {
+        RtPolicy policy;
+        rtServoPolicy(policy, cpu);
+        memory = rtLockMemory(policy);
+        rtSelfCheck(policy, periodUs, count, on, onReport);
+    }
+
+    atomicStore(&stop, 1);
+    for (int i = 0; i < started; i++)
+        platformJoinThread(threads[i]);
+
+    comment("on", onReport + memory);
+    printf("policy,load_threads,samples,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    if (runOff)
+        report("off", started, off, histogram);
+    if (runOn)
+        report("on", started, on, histogram);
+    return 0;
+}
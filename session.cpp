@@ -0,0 +1,661 @@
+#include "session.h"
+#include "trace.h"
+#include "alloc.h"
+#include <string.h>
+
+// "HGSN" at the start of the file, "HGSX" at the very end once indexed
+static const uint32_t SESSION_MAGIC = 0x4E534748;
+static const uint32_t SESSION_INDEX_MAGIC = 0x58534748;
+static const uint16_t SESSION_VERSION = 3;
+
+// Version 2 files have no arena; they still play back
+static const uint16_t SESSION_OLDEST_VERSION = 2;
+
+// Record tags.  A step record is its own flags byte.
+enum SessionRecord {
+    SESSION_STEP_P1_Y      = 0x01,  // player 1 paddle delta follows
+    SESSION_STEP_P2_Y      = 0x02,  // player 2 paddle delta follows
+    SESSION_STEP_P1_BUTTON = 0x04,
+    SESSION_STEP_P2_BUTTON = 0x08,
+    SESSION_STEP_LAST      = 0x0F,
+    SESSION_RUN            = 0x10,  // count of steps repeating the last input
+    SESSION_KEY            = 0x20,  // full game state and rules
+    SESSION_INDEX          = 0x30,  // keyframe and rally tables
+    SESSION_CONFIG         = 0x40   // new rules
+    };
+
+// Write buffered data once this much has built up
+static const size_t SESSION_FLUSH_BYTES = 64 * 1024;
+
+// Index entries made room for when a session opens, so that recording a
+// step never allocates: a keyframe every rally, at least, for hours
+static const size_t SESSION_INDEX_RESERVE = 8192;
+
+// Little-endian, byte at a time, so files move between machines
+static void putU8(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char)v);
+}
+
+static void putU16(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char)v);
+    out.push_back((unsigned char)(v >> 8));
+}
+
+static void putU32(std::vector<unsigned char>& out, uint32_t v)
+{
+    putU16(out, v);
+    putU16(out, v >> 16);
+}
+
+static void putDouble(std::vector<unsigned char>& out, double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    putU32(out, (uint32_t)bits);
+    putU32(out, (uint32_t)(bits >> 32));
+}
+
+static void putVarint(std::vector<unsigned char>& out, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+// Small deltas of either sign become small unsigned numbers
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Bounds-checked reads; a truncated file simply ends early
+class ByteReader
+{
+public:
+    ByteReader(const std::vector<unsigned char>& data, size_t pos, size_t end)
+        : m_data(data), m_pos(pos), m_end(end), m_ok(true) {}
+
+    uint32_t u8()
+    {
+        if (m_pos + 1 > m_end) { m_ok = false; return 0; }
+        return m_data[m_pos++];
+    }
+
+    uint32_t u16()
+    {
+        uint32_t lo = u8();
+        return lo | (u8() << 8);
+    }
+
+    uint32_t u32()
+    {
+        uint32_t lo = u16();
+        return lo | (u16() << 16);
+    }
+
+    double f64()
+    {
+        uint64_t lo = u32();
+        uint64_t bits = lo | ((uint64_t)u32() << 32);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    uint32_t varint()
+    {
+        uint32_t v = 0;
+        for (int shift = 0; shift < 35; shift += 7)
+        {
+            uint32_t b = u8();
+            v |= (b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+                return v;
+        }
+        m_ok = false;
+        return 0;
+    }
+
+    bool ok() const { return m_ok; }
+    size_t pos() const { return m_pos; }
+
+private:
+    const std::vector<unsigned char>& m_data;
+    size_t m_pos;
+    size_t m_end;
+    bool m_ok;
+};
+
+static void putState(std::vector<unsigned char>& out, const GameState& s)
+{
+    putU32(out, s.step);
+    putDouble(out, s.puckX);
+    putDouble(out, s.puckY);
+    putDouble(out, s.velX);
+    putDouble(out, s.velY);
+    for (int p = 0; p < PLAYER_COUNT; p++)
+        putDouble(out, s.paddleY[p]);
+    for (int p = 0; p < PLAYER_COUNT; p++)
+        putU32(out, (uint32_t)s.score[p]);
+    putU32(out, (uint32_t)s.hits);
+    putU32(out, (uint32_t)s.misses);
+    putU32(out, (uint32_t)s.freeze);
+    putU32(out, (uint32_t)s.spin);
+}
+
+static void getState(ByteReader& in, GameState& s)
+{
+    memset(&s, 0, sizeof(s));
+    s.step = in.u32();
+    s.puckX = in.f64();
+    s.puckY = in.f64();
+    s.velX = in.f64();
+    s.velY = in.f64();
+    for (int p = 0; p < PLAYER_COUNT; p++)
+        s.paddleY[p] = in.f64();
+    for (int p = 0; p < PLAYER_COUNT; p++)
+        s.score[p] = (int)in.u32();
+    s.hits = (int)in.u32();
+    s.misses = (int)in.u32();
+    s.freeze = (int)in.u32();
+    s.spin = (int)in.u32();
+}
+
+static void putConfig(std::vector<unsigned char>& out, const GameConfig& c)
+{
+    putDouble(out, c.north);
+    putDouble(out, c.south);
+    putDouble(out, c.east);
+    putDouble(out, c.west);
+    putDouble(out, c.edgeLength);
+    putDouble(out, c.serveSpeed);
+    putDouble(out, c.speedUp);
+    putU32(out, (uint32_t)c.rebounds);
+    putU8(out, c.practice ? 1 : 0);
+}
+
+static void getConfig(ByteReader& in, GameConfig& c)
+{
+    c.north = in.f64();
+    c.south = in.f64();
+    c.east = in.f64();
+    c.west = in.f64();
+    c.edgeLength = in.f64();
+    c.serveSpeed = in.f64();
+    c.speedUp = in.f64();
+    c.rebounds = (int)in.u32();
+    c.practice = in.u8() != 0;
+    c.arena = NULL;
+}
+
+static void putArena(std::vector<unsigned char>& out, const Arena* arena)
+{
+    uint32_t count = arena != NULL ? (uint32_t)arena->size() : 0;
+    putU32(out, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const ArenaSegment& s = arena->segment(i);
+        putDouble(out, s.ax);
+        putDouble(out, s.ay);
+        putDouble(out, s.bx);
+        putDouble(out, s.by);
+        putDouble(out, s.bounce);
+    }
+}
+
+static void getArena(ByteReader& in, Arena& arena)
+{
+    std::vector<ArenaSegment> segments;
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count && in.ok(); i++)
+    {
+        ArenaSegment s;
+        s.ax = in.f64();
+        s.ay = in.f64();
+        s.bx = in.f64();
+        s.by = in.f64();
+        s.bounce = in.f64();
+        segments.push_back(s);
+    }
+    arena.build(segments);
+}
+
+static bool sameInput(const PlayerInput& a, const PlayerInput& b)
+{
+    return a.paddleY == b.paddleY && a.button == b.button;
+}
+
+SessionWriter::SessionWriter()
+    : m_file(NULL),
+      m_offset(0),
+      m_run(0),
+      m_lastKeyStep(0),
+      m_rallyPending(false)
+{
+}
+
+SessionWriter::~SessionWriter()
+{
+    close();
+}
+
+bool SessionWriter::open(const char* path, const GameConfig& config)
+{
+    close();
+
+    m_file = fopen(path, "wb");
+    if (m_file == NULL)
+        return false;
+
+    m_offset = 0;
+    m_buffer.clear();
+    m_buffer.reserve(SESSION_FLUSH_BYTES * 2);
+    m_keyframes.clear();
+    m_keyframes.reserve(SESSION_INDEX_RESERVE);
+    m_rallies.clear();
+    m_rallies.reserve(SESSION_INDEX_RESERVE);
+    memset(m_last, 0, sizeof(m_last));
+    m_run = 0;
+    m_lastKeyStep = 0;
+    m_rallyPending = false;
+
+    m_config = config;
+    putU32(m_buffer, SESSION_MAGIC);
+    putU16(m_buffer, SESSION_VERSION);
+    putConfig(m_buffer, config);
+    putArena(m_buffer, config.arena);
+    return true;
+}
+
+void SessionWriter::configure(const GameConfig& config)
+{
+    if (m_file == NULL)
+        return;
+
+    flushRun();
+    m_config = config;
+    putU8(m_buffer, SESSION_CONFIG);
+    putConfig(m_buffer, config);
+}
+
+void SessionWriter::record(const GameState& before, const PlayerInput input[PLAYER_COUNT], unsigned int events)
+{
+    if (m_file == NULL)
+        return;
+
+    // A rally starts with the game and after every serve
+    bool rallyStart = m_keyframes.empty() || m_rallyPending;
+    if (rallyStart || before.step - m_lastKeyStep >= (uint32_t)SESSION_KEYFRAME_STEPS)
+        keyframe(before, rallyStart);
+    m_rallyPending = (events & (GAME_EV_FIRE | GAME_EV_SERVE_P2)) != 0;
+
+    if (sameInput(input[PLAYER_1], m_last[PLAYER_1]) && sameInput(input[PLAYER_2], m_last[PLAYER_2]))
+    {
+        m_run++;
+        return;
+    }
+    flushRun();
+
+    int32_t delta[PLAYER_COUNT];
+    unsigned int flags = 0;
+    for (int p = 0; p < PLAYER_COUNT; p++)
+    {
+        delta[p] = input[p].paddleY - m_last[p].paddleY;
+        if (delta[p] != 0)
+            flags |= (p == PLAYER_1 ? SESSION_STEP_P1_Y : SESSION_STEP_P2_Y);
+        if (input[p].button)
+            flags |= (p == PLAYER_1 ? SESSION_STEP_P1_BUTTON : SESSION_STEP_P2_BUTTON);
+    }
+
+    putU8(m_buffer, flags);
+    for (int p = 0; p < PLAYER_COUNT; p++)
+    {
+        if (delta[p] != 0)
+            putVarint(m_buffer, zigzag(delta[p]));
+        m_last[p] = input[p];
+    }
+
+    if (m_buffer.size() >= SESSION_FLUSH_BYTES)
+        flush();
+}
+
+void SessionWriter::keyframe(const GameState& state, bool rallyStart)
+{
+    flushRun();
+
+    SessionKeyframe key;
+    key.step = state.step;
+    key.offset = m_offset + (uint32_t)m_buffer.size();
+    if (rallyStart)
+        m_rallies.push_back((uint32_t)m_keyframes.size());
+    key.rally = (uint32_t)m_rallies.size() - 1;
+    m_keyframes.push_back(key);
+    m_lastKeyStep = state.step;
+
+    // The last inputs go along, so deltas after here stand alone
+    putU8(m_buffer, SESSION_KEY);
+    putU8(m_buffer, rallyStart ? 1 : 0);
+    putState(m_buffer, state);
+    putConfig(m_buffer, m_config);
+    for (int p = 0; p < PLAYER_COUNT; p++)
+    {
+        putU16(m_buffer, (uint16_t)m_last[p].paddleY);
+        putU8(m_buffer, m_last[p].button);
+    }
+}
+
+void SessionWriter::flushRun()
+{
+    if (m_run == 0)
+        return;
+    putU8(m_buffer, SESSION_RUN);
+    putVarint(m_buffer, m_run);
+    m_run = 0;
+}
+
+void SessionWriter::flush()
+{
+    TRACE_SCOPE("session.flush");
+    allocBlocking("session.flush");
+    if (!m_buffer.empty())
+        fwrite(&m_buffer[0], 1, m_buffer.size(), m_file);
+    m_offset += (uint32_t)m_buffer.size();
+    m_buffer.clear();
+}
+
+void SessionWriter::close()
+{
+    if (m_file == NULL)
+        return;
+
+    flushRun();
+
+    uint32_t indexOffset = m_offset + (uint32_t)m_buffer.size();
+    putU8(m_buffer, SESSION_INDEX);
+    putU32(m_buffer, (uint32_t)m_keyframes.size());
+    for (size_t i = 0; i < m_keyframes.size(); i++)
+    {
+        putU32(m_buffer, m_keyframes[i].step);
+        putU32(m_buffer, m_keyframes[i].offset);
+        putU32(m_buffer, m_keyframes[i].rally);
+    }
+    putU32(m_buffer, (uint32_t)m_rallies.size());
+    for (size_t i = 0; i < m_rallies.size(); i++)
+        putU32(m_buffer, m_rallies[i]);
+    putU32(m_buffer, indexOffset);
+    putU32(m_buffer, SESSION_INDEX_MAGIC);
+
+    flush();
+    fclose(m_file);
+    m_file = NULL;
+}
+
+SessionReader::SessionReader()
+    : m_streamEnd(0),
+      m_pos(0),
+      m_run(0),
+      m_mismatches(0)
+{
+    gameDefaultConfig(m_config);
+    memset(m_last, 0, sizeof(m_last));
+}
+
+bool SessionReader::open(const char* path)
+{
+    m_data.clear();
+    m_keyframes.clear();
+    m_rallies.clear();
+    m_mismatches = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    unsigned char chunk[16384];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        m_data.insert(m_data.end(), chunk, chunk + got);
+    fclose(file);
+
+    ByteReader in(m_data, 0, m_data.size());
+    if (in.u32() != SESSION_MAGIC)
+        return false;
+    uint32_t version = in.u16();
+    if (version < SESSION_OLDEST_VERSION || version > SESSION_VERSION)
+        return false;
+    getConfig(in, m_config);
+    m_arena.build(std::vector<ArenaSegment>());
+    if (version >= 3)
+        getArena(in, m_arena);
+    if (!in.ok())
+        return false;
+    m_config.arena = m_arena.empty() ? NULL : &m_arena;
+    m_pos = in.pos();
+    m_streamEnd = m_data.size();
+
+    // Use the index if the session was closed properly
+    size_t size = m_data.size();
+    if (size >= 8)
+    {
+        ByteReader trailer(m_data, size - 8, size);
+        uint32_t indexOffset = trailer.u32();
+        if (trailer.u32() == SESSION_INDEX_MAGIC && indexOffset < size - 8 && m_data[indexOffset] == SESSION_INDEX)
+        {
+            ByteReader index(m_data, indexOffset + 1, size - 8);
+            uint32_t count = index.u32();
+            for (uint32_t i = 0; i < count && index.ok(); i++)
+            {
+                SessionKeyframe key;
+                key.step = index.u32();
+                key.offset = index.u32();
+                key.rally = index.u32();
+                m_keyframes.push_back(key);
+            }
+            count = index.u32();
+            for (uint32_t i = 0; i < count && index.ok(); i++)
+                m_rallies.push_back(index.u32());
+            m_streamEnd = indexOffset;
+            if (index.ok())
+                return !m_keyframes.empty();
+            m_keyframes.clear();
+            m_rallies.clear();
+        }
+    }
+
+    return scan();
+}
+
+// Walk the records to rebuild the index
+bool SessionReader::scan()
+{
+    size_t pos = m_pos;
+    while (pos < m_streamEnd)
+    {
+        ByteReader in(m_data, pos, m_streamEnd);
+        uint32_t tag = in.u8();
+        if (tag <= SESSION_STEP_LAST)
+        {
+            if (tag & SESSION_STEP_P1_Y) in.varint();
+            if (tag & SESSION_STEP_P2_Y) in.varint();
+        }
+        else if (tag == SESSION_RUN)
+        {
+            in.varint();
+        }
+        else if (tag == SESSION_CONFIG)
+        {
+            GameConfig config;
+            getConfig(in, config);
+        }
+        else if (tag == SESSION_KEY)
+        {
+            bool rallyStart = in.u8() != 0;
+            GameState state;
+            GameConfig config;
+            getState(in, state);
+            getConfig(in, config);
+            for (int p = 0; p < PLAYER_COUNT; p++)
+            {
+                in.u16();
+                in.u8();
+            }
+            if (!in.ok())
+                break;
+            if (rallyStart || m_rallies.empty())
+                m_rallies.push_back((uint32_t)m_keyframes.size());
+
+            SessionKeyframe key;
+            key.step = state.step;
+            key.offset = (uint32_t)pos;
+            key.rally = (uint32_t)m_rallies.size() - 1;
+            m_keyframes.push_back(key);
+        }
+        else
+        {
+            break;
+        }
+
+        if (!in.ok())
+            break;
+        pos = in.pos();
+    }
+
+    // Anything after the last complete record is lost
+    m_streamEnd = pos;
+    return !m_keyframes.empty();
+}
+
+uint32_t SessionReader::rallyStep(size_t rally) const
+{
+    return m_keyframes[m_rallies[rally]].step;
+}
+
+bool SessionReader::readKeyframe(size_t& pos, GameState& state)
+{
+    ByteReader in(m_data, pos + 1, m_streamEnd);
+    in.u8();
+    getState(in, state);
+    getConfig(in, m_config);
+    m_config.arena = m_arena.empty() ? NULL : &m_arena;
+    for (int p = 0; p < PLAYER_COUNT; p++)
+    {
+        m_last[p].paddleY = (int16_t)in.u16();
+        m_last[p].button = (uint8_t)in.u8();
+    }
+    pos = in.pos();
+    return in.ok();
+}
+
+bool SessionReader::seekKeyframe(size_t index, GameState& state)
+{
+    if (index >= m_keyframes.size())
+        return false;
+    size_t pos = m_keyframes[index].offset;
+    if (pos >= m_streamEnd || m_data[pos] != SESSION_KEY)
+        return false;
+    if (!readKeyframe(pos, state))
+        return false;
+    m_pos = pos;
+    m_run = 0;
+    return true;
+}
+
+bool SessionReader::seekRally(size_t rally, GameState& state)
+{
+    if (rally >= m_rallies.size())
+        return false;
+    return seekKeyframe(m_rallies[rally], state);
+}
+
+bool SessionReader::seekStep(uint32_t step, GameState& state)
+{
+    // Last keyframe at or before the step
+    size_t lo = 0, hi = m_keyframes.size();
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_keyframes[mid].step <= step)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (!seekKeyframe(lo, state))
+        return false;
+
+    PlayerInput input[PLAYER_COUNT];
+    while (state.step < step && next(input, state))
+        gameStep(state, m_config, input);
+    return state.step == step;
+}
+
+bool SessionReader::next(PlayerInput input[PLAYER_COUNT], const GameState& state)
+{
+    for (;;)
+    {
+        if (m_run > 0)
+        {
+            m_run--;
+            input[PLAYER_1] = m_last[PLAYER_1];
+            input[PLAYER_2] = m_last[PLAYER_2];
+            return true;
+        }
+        if (m_pos >= m_streamEnd)
+            return false;
+
+        ByteReader in(m_data, m_pos, m_streamEnd);
+        uint32_t tag = in.u8();
+        if (tag <= SESSION_STEP_LAST)
+        {
+            if (tag & SESSION_STEP_P1_Y)
+                m_last[PLAYER_1].paddleY = (int16_t)(m_last[PLAYER_1].paddleY + unzigzag(in.varint()));
+            if (tag & SESSION_STEP_P2_Y)
+                m_last[PLAYER_2].paddleY = (int16_t)(m_last[PLAYER_2].paddleY + unzigzag(in.varint()));
+            m_last[PLAYER_1].button = (tag & SESSION_STEP_P1_BUTTON) ? 1 : 0;
+            m_last[PLAYER_2].button = (tag & SESSION_STEP_P2_BUTTON) ? 1 : 0;
+            if (!in.ok())
+                return false;
+            m_pos = in.pos();
+            input[PLAYER_1] = m_last[PLAYER_1];
+            input[PLAYER_2] = m_last[PLAYER_2];
+            return true;
+        }
+        else if (tag == SESSION_RUN)
+        {
+            m_run = in.varint();
+            if (!in.ok())
+                return false;
+            m_pos = in.pos();
+        }
+        else if (tag == SESSION_CONFIG)
+        {
+            GameConfig config;
+            getConfig(in, config);
+            if (!in.ok())
+                return false;
+            m_config = config;
+            m_config.arena = m_arena.empty() ? NULL : &m_arena;
+            m_pos = in.pos();
+        }
+        else if (tag == SESSION_KEY)
+        {
+            GameState recorded;
+            if (!readKeyframe(m_pos, recorded))
+                return false;
+            if (gameChecksum(recorded) != gameChecksum(state))
+                m_mismatches++;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
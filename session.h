@@ -0,0 +1,124 @@
+// Make sure this header is included only once
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "game.h"
+#include "arena.h"
+#include <stdio.h>
+#include <vector>
+
+// Session files record a match as the inputs of every step, which is all
+// the deterministic simulation needs to reproduce it.  Inputs are stored
+// as deltas from the previous step, and runs of identical steps collapse
+// to a count, so a session costs a byte or two per step.
+//
+// Every SESSION_KEYFRAME_STEPS steps, and at the start of every rally,
+// the full game state is written as a keyframe.  Inputs after a keyframe
+// never refer to anything before it, so playback can start at any
+// keyframe.  An index of keyframes and rallies at the end of the file
+// makes seeking to a rally a single table lookup.
+//
+// The rules can be retuned during a match.  Each change is recorded where
+// it happened, and every keyframe carries the rules in force, so playback
+// from any point uses the same rules the match did.  The arena, if there
+// is one, is stored once after the header; it cannot change mid-match.
+
+// Longest stretch of steps between keyframes (10 s)
+const int SESSION_KEYFRAME_STEPS = 2000;
+
+struct SessionKeyframe {
+    uint32_t step;
+    uint32_t offset;    // of the keyframe record, from the start of the file
+    uint32_t rally;     // rally in progress at this keyframe
+};
+
+class SessionWriter
+{
+public:
+    SessionWriter();
+    ~SessionWriter();
+
+    // Start a new session file
+    bool open(const char* path, const GameConfig& config);
+
+    // Record one step: the state before it, the inputs it was given and
+    // the events it produced
+    void record(const GameState& before, const PlayerInput input[PLAYER_COUNT], unsigned int events);
+
+    // The rules change from the next recorded step on
+    void configure(const GameConfig& config);
+
+    // Write the index and close the file
+    void close();
+
+    bool isOpen() const { return m_file != NULL; }
+
+private:
+    void keyframe(const GameState& state, bool rallyStart);
+    void flushRun();
+    void flush();
+
+    FILE*                        m_file;
+    GameConfig                   m_config;
+    uint32_t                     m_offset;      // file offset of m_buffer[0]
+    std::vector<unsigned char>   m_buffer;
+    std::vector<SessionKeyframe> m_keyframes;
+    std::vector<uint32_t>        m_rallies;     // keyframe index of each rally start
+    PlayerInput                  m_last[PLAYER_COUNT];
+    uint32_t                     m_run;         // identical steps not yet written
+    uint32_t                     m_lastKeyStep;
+    bool                         m_rallyPending;
+};
+
+class SessionReader
+{
+public:
+    SessionReader();
+
+    // Load a session file.  A file without an index (the game did not exit
+    // cleanly) is scanned to rebuild it.
+    bool open(const char* path);
+
+    // Rules in force at the current playback position
+    const GameConfig& config() const { return m_config; }
+
+    size_t rallyCount() const { return m_rallies.size(); }
+    size_t keyframeCount() const { return m_keyframes.size(); }
+    const SessionKeyframe& keyframe(size_t index) const { return m_keyframes[index]; }
+
+    // First step of a rally
+    uint32_t rallyStep(size_t rally) const;
+
+    // Position playback at a keyframe, a rally or an arbitrary step.
+    // state receives the game state to simulate from.  seekStep() starts
+    // from the nearest keyframe at or before the step and simulates
+    // forward to it.
+    bool seekKeyframe(size_t index, GameState& state);
+    bool seekRally(size_t rally, GameState& state);
+    bool seekStep(uint32_t step, GameState& state);
+
+    // Inputs for the next step.  Returns false at the end of the session.
+    // A keyframe met on the way is checked against state, which is how a
+    // replay notices that the simulation has changed since recording.
+    bool next(PlayerInput input[PLAYER_COUNT], const GameState& state);
+
+    // Keyframes met during playback that disagreed with the simulation
+    uint32_t mismatches() const { return m_mismatches; }
+
+private:
+    bool scan();
+    bool readKeyframe(size_t& pos, GameState& state);
+
+    std::vector<unsigned char>   m_data;
+    size_t                       m_streamEnd;
+    GameConfig                   m_config;
+    Arena                        m_arena;       // what m_config.arena points at
+    std::vector<SessionKeyframe> m_keyframes;
+    std::vector<uint32_t>        m_rallies;
+    size_t                       m_pos;
+    PlayerInput                  m_last[PLAYER_COUNT];
+    uint32_t                     m_run;
+    uint32_t                     m_mismatches;
+};
+
+#endif // SESSION_H
@@ -0,0 +1,83 @@
+// spectate: follows the running game through its spectator feed and
+// prints the states as CSV, from a process of its own, as a second
+// display or an analysis would.  The game never knows it is there.
+#include "spectator.h"
+#include "realtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool spectate [options]\n"
+        "  --every N     print one step in N (default 1, every step)\n"
+        "  --hz N        how often to read the feed (default 60)\n"
+        "  --seconds N   stop after this long (default until the game stops)\n");
+}
+
+int spectateMain(int argc, char* argv[])
+{
+    int every = 1;
+    int hz = 60;
+    int seconds = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--every") == 0 && hasValue)
+            every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--hz") == 0 && hasValue)
+            hz = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (every < 1)
+        every = 1;
+    if (hz < 1)
+        hz = 1;
+
+    SpectatorReader reader;
+    if (!reader.attach())
+    {
+        fprintf(stderr, "spectate: the game is not running\n");
+        return 1;
+    }
+
+    SpectatorConfig config = reader.config();
+    printf("# field %g %g %g %g, edge %g, %s%s\n", config.west, config.east, config.south, config.north,
+           config.edgeLength, config.practice ? "practice" : "match", config.hasArena ? ", arena" : "");
+    printf("step,puck_x,puck_y,paddle_1,paddle_2,score_1,score_2,hits,misses\n");
+
+    uint64_t start = platformMicros();
+    uint64_t next = start;
+    for (;;)
+    {
+        SpectatorState state;
+        while (reader.next(state))
+        {
+            if (state.step % every == 0)
+                printf("%u,%.4f,%.4f,%.4f,%.4f,%d,%d,%d,%d\n", state.step, state.puckX, state.puckY,
+                       state.paddleY[PLAYER_1], state.paddleY[PLAYER_2], state.score[PLAYER_1],
+                       state.score[PLAYER_2], state.hits, state.misses);
+        }
+        fflush(stdout);
+
+        if (!reader.live())
+            break;
+        if (seconds > 0 && platformMicros() - start >= (uint64_t)seconds * 1000000)
+            break;
+        next += 1000000 / hz;
+        rtSleepUntil(next);
+    }
+
+    if (reader.skipped() != 0 || reader.restarts() != 0)
+        fprintf(stderr, "spectate: %u steps skipped for falling behind, %u restarts\n",
+                reader.skipped(), reader.restarts());
+    return 0;
+}
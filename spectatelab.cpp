@@ -0,0 +1,251 @@
+// spectatelab: the spectator feed with many observers.  The calling
+// thread plays a simulated practice game, missing now and then so that
+// there are scores and serves, and publishes every step as the game
+// does, at the game's 200 steps a second or flat out.  Observer threads,
+// 1, 16 and 128 of them, each map the shared ring read-only as another
+// process would and follow it at a display's 60 Hz.  For each number of
+// observers it reports what a publish cost, and how closely and how
+// completely the observers followed.  The cost must not grow with the
+// number of observers.
+#include "spectator.h"
+#include "realtime.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// What an observer should have seen at a step
+struct Truth {
+    double  puckX, puckY;
+    double  paddleY[PLAYER_COUNT];
+    int32_t score[PLAYER_COUNT];
+};
+
+// Flat out stops after this many steps
+const uint32_t SPECTATELAB_MOST_STEPS = 1000000;
+
+struct Observer {
+    int                 periodUs;       // 0 to spin
+    volatile uint32_t*  stop;
+    const Truth*        truth;          // by step
+    bool                shared;
+    const SpectatorBlock* block;
+    uint32_t            steps;          // states read
+    uint32_t            skipped;
+    uint32_t            restarts;
+    double              maxError;
+};
+
+static void observerThread(void* arg)
+{
+    Observer& o = *(Observer*)arg;
+    SpectatorReader reader;
+    if (o.shared)
+        reader.attach();
+    else
+        reader.attach(o.block);
+
+    uint64_t next = platformMicros();
+    bool stopping = false;
+    for (;;)
+    {
+        SpectatorState state;
+        while (reader.next(state))
+        {
+            const Truth& truth = o.truth[state.step];
+            double error = fabs(state.puckX - truth.puckX);
+            error = std::max(error, fabs(state.puckY - truth.puckY));
+            error = std::max(error, fabs(state.paddleY[PLAYER_1] - truth.paddleY[PLAYER_1]));
+            error = std::max(error, fabs(state.paddleY[PLAYER_2] - truth.paddleY[PLAYER_2]));
+            if (state.score[PLAYER_1] != truth.score[PLAYER_1] || state.score[PLAYER_2] != truth.score[PLAYER_2])
+                error = 1e9;
+            o.maxError = std::max(o.maxError, error);
+            o.steps++;
+        }
+
+        // One last read after the publisher stops, for whatever is left
+        if (stopping)
+            break;
+        stopping = atomicLoad(o.stop) != 0;
+        if (o.periodUs == 0)
+        {
+            platformYield();
+        }
+        else if (!stopping)
+        {
+            next += o.periodUs;
+            rtSleepUntil(next);
+        }
+    }
+    o.skipped = reader.skipped();
+    o.restarts = reader.restarts();
+}
+
+template <class T>
+static T percentile(std::vector<T> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+static void run(int observers, int rate, int periodUs, int seconds, bool shared)
+{
+    SpectatorFeed feed;
+    feed.open(shared);
+    if (shared && !feed.isShared())
+    {
+        fprintf(stderr, "spectatelab: no shared memory; observers share a private ring\n");
+        shared = false;
+    }
+
+    GameConfig config;
+    gameDefaultConfig(config);
+    config.rebounds = 0x7fffffff;
+    feed.configure(config);
+    GameState state;
+    gameInit(state, config);
+
+    size_t most = rate > 0 ? (size_t)rate * seconds + 16 : SPECTATELAB_MOST_STEPS;
+    std::vector<Truth> truth(most);
+    std::vector<double> publishNs;
+    publishNs.reserve(most);
+
+    volatile uint32_t stop = 0;
+    std::vector<Observer> readers(observers);
+    std::vector<PlatformThread> threads(observers);
+    for (int i = 0; i < observers; i++)
+    {
+        Observer& o = readers[i];
+        o.periodUs = periodUs;
+        o.stop = &stop;
+        o.truth = &truth[0];
+        o.shared = shared;
+        o.block = feed.block();
+        o.steps = 0;
+        o.skipped = 0;
+        o.restarts = 0;
+        o.maxError = 0;
+        platformStartThread(threads[i], observerThread, &o);
+    }
+
+    // Returns the puck, except every seventh, and serves straight away
+    double nsPerTick = 1e9 / platformTicksPerSecond();
+    uint64_t start = platformMicros();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint64_t due = start;
+    while (platformMicros() < end && state.step + 1 < most)
+    {
+        if (rate > 0)
+        {
+            due += 1000000 / rate;
+            rtSleepUntil(due);
+        }
+        PlayerInput input[PLAYER_COUNT];
+        bool miss = state.puckX > config.east - 1 && state.hits % 7 == 6;
+        input[PLAYER_1] = gameMakeInput(miss ? -state.puckY : state.puckY, true);
+        input[PLAYER_2] = input[PLAYER_1];
+        gameStep(state, config, input);
+        Truth& t = truth[state.step];
+        t.puckX = state.puckX;
+        t.puckY = state.puckY;
+        t.paddleY[PLAYER_1] = state.paddleY[PLAYER_1];
+        t.paddleY[PLAYER_2] = state.paddleY[PLAYER_2];
+        t.score[PLAYER_1] = state.score[PLAYER_1];
+        t.score[PLAYER_2] = state.score[PLAYER_2];
+
+        uint64_t before = platformTicks();
+        feed.publish(state);
+        publishNs.push_back((platformTicks() - before) * nsPerTick);
+    }
+    atomicStore(&stop, 1);
+
+    uint32_t steps = 0, skipped = 0, restarts = 0;
+    double maxError = 0;
+    for (int i = 0; i < observers; i++)
+    {
+        platformJoinThread(threads[i]);
+        steps += readers[i].steps;
+        skipped += readers[i].skipped;
+        restarts += readers[i].restarts;
+        maxError = std::max(maxError, readers[i].maxError);
+    }
+
+    char label[16];
+    sprintf(label, rate > 0 ? "%d" : "flat out", rate);
+    printf("%d,%s,%u,%u,%.0f,%.0f,%.0f,%.1f,%u,%u,%.6f\n", observers, label, feed.published(),
+           feed.keyframes(), percentile(publishNs, 0.5), percentile(publishNs, 0.99),
+           percentile(publishNs, 1.0), observers ? (double)steps / observers : 0.0, skipped, restarts,
+           maxError);
+    fflush(stdout);
+    feed.close();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool spectatelab [options]\n"
+        "  --observers LIST  numbers of observers, comma separated (default 1,16,128)\n"
+        "  --rates LIST      steps a second; 0 is flat out (default 200,0)\n"
+        "  --hz N            how often each observer reads; 0 to spin (default 60)\n"
+        "  --seconds N       time for each, at most a million steps (default 2)\n"
+        "  --private         a ring in this process, not shared memory\n");
+}
+
+// The numbers in a comma separated list
+static std::vector<int> numbers(const char* list)
+{
+    std::vector<int> values;
+    for (const char* p = list; *p != '\0'; )
+    {
+        if (*p >= '0' && *p <= '9')
+            values.push_back(atoi(p));
+        while (*p != '\0' && *p++ != ',')
+            ;
+    }
+    return values;
+}
+
+int spectatelabMain(int argc, char* argv[])
+{
+    const char* observers = "1,16,128";
+    const char* rates = "200,0";
+    int hz = 60;
+    int seconds = 2;
+    bool shared = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--observers") == 0 && hasValue)
+            observers = argv[++i];
+        else if (strcmp(argv[i], "--rates") == 0 && hasValue)
+            rates = argv[++i];
+        else if (strcmp(argv[i], "--hz") == 0 && hasValue)
+            hz = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--private") == 0)
+            shared = false;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (seconds < 1)
+        seconds = 1;
+
+    std::vector<int> counts = numbers(observers);
+    std::vector<int> rateList = numbers(rates);
+    printf("observers,rate,steps,keyframes,publish_p50_ns,publish_p99_ns,publish_max_ns,"
+           "steps_per_observer,skipped,restarts,max_error\n");
+    fflush(stdout);
+    for (size_t c = 0; c < counts.size(); c++)
+        for (size_t r = 0; r < rateList.size(); r++)
+            run(counts[c], rateList[r], hz > 0 ? 1000000 / hz : 0, seconds, shared);
+    return 0;
+}
@@ -0,0 +1,472 @@
+#include "spectator.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// "HGSF"
+static const uint32_t SPECTATOR_MAGIC = 0x46534748;
+
+#ifdef _WIN32
+static const char* SPECTATOR_SHARED_NAME = "Local\\HapticsGameSpectate";
+#else
+static const char* SPECTATOR_SHARED_NAME = "/hapticsgame-spectate";
+#endif
+
+// Set in a record's step when it is a keyframe; its moves then hold the
+// keyframe's index
+static const uint32_t SPECTATOR_KEY = 0x80000000u;
+
+// One step.  seq is the record's index plus one once it is written, and
+// 0 while it is being written.
+struct SpectatorRecord {
+    volatile uint32_t seq;
+    uint32_t          step;
+    int16_t           move[4];      // puck x and y, paddle 1 and 2, in 1/GAME_INPUT_SCALE
+};
+
+struct SpectatorKeyframe {
+    volatile uint32_t seq;          // keyframe index plus one once written
+    uint32_t          record;       // the record it went out as
+    SpectatorState    state;
+};
+
+struct SpectatorBlock {
+    uint32_t          magic;
+    volatile uint32_t generation;   // a new game; observers start over
+    volatile uint32_t live;         // the game is publishing
+    volatile uint32_t configSequence;  // odd while the config is written
+    SpectatorConfig   config;
+    volatile uint32_t records;      // records published
+    volatile uint32_t keyframeCount;
+    SpectatorKeyframe keyframes[SPECTATOR_KEYFRAMES];
+    SpectatorRecord   ring[SPECTATOR_RECORDS];
+};
+
+static void copyState(SpectatorState& to, const GameState& from)
+{
+    to.step = from.step;
+    to.puckX = from.puckX;
+    to.puckY = from.puckY;
+    to.paddleY[PLAYER_1] = from.paddleY[PLAYER_1];
+    to.paddleY[PLAYER_2] = from.paddleY[PLAYER_2];
+    to.score[PLAYER_1] = from.score[PLAYER_1];
+    to.score[PLAYER_2] = from.score[PLAYER_2];
+    to.hits = from.hits;
+    to.misses = from.misses;
+    to.freeze = from.freeze;
+    to.spin = from.spin;
+}
+
+// The move from shown to actual in 1/GAME_INPUT_SCALE, and shown moved by
+// it; false if it does not fit
+static bool quantise(double actual, double& shown, int16_t& move)
+{
+    double units = floor((actual - shown) * GAME_INPUT_SCALE + 0.5);
+    if (units > 32767 || units < -32768)
+        return false;
+    move = (int16_t)units;
+    shown += move / GAME_INPUT_SCALE;
+    return true;
+}
+
+SpectatorFeed::SpectatorFeed()
+    : m_block(NULL),
+      m_mapping(NULL),
+      m_shared(false),
+      m_records(0),
+      m_keyframes(0),
+      m_sinceKeyframe(0)
+{
+    memset(&m_shown, 0, sizeof(m_shown));
+}
+
+SpectatorFeed::~SpectatorFeed()
+{
+    close();
+}
+
+bool SpectatorFeed::open(bool shared)
+{
+    close();
+    SpectatorBlock* block = NULL;
+    if (shared)
+    {
+#ifdef _WIN32
+        HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                            sizeof(SpectatorBlock), SPECTATOR_SHARED_NAME);
+        if (mapping != NULL)
+        {
+            block = (SpectatorBlock*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SpectatorBlock));
+            if (block == NULL)
+                CloseHandle(mapping);
+            else
+                m_mapping = mapping;
+        }
+#else
+        int fd = shm_open(SPECTATOR_SHARED_NAME, O_RDWR | O_CREAT, 0644);
+        if (fd >= 0)
+        {
+            if (ftruncate(fd, sizeof(SpectatorBlock)) == 0)
+            {
+                void* p = mmap(NULL, sizeof(SpectatorBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED)
+                    block = (SpectatorBlock*)p;
+            }
+            ::close(fd);
+        }
+#endif
+    }
+    m_shared = block != NULL;
+    if (block == NULL)
+        block = new SpectatorBlock();
+
+    // Observers of the last game see the generation change and start over
+    uint32_t generation = block->magic == SPECTATOR_MAGIC ? block->generation + 1 : 1;
+    atomicStore(&block->generation, generation);
+    atomicStore(&block->live, 0);
+    atomicStore(&block->records, 0);
+    atomicStore(&block->keyframeCount, 0);
+    for (uint32_t i = 0; i < SPECTATOR_KEYFRAMES; i++)
+        atomicStore(&block->keyframes[i].seq, 0);
+    for (uint32_t i = 0; i < SPECTATOR_RECORDS; i++)
+        atomicStore(&block->ring[i].seq, 0);
+    atomicStore(&block->configSequence, 0);
+    memset(&block->config, 0, sizeof(block->config));
+    block->magic = SPECTATOR_MAGIC;
+    atomicStore(&block->live, 1);
+
+    m_block = block;
+    m_records = 0;
+    m_keyframes = 0;
+    m_sinceKeyframe = 0;
+    memset(&m_shown, 0, sizeof(m_shown));
+    return true;
+}
+
+void SpectatorFeed::close()
+{
+    if (m_block == NULL)
+        return;
+    atomicStore(&m_block->live, 0);
+    if (!m_shared)
+    {
+        delete m_block;
+    }
+    else
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_block);
+        CloseHandle((HANDLE)m_mapping);
+#else
+        munmap(m_block, sizeof(SpectatorBlock));
+        shm_unlink(SPECTATOR_SHARED_NAME);
+#endif
+    }
+    m_block = NULL;
+    m_mapping = NULL;
+    m_shared = false;
+}
+
+void SpectatorFeed::configure(const GameConfig& config)
+{
+    if (m_block == NULL)
+        return;
+    uint32_t sequence = atomicLoad(&m_block->configSequence);
+    atomicExchange(&m_block->configSequence, sequence + 1);
+    m_block->config.north = config.north;
+    m_block->config.south = config.south;
+    m_block->config.east = config.east;
+    m_block->config.west = config.west;
+    m_block->config.edgeLength = config.edgeLength;
+    m_block->config.practice = config.practice ? 1 : 0;
+    m_block->config.hasArena = config.arena != NULL ? 1 : 0;
+    atomicStore(&m_block->configSequence, sequence + 2);
+}
+
+void SpectatorFeed::keyframe(const GameState& state)
+{
+    uint32_t index = m_keyframes;
+    SpectatorKeyframe& key = m_block->keyframes[index % SPECTATOR_KEYFRAMES];
+
+    // Mark it torn first; the exchange keeps the writes below from
+    // moving above it
+    atomicExchange(&key.seq, 0);
+    key.record = m_records;
+    copyState(key.state, state);
+    atomicStore(&key.seq, index + 1);
+    atomicStore(&m_block->keyframeCount, index + 1);
+    m_keyframes++;
+
+    SpectatorRecord& record = m_block->ring[m_records % SPECTATOR_RECORDS];
+    atomicExchange(&record.seq, 0);
+    record.step = state.step | SPECTATOR_KEY;
+    record.move[0] = (int16_t)(index & 0xffff);
+    record.move[1] = (int16_t)(index >> 16);
+    record.move[2] = 0;
+    record.move[3] = 0;
+    atomicStore(&record.seq, m_records + 1);
+
+    copyState(m_shown, state);
+    m_sinceKeyframe = 0;
+}
+
+void SpectatorFeed::publish(const GameState& state)
+{
+    if (m_block == NULL)
+        return;
+
+    // A step already out, as when a replay holds its last position
+    if (m_records != 0 && state.step == m_shown.step)
+        return;
+
+    // Anything but a move, a gap, or a move too far is a keyframe
+    bool key = m_records == 0 ||
+               m_sinceKeyframe + 1 >= SPECTATOR_KEYFRAME_STEPS ||
+               state.step != m_shown.step + 1 ||
+               state.score[PLAYER_1] != m_shown.score[PLAYER_1] ||
+               state.score[PLAYER_2] != m_shown.score[PLAYER_2] ||
+               state.hits != m_shown.hits ||
+               state.misses != m_shown.misses ||
+               state.freeze != m_shown.freeze ||
+               state.spin != m_shown.spin;
+
+    SpectatorState shown = m_shown;
+    int16_t move[4];
+    if (!key)
+    {
+        key = !quantise(state.puckX, shown.puckX, move[0]) ||
+              !quantise(state.puckY, shown.puckY, move[1]) ||
+              !quantise(state.paddleY[PLAYER_1], shown.paddleY[PLAYER_1], move[2]) ||
+              !quantise(state.paddleY[PLAYER_2], shown.paddleY[PLAYER_2], move[3]);
+    }
+
+    if (key)
+    {
+        keyframe(state);
+    }
+    else
+    {
+        SpectatorRecord& record = m_block->ring[m_records % SPECTATOR_RECORDS];
+        atomicExchange(&record.seq, 0);
+        record.step = state.step;
+        memcpy(record.move, move, sizeof(move));
+        atomicStore(&record.seq, m_records + 1);
+
+        shown.step = state.step;
+        m_shown = shown;
+        m_sinceKeyframe++;
+    }
+    m_records++;
+    atomicStore(&m_block->records, m_records);
+}
+
+SpectatorReader::SpectatorReader()
+    : m_block(NULL),
+      m_mapped(false),
+      m_mapping(NULL),
+      m_generation(0),
+      m_next(0),
+      m_joined(false),
+      m_skipped(0),
+      m_restarts(0)
+{
+    memset(&m_state, 0, sizeof(m_state));
+}
+
+SpectatorReader::~SpectatorReader()
+{
+    detach();
+}
+
+bool SpectatorReader::attach()
+{
+    detach();
+    const SpectatorBlock* block = NULL;
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, SPECTATOR_SHARED_NAME);
+    if (mapping != NULL)
+    {
+        block = (const SpectatorBlock*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(SpectatorBlock));
+        if (block == NULL)
+            CloseHandle(mapping);
+        else
+            m_mapping = mapping;
+    }
+#else
+    int fd = shm_open(SPECTATOR_SHARED_NAME, O_RDONLY, 0);
+    if (fd >= 0)
+    {
+        void* p = mmap(NULL, sizeof(SpectatorBlock), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            block = (const SpectatorBlock*)p;
+        ::close(fd);
+    }
+#endif
+    if (block == NULL)
+        return false;
+    m_block = block;
+    m_mapped = true;
+    if (block->magic != SPECTATOR_MAGIC)
+    {
+        detach();
+        return false;
+    }
+    return true;
+}
+
+void SpectatorReader::attach(const SpectatorBlock* block)
+{
+    detach();
+    m_block = block;
+}
+
+void SpectatorReader::detach()
+{
+    if (m_mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_block);
+        CloseHandle((HANDLE)m_mapping);
+#else
+        munmap((void*)m_block, sizeof(SpectatorBlock));
+#endif
+    }
+    m_block = NULL;
+    m_mapped = false;
+    m_mapping = NULL;
+    m_joined = false;
+}
+
+// The state of keyframe index, and the record it went out as; false if
+// it has been overwritten since
+bool SpectatorReader::readKeyframe(uint32_t index, uint32_t& record)
+{
+    const SpectatorKeyframe& key = m_block->keyframes[index % SPECTATOR_KEYFRAMES];
+    if (atomicLoad(&key.seq) != index + 1)
+        return false;
+    SpectatorState state;
+    memcpy(&state, (const void*)&key.state, sizeof(state));
+    record = key.record;
+    atomicLoadFence();
+    if (atomicLoad(&key.seq) != index + 1)
+        return false;
+    m_state = state;
+    return true;
+}
+
+// Start from the newest keyframe
+bool SpectatorReader::join()
+{
+    m_generation = atomicLoad(&m_block->generation);
+    for (;;)
+    {
+        uint32_t count = atomicLoad(&m_block->keyframeCount);
+        if (count == 0)
+            return false;
+        uint32_t record;
+        if (readKeyframe(count - 1, record))
+        {
+            if (m_joined && record > m_next)
+                m_skipped += record - m_next;
+            m_next = record + 1;
+            m_joined = true;
+            return true;
+        }
+    }
+}
+
+bool SpectatorReader::next(SpectatorState& state)
+{
+    if (m_block == NULL)
+        return false;
+
+    // A new game
+    if (m_joined && atomicLoad(&m_block->generation) != m_generation)
+    {
+        m_joined = false;
+        m_restarts++;
+    }
+    if (!m_joined)
+    {
+        if (!join())
+            return false;
+        state = m_state;
+        return true;
+    }
+
+    uint32_t head = atomicLoad(&m_block->records);
+    if (head == m_next)
+        return false;
+
+    // Still there, whole, and not the keyframe of one that is gone
+    bool lapped = head - m_next > SPECTATOR_RECORDS;
+    if (!lapped)
+    {
+        const SpectatorRecord& record = m_block->ring[m_next % SPECTATOR_RECORDS];
+        uint32_t seq = atomicLoad(&record.seq);
+        uint32_t step = record.step;
+        int16_t move[4];
+        memcpy(move, (const void*)record.move, sizeof(move));
+        atomicLoadFence();
+        lapped = seq != m_next + 1 || atomicLoad(&record.seq) != seq;
+
+        if (!lapped && (step & SPECTATOR_KEY) != 0)
+        {
+            uint32_t index = (uint16_t)move[0] | ((uint32_t)(uint16_t)move[1] << 16);
+            uint32_t at;
+            lapped = !readKeyframe(index, at);
+        }
+        else if (!lapped)
+        {
+            m_state.step = step;
+            m_state.puckX += move[0] / GAME_INPUT_SCALE;
+            m_state.puckY += move[1] / GAME_INPUT_SCALE;
+            m_state.paddleY[PLAYER_1] += move[2] / GAME_INPUT_SCALE;
+            m_state.paddleY[PLAYER_2] += move[3] / GAME_INPUT_SCALE;
+        }
+    }
+
+    if (lapped)
+    {
+        m_restarts++;
+        if (!join())
+            return false;
+        state = m_state;
+        return true;
+    }
+    m_next++;
+    state = m_state;
+    return true;
+}
+
+SpectatorConfig SpectatorReader::config() const
+{
+    SpectatorConfig config;
+    memset(&config, 0, sizeof(config));
+    if (m_block == NULL)
+        return config;
+    for (;;)
+    {
+        uint32_t before = atomicLoad(&m_block->configSequence);
+        if ((before & 1) == 0)
+        {
+            memcpy(&config, (const void*)&m_block->config, sizeof(config));
+            atomicLoadFence();
+            if (atomicLoad(&m_block->configSequence) == before)
+                return config;
+        }
+        platformYield();
+    }
+}
+
+bool SpectatorReader::live() const
+{
+    return m_block != NULL && atomicLoad(&m_block->live) != 0;
+}
@@ -0,0 +1,137 @@
+// Make sure this header is included only once
+#ifndef SPECTATOR_H
+#define SPECTATOR_H
+
+#include "game.h"
+
+// The live game for other processes to watch: second-screen displays,
+// or an experimenter's analysis, with nothing to run in the game's
+// process and nothing for it to wait on.  The simulation publishes every
+// step into a ring in shared memory, and observers map it read-only and
+// follow along at their own pace.  Observers never write to it, so the
+// writer neither knows nor cares how many there are.
+//
+// Most steps are a delta: the puck and paddles' moves since the step
+// before, in 16 bytes.  Every SPECTATOR_KEYFRAME_STEPS steps, and when a
+// score, serve or anything else but a move happens, the full state goes
+// out as a keyframe instead.  Deltas are quantised to 1/GAME_INPUT_SCALE
+// against what an observer rebuilds, not against the true state, so the
+// error stays under half of that however long an observer follows.
+//
+// An observer starts from the newest keyframe.  One that falls a ring
+// behind starts again from the newest keyframe, and counts the steps it
+// skipped.
+
+// Steps the ring holds; 20 seconds of play
+const uint32_t SPECTATOR_RECORDS = 4096;
+
+// Keyframes the ring holds, and the most steps between two
+const uint32_t SPECTATOR_KEYFRAMES = 16;
+const uint32_t SPECTATOR_KEYFRAME_STEPS = 200;
+
+// The rules and playfield an observer draws, from the game's config
+struct SpectatorConfig {
+    double north, south, east, west;
+    double edgeLength;
+    int    practice;
+    int    hasArena;
+};
+
+// What an observer sees at each step
+struct SpectatorState {
+    uint32_t step;
+    double   puckX, puckY;
+    double   paddleY[PLAYER_COUNT];
+    int32_t  score[PLAYER_COUNT];
+    int32_t  hits, misses;
+    int32_t  freeze;
+    int32_t  spin;
+};
+
+struct SpectatorBlock;
+
+// The writer: the game's simulation thread
+class SpectatorFeed
+{
+public:
+    SpectatorFeed();
+    ~SpectatorFeed();
+
+    // Create the shared ring, or if not shared (or shared memory is
+    // unavailable) a private one that only observers in this process can
+    // follow.  Observers of an earlier game start over.
+    bool open(bool shared = true);
+    void close();
+    bool isOpen() const { return m_block != NULL; }
+    bool isShared() const { return m_shared; }
+
+    // The rules and playfield, when they change
+    void configure(const GameConfig& config);
+
+    // The state after a step.  A copy and a few stores; never waits and
+    // never allocates.
+    void publish(const GameState& state);
+
+    uint32_t published() const { return m_records; }
+    uint32_t keyframes() const { return m_keyframes; }
+
+    // For observers in this process
+    const SpectatorBlock* block() const { return m_block; }
+
+private:
+    void keyframe(const GameState& state);
+
+    SpectatorBlock* m_block;
+    void*           m_mapping;       // the shared ring's handle, where there is one
+    bool            m_shared;
+    uint32_t        m_records;       // steps published
+    uint32_t        m_keyframes;     // keyframes published
+    uint32_t        m_sinceKeyframe;
+    SpectatorState  m_shown;         // what observers rebuild
+};
+
+// An observer, in another process or this one
+class SpectatorReader
+{
+public:
+    SpectatorReader();
+    ~SpectatorReader();
+
+    // Map the game's ring read-only; false if no game has one
+    bool attach();
+
+    // Follow a ring in this process
+    void attach(const SpectatorBlock* block);
+
+    void detach();
+
+    // The next step's state, if one has been published since the last.
+    // After falling a ring behind this is the newest keyframe.
+    bool next(SpectatorState& state);
+
+    // The rules and playfield, as last configured
+    SpectatorConfig config() const;
+
+    // The game is still publishing
+    bool live() const;
+
+    // Steps skipped for falling behind, and times it started over
+    uint32_t skipped() const { return m_skipped; }
+    uint32_t restarts() const { return m_restarts; }
+
+private:
+    bool join();
+    bool readKeyframe(uint32_t index, uint32_t& record);
+
+    const SpectatorBlock* m_block;
+    bool                  m_mapped;
+    void*                 m_mapping;    // the shared ring's handle, where there is one
+    uint32_t              m_generation;
+    uint32_t              m_next;       // record to read next
+    bool                  m_joined;
+    SpectatorState        m_state;
+    uint32_t              m_skipped;
+    uint32_t              m_restarts;
+};
+
+#endif // SPECTATOR_H
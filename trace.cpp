@@ -0,0 +1,184 @@
+#include "trace.h"
+
+#ifdef HG_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    uint64_t    start;      // ticks
+    uint64_t    end;
+    const char* name;
+    uint32_t    instant;
+};
+
+// One thread's events.  Only that thread writes; head counts every event
+// it has ever written, and event i lives at i % TRACE_RING_EVENTS.
+struct TraceRing {
+    volatile uint32_t head;
+    char              name[32];
+    TraceEvent        events[TRACE_RING_EVENTS];
+};
+
+static TraceRing* volatile gRings[TRACE_MAX_THREADS];
+static volatile uint32_t gRingCount;
+
+static PLATFORM_THREAD_LOCAL TraceRing* tRing;
+static PLATFORM_THREAD_LOCAL uint32_t tNoRing;
+
+// The calling thread's ring, made on its first event.  Clearing it here
+// touches every page, so recording never faults later.
+static TraceRing* threadRing()
+{
+    TraceRing* ring = tRing;
+    if (ring != NULL || tNoRing)
+        return ring;
+
+    uint32_t slot = atomicAdd(&gRingCount, 1) - 1;
+    if (slot >= TRACE_MAX_THREADS)
+    {
+        tNoRing = 1;
+        return NULL;
+    }
+    ring = new TraceRing;
+    memset((void*)ring, 0, sizeof(*ring));
+    sprintf(ring->name, "thread %u", slot + 1);
+    gRings[slot] = ring;
+    atomicFence();
+    tRing = ring;
+    return ring;
+}
+
+static void record(const char* name, uint64_t start, uint64_t end, uint32_t instant)
+{
+    TraceRing* ring = threadRing();
+    if (ring == NULL)
+        return;
+
+    uint32_t head = ring->head;
+    TraceEvent& event = ring->events[head % TRACE_RING_EVENTS];
+    event.start = start;
+    event.end = end;
+    event.name = name;
+    event.instant = instant;
+    atomicStore(&ring->head, head + 1);
+}
+
+void traceSpan(const char* name, uint64_t startTicks, uint64_t endTicks)
+{
+    record(name, startTicks, endTicks, 0);
+}
+
+void traceInstant(const char* name)
+{
+    uint64_t now = platformTicks();
+    record(name, now, now, 1);
+}
+
+void traceThreadName(const char* name)
+{
+    TraceRing* ring = threadRing();
+    if (ring == NULL || strncmp(ring->name, name, sizeof(ring->name) - 1) == 0)
+        return;
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    ring->name[sizeof(ring->name) - 1] = '\0';
+}
+
+// Names are literals from the code, but quotes would still break the file
+static void writeString(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (const char* p = text; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*p >= 0x20)
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+struct TraceCopy {
+    std::string             name;
+    std::vector<TraceEvent> events;
+};
+
+bool traceWrite(const char* path)
+{
+    // Copy every ring first, so the file is written from a still picture
+    std::vector<TraceCopy> copies;
+    uint32_t count = atomicLoad(&gRingCount);
+    if (count > TRACE_MAX_THREADS)
+        count = TRACE_MAX_THREADS;
+    for (uint32_t slot = 0; slot < count; slot++)
+    {
+        TraceRing* ring = gRings[slot];
+        if (ring == NULL)
+            continue;
+
+        uint32_t head = atomicLoad(&ring->head);
+        uint32_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        TraceCopy copy;
+        copy.name = ring->name;
+        for (uint32_t i = first; i < head; i++)
+            copy.events.push_back(ring->events[i % TRACE_RING_EVENTS]);
+
+        // The owner kept writing while we copied; whatever it may have
+        // overwritten in that time is dropped
+        atomicLoadFence();
+        uint32_t after = atomicLoad(&ring->head);
+        uint32_t safe = after >= TRACE_RING_EVENTS ? after - TRACE_RING_EVENTS + 1 : 0;
+        if (safe > first)
+            copy.events.erase(copy.events.begin(),
+                              copy.events.begin() + std::min<size_t>(safe - first, copy.events.size()));
+        copies.push_back(copy);
+    }
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    // Times from the earliest event, in microseconds
+    uint64_t origin = ~(uint64_t)0;
+    for (size_t t = 0; t < copies.size(); t++)
+    {
+        for (size_t i = 0; i < copies[t].events.size(); i++)
+        {
+            if (copies[t].events[i].start < origin)
+                origin = copies[t].events[i].start;
+        }
+    }
+    double usPerTick = 1e6 / (double)platformTicksPerSecond();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t t = 0; t < copies.size(); t++)
+    {
+        int tid = (int)t + 1;
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                first ? "" : ",\n", tid);
+        writeString(file, copies[t].name.c_str());
+        fprintf(file, "}}");
+        first = false;
+
+        for (size_t i = 0; i < copies[t].events.size(); i++)
+        {
+            const TraceEvent& e = copies[t].events[i];
+            fprintf(file, ",\n{\"name\":");
+            writeString(file, e.name);
+            double ts = (e.start - origin) * usPerTick;
+            if (e.instant)
+                fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", tid, ts);
+            else
+                fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        tid, ts, (e.end - e.start) * usPerTick);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif // HG_TRACE
@@ -0,0 +1,85 @@
+// Make sure this header is included only once
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "platform.h"
+
+// A timeline of what each thread was doing, for finding out where a
+// stutter came from: the wait in synchFromServo(), the buffer swap, a
+// sound loading from disk, a results flush.  Code marks spans and
+// instants with the macros below; traceWrite() saves everything recorded
+// as Chrome trace-event JSON, which chrome://tracing and ui.perfetto.dev
+// both open.
+//
+// Tracing is compiled in only when HG_TRACE is defined.  Without it the
+// macros expand to nothing and none of this exists.
+//
+// Each thread records into a ring of its own, so recording takes no lock
+// and never waits: two clock reads and a few stores per span.  A full
+// ring overwrites its oldest events, so a trace always holds the last
+// TRACE_RING_EVENTS of every thread.  Names must be string literals, or
+// anything else that outlives the trace.
+//
+//     TRACE_SCOPE("frame");              span until the end of the block
+//     TRACE_SCOPE_EVERY("servo", 64);    one span in 64, for hot paths
+//     TRACE_INSTANT("sound.hit");        a moment
+//     TRACE_THREAD("servo");             name the calling thread
+
+#ifdef HG_TRACE
+
+// Events kept per thread
+const uint32_t TRACE_RING_EVENTS = 16384;
+
+// Threads that can record; later ones are ignored
+const uint32_t TRACE_MAX_THREADS = 16;
+
+void traceSpan(const char* name, uint64_t startTicks, uint64_t endTicks);
+void traceInstant(const char* name);
+void traceThreadName(const char* name);
+
+// Save the trace so far.  Threads can keep recording while it is written.
+bool traceWrite(const char* path);
+
+class TraceScope
+{
+public:
+    // A NULL name records nothing
+    explicit TraceScope(const char* name)
+        : m_name(name), m_start(name != NULL ? platformTicks() : 0) {}
+
+    ~TraceScope()
+    {
+        if (m_name != NULL)
+            traceSpan(m_name, m_start, platformTicks());
+    }
+
+private:
+    const char* m_name;
+    uint64_t    m_start;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+
+// The counter is per call site and not atomic: meant for a site only one
+// thread runs, like the servo callback
+#define TRACE_SCOPE_EVERY(name, n) \
+    static uint32_t TRACE_JOIN(traceEvery, __LINE__) = 0; \
+    TraceScope TRACE_JOIN(traceScope, __LINE__)( \
+        ++TRACE_JOIN(traceEvery, __LINE__) % (n) == 0 ? (name) : NULL)
+
+#define TRACE_INSTANT(name) traceInstant(name)
+#define TRACE_THREAD(name) traceThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_EVERY(name, n)
+#define TRACE_INSTANT(name)
+#define TRACE_THREAD(name)
+
+#endif // HG_TRACE
+
+#endif // TRACE_H
@@ -0,0 +1,57 @@
+// Make sure this header is included only once
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include "platform.h"
+
+// Hands the newest of a stream of values from one thread to another
+// without either of them ever waiting.  The writer fills one slot while
+// the reader holds another; the third holds the newest finished value,
+// and is traded for the writer's slot by publish() and for the reader's
+// by acquire().  The reader skips whatever it was too slow for, never
+// sees a value half written, and keeps the one it holds until it asks
+// for a newer one.
+template <class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : m_back(0), m_middle(1), m_front(2)
+    {
+    }
+
+    // Writer: the slot to fill next.  It holds an old value; overwrite
+    // all of it.
+    T& back() { return m_slots[m_back]; }
+
+    // Writer: make the filled slot the newest value
+    void publish()
+    {
+        m_back = atomicExchange(&m_middle, m_back | FRESH) & INDEX;
+    }
+
+    // Reader: take the newest value, if there is one since the last
+    // call.  Returns whether front() changed.
+    bool acquire()
+    {
+        if ((atomicLoad(&m_middle) & FRESH) == 0)
+            return false;
+        m_front = atomicExchange(&m_middle, m_front) & INDEX;
+        return true;
+    }
+
+    // Reader: the value last acquired
+    const T& front() const { return m_slots[m_front]; }
+
+private:
+    // m_middle holds a slot index, and FRESH when the writer has
+    // published into it since the reader last took it
+    enum { INDEX = 3, FRESH = 4 };
+
+    T                 m_slots[3];
+    uint32_t          m_back;       // writer only
+    volatile uint32_t m_middle;
+    uint32_t          m_front;      // reader only
+};
+
+#endif // TRIPLEBUFFER_H
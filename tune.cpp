@@ -0,0 +1,94 @@
+// tune: reads and changes the running game's parameters through the
+// shared parameter block.  The game notices the change on its next servo
+// tick and logs it to the results file.  Only the parameters named are
+// written, so a change the game made meanwhile is kept.
+#include "params.h"
+#include <stdio.h>
+#include <string.h>
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: hgtool tune                  print the running game's parameters\n"
+        "       hgtool tune name=value ...   change parameters\n"
+        "       hgtool tune --file FILE      apply a parameter file\n"
+        "       hgtool tune --defaults       put every parameter back\n");
+}
+
+int tuneMain(int argc, char* argv[])
+{
+    ParamBlock* block = paramsShared(false);
+    if (block == NULL)
+    {
+        fprintf(stderr, "tune: the game is not running\n");
+        return 1;
+    }
+
+    GameParams before, after;
+    uint32_t version;
+    if (!paramsRead(block, before, version))
+    {
+        fprintf(stderr, "tune: another writer holds the parameters; try again\n");
+        return 1;
+    }
+    after = before;
+
+    if (argc < 2)
+    {
+        printf("# version %u\n", version);
+        paramsPrint(stdout, before);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+        {
+            std::string rejected;
+            if (!paramsLoadFile(argv[++i], after, rejected))
+            {
+                fprintf(stderr, "tune: cannot read %s\n", argv[i]);
+                return 1;
+            }
+            if (!rejected.empty())
+                fprintf(stderr, "tune: %s: skipped\n%s", argv[i], rejected.c_str());
+        }
+        else if (strcmp(argv[i], "--defaults") == 0)
+        {
+            paramsDefault(after);
+        }
+        else
+        {
+            char name[64];
+            const char* equals = strchr(argv[i], '=');
+            size_t length = equals ? (size_t)(equals - argv[i]) : 0;
+            if (length == 0 || length >= sizeof(name))
+            {
+                usage();
+                return 2;
+            }
+            memcpy(name, argv[i], length);
+            name[length] = 0;
+            std::string error;
+            if (!paramsSet(after, name, equals + 1, error))
+            {
+                fprintf(stderr, "tune: %s; nothing changed\n", error.c_str());
+                return 2;
+            }
+        }
+    }
+
+    std::string changes = paramsDiff(before, after);
+    if (changes.empty())
+    {
+        printf("no change\n");
+        return 0;
+    }
+    if (!paramsWriteChanges(block, before, after))
+    {
+        fprintf(stderr, "tune: another writer holds the parameters; try again\n");
+        return 1;
+    }
+    printf("%s", changes.c_str());
+    return 0;
+}